@@ -0,0 +1,552 @@
+// Throughput of the scan pipeline from serial bytes to a point mesh, one
+// stage at a time, on synthetic scans. Writes the results as JSON and
+// compares them against a stored baseline.
+
+#include <MeshBuilder.hpp>
+#include <Logger.hpp>
+
+#include <lidar/Clock.hpp>
+#include <lidar/ProtocolDecoder.hpp>
+#include <lidar/SimulatedScanDevice.hpp>
+#include <lidar/ScanFrame.hpp>
+#include <lidar/ScanFilter.hpp>
+#include <lidar/PolarToCartesian.hpp>
+#include <lidar/TripleBuffer.hpp>
+#include <lidar/ScanBus.hpp>
+#include <lidar/FramePool.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef BENCH_BASELINE
+#define BENCH_BASELINE "bench/baseline.json"
+#endif
+
+using namespace em;
+
+static Logger logger("PipelineBench");
+
+namespace
+{
+    typedef std::vector<uint8_t> Bytes;
+
+    enum Stage
+    {
+        DECODE,         // Serial bytes to a filled frame
+        FILTERING,      // ScanFilter with every stage on
+        PUBLICATION,    // Triple buffer and scan bus, including the consumer taking it
+        CONVERSION,     // Polar to rig coordinates
+        MESH,           // MeshBuilder::index() and vertex() per point, as the preview does
+        STAGE_COUNT
+    };
+
+    const char* STAGE_NAMES[STAGE_COUNT] = { "decode", "filtering", "publication", "conversion", "mesh" };
+
+    const size_t MAX_NODES = 8192;
+    const size_t DENSE_CABINS = 40;
+
+    struct Options
+    {
+        std::vector<int> rates = { 2000, 8000, 16000, 32000 };
+        float rpm = 600.0f;
+        size_t scans = 200;
+        size_t warmup = 20;
+        size_t repeat = 5;              // Passes per rate, the fastest one is kept
+        float scanRate = 0.0f;          // Scans per second to feed at, 0 for as fast as possible
+        std::string output = "pipeline-bench.json";
+        std::string baseline = BENCH_BASELINE;
+        bool compare = true;
+        double tolerance = 0.25;        // Fraction a metric may get worse by
+    };
+
+    struct Result
+    {
+        int sampleRate = 0;
+        size_t scans = 0;
+        uint64_t points = 0;
+        double seconds = 0.0;           // Wall time, pacing included
+        double busySeconds = 0.0;       // Time spent in the stages
+        uint64_t nanos[STAGE_COUNT] = {};
+
+        double nsPerPoint(int stage) const
+        {
+            return points ? (double) nanos[stage] / points : 0.0;
+        }
+
+        double totalNsPerPoint() const
+        {
+            return points ? busySeconds * 1e9 / points : 0.0;
+        }
+
+        std::string getName() const
+        {
+            return std::to_string(sampleRate / 1000) + "k";
+        }
+    };
+
+    void put16(Bytes& out, uint16_t value)
+    {
+        out.push_back(value & 0xFF);
+        out.push_back(value >> 8);
+    }
+
+    // One dense capsule holding 40 distances, the sensor's usual scan mode
+    void putDenseCapsule(Bytes& out, const ScanNode* nodes)
+    {
+        size_t start = out.size();
+
+        out.push_back(0);
+        out.push_back(0);
+        put16(out, (uint16_t) (((uint32_t) nodes[0].angle_z_q14 * 90) >> 8));
+
+        for(size_t i = 0; i < DENSE_CABINS; i++)
+            put16(out, (uint16_t) (nodes[i].dist_mm_q2 >> 2));
+
+        uint8_t checksum = 0;
+        for(size_t i = start + 2; i < out.size(); i++)
+            checksum ^= out[i];
+
+        out[start] = 0xA0 | (checksum & 0xF);
+        out[start + 1] = 0x50 | (checksum >> 4);
+    }
+
+    // Every scan the simulator produces, as the serial stream a sensor would
+    // send for it. Generated up front so none of it is timed.
+    std::vector<Bytes> makeScans(int sampleRate, float rpm, size_t count)
+    {
+        SimulatorParams params;
+        params.sampleRate = sampleRate;
+        params.rpm = rpm;
+        params.noise = 10.0f;
+        params.dropout = 0.01f;
+        params.realtime = false;
+
+        SimulatedScanDevice device(params);
+        device.connect();
+        device.startScan();
+
+        std::vector<ScanNode> nodes(MAX_NODES);
+        std::vector<Bytes> scans(count);
+
+        for(Bytes& scan : scans)
+        {
+            size_t numNodes = nodes.size();
+            device.grabScanDataHq(nodes.data(), numNodes);
+
+            for(size_t first = 0; first + DENSE_CABINS <= numNodes; first += DENSE_CABINS)
+                putDenseCapsule(scan, nodes.data() + first);
+        }
+
+        device.stop();
+        device.disconnect();
+
+        return scans;
+    }
+
+    struct Decoded
+    {
+        std::vector<ScanNode> nodes;
+        size_t count = 0;
+    };
+
+    void collect(const ScanNode* nodes, size_t count, void* user)
+    {
+        Decoded* decoded = static_cast<Decoded*>(user);
+        count = std::min(count, decoded->nodes.size() - decoded->count);
+
+        memcpy(decoded->nodes.data() + decoded->count, nodes, count * sizeof(ScanNode));
+        decoded->count += count;
+    }
+
+    inline uint64_t lap(uint64_t& last)
+    {
+        uint64_t now = monotonicNanos();
+        uint64_t elapsed = now - last;
+        last = now;
+
+        return elapsed;
+    }
+
+    Result run(int sampleRate, const std::vector<Bytes>& scans, const Options& options)
+    {
+        ProtocolDecoder decoder(ProtocolDecoder::DENSE_CAPSULE);
+        Decoded decoded;
+        decoded.nodes.resize(MAX_NODES);
+
+        ScanFilter::Config filterConfig;
+        std::fill(filterConfig.enabled, filterConfig.enabled + ScanFilter::STAGE_COUNT, true);
+        ScanFilter filter(filterConfig);
+
+        // Set up like LIDARFrameGrabber's, so steady state allocates nothing
+        FramePool framePool(ScanFrame::getStorageSize(MAX_NODES), 3, true);
+        TripleBuffer<ScanFrame> frames;
+        ScanBus bus(MAX_NODES);
+        std::shared_ptr<ScanBus::Subscriber> subscriber = bus.subscribe("bench", 4);
+
+        for(int i = 0; i < 3; i++)
+        {
+            if(!frames.slot(i).reserve(MAX_NODES, framePool))
+                frames.slot(i).reserve(MAX_NODES);
+        }
+
+        std::vector<float> x(MAX_NODES), y(MAX_NODES);
+
+        // A device mounted off the rig's origin, so conversion pays for the
+        // transform like the fused preview does
+        const float transform[16] = {
+            0.0f, 1.0f, 0.0f, 0.0f,
+            -1.0f, 0.0f, 0.0f, 0.0f,
+            0.0f, 0.0f, 1.0f, 0.0f,
+            250.0f, -100.0f, 0.0f, 1.0f
+        };
+
+        VertexFormat vtxFmt;
+        vtxFmt.size = 3;
+        vtxFmt[0].data = EMVF_ATTRB_USAGE_POS | EMVF_ATTRB_TYPE_FLOAT | EMVF_ATTRB_SIZE(3);
+        vtxFmt[1].data = EMVF_ATTRB_USAGE_UV | EMVF_ATTRB_TYPE_FLOAT | EMVF_ATTRB_SIZE(2);
+        vtxFmt[2].data = EMVF_ATTRB_USAGE_COLOR | EMVF_ATTRB_TYPE_FLOAT | EMVF_ATTRB_SIZE(4);
+        MeshBuilder builder(vtxFmt);
+
+        Result result;
+        result.sampleRate = sampleRate;
+
+        std::chrono::steady_clock::duration period = options.scanRate > 0.0f
+            ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / options.scanRate))
+            : std::chrono::steady_clock::duration::zero();
+        std::chrono::steady_clock::time_point deadline;
+        uint64_t start = 0;
+
+        for(size_t i = 0; i < scans.size(); i++)
+        {
+            bool measured = i >= options.warmup;
+
+            if(i == options.warmup)
+            {
+                start = monotonicNanos();
+                deadline = std::chrono::steady_clock::now();
+            }
+
+            if(measured && period.count())
+            {
+                std::this_thread::sleep_until(deadline);
+                deadline += period;
+            }
+
+            uint64_t stages[STAGE_COUNT];
+            uint64_t last = monotonicNanos();
+
+            decoded.count = 0;
+            decoder.feed(scans[i].data(), scans[i].size(), collect, &decoded);
+
+            ScanFrame& frame = frames.back();
+            frame.assign(decoded.nodes.data(), decoded.count);
+            frame.setSequence(i + 1);
+            frame.setTimestamp(monotonicMicros());
+            stages[DECODE] = lap(last);
+
+            filter.apply(frame);
+            stages[FILTERING] = lap(last);
+
+            frames.publish();
+            bus.publish(frame);
+            frames.update();
+            ScanBus::FrameRef published = subscriber->next();
+            stages[PUBLICATION] = lap(last);
+
+            const ScanFrame& consumed = frames.front();
+            PolarToCartesian::convert(consumed, x.data(), y.data(), nullptr, 1.0f / 12000.0f, transform);
+            stages[CONVERSION] = lap(last);
+
+            builder.reset();
+            builder.index(1, 0);
+            builder.vertex(NULL, 0.0f, 0.0f, 0.0f, 0.0, 0.0, 0.0f, 0.5f, 0.0f, 1.0f);
+
+            for(size_t point = 0; point < consumed.size(); point++)
+            {
+                builder.index(1, 0);
+                builder.vertex(NULL, x[point], y[point], 0.0f, 0.0, 0.0, 1.0f, 1.0f, 1.0f, 1.0f);
+            }
+
+            stages[MESH] = lap(last);
+
+            if(!measured)
+                continue;
+
+            result.scans++;
+            result.points += decoded.count;
+
+            for(int stage = 0; stage < STAGE_COUNT; stage++)
+            {
+                result.nanos[stage] += stages[stage];
+                result.busySeconds += stages[stage] / 1e9;
+            }
+        }
+
+        result.seconds = (monotonicNanos() - start) / 1e9;
+
+        return result;
+    }
+
+    bool writeResults(const std::string& path, const Options& options, const std::vector<Result>& results)
+    {
+        FILE* file = fopen(path.c_str(), "w");
+
+        if(!file)
+            return false;
+
+        fprintf(file, "{\n  \"benchmark\": \"scan-pipeline\",\n  \"rpm\": %.0f,\n  \"scanRate\": %.1f,\n  \"scans\": %zu,\n  \"repeat\": %zu,\n",
+            options.rpm, options.scanRate, options.scans, options.repeat);
+        fprintf(file, "  \"filter\": \"%s\",\n  \"conversion\": \"%s\",\n  \"runs\": [",
+            ScanFilter::getImplementationName(ScanFilter::getImplementation()),
+            PolarToCartesian::getImplementationName(PolarToCartesian::getImplementation()));
+
+        for(size_t i = 0; i < results.size(); i++)
+        {
+            const Result& result = results[i];
+
+            fprintf(file, "%s\n    {\"name\": \"%s\", \"sampleRate\": %d, \"pointsPerScan\": %.1f, \"points\": %llu, ",
+                i ? "," : "", result.getName().c_str(), result.sampleRate,
+                result.scans ? (double) result.points / result.scans : 0.0, (unsigned long long) result.points);
+            fprintf(file, "\"pointsPerSecond\": %.0f, \"load\": %.3f, \"nsPerPoint\": {",
+                result.seconds > 0.0 ? result.points / result.seconds : 0.0,
+                result.seconds > 0.0 ? result.busySeconds / result.seconds : 0.0);
+
+            for(int stage = 0; stage < STAGE_COUNT; stage++)
+                fprintf(file, "\"%s\": %.3f, ", STAGE_NAMES[stage], result.nsPerPoint(stage));
+
+            fprintf(file, "\"total\": %.3f}}", result.totalNsPerPoint());
+        }
+
+        fprintf(file, "\n  ]\n}\n");
+
+        return fclose(file) == 0;
+    }
+
+    bool readFile(const std::string& path, std::string& text)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+
+        if(!file)
+            return false;
+
+        char buffer[4096];
+        size_t read;
+
+        while((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            text.append(buffer, read);
+
+        fclose(file);
+
+        return true;
+    }
+
+    // The baseline is only ever a file this benchmark wrote, so finding a key
+    // within a run's object is all the parsing it needs
+    bool findNumber(const std::string& text, size_t from, size_t to, const char* key, double& value)
+    {
+        std::string quoted = std::string("\"") + key + "\":";
+        size_t at = text.find(quoted, from);
+
+        if(at == std::string::npos || at >= to)
+            return false;
+
+        value = strtod(text.c_str() + at + quoted.size(), nullptr);
+
+        return true;
+    }
+
+    bool findRun(const std::string& text, const std::string& name, size_t& from, size_t& to)
+    {
+        from = text.find("{\"name\": \"" + name + "\"");
+
+        if(from == std::string::npos)
+            return false;
+
+        to = text.find("{\"name\":", from + 1);
+
+        if(to == std::string::npos)
+            to = text.size();
+
+        return true;
+    }
+
+    // Logs every metric next to the baseline's and returns false if any got
+    // worse by more than the tolerance
+    bool compare(const std::string& path, const Options& options, const std::vector<Result>& results)
+    {
+        std::string text;
+
+        if(!readFile(path, text))
+        {
+            logger.warnf("No baseline at %s, nothing to compare against", path.c_str());
+            return true;
+        }
+
+        double baselineScanRate = 0.0;
+        findNumber(text, 0, text.size(), "scanRate", baselineScanRate);
+
+        if((float) baselineScanRate != options.scanRate)
+            logger.warnf("Baseline was fed at %.1f scans/s and this run at %.1f, points/s won't match", baselineScanRate, options.scanRate);
+
+        int regressions = 0;
+
+        for(const Result& result : results)
+        {
+            size_t from, to;
+
+            if(!findRun(text, result.getName(), from, to))
+            {
+                logger.warnf("Baseline has no %s run", result.getName().c_str());
+                continue;
+            }
+
+            for(int stage = 0; stage <= STAGE_COUNT; stage++)
+            {
+                const char* name = stage < STAGE_COUNT ? STAGE_NAMES[stage] : "total";
+                double current = stage < STAGE_COUNT ? result.nsPerPoint(stage) : result.totalNsPerPoint();
+                double baseline;
+
+                if(!findNumber(text, text.find("\"nsPerPoint\"", from), to, name, baseline) || baseline <= 0.0)
+                    continue;
+
+                double change = current / baseline - 1.0;
+                bool regressed = change > options.tolerance;
+                regressions += regressed;
+
+                printf("%-4s %-12s %9.2f ns/point  baseline %9.2f  %+6.1f%%%s\n", result.getName().c_str(), name,
+                    current, baseline, change * 100.0, regressed ? "  REGRESSION" : "");
+            }
+        }
+
+        if(regressions)
+            logger.errorf("%d metrics are more than %.0f%% slower than %s", regressions, options.tolerance * 100.0, path.c_str());
+
+        return regressions == 0;
+    }
+
+    bool parseRates(const char* text, std::vector<int>& rates)
+    {
+        rates.clear();
+
+        while(*text)
+        {
+            char* end;
+            long rate = strtol(text, &end, 10);
+
+            if(end == text || rate < 2000 || rate > 32000 || (*end && *end != ','))
+                return false;
+
+            rates.push_back((int) rate);
+            text = *end ? end + 1 : end;
+        }
+
+        return !rates.empty();
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options)
+    {
+        for(int i = 1; i < argc; i++)
+        {
+            const char* option = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+            if(strcmp(option, "--no-compare") == 0)
+            {
+                options.compare = false;
+                continue;
+            }
+
+            if(!value)
+                return false;
+
+            i++;
+
+            if(strcmp(option, "--rates") == 0)
+            {
+                if(!parseRates(value, options.rates))
+                    return false;
+            }
+            else if(strcmp(option, "--rpm") == 0)
+                options.rpm = strtof(value, nullptr);
+            else if(strcmp(option, "--scans") == 0)
+                options.scans = strtoul(value, nullptr, 10);
+            else if(strcmp(option, "--repeat") == 0)
+                options.repeat = strtoul(value, nullptr, 10);
+            else if(strcmp(option, "--scan-rate") == 0)
+                options.scanRate = strtof(value, nullptr);
+            else if(strcmp(option, "--output") == 0)
+                options.output = value;
+            else if(strcmp(option, "--baseline") == 0)
+                options.baseline = value;
+            else if(strcmp(option, "--tolerance") == 0)
+                options.tolerance = strtod(value, nullptr);
+            else
+                return false;
+        }
+
+        return options.rpm > 0.0f && options.scans > 0 && options.repeat > 0 && options.scanRate >= 0.0f;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    if(!parseOptions(argc, argv, options))
+    {
+        printf("Usage: %s [options]\n"
+            "  --rates <list>       sample rates to generate scans at (default 2000,8000,16000,32000)\n"
+            "  --rpm <rpm>          rotation speed of the generated scans (default 600)\n"
+            "  --scans <count>      scans measured per rate (default 200)\n"
+            "  --repeat <count>     passes per rate, the fastest is kept (default 5)\n"
+            "  --scan-rate <hz>     feed scans at this rate instead of as fast as possible\n"
+            "  --output <path>      where the JSON results go (default pipeline-bench.json)\n"
+            "  --baseline <path>    results to compare against (default bench/baseline.json)\n"
+            "  --tolerance <frac>   how much slower a stage may get (default 0.25)\n"
+            "  --no-compare         skip the comparison\n",
+            argv[0]);
+        return 2;
+    }
+
+    std::vector<Result> results;
+
+    for(int rate : options.rates)
+    {
+        std::vector<Bytes> scans = makeScans(rate, options.rpm, options.warmup + options.scans);
+
+        // Other work on the machine only ever makes a pass slower
+        results.push_back(run(rate, scans, options));
+
+        for(size_t pass = 1; pass < options.repeat; pass++)
+        {
+            Result result = run(rate, scans, options);
+
+            if(result.totalNsPerPoint() < results.back().totalNsPerPoint())
+                results.back() = result;
+        }
+
+        const Result& result = results.back();
+        logger.infof("%s: %.0f points/scan, %.2f Mpoints/s, %.1f ns/point (decode %.1f, filtering %.1f, publication %.1f, conversion %.1f, mesh %.1f)",
+            result.getName().c_str(), (double) result.points / result.scans, result.points / result.seconds / 1e6,
+            result.totalNsPerPoint(), result.nsPerPoint(DECODE), result.nsPerPoint(FILTERING),
+            result.nsPerPoint(PUBLICATION), result.nsPerPoint(CONVERSION), result.nsPerPoint(MESH));
+    }
+
+    if(!writeResults(options.output, options, results))
+    {
+        logger.errorf("Unable to write results to %s", options.output.c_str());
+        return 1;
+    }
+
+    logger.infof("Results written to %s", options.output.c_str());
+
+    if(options.compare && !compare(options.baseline, options, results))
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Logger.hpp>
+#include <LIDARFrameGrabber.hpp>
+
+#include <memory>
+#include <string>
+#include <inttypes.h>
+
+namespace em {
+    struct HeadlessParams
+    {
+        std::string port;
+        uint64_t scans = 0;             // Stop after this many scans, 0 runs until interrupted
+        unsigned int duration = 0;      // Stop after this many seconds, 0 runs until interrupted
+        unsigned int interval = 1000;   // Milliseconds between summaries, 0 for none
+        bool perScan = false;           // One line on stdout for every scan
+        std::string recordPath;
+        bool compress = false;
+        std::string telemetryPath;      // Written when the run ends
+
+        // Whether the command line asks for a headless run at all
+        static bool isRequested(int argc, char** argv);
+
+        // Fills params from --headless <port> and the options after it
+        static bool parse(int argc, char** argv, HeadlessParams& params);
+        static void printUsage(const char* program);
+    };
+
+    // Runs one device's acquisition without a window, GL context, ImGui or
+    // scene, and reports on the scans as they arrive. Every scan is taken
+    // from the grabber's scan bus, so none are missed between summaries.
+    class HeadlessApp
+    {
+    public:
+        HeadlessApp();
+
+        bool start(const HeadlessParams& params);
+        bool shouldClose();
+        bool runLoop();
+        bool terminate();
+
+        LIDARFrameGrabber* getLIDARFrameGrabber();
+    private:
+        Logger m_logger;
+        HeadlessParams m_params;
+        bool m_shouldClose;
+        bool m_initialized;
+
+        std::unique_ptr<LIDARFrameGrabber> m_grabber;
+        std::shared_ptr<ScanBus::Subscriber> m_subscriber;
+        bool m_recording;
+
+        uint64_t m_startTime;
+        uint64_t m_firstScanTime;
+        uint64_t m_scans;
+        uint64_t m_nodes;
+
+        // Since the last summary
+        uint64_t m_summaryTime;
+        uint64_t m_summaryScans;
+        uint64_t m_summaryNodes;
+        uint64_t m_summaryDropped;
+
+        void printScan(const ScanFrame& frame, const ScanBus::SubscriberStats& stats);
+        void printSummary(uint64_t now);
+        bool writeTelemetry();
+    };
+}
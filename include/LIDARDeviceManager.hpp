@@ -0,0 +1,157 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "LIDARFrameGrabber.hpp"
+#include "LuaInclude.hpp"
+#include "lidar/MotionModel.hpp"
+#include "lidar/ScanDeskew.hpp"
+#include "lidar/TemporalFilter.hpp"
+
+// Runs several LIDARFrameGrabbers side by side and fuses their latest scans
+// into one point cloud in a common frame of reference.
+//
+// Every grabber keeps its own acquisition thread. The manager itself is not
+// thread safe, call it from the thread that renders or otherwise consumes
+// the frames.
+class LIDARDeviceManager
+{
+public:
+    // Where a device sits on the rig, in millimeters and degrees
+    struct Extrinsics
+    {
+        float x;
+        float y;
+        float z;
+        float roll;
+        float pitch;
+        float yaw;
+
+        Extrinsics();
+
+        // Column-major 4x4 that takes points from the device to the rig
+        void toMatrix(float* matrix) const;
+    };
+
+    struct FusedSource
+    {
+        size_t device = 0;
+        size_t first = 0;
+        size_t count = 0;
+        uint64_t sequence = 0;
+        uint64_t timestamp = 0;
+    };
+
+    // Points of every device that had a recent enough scan, in millimeters.
+    // sources lists which range of points came from which device.
+    struct FusedFrame
+    {
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<uint8_t> device;
+        std::vector<FusedSource> sources;
+
+        size_t size = 0;
+        uint64_t timestamp = 0;     // Newest scan in the frame
+        uint64_t revision = 0;      // Bumped every time the contents change
+
+        // Farthest any point can be from the rig origin
+        float radius = 0.0f;
+    };
+
+    LIDARDeviceManager();
+    ~LIDARDeviceManager();
+
+    // Creates and starts a grabber, returns its index
+    size_t addDevice(const std::string& port, const Extrinsics& extrinsics = Extrinsics());
+    void removeDevice(size_t index);
+    void removeAll();
+
+    size_t getDeviceCount() const;
+    LIDARFrameGrabber* getGrabber(size_t index);
+    bool hasPort(const std::string& port) const;
+
+    void setExtrinsics(size_t index, const Extrinsics& extrinsics);
+    const Extrinsics& getExtrinsics(size_t index) const;
+
+    // Scans older than this relative to the newest one are left out
+    void setMaxSkew(uint64_t micros);
+    uint64_t getMaxSkew() const;
+
+    // How the rig moves. When set, every scan is deskewed and all of them are
+    // brought to the rig's pose at the newest scan. Scans the model has no
+    // pose for are fused as they are.
+    void setMotionModel(std::shared_ptr<em::MotionModel> model);
+    const std::shared_ptr<em::MotionModel>& getMotionModel() const;
+
+    // Smooths a device's scans over time. The fused cloud then has the
+    // smoothed view of that device, one point per bin, instead of its raw
+    // scan. Changing the config starts the smoothing over.
+    void setSmoothing(size_t index, bool enabled, const em::TemporalFilter::Config& config = em::TemporalFilter::Config());
+
+    // nullptr when the device isn't smoothed
+    const em::TemporalFilter* getSmoothing(size_t index) const;
+
+    // How the device's next recording is written
+    void setRecordingEncoding(size_t index, em::ScanEncoding encoding);
+    em::ScanEncoding getRecordingEncoding(size_t index) const;
+
+    // Pulls the latest scan of every device and rebuilds the fused frame if
+    // any of them changed
+    const FusedFrame& fuse();
+    const FusedFrame& getFusedFrame() const;
+
+    // How many times a device's scan was left out for being too old
+    uint64_t getStaleCount(size_t index) const;
+
+    // Tells every device's telemetry that the scans picked up so far are on
+    // screen now
+    void framePresented();
+    void resetTelemetry();
+
+    // Writes the telemetry of every device to a JSON file
+    bool dumpTelemetry(const std::string& path);
+
+    // Registers the "lidar" global for scripts, bound to this manager
+    int lua_openLidarLib(lua_State* L);
+private:
+    struct Device
+    {
+        std::unique_ptr<LIDARFrameGrabber> grabber;
+        Extrinsics extrinsics;
+        float matrix[16];
+        const LIDARFrameGrabber::Frame* frame = nullptr;
+        std::unique_ptr<em::TemporalFilter> smoothing;
+        em::ScanEncoding recordingEncoding = em::SCAN_ENCODING_RAW;
+        uint64_t fusedSequence = 0;
+        uint64_t staleCount = 0;
+    };
+
+    std::vector<std::unique_ptr<Device>> m_devices;
+    FusedFrame m_fused;
+    uint64_t m_maxSkew;
+    std::shared_ptr<em::MotionModel> m_motion;
+    em::ScanDeskew m_deskew;
+    bool m_dirty;
+
+    void reserve(size_t size);
+
+    static LIDARDeviceManager* lua_getManager(lua_State* L);
+    static LIDARFrameGrabber* lua_getGrabber(lua_State* L, int index);
+
+    static int lua_getDeviceCount(lua_State* L);
+    static int lua_getPort(lua_State* L);
+    static int lua_getLatency(lua_State* L);
+    static int lua_getCounters(lua_State* L);
+    static int lua_dumpTelemetry(lua_State* L);
+    static int lua_resetTelemetry(lua_State* L);
+    static int lua_getRange(lua_State* L);
+    static int lua_getRanges(lua_State* L);
+    static int lua_setGrid(lua_State* L);
+    static int lua_setFilter(lua_State* L);
+    static int lua_getFilterStats(lua_State* L);
+    static int lua_setSmoothing(lua_State* L);
+};
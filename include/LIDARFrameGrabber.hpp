@@ -3,9 +3,23 @@
 #include <vector>
 #include <string>
 #include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "lidar/TripleBuffer.hpp"
+#include "lidar/ScanFrame.hpp"
+#include "lidar/FramePool.hpp"
+#include "lidar/ScanDevice.hpp"
+#include "lidar/ScanRecorder.hpp"
+#include "lidar/ScanServer.hpp"
+#include "lidar/SharedScanRing.hpp"
+#include "lidar/ScanBus.hpp"
+#include "lidar/ScanTelemetry.hpp"
+#include "lidar/SectorStream.hpp"
+#include "lidar/ScanGrid.hpp"
+#include "lidar/ScanFilter.hpp"
 
 #include "sl_lidar.h"
-#include "sl_lidar_driver.h"
 
 class LIDARFrameGrabber
 {
@@ -13,6 +27,8 @@ public:
     typedef sl_lidar_response_device_health_t LIDARHealth;
     typedef sl_lidar_response_device_info_t LIDARInfo;
 
+    typedef em::ScanFrame Frame;
+
     struct Node
     {
         float angle = 0.0f;
@@ -27,49 +43,191 @@ public:
         IDLE
     };
 
+    // Where the acquisition thread is in bringing the device up. Any failure
+    // leads to BACKING_OFF and from there back to CONNECTING.
+    enum ConnectionState
+    {
+        DISCONNECTED,
+        CONNECTING,         // Opening the port
+        IDENTIFYING,        // Waiting for the device info
+        CHECKING_HEALTH,
+        STARTING_SCAN,      // Scan requested, no revolution yet
+        SCANNING,
+        BACKING_OFF         // Waiting before the next attempt
+    };
+
+    // Bounds on every step of bringing a device up and on retrying it, all
+    // times in milliseconds
+    struct ReconnectPolicy
+    {
+        unsigned int commandTimeout;    // Device info and health requests
+        unsigned int scanTimeout;       // Waiting for one revolution
+        int maxStalls;                  // Failed revolutions in a row before the scan is restarted
+        int maxRestarts;                // Restarts in a row without a revolution before the device is given up on
+        unsigned int initialBackoff;    // Doubled after every failed attempt
+        unsigned int maxBackoff;
+
+        ReconnectPolicy();
+    };
+
+    enum ScanMode
+    {
+        STREAMING,          // Start the scan once and pull revolutions back-to-back
+        RESTART_PER_FRAME   // Re-issue the scan command before every revolution
+    };
+
     LIDARFrameGrabber(std::string port);
+    ~LIDARFrameGrabber();
 
     void start();
     void stop();
 
     const std::string& getPort() const;
-    const std::string& getStatusMessage() const;
-    const std::string& getSerialNumber() const;
-    const std::string& getFirmwareVersion() const;
-    const std::string& getHardwareVersion() const;
+    std::string getStatusMessage() const;
+    // Copies, since a reconnect replaces them from the acquisition thread
+    std::string getSerialNumber() const;
+    std::string getFirmwareVersion() const;
+    std::string getHardwareVersion() const;
 
     bool isConnected() const;
     float getFPS() const;
 
+    // Milliseconds between the last two completed revolutions
+    float getRevolutionTime() const;
+    float getRevolutionsPerSecond() const;
+    uint64_t getRevolutionCount() const;
+    uint32_t getScanRestarts() const;
+
+    void setScanMode(ScanMode mode);
+    ScanMode getScanMode() const;
+
+    // Only takes effect when set before start()
+    void setReconnectPolicy(const ReconnectPolicy& policy);
+    const ReconnectPolicy& getReconnectPolicy() const;
+
+    ConnectionState getConnectionState() const;
+
+    // Times the device came back after being lost, and attempts that failed
+    uint32_t getReconnects() const;
+    uint32_t getFailedAttempts() const;
+
+    static const char* getConnectionStateName(ConnectionState state);
+
+    // Swaps in the most recently published frame, if any. Only call this
+    // from the thread that renders or otherwise consumes the frames.
+    const Frame& latestFrame();
+
+    // Per-scan latency, the consumer reports presenting through scanPresented()
+    em::ScanTelemetry& getTelemetry();
+
+    // Sectors of the revolution in progress, published as the scan passes
+    // them. Full frames keep coming through latestFrame() either way. Devices
+    // that only deliver whole revolutions are cut up once they arrive.
+    em::SectorStream& getSectorStream();
+    bool hasLiveSectors() const;
+
+    // Float copies of the current frame for older callers, prefer latestFrame()
     const std::vector<Node>& getNodes() const;
-    const Node& longestNode() const;
+    Node longestNode() const;
+
+    // The current frame resampled onto fixed angular bins, rebuilt on first
+    // use after the frame changes. Same threading rules as latestFrame().
+    const em::ScanGrid& getScanGrid() const;
+    void setScanGrid(float resolution, em::ScanGrid::Reduction reduction);
+
+    // Filters run on the acquisition thread before each revolution is
+    // published. A new config is picked up at the next revolution. Sectors
+    // and recordings keep the unfiltered nodes.
+    void setFilterConfig(const em::ScanFilter::Config& config);
+    em::ScanFilter::Config getFilterConfig() const;
+
+    // Timing and rejection counts of every stage
+    const em::ScanFilter& getFilter() const;
+
+    // The device scans are pulled from, picked from the port name
+    em::ScanDevice* getDevice();
+
+    // Records every scan captured from now on, only valid once connected
+    bool startRecording(const std::string& path, em::ScanEncoding encoding = em::SCAN_ENCODING_RAW);
+    void stopRecording();
+    const em::ScanRecorder& getRecorder() const;
+
+    // Streams every published frame to other processes once started
+    em::ScanServer& getServer();
+
+    // Publishes every frame into a shared memory ring that local processes
+    // read with em::SharedScanReader
+    bool startSharing(const std::string& name);
+    void stopSharing();
+    const em::SharedScanRing& getSharedRing() const;
+
+    // Storage of the frames handed to latestFrame(), its allocation count
+    // stays put once scanning has started
+    const em::FramePool& getFramePool() const;
+
+    // Every published frame for any number of in-process consumers, each
+    // with its own queue. Subscribe from any thread.
+    em::ScanBus& getBus();
 
     Status getStatus() const;
-    LIDARHealth getHealth();
-    LIDARInfo getInfo();
+    LIDARHealth getHealth() const;
+    LIDARInfo getInfo() const;
 
     static std::vector<std::string> getAvailableDevices();
 private:
     std::string m_port;
-    Status m_status;
+    std::atomic<Status> m_status;
+    std::atomic<ConnectionState> m_state;
     std::string m_message;
+    mutable std::mutex m_messageMutex;
     std::thread m_thread;
-    float m_fps;
-    double m_lastFrameTime;
+    std::atomic<float> m_fps;
+    std::atomic<float> m_revolutionTime;
+    std::atomic<float> m_revolutionsPerSecond;
+    std::atomic<uint64_t> m_revolutions;
+    std::atomic<uint32_t> m_scanRestarts;
+    std::atomic<ScanMode> m_scanMode;
+    ReconnectPolicy m_policy;
+    std::atomic<uint32_t> m_reconnects;
+    std::atomic<uint32_t> m_failedAttempts;
 
     LIDARHealth m_health;
     LIDARInfo m_info;
-    sl::IChannel* m_channel;
-    std::vector<Node> m_nodes;
-    Node m_longestNode;
+    std::unique_ptr<em::ScanDevice> m_device;
+    std::vector<em::ScanNode> m_scanNodes;
+    em::FramePool m_framePool;
+    em::TripleBuffer<Frame> m_frames;
+    uint64_t m_sequence;
+    uint64_t m_lastCompleted;
+    em::ScanRecorder m_recorder;
+    em::ScanServer m_server;
+    em::SharedScanRing m_shared;
+    em::ScanBus m_bus;
+    em::ScanTelemetry m_telemetry;
+    em::SectorStream m_sectors;
+    bool m_liveSectors;
+
+    em::ScanFilter m_filter;
+    em::ScanFilter::Config m_filterConfig;
+    mutable std::mutex m_filterMutex;
+    std::atomic<bool> m_filterChanged;
+
+    mutable std::vector<Node> m_nodes;
+    mutable uint64_t m_nodesSequence;
+    mutable em::ScanGrid m_grid;
 
     std::string m_serialNumber;
     std::string m_firmwareVersion;
     std::string m_hardwareVersion;
 
-    bool m_shouldStop;
+    std::atomic<bool> m_shouldStop;
+
+    void setState(ConnectionState state, const std::string& message);
 
     static void workerThread(LIDARFrameGrabber* grabber);
-    static void printLidarInfo(LIDARFrameGrabber& grabber);
-    static sl_result captureFrame(LIDARFrameGrabber& grabber, sl::ILidarDriver* driver);
+    static bool bringUp(LIDARFrameGrabber& grabber, em::ScanDevice* device, std::string& failure);
+    static void scanLoop(LIDARFrameGrabber& grabber, em::ScanDevice* device, std::string& failure);
+    static void printLidarInfo(LIDARFrameGrabber& grabber, const LIDARInfo& info);
+    static sl_result captureFrame(LIDARFrameGrabber& grabber, em::ScanDevice* device);
+    static void onNodes(const em::ScanNode* nodes, size_t count, uint64_t timestamp, void* user);
 };
\ No newline at end of file
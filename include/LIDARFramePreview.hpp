@@ -2,6 +2,8 @@
 
 #include "SceneObject.hpp"
 #include "MeshBuilder.hpp"
+#include "lidar/MotionModel.hpp"
+#include "lidar/ScanDecimator.hpp"
 
 using namespace em;
 
@@ -11,9 +13,28 @@ public:
     LIDARFramePreview(const std::string& name);
 
     void draw(Shader& shader) override;
+
+    // Thins each sweep to about as many points as can be told apart at the
+    // current zoom and viewport
+    void setLevelOfDetail(bool enabled);
+    bool getLevelOfDetail() const;
+
+    // Of the last draw, the build time averaged over recent draws
+    size_t getPointCount() const;
+    size_t getVertexCount() const;
+    double getBuildMicros() const;
 private:
     std::unique_ptr<MeshBuilder> m_meshBuilder;
 
+    // Drives deskewing from the "motion" timeline in this object's dynamics
+    std::shared_ptr<TimelineMotionModel> m_motion;
+
+    ScanDecimator m_decimator;
+    bool m_levelOfDetail;
+    size_t m_pointCount;
+    size_t m_vertexCount;
+    double m_buildMicros;
+
     int var;
 protected:
     void update(float dt) override;
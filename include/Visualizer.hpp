@@ -7,11 +7,15 @@
 #include <glm/glm.hpp>
 #include <VisualizerScene.hpp>
 #include <LIDARFrameGrabber.hpp>
+#include <LIDARDeviceManager.hpp>
+#include <lidar/DeviceDiscovery.hpp>
 
 #include <memory>
 #include <inttypes.h>
 
 namespace em {
+    class ReplayScanDevice;
+
     struct AppParams
     {
         uint8_t msaaSamples = 2;
@@ -41,6 +45,7 @@ namespace em {
         const Input& getInput();
         GLFWwindow* getWindowHandle();
         LIDARFrameGrabber* getLIDARFrameGrabber();
+        LIDARDeviceManager& getDeviceManager();
 
         static VisualizerApp& getInstance();
     private:
@@ -56,9 +61,14 @@ namespace em {
 
         VisualizerScene m_scene;
 
-        std::unique_ptr<LIDARFrameGrabber> m_frameGrabber;
+        LIDARDeviceManager m_devices;
+        DeviceDiscovery m_discovery;
 
         void genUI();
+        bool genDeviceUI(size_t index);
+        void genTelemetryUI(const ScanTelemetry& telemetry);
+        void genFilterUI(LIDARFrameGrabber& grabber);
+        void genReplayUI(ReplayScanDevice& replay);
 
         static void onWindowResize(GLFWwindow* window, int width, int height);
     };
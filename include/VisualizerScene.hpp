@@ -27,6 +27,8 @@ namespace em
 
         void onWindowResize(int width, int height);
 
+        LIDARFramePreview* getLIDARPreview();
+
     private:
         std::unique_ptr<Camera> mainCamera;
         Framebuffer framebuffer;
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+namespace em
+{
+    // Finds serial ports a LIDAR could be on without holding up the caller.
+    //
+    // On Linux only ttys that sysfs says belong to a USB serial driver or a
+    // known USB serial vendor are opened, the rest are never touched. After
+    // the first scan /dev is watched with inotify and ports are added and
+    // removed one at a time as they come and go. Elsewhere every port is
+    // probed on each scan.
+    //
+    // root prefixes /dev and /sys, so tests can point it at a fake tree.
+    class DeviceDiscovery
+    {
+    public:
+        DeviceDiscovery(const std::string& root = "");
+        ~DeviceDiscovery();
+
+        DeviceDiscovery(const DeviceDiscovery&) = delete;
+        DeviceDiscovery& operator=(const DeviceDiscovery&) = delete;
+
+        // Runs the first scan and the watch on a background thread
+        void start();
+        void stop();
+        bool isRunning() const;
+
+        // Asks the background thread for a full rescan
+        void refresh();
+
+        // Ports found so far, sorted
+        std::vector<std::string> getDevices() const;
+
+        // Bumped every time the list changes, 0 until the first scan is done
+        uint64_t getRevision() const;
+
+        // Scans synchronously on the calling thread
+        std::vector<std::string> scan() const;
+
+        // Whether a tty, e.g. "ttyUSB0", is worth opening
+        bool isCandidate(const std::string& name) const;
+    private:
+        std::string m_root;
+
+        mutable std::mutex m_mutex;
+        std::vector<std::string> m_devices;
+        std::atomic<uint64_t> m_revision;
+
+        std::thread m_thread;
+        std::atomic<bool> m_shouldStop;
+        std::atomic<bool> m_shouldRefresh;
+        std::condition_variable m_wake;
+        int m_wakePipe[2];
+
+        bool probe(const std::string& name) const;
+        void publish(std::vector<std::string>&& devices);
+        void update(const std::string& name, bool present);
+
+        static void discoveryThread(DeviceDiscovery* discovery);
+    };
+}
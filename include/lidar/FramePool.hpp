@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace em
+{
+    // Fixed size, cache line aligned blocks for scan buffers, recycled
+    // through a lock-free free list.
+    //
+    // Blocks come from chunks mapped straight from the system, optionally
+    // on huge pages so that a whole frame sits behind one TLB entry. A chunk
+    // is only ever mapped when every block is in use, and none are given
+    // back before the pool goes away. Once a pipeline has warmed up, the
+    // allocation count stops moving. acquire() and release() may be called
+    // from any thread.
+    class FramePool
+    {
+    public:
+        static const size_t MAX_CHUNKS = 32;
+        static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+        // With hugePages the chunks are rounded up to whole huge pages. If
+        // none are reserved they fall back to transparent huge pages.
+        FramePool(size_t blockSize, size_t blocksPerChunk = 8, bool hugePages = false);
+        ~FramePool();
+
+        FramePool(const FramePool&) = delete;
+        FramePool& operator=(const FramePool&) = delete;
+
+        // A free block, mapping another chunk if there is none. nullptr only
+        // once MAX_CHUNKS chunks are all in use.
+        void* acquire();
+        void release(void* block);
+
+        size_t getBlockSize() const;
+        size_t getBlockCount() const;
+        size_t getFreeBlocks() const;
+
+        // Chunks mapped so far, the first one included
+        uint64_t getAllocations() const;
+        uint64_t getAcquired() const;
+
+        // Whether any chunk got explicit huge pages
+        bool hasHugePages() const;
+    private:
+        // Every chunk has the same number of blocks, block i is in chunk
+        // i / m_blocksPerChunk
+        struct Chunk
+        {
+            uint8_t* data = nullptr;
+            size_t size = 0;                                // Bytes mapped
+            std::unique_ptr<std::atomic<uint32_t>[]> next;  // Free list links, index + 1
+        };
+
+        size_t m_blockSize;
+        size_t m_blocksPerChunk;
+        size_t m_chunkSize;
+        bool m_hugePages;
+
+        Chunk m_chunks[MAX_CHUNKS];
+        std::atomic<size_t> m_chunkCount;
+        std::mutex m_growMutex;
+
+        // Tag in the high half against ABA, index + 1 of the top block in the
+        // low half, 0 when empty
+        std::atomic<uint64_t> m_head;
+
+        std::atomic<size_t> m_blockCount;
+        std::atomic<size_t> m_free;
+        std::atomic<uint64_t> m_allocations;
+        std::atomic<uint64_t> m_acquired;
+        std::atomic<bool> m_hasHugePages;
+
+        bool grow();
+        bool pop(uint32_t& index);
+        void push(uint32_t index);
+
+        std::atomic<uint32_t>& nextOf(uint32_t index);
+        uint8_t* blockAt(uint32_t index) const;
+    };
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace em
+{
+    // Log-linear histogram of microsecond durations in the style of HDR
+    // histograms. Every power of two is split into 32 buckets, so any
+    // percentile is within about 3% of the recorded value, from 1 us up to
+    // about 25 days.
+    //
+    // record() is lock free and may be called from any number of threads.
+    // Readers see counts that are individually exact but not an atomic
+    // snapshot of the whole histogram.
+    class LatencyHistogram
+    {
+    public:
+        static const int SUB_BUCKET_BITS = 6;
+        static const int MAX_MAGNITUDE = 40;
+        static const size_t BUCKET_COUNT = (1 << SUB_BUCKET_BITS) + (MAX_MAGNITUDE - SUB_BUCKET_BITS + 1) * (1 << (SUB_BUCKET_BITS - 1));
+
+        LatencyHistogram();
+
+        LatencyHistogram(const LatencyHistogram&) = delete;
+        LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+        void record(uint64_t micros);
+
+        // Not safe against concurrent record() calls losing a few samples
+        void reset();
+
+        uint64_t getCount() const;
+        uint64_t getMin() const;
+        uint64_t getMax() const;
+        double getMean() const;
+
+        // percentile is in [0, 100], returns 0 when nothing was recorded
+        uint64_t getPercentile(double percentile) const;
+
+        static size_t bucketIndex(uint64_t micros);
+
+        // Smallest and largest value that land in a bucket
+        static uint64_t bucketLow(size_t index);
+        static uint64_t bucketHigh(size_t index);
+    private:
+        std::atomic<uint64_t> m_buckets[BUCKET_COUNT];
+        std::atomic<uint64_t> m_count;
+        std::atomic<uint64_t> m_sum;
+        std::atomic<uint64_t> m_min;
+        std::atomic<uint64_t> m_max;
+    };
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "lidar/ScanRecording.hpp"
+#include "lidar/ScanCodec.hpp"
+
+namespace em
+{
+    // A scan inside a mapped recording. Both pointers point straight into
+    // the mapping and stay valid for as long as the MappedRecording is open.
+    // nodes is only set for raw scans, packed ones go through readScan().
+    struct RecordedScanView
+    {
+        const RecordedScanHeader* header = nullptr;
+        const RecordedNode* nodes = nullptr;
+        const uint8_t* payload = nullptr;
+    };
+
+    // Read-only view of a recording through mmap. Scans and, for cleanly
+    // closed files, the index are read in place without copying.
+    class MappedRecording
+    {
+    public:
+        MappedRecording();
+        ~MappedRecording();
+
+        MappedRecording(const MappedRecording&) = delete;
+        MappedRecording& operator=(const MappedRecording&) = delete;
+
+        bool open(const std::string& path);
+        void close();
+
+        bool isOpen() const;
+        bool hasFooter() const;
+        const RecordingHeader& getHeader() const;
+
+        size_t getScanCount() const;
+        RecordedScanView getScan(size_t index) const;
+
+        // Copies or decodes up to count nodes of a scan, returns the number
+        // of nodes read. Reading packed scans in order decodes each once,
+        // anywhere else decodes forward from the key scan before it.
+        size_t readScan(size_t index, ScanNode* nodes, size_t count);
+        uint64_t getTimestamp(size_t index) const;
+
+        // Microseconds between the first and last scan
+        uint64_t getDuration() const;
+
+        // Index of the last scan recorded at or before timestamp
+        size_t findScan(uint64_t timestamp) const;
+    private:
+        const uint8_t* m_data;
+        size_t m_size;
+
+        const RecordingIndexEntry* m_index;
+        size_t m_count;
+        std::vector<RecordingIndexEntry> m_rebuiltIndex;
+
+        ScanDecoder m_decoder;
+        size_t m_decoded;
+        std::vector<ScanNode> m_scratch;
+
+        bool decodeScan(size_t index, ScanNode* nodes, size_t& count);
+    };
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+namespace em
+{
+    // Compare-exchange networks for small medians. min and max are passed in
+    // so the same network works on scalars and on SIMD lanes.
+
+    template<typename T, typename Min, typename Max>
+    T median3(T a, T b, T c, Min min, Max max)
+    {
+        return max(min(a, b), min(max(a, b), c));
+    }
+
+    template<typename T, typename Min, typename Max>
+    T median5(T a, T b, T c, T d, T e, Min min, Max max)
+    {
+        T t;
+        t = min(a, b); b = max(a, b); a = t;
+        t = min(d, e); e = max(d, e); d = t;
+        t = min(a, d); d = max(a, d); a = t;
+        t = min(b, e); e = max(b, e); b = t;
+        t = min(b, c); c = max(b, c); b = t;
+        t = min(c, d); d = max(c, d); c = t;
+        return max(b, c);
+    }
+}
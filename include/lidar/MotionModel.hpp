@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace em
+{
+    class Timeline;
+
+    // Position in millimeters and heading in degrees, counterclockwise from +x
+    struct Pose2D
+    {
+        float x = 0.0f;
+        float y = 0.0f;
+        float yaw = 0.0f;
+
+        // This pose followed by other, which is relative to this one
+        Pose2D compose(const Pose2D& other) const;
+        Pose2D inverse() const;
+
+        // Straight line between the positions, shortest turn between the headings
+        static Pose2D interpolate(const Pose2D& a, const Pose2D& b, float t);
+    };
+
+    // Where the platform a sensor is mounted on was at a given moment. Only
+    // differences between poses matter, so the fixed frame they are expressed
+    // in can be anything.
+    class MotionModel
+    {
+    public:
+        enum Type
+        {
+            CONSTANT_VELOCITY,
+            POSE_STREAM,
+            TIMELINE
+        };
+
+        MotionModel(Type type);
+        virtual ~MotionModel();
+
+        Type getType() const;
+
+        // micros is from monotonicMicros(). Returns false if the model can't
+        // tell where the platform was then.
+        virtual bool getPose(uint64_t micros, Pose2D& pose) const = 0;
+
+        static const char* getTypeName(Type type);
+    private:
+        Type m_type;
+    };
+
+    // Moves at a fixed velocity given in the platform's own frame, so a
+    // turning platform drives along an arc
+    class ConstantVelocityModel : public MotionModel
+    {
+    public:
+        // mm/s forward, mm/s to the left and degrees/s
+        ConstantVelocityModel(float vx = 0.0f, float vy = 0.0f, float yawRate = 0.0f);
+
+        void setVelocity(float vx, float vy, float yawRate);
+        float getVelocityX() const;
+        float getVelocityY() const;
+        float getYawRate() const;
+
+        // The moment the platform is at the origin, the model's creation by default
+        void setReferenceTime(uint64_t micros);
+        uint64_t getReferenceTime() const;
+
+        bool getPose(uint64_t micros, Pose2D& pose) const override;
+
+        // Where a platform starting at the origin is after seconds
+        static Pose2D integrate(float vx, float vy, float yawRate, float seconds);
+    private:
+        float m_vx;
+        float m_vy;
+        float m_yawRate;
+        uint64_t m_reference;
+    };
+
+    // Poses pushed from elsewhere, e.g. odometry or a localization system,
+    // interpolated in between. Pushing and reading can happen on different
+    // threads.
+    class PoseStream : public MotionModel
+    {
+    public:
+        static const size_t DEFAULT_CAPACITY = 256;
+        static const uint64_t DEFAULT_MAX_EXTRAPOLATION = 100000;
+
+        // Poses beyond either end of the stream are held for up to
+        // maxExtrapolation microseconds
+        PoseStream(size_t capacity = DEFAULT_CAPACITY, uint64_t maxExtrapolation = DEFAULT_MAX_EXTRAPOLATION);
+
+        // Poses must come in time order, older ones are ignored
+        void push(uint64_t micros, const Pose2D& pose);
+        void clear();
+        size_t size() const;
+
+        bool getPose(uint64_t micros, Pose2D& pose) const override;
+    private:
+        struct Sample
+        {
+            uint64_t micros;
+            Pose2D pose;
+        };
+
+        mutable std::mutex m_mutex;
+        std::deque<Sample> m_samples;
+        size_t m_capacity;
+        uint64_t m_maxExtrapolation;
+    };
+
+    // Reads the pose from the "x", "y" and "yaw" tracks of a Timeline, e.g.
+    // one in a SceneObject's dynamics. Missing tracks read as 0.
+    //
+    // Timelines only know their current time, so sync() ties that to the
+    // clock and the timeline's speed and state carry it to other moments.
+    // Call sync() after every update of the timeline, from the thread that
+    // updates it, which is also the only one that may call getPose().
+    class TimelineMotionModel : public MotionModel
+    {
+    public:
+        TimelineMotionModel(const Timeline* timeline = nullptr);
+
+        void setTimeline(const Timeline* timeline);
+        const Timeline* getTimeline() const;
+
+        void sync(uint64_t micros);
+
+        bool getPose(uint64_t micros, Pose2D& pose) const override;
+    private:
+        const Timeline* m_timeline;
+        uint64_t m_syncMicros;
+        float m_syncTime;
+        float m_rate;
+    };
+}
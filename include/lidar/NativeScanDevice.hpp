@@ -0,0 +1,77 @@
+#pragma once
+
+#include "lidar/ScanDevice.hpp"
+#include "lidar/ProtocolDecoder.hpp"
+
+#include "sl_lidar_driver.h"
+
+#include <vector>
+
+namespace em
+{
+    // Talks the RPLidar serial protocol directly and decodes the measurement
+    // stream with ProtocolDecoder instead of the SDK driver. Only the SDK's
+    // channel layer is used. Ports look like "native:///dev/ttyUSB0".
+    class NativeScanDevice : public ScanDevice
+    {
+    public:
+        NativeScanDevice(const std::string& port, int baudrate = 115200);
+
+        // Takes ownership of an already created channel
+        NativeScanDevice(sl::IChannel* channel);
+        ~NativeScanDevice();
+
+        sl_result connect() override;
+        void disconnect() override;
+
+        sl_result getDeviceInfo(sl_lidar_response_device_info_t& info, unsigned int timeout = DEFAULT_TIMEOUT) override;
+        sl_result getHealth(sl_lidar_response_device_health_t& health, unsigned int timeout = DEFAULT_TIMEOUT) override;
+
+        sl_result startScan() override;
+        sl_result stop() override;
+
+        sl_result grabScanDataHq(ScanNode* nodes, size_t& count, unsigned int timeout = DEFAULT_TIMEOUT) override;
+        sl_result ascendScanData(ScanNode* nodes, size_t count) override;
+        uint64_t getScanStartTime() const override;
+        bool setNodeListener(NodeListener listener, void* user) override;
+
+        const ProtocolDecoder& getDecoder() const;
+
+        static bool isNativePort(const std::string& port);
+        static std::string getSerialPath(const std::string& port);
+    private:
+        std::string m_port;
+        int m_baudrate;
+
+        sl::IChannel* m_channel;
+        bool m_connected;
+        bool m_scanning;
+
+        ProtocolDecoder m_decoder;
+        uint8_t m_readBuffer[4096];
+
+        // Nodes of the revolution being decoded and the last complete one
+        std::vector<ScanNode> m_revolution;
+        std::vector<ScanNode> m_completed;
+        bool m_hasCompleted;
+
+        // When the bytes being decoded were read, and when the first bytes of
+        // the current, completed and last grabbed revolutions were
+        uint64_t m_readTime;
+        uint64_t m_revolutionStart;
+        uint64_t m_completedStart;
+        uint64_t m_scanStart;
+
+        NodeListener m_listener;
+        void* m_listenerUser;
+
+        sl_result sendCommand(uint8_t command, const void* payload = nullptr, size_t size = 0);
+        sl_result readDescriptor(uint8_t* descriptor, unsigned int timeout);
+        sl_result readResponse(uint8_t type, void* payload, size_t size, unsigned int timeout);
+        sl_result readExact(void* data, size_t size, unsigned int timeout);
+
+        sl_result queryTypicalScanMode(uint16_t& mode);
+
+        static void onNodes(const ScanNode* nodes, size_t count, void* user);
+    };
+}
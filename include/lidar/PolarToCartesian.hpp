@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "lidar/ScanFrame.hpp"
+
+namespace em
+{
+    // Converts scan nodes from q14 angles and q2 distances to Cartesian
+    // points. Sines come from a table with one entry per q14 step, so they are
+    // exact for every angle a device can report. The fastest implementation
+    // the CPU supports is picked at runtime.
+    class PolarToCartesian
+    {
+    public:
+        enum Implementation
+        {
+            SCALAR,
+            SSE2,
+            AVX2
+        };
+
+        // x = distance * cos(angle) and y = distance * sin(angle), in millimeters
+        // times scale. transform is an optional column-major 4x4 matrix, e.g.
+        // glm::value_ptr(), applied to (x, y, 0, 1). z is only written when
+        // it isn't null.
+        static void convert(const uint16_t* angles, const uint32_t* distances, size_t count,
+            float* x, float* y, float* z = nullptr, float scale = 1.0f, const float* transform = nullptr);
+
+        static void convert(const ScanFrame& frame,
+            float* x, float* y, float* z = nullptr, float scale = 1.0f, const float* transform = nullptr);
+
+        // Table lookups for a q14 angle
+        static float sin(uint16_t angle);
+        static float cos(uint16_t angle);
+
+        static bool isSupported(Implementation implementation);
+
+        // Overrides the detected implementation, returns false if the CPU
+        // doesn't support it
+        static bool setImplementation(Implementation implementation);
+        static Implementation getImplementation();
+        static const char* getImplementationName(Implementation implementation);
+    };
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "lidar/ScanDevice.hpp"
+
+namespace em
+{
+    // Incremental decoder for the RPLidar measurement stream.
+    //
+    // Bytes can be fed in fragments of any size. Whole packets are decoded in
+    // place from the caller's buffer; only a packet split across two feed()
+    // calls is staged internally. Nodes are handed to the callback as soon as
+    // their packet completes, standard nodes are batched per feed() call.
+    // Capsule formats encode angles relative to the next capsule, so their
+    // nodes come out one packet later.
+    class ProtocolDecoder
+    {
+    public:
+        enum Format
+        {
+            STANDARD,       // 5-byte nodes
+            CAPSULE,        // 84-byte express capsules, 32 nodes
+            DENSE_CAPSULE,  // 84-byte dense capsules, 40 nodes
+            ULTRA_CAPSULE,  // 132-byte ultra capsules, 96 nodes
+            HQ              // 781-byte HQ capsules, 96 nodes with a CRC-32
+        };
+
+        // Answer types from the response descriptor that starts a scan
+        static const uint8_t ANS_TYPE_STANDARD = 0x81;
+        static const uint8_t ANS_TYPE_CAPSULE = 0x82;
+        static const uint8_t ANS_TYPE_HQ = 0x83;
+        static const uint8_t ANS_TYPE_ULTRA_CAPSULE = 0x84;
+        static const uint8_t ANS_TYPE_DENSE_CAPSULE = 0x85;
+
+        static const size_t DESCRIPTOR_SIZE = 7;
+        static const size_t MAX_PACKET_SIZE = 781;
+        static const size_t MAX_NODES_PER_PACKET = 96;
+
+        typedef void (*Callback)(const ScanNode* nodes, size_t count, void* user);
+
+        struct Stats
+        {
+            uint64_t packets = 0;
+            uint64_t nodes = 0;
+            uint64_t checksumErrors = 0;
+            uint64_t skippedBytes = 0;
+        };
+
+        ProtocolDecoder(Format format = STANDARD);
+
+        void setFormat(Format format);
+        Format getFormat() const;
+        void reset();
+
+        void feed(const uint8_t* data, size_t size, Callback callback, void* user);
+
+        const Stats& getStats() const;
+
+        static size_t packetSize(Format format);
+
+        // Reads a 7-byte response descriptor, returns false if it isn't a
+        // measurement stream the decoder understands
+        static bool parseDescriptor(const uint8_t* data, Format& format);
+    private:
+        Format m_format;
+        Stats m_stats;
+
+        uint8_t m_pending[MAX_PACKET_SIZE];
+        size_t m_pendingSize;
+
+        uint8_t m_previous[MAX_PACKET_SIZE];
+        bool m_hasPrevious;
+        int m_lastAngleQ16;
+
+        ScanNode m_nodes[MAX_NODES_PER_PACKET];
+        size_t m_batchSize;
+
+        // Returns false if the bytes at packet don't start a valid packet
+        bool isPacketStart(const uint8_t* packet, size_t available) const;
+        bool decodePacket(const uint8_t* packet, Callback callback, void* user);
+
+        void flushBatch(Callback callback, void* user);
+        int isRevolutionStart(int angleQ16);
+
+        void decodeStandard(const uint8_t* packet, ScanNode& node);
+        size_t decodeCapsule(const uint8_t* packet);
+        size_t decodeDenseCapsule(const uint8_t* packet);
+        size_t decodeUltraCapsule(const uint8_t* packet);
+    };
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "lidar/ScanDevice.hpp"
+#include "lidar/MappedRecording.hpp"
+
+#include <atomic>
+#include <chrono>
+
+namespace em
+{
+    // Plays a recording back through the same acquisition path as a live
+    // device. Transport controls may be called from any thread.
+    class ReplayScanDevice : public ScanDevice
+    {
+    public:
+        ReplayScanDevice(const std::string& path);
+
+        sl_result connect() override;
+        void disconnect() override;
+
+        sl_result getDeviceInfo(sl_lidar_response_device_info_t& info, unsigned int timeout = DEFAULT_TIMEOUT) override;
+        sl_result getHealth(sl_lidar_response_device_health_t& health, unsigned int timeout = DEFAULT_TIMEOUT) override;
+
+        sl_result startScan() override;
+        sl_result stop() override;
+
+        sl_result grabScanDataHq(ScanNode* nodes, size_t& count, unsigned int timeout = DEFAULT_TIMEOUT) override;
+        sl_result ascendScanData(ScanNode* nodes, size_t count) override;
+
+        // 1 is real time, 10 is ten times faster, 0 is as fast as possible
+        void setSpeed(float speed);
+        float getSpeed() const;
+
+        void setPaused(bool paused);
+        bool isPaused() const;
+
+        void setLooping(bool looping);
+        bool isLooping() const;
+
+        void seek(size_t scan);
+        void seekTime(uint64_t timestamp);
+
+        size_t getPosition() const;
+        uint64_t getPositionTime() const;
+        const MappedRecording& getRecording() const;
+
+        static bool isReplayPort(const std::string& port);
+        static std::string getReplayPath(const std::string& port);
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        std::string m_path;
+        MappedRecording m_recording;
+        bool m_scanning;
+
+        std::atomic<float> m_speed;
+        std::atomic<bool> m_paused;
+        std::atomic<bool> m_looping;
+        std::atomic<bool> m_reanchor;
+        std::atomic<int64_t> m_seekRequest;
+        std::atomic<size_t> m_position;
+
+        size_t m_next;
+        Clock::time_point m_anchorTime;
+        uint64_t m_anchorTimestamp;
+
+        size_t deliver(size_t scan, ScanNode* nodes, size_t count);
+    };
+}
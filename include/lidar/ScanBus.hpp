@@ -0,0 +1,204 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "lidar/ScanFrame.hpp"
+#include "lidar/FramePool.hpp"
+
+namespace em
+{
+    // Hands every published frame to any number of in-process subscribers
+    // without copying it per subscriber.
+    //
+    // Frames come from a pool and are read-only once published. Subscribers
+    // and latest() hold them through reference counted FrameRefs, and a frame
+    // goes back to the pool when the last reference is dropped. Each
+    // subscriber has its own bounded queue. When it is full, the subscriber
+    // either loses its oldest frame or holds up publish() until there is
+    // room, so one slow subscriber never costs the others anything.
+    //
+    // claim() and publish() belong to a single producer thread. Everything
+    // else may be called from any thread. Frames and subscribers must not
+    // outlive the bus.
+    class ScanBus
+    {
+        struct PooledFrame;
+    public:
+        enum OverflowPolicy
+        {
+            DROP_OLDEST,    // Drop the oldest queued frame to make room
+            BLOCK           // Wait up to the subscriber's block timeout, then drop the oldest
+        };
+
+        // Shared, read-only hold on a published frame
+        class FrameRef
+        {
+        public:
+            FrameRef();
+            ~FrameRef();
+
+            FrameRef(const FrameRef& other);
+            FrameRef(FrameRef&& other);
+            FrameRef& operator=(const FrameRef& other);
+            FrameRef& operator=(FrameRef&& other);
+
+            void reset();
+
+            const ScanFrame* get() const;
+            const ScanFrame& operator*() const;
+            const ScanFrame* operator->() const;
+            explicit operator bool() const;
+
+            // References to the frame, including this one
+            int useCount() const;
+        private:
+            friend class ScanBus;
+
+            PooledFrame* m_frame;
+
+            // Takes over a reference that was already counted
+            explicit FrameRef(PooledFrame* frame);
+        };
+
+        struct SubscriberStats
+        {
+            std::string name;
+            OverflowPolicy policy = DROP_OLDEST;
+            uint64_t received = 0;          // Frames taken with next()
+            uint64_t dropped = 0;           // Frames lost to a full queue
+            uint64_t blocked = 0;           // Times publish() had to wait for room
+            uint64_t blockedMicros = 0;
+            size_t queued = 0;
+            size_t maxQueued = 0;
+            uint64_t lag = 0;               // Frames published after the last one taken
+            uint64_t delayMicros = 0;       // From publishing the last frame taken to taking it
+            uint64_t maxDelayMicros = 0;
+        };
+
+        class Subscriber
+        {
+        public:
+            ~Subscriber();
+
+            Subscriber(const Subscriber&) = delete;
+            Subscriber& operator=(const Subscriber&) = delete;
+
+            // Oldest queued frame, waiting up to timeout milliseconds for
+            // one. Empty on a timeout or once closed.
+            FrameRef next(unsigned int timeout = 0);
+
+            // Stops the subscription and wakes a waiting next()
+            void close();
+            bool isClosed() const;
+
+            const std::string& getName() const;
+            size_t getQueued() const;
+            SubscriberStats getStats() const;
+        private:
+            friend class ScanBus;
+
+            ScanBus* m_bus;
+            std::string m_name;
+            OverflowPolicy m_policy;
+            unsigned int m_blockTimeout;
+
+            // Fixed ring of queued frames, each holding a reference
+            std::vector<PooledFrame*> m_queue;
+            size_t m_head;
+            size_t m_queued;
+            bool m_closed;
+
+            mutable std::mutex m_mutex;
+            std::condition_variable m_notEmpty;
+            std::condition_variable m_notFull;
+            SubscriberStats m_stats;
+
+            Subscriber(ScanBus* bus, const std::string& name, size_t queueSize, OverflowPolicy policy, unsigned int blockTimeout);
+
+            void push(PooledFrame* frame);
+            void dropOldest();
+        };
+
+        static const size_t DEFAULT_POOL_SIZE = 8;
+
+        ScanBus(size_t capacity = 8192, size_t poolSize = DEFAULT_POOL_SIZE);
+        ~ScanBus();
+
+        ScanBus(const ScanBus&) = delete;
+        ScanBus& operator=(const ScanBus&) = delete;
+
+        // A frame to fill for the next publish(). The pool grows if every
+        // frame is still held somewhere, so this never fails.
+        ScanFrame& claim();
+        void publish();
+
+        // Copies frame into a pooled frame and publishes it. With nobody
+        // subscribed the frame is only counted, latest() is left as it was.
+        void publish(const ScanFrame& frame);
+
+        // Dropping the returned handle ends the subscription. blockTimeout is
+        // in milliseconds and only used by BLOCK.
+        std::shared_ptr<Subscriber> subscribe(const std::string& name, size_t queueSize = 4,
+            OverflowPolicy policy = DROP_OLDEST, unsigned int blockTimeout = 100);
+
+        // The newest published frame, empty before the first
+        FrameRef latest() const;
+
+        std::vector<SubscriberStats> getSubscribers() const;
+
+        uint64_t getPublished() const;
+
+        // Frames allocated so far and those not held by anyone
+        size_t getPoolSize() const;
+        size_t getFreeFrames() const;
+
+        // Where the frames' nodes live
+        const FramePool& getStorage() const;
+
+        static const char* getPolicyName(OverflowPolicy policy);
+    private:
+        struct PooledFrame
+        {
+            ScanFrame frame;
+            std::atomic<int> references;
+            ScanBus* bus;
+            uint64_t index;         // 1 for the first frame the bus published
+            uint64_t publishedAt;   // From monotonicMicros()
+
+            PooledFrame(ScanBus* owner, size_t capacity);
+        };
+
+        size_t m_capacity;
+
+        FramePool m_storage;
+        std::vector<std::unique_ptr<PooledFrame>> m_frames;
+        std::vector<PooledFrame*> m_free;
+        mutable std::mutex m_poolMutex;
+
+        PooledFrame* m_claimed;
+        FrameRef m_latest;
+        mutable std::mutex m_latestMutex;
+
+        std::vector<std::weak_ptr<Subscriber>> m_subscribers;
+        mutable std::mutex m_subscribersMutex;
+
+        // Producer side only, the subscribers publish() pushes to once it
+        // has let go of m_subscribersMutex. Kept so publishing never allocates.
+        std::vector<std::shared_ptr<Subscriber>> m_publishing;
+
+        std::atomic<uint64_t> m_published;
+
+        // Subscribers not closed yet
+        std::atomic<size_t> m_live;
+
+        PooledFrame* allocate();
+        void recycle(PooledFrame* frame);
+    };
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lidar/ScanDevice.hpp"
+
+// Layout of a packed scan (all fields little-endian):
+//
+//   PackedScanHeader
+//   dropout mask                    (PACKED_DROPOUTS only, a bit per node)
+//   angle residuals                 (every node)
+//   distance residuals              (nodes with a distance)
+//   quality residuals               (nodes with a distance)
+//   qualities                       (dropped nodes)
+//   flag exceptions                 (varint index delta + flag byte each)
+//
+// Each stream is zig-zag coded and bit-packed in groups of 16 values, a byte
+// holding the group's bit width followed by 16 values of that width. A
+// static scene costs a few bits per node instead of eight bytes.
+//
+// Angles are predicted from a steady step across the scan. Distances are
+// predicted from the same angular bin in the previous scan, or from the
+// previous return when that bin was empty. A scan with chain 0 is a key scan
+// that is predicted from nothing before it, so a decoder can start at any
+// key scan. Scans that would pack to more than their raw size are stored
+// raw behind the header instead (PACKED_STORED).
+
+namespace em
+{
+    enum PackedScanFlags : uint8_t
+    {
+        PACKED_DROPOUTS = 1,        // Some nodes have no distance
+        PACKED_STORED = 2           // Nodes follow raw, 8 bytes each
+    };
+
+#pragma pack(push, 1)
+    struct PackedScanHeader
+    {
+        uint32_t nodeCount;
+        uint32_t angleStep;         // Expected angle_z_q14 step per node, 16.16 fixed point
+        uint32_t exceptions;        // Nodes whose flag byte isn't the sync bit on node 0 alone
+        uint16_t firstAngle;
+        uint16_t chain;             // Scans since the last key scan
+        uint8_t flags;              // PackedScanFlags
+        uint8_t reserved[3];
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(PackedScanHeader) == 20, "PackedScanHeader must be 20 bytes");
+
+    // What encoder and decoder both know about the scan before this one: the
+    // distance last seen in each angular bin
+    class ScanPredictor
+    {
+    public:
+        static const int BIN_BITS = 12;
+
+        ScanPredictor();
+
+        void reset();
+        bool isPrimed() const;
+
+        const uint32_t* previous() const;
+
+        // Makes nodes the scan the next one is predicted from
+        void update(const ScanNode* nodes, size_t count);
+
+        static size_t binOf(uint16_t angle) { return angle >> (16 - BIN_BITS); }
+    private:
+        std::vector<uint32_t> m_previous;
+        bool m_primed;
+    };
+
+    class ScanEncoder
+    {
+    public:
+        // Every keyInterval-th scan is a key scan, 1 makes them all key scans
+        ScanEncoder(uint32_t keyInterval = 10);
+
+        void setKeyInterval(uint32_t keyInterval);
+        uint32_t getKeyInterval() const;
+
+        // The next scan becomes a key scan. Call it whenever a scan that was
+        // encoded doesn't reach the decoder.
+        void reset();
+
+        // Replaces out with the packed scan, returns its size
+        size_t encode(const ScanNode* nodes, size_t count, std::vector<uint8_t>& out);
+
+        static size_t getMaxEncodedSize(size_t count);
+    private:
+        uint32_t m_keyInterval;
+        uint32_t m_chain;
+        ScanPredictor m_predictor;
+
+        // Scratch space kept between scans
+        std::vector<uint32_t> m_angles;
+        std::vector<uint32_t> m_distances;
+        std::vector<uint32_t> m_qualities;
+        std::vector<uint32_t> m_dropped;
+    };
+
+    class ScanDecoder
+    {
+    public:
+        ScanDecoder();
+
+        void reset();
+
+        // Decodes into nodes, which has room for count nodes, and sets count
+        // to the nodes decoded. Fails on damaged data, too little room, or a
+        // scan that follows one this decoder hasn't seen.
+        bool decode(const uint8_t* data, size_t size, ScanNode* nodes, size_t& count);
+
+        // Scans since the last key scan, or -1 if data isn't a packed scan
+        static int getChain(const uint8_t* data, size_t size);
+    private:
+        int m_chain;
+        ScanPredictor m_predictor;
+
+        std::vector<uint32_t> m_values;
+    };
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lidar/ScanFrame.hpp"
+
+namespace em
+{
+    // Thins a revolution down to a point budget for drawing or export. The
+    // turn is split into budget / 2 angular buckets and each bucket keeps its
+    // nearest and farthest return, so range extremes survive and an edge
+    // inside a bucket keeps a point on either side of it. Dropped returns are
+    // never kept. Kept indices are in the order the points came in, so a line
+    // through them still traces the outline.
+    class ScanDecimator
+    {
+    public:
+        ScanDecimator();
+
+        // Nodes bucketed by their angle, ranges are the node distances
+        size_t decimate(const ScanFrame& frame, size_t budget);
+
+        // Points in millimeters around an origin, in angle order and evenly
+        // spaced in angle like the nodes they came from, so runs of the same
+        // length cover the same angle. Points within a few millimeters of the
+        // origin are dropped returns.
+        size_t decimate(const float* x, const float* y, size_t count, float originX, float originY, size_t budget);
+
+        // Indices of the points kept by the last call
+        const std::vector<uint32_t>& getKept() const;
+
+        // Enough points that a sweep whose farthest return is radiusPixels
+        // from its center, drawn with points pointSize pixels wide, looks the
+        // same as the full scan
+        static size_t getBudget(float radiusPixels, float pointSize);
+    private:
+        std::vector<uint32_t> m_kept;
+
+        // Scratch space kept between calls
+        std::vector<float> m_ranges;
+    };
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lidar/ScanFrame.hpp"
+#include "lidar/MotionModel.hpp"
+
+namespace em
+{
+    // Undoes the smear a moving platform leaves in a revolution.
+    //
+    // Nodes carry no time of their own. The sensor sweeps at a steady rate
+    // though, so a node's time follows from how far past the sync node it is,
+    // spread over the revolution from its first byte to its timestamp.
+    //
+    // The motion model is sampled at a few knots across the revolution and
+    // points are moved with a transform interpolated between the two knots
+    // around them, which keeps the per point work to plain multiply-adds.
+    class ScanDeskew
+    {
+    public:
+        static const size_t DEFAULT_KNOTS = 16;
+
+        ScanDeskew(size_t knots = DEFAULT_KNOTS);
+
+        void setKnots(size_t knots);
+        size_t getKnots() const;
+
+        // x and y hold the frame's points in the frame the model moves, e.g.
+        // from PolarToCartesian. They are moved to where they'd be seen from
+        // the platform's pose at reference, the frame's timestamp when 0.
+        // Nodes without a return are left alone.
+        //
+        // Returns false without touching the points when the frame has no
+        // first byte time or the model has no pose for the revolution.
+        bool apply(const ScanFrame& frame, const MotionModel& model, float* x, float* y, uint64_t reference = 0);
+
+        // Capture time of every node in microseconds, false if the frame has
+        // no first byte time
+        static bool nodeTimes(const ScanFrame& frame, uint64_t* times);
+
+        // Angle, in angle_z_q14 units, the revolution started at
+        static uint16_t sweepStart(const ScanFrame& frame);
+    private:
+        size_t m_knots;
+
+        // Per knot rotation and translation, as cos, sin, x, y
+        std::vector<float> m_transforms;
+        std::vector<float> m_phases;
+    };
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "sl_lidar.h"
+
+namespace em
+{
+    typedef sl_lidar_response_measurement_node_hq_t ScanNode;
+
+    // timestamp is when the nodes arrived, from monotonicMicros()
+    typedef void (*NodeListener)(const ScanNode* nodes, size_t count, uint64_t timestamp, void* user);
+
+    // A source of raw scan nodes. LIDARFrameGrabber only talks to devices
+    // through this interface, so hardware, simulated and recorded sources all
+    // go through the same acquisition path. Results use the SDK's sl_result
+    // codes.
+    class ScanDevice
+    {
+    public:
+        static const unsigned int DEFAULT_TIMEOUT = 2000;
+
+        enum Type
+        {
+            SERIAL,
+            SIMULATED,
+            REPLAY,
+            NATIVE
+        };
+
+        ScanDevice(Type type) : m_type(type) {}
+        virtual ~ScanDevice() {}
+
+        Type getType() const { return m_type; }
+
+        virtual sl_result connect() = 0;
+        virtual void disconnect() = 0;
+
+        virtual sl_result getDeviceInfo(sl_lidar_response_device_info_t& info, unsigned int timeout = DEFAULT_TIMEOUT) = 0;
+        virtual sl_result getHealth(sl_lidar_response_device_health_t& health, unsigned int timeout = DEFAULT_TIMEOUT) = 0;
+
+        virtual sl_result startScan() = 0;
+        virtual sl_result stop() = 0;
+
+        // Fills nodes with one full revolution, count is the buffer capacity on
+        // input and the number of nodes on output
+        virtual sl_result grabScanDataHq(ScanNode* nodes, size_t& count, unsigned int timeout = DEFAULT_TIMEOUT) = 0;
+        virtual sl_result ascendScanData(ScanNode* nodes, size_t count) = 0;
+
+        // When the first byte of the last grabbed revolution arrived, from
+        // monotonicMicros(), or 0 when the device can't tell
+        virtual uint64_t getScanStartTime() const { return 0; }
+
+        // Devices that produce nodes a few at a time hand them to the listener
+        // in arrival order as they come in, from inside grabScanDataHq().
+        // Returns false for devices that only deliver whole revolutions.
+        virtual bool setNodeListener(NodeListener listener, void* user) { return false; }
+
+        // Picks the implementation from the port name, e.g. "/dev/ttyUSB0",
+        // "native:///dev/ttyUSB0", "sim://rate=8000,rpm=600" or "replay://scan.rplr"
+        static std::unique_ptr<ScanDevice> create(const std::string& port);
+    private:
+        Type m_type;
+    };
+}
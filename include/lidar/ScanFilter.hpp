@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lidar/ScanFrame.hpp"
+
+namespace em
+{
+    // A chain of filters run over every revolution before it is published.
+    // Rejected nodes keep their place with a distance of 0, like a dropped
+    // measurement, so the arrays stay aligned and every stage is one
+    // branchless pass over them. The fastest implementation the CPU
+    // supports is picked at runtime.
+    //
+    // Stages that look at neighbors expect the frame in angle order and wrap
+    // around from the last node to the first.
+    class ScanFilter
+    {
+    public:
+        // In the order they run
+        enum Stage
+        {
+            RANGE,          // Closer than minRange or farther than maxRange
+            QUALITY,        // Quality byte below minQuality
+            SHADOW,         // Seen at a grazing angle to a neighbor, the veil between an edge and the background
+            MIXED_PIXEL,    // Between a foreground and a background neighbor and far from both
+            ISOLATED,       // No neighbor within isolatedDistance
+            MEDIAN,         // Replaced by the median of medianWindow nodes around it
+            STAGE_COUNT
+        };
+
+        enum Implementation
+        {
+            SCALAR,
+            SSE2
+        };
+
+        struct Config
+        {
+            bool enabled[STAGE_COUNT];
+            float minRange;             // Millimeters
+            float maxRange;
+            uint8_t minQuality;         // Quality byte of an HQ node
+            int neighbors;              // Nodes on each side SHADOW and ISOLATED look at, 1 to 3
+            float shadowAngle;          // Degrees
+            float mixedPixelJump;       // Millimeters
+            float isolatedDistance;     // Millimeters
+            int medianWindow;           // 3 or 5
+
+            Config();
+        };
+
+        ScanFilter(const Config& config = Config());
+
+        ScanFilter(const ScanFilter&) = delete;
+        ScanFilter& operator=(const ScanFilter&) = delete;
+
+        // Only call these from the thread that calls apply()
+        void configure(const Config& config);
+        const Config& getConfig() const;
+        bool isEnabled() const;
+
+        // Filters the frame in place
+        void apply(ScanFrame& frame);
+
+        // Statistics may be read from any thread. Times are per revolution
+        // the stage ran on.
+        uint64_t getRuns() const;
+        double getMeanMicros(Stage stage) const;
+        uint64_t getRejected(Stage stage) const;
+        uint32_t getLastRejected(Stage stage) const;
+        void resetStats();
+
+        static const char* getStageName(Stage stage);
+
+        static bool isSupported(Implementation implementation);
+
+        // Overrides the detected implementation, returns false if the CPU
+        // doesn't support it
+        static bool setImplementation(Implementation implementation);
+        static Implementation getImplementation();
+        static const char* getImplementationName(Implementation implementation);
+    private:
+        Config m_config;
+
+        // Copies of the frame with a few nodes from the other end of the
+        // turn on each side, which the neighbor stages read from
+        std::vector<int32_t> m_distances;
+        std::vector<int32_t> m_angles;
+
+        std::atomic<uint64_t> m_runs;
+        std::atomic<uint64_t> m_stageRuns[STAGE_COUNT];
+        std::atomic<uint64_t> m_nanos[STAGE_COUNT];
+        std::atomic<uint64_t> m_rejected[STAGE_COUNT];
+        std::atomic<uint32_t> m_lastRejected[STAGE_COUNT];
+
+        void pad(const ScanFrame& frame, bool angles);
+    };
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "lidar/ScanDevice.hpp"
+#include "lidar/FramePool.hpp"
+
+namespace em
+{
+    // One revolution stored as separate, cache line aligned arrays in the
+    // device's own fixed point units. Float views are converted on demand.
+    //
+    // Storage is allocated by reserve() only, so a frame can be refilled
+    // every revolution without allocating. It is a single block, either from
+    // the heap or from a FramePool.
+    class ScanFrame
+    {
+    public:
+        static const size_t ALIGNMENT = 64;
+
+        // angle_z_q14 has 90 degrees at 1 << 14, dist_mm_q2 is millimeters * 4
+        static constexpr float DEGREES_PER_UNIT = 90.0f / (1 << 14);
+        static constexpr float MILLIMETERS_PER_UNIT = 0.25f;
+
+        ScanFrame(size_t capacity = 0);
+        ~ScanFrame();
+
+        ScanFrame(const ScanFrame&) = delete;
+        ScanFrame& operator=(const ScanFrame&) = delete;
+
+        void reserve(size_t capacity);
+
+        // Moves the frame into a block from pool, false if the pool's blocks
+        // are too small for capacity or it has run out
+        bool reserve(size_t capacity, FramePool& pool);
+        size_t capacity() const;
+
+        bool isPooled() const;
+
+        // Bytes of storage a frame of capacity nodes needs, for sizing pools
+        static size_t getStorageSize(size_t capacity);
+
+        // Storage blocks any frame took from the heap so far
+        static uint64_t getHeapAllocations();
+
+        size_t size() const;
+        bool empty() const;
+
+        // Splits device nodes into the arrays, nodes past the capacity are dropped
+        void assign(const ScanNode* nodes, size_t count);
+        void clear();
+
+        // Copies the nodes, sequence and timestamps of another frame, nodes
+        // past the capacity are dropped
+        void copyFrom(const ScanFrame& other);
+
+        // Sets the node count after writing the arrays directly
+        void resize(size_t count);
+
+        const uint16_t* angles() const;
+        const uint32_t* distances() const;
+        const uint8_t* qualities() const;
+        const uint8_t* flags() const;
+
+        uint16_t* angles();
+        uint32_t* distances();
+        uint8_t* qualities();
+        uint8_t* flags();
+
+        float angle(size_t i) const;
+        float distance(size_t i) const;
+
+        // Batch conversions to degrees and millimeters
+        void anglesToDegrees(float* out) const;
+        void distancesToMillimeters(float* out) const;
+
+        // Converted once on first use after the frame changes. Only call these
+        // from the thread that owns the frame.
+        const float* degrees() const;
+        const float* millimeters() const;
+
+        // Index of the farthest node, 0 for an empty frame
+        size_t longestIndex() const;
+
+        void setSequence(uint64_t sequence);
+        uint64_t getSequence() const;
+
+        // When the revolution was captured, from monotonicMicros()
+        void setTimestamp(uint64_t timestamp);
+        uint64_t getTimestamp() const;
+
+        // When the revolution's first byte arrived and when it was handed to
+        // the consumer, for latency telemetry
+        void setFirstByteTime(uint64_t timestamp);
+        uint64_t getFirstByteTime() const;
+
+        void setPublishTime(uint64_t timestamp);
+        uint64_t getPublishTime() const;
+    private:
+        size_t m_capacity;
+        size_t m_size;
+        size_t m_longest;
+        uint64_t m_sequence;
+        uint64_t m_timestamp;
+        uint64_t m_firstByteTime;
+        uint64_t m_publishTime;
+
+        uint8_t* m_storage;
+        FramePool* m_pool;
+        uint16_t* m_angles;
+        uint32_t* m_distances;
+        uint8_t* m_qualities;
+        uint8_t* m_flags;
+
+        mutable float* m_degrees;
+        mutable float* m_millimeters;
+        mutable bool m_degreesValid;
+        mutable bool m_millimetersValid;
+
+        void invalidate();
+        void findLongest();
+
+        void adopt(uint8_t* storage, size_t capacity, FramePool* pool);
+    };
+}
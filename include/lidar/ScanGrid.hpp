@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lidar/ScanFrame.hpp"
+
+namespace em
+{
+    // A revolution resampled onto fixed angular bins, so the range at any
+    // bearing is one array lookup however many nodes the revolution had.
+    // Bin i covers [i, i + 1) * resolution degrees. Bins without a return
+    // hold 0.
+    class ScanGrid
+    {
+    public:
+        enum Reduction
+        {
+            MIN,        // Closest return in the bin, the safe choice for obstacles
+            NEAREST,    // Return whose angle is closest to the bin center
+            MEAN        // Average of every return in the bin
+        };
+
+        ScanGrid(float resolution = 0.5f, Reduction reduction = MIN);
+
+        // resolution is in degrees and is rounded so the bins tile 360 evenly
+        void configure(float resolution, Reduction reduction);
+
+        float getResolution() const;
+        Reduction getReduction() const;
+        size_t size() const;
+
+        void build(const ScanFrame& frame);
+
+        // Range in millimeters at a bearing in degrees, any value wraps
+        float range(float degrees) const;
+        float rangeAt(size_t bin) const;
+        const float* ranges() const;
+
+        size_t binOf(float degrees) const;
+        float binCenter(size_t bin) const;
+
+        // Sequence and timestamp of the frame the grid was built from
+        uint64_t getSequence() const;
+        uint64_t getTimestamp() const;
+
+        static const char* getReductionName(Reduction reduction);
+    private:
+        float m_resolution;
+        Reduction m_reduction;
+        uint32_t m_bins;
+        uint64_t m_sequence;
+        uint64_t m_timestamp;
+
+        std::vector<float> m_ranges;
+
+        // Scratch space kept between builds
+        std::vector<uint32_t> m_indices;
+        std::vector<uint32_t> m_accumulator;
+        std::vector<uint32_t> m_counts;
+    };
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+#include "lidar/ScanRecording.hpp"
+#include "lidar/ScanCodec.hpp"
+
+namespace em
+{
+    // Appends scans to a recording file from its own thread. The acquisition
+    // thread hands scans over through a fixed ring of preallocated slots, so
+    // memory stays bounded and write() never blocks; when the disk falls
+    // behind, scans are dropped and counted instead.
+    class ScanRecorder
+    {
+    public:
+        ScanRecorder(size_t capacity = 32);
+        ~ScanRecorder();
+
+        ScanRecorder(const ScanRecorder&) = delete;
+        ScanRecorder& operator=(const ScanRecorder&) = delete;
+
+        // Packed recordings are encoded on the writer thread, with a key scan
+        // every keyInterval scans to seek to
+        bool open(const std::string& path, const sl_lidar_response_device_info_t& info,
+            ScanEncoding encoding = SCAN_ENCODING_RAW, uint32_t keyInterval = 10);
+        void close();
+
+        bool isOpen() const;
+        const std::string& getPath() const;
+        ScanEncoding getEncoding() const;
+
+        // timestamp is in microseconds from em::monotonicMicros()
+        bool write(const ScanNode* nodes, size_t count, uint64_t timestamp);
+
+        uint64_t getScansWritten() const;
+        uint64_t getScansDropped() const;
+        uint64_t getBytesWritten() const;
+
+        // What the scans written so far would have taken raw
+        uint64_t getRawBytesWritten() const;
+    private:
+        struct Slot
+        {
+            std::vector<RecordedNode> nodes;
+            uint32_t count;
+            uint32_t sequence;
+            uint64_t timestamp;
+        };
+
+        std::string m_path;
+        FILE* m_file;
+        uint64_t m_offset;
+        uint64_t m_startTimestamp;
+        std::vector<RecordingIndexEntry> m_index;
+        ScanEncoding m_encoding;
+        ScanEncoder m_encoder;
+        std::vector<uint8_t> m_packed;
+
+        std::vector<Slot> m_slots;
+        std::atomic<size_t> m_head;
+        std::atomic<size_t> m_tail;
+        uint32_t m_sequence;
+
+        std::atomic<bool> m_open;
+        std::atomic<int> m_producers;
+        std::atomic<bool> m_shouldStop;
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+
+        std::atomic<uint64_t> m_scansWritten;
+        std::atomic<uint64_t> m_scansDropped;
+        std::atomic<uint64_t> m_bytesWritten;
+        std::atomic<uint64_t> m_rawBytesWritten;
+
+        bool writeSlot(const Slot& slot);
+        bool writeIndex();
+
+        static void writerThread(ScanRecorder* recorder);
+    };
+}
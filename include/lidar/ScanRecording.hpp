@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "lidar/ScanDevice.hpp"
+
+// On-disk layout of a scan recording (all fields little-endian):
+//
+//   RecordingHeader
+//   RecordedScanHeader + payload    (repeated, appended one scan at a time)
+//   RecordingIndexEntry[count]      (written on close)
+//   RecordingFooter                 (written on close)
+//
+// The index and footer only exist once a recording has been closed cleanly.
+// A file cut short by a crash still has valid scan records up to the point
+// of failure, and ScanRecording::recover() rebuilds the index from them.
+//
+// Version 2 added packed scans. Recordings of raw scans only are still
+// written as version 1 so older builds can play them.
+
+namespace em
+{
+    enum ScanEncoding : uint16_t
+    {
+        SCAN_ENCODING_RAW = 0,      // nodeCount RecordedNodes, 8 bytes each
+        SCAN_ENCODING_PACKED = 1    // Compressed by ScanEncoder, see ScanCodec.hpp
+    };
+
+#pragma pack(push, 1)
+    struct RecordingHeader
+    {
+        char magic[4];              // "RPLR"
+        uint16_t version;
+        uint16_t headerSize;
+        uint8_t model;
+        uint8_t hardwareVersion;
+        uint16_t firmwareVersion;
+        uint8_t serialNumber[16];
+        uint64_t startTime;         // Microseconds since the Unix epoch
+        uint8_t reserved[28];
+    };
+
+    // Same layout as sl_lidar_response_measurement_node_hq_t, so raw payloads
+    // can be handed straight to the acquisition path
+    struct RecordedNode
+    {
+        uint16_t angle_q14;
+        uint32_t distance_q2;
+        uint8_t quality;
+        uint8_t flags;
+    };
+
+    struct RecordedScanHeader
+    {
+        uint32_t magic;             // SCAN_MAGIC
+        uint32_t sequence;
+        uint64_t timestamp;         // Microseconds since the start of the recording
+        uint32_t nodeCount;
+        uint32_t payloadSize;
+        uint16_t encoding;
+        uint16_t reserved;
+        uint32_t checksum;          // CRC-32 of the payload
+    };
+
+    struct RecordingIndexEntry
+    {
+        uint64_t offset;            // File offset of the RecordedScanHeader
+        uint64_t timestamp;
+    };
+
+    struct RecordingFooter
+    {
+        uint64_t indexOffset;
+        uint32_t count;
+        uint32_t checksum;          // CRC-32 of the index entries
+        char magic[4];              // "RIDX"
+        uint32_t reserved;
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(RecordingHeader) == 64, "RecordingHeader must be 64 bytes");
+    static_assert(sizeof(RecordedNode) == sizeof(ScanNode), "RecordedNode must match the SDK node layout");
+    static_assert(sizeof(RecordedScanHeader) == 32, "RecordedScanHeader must be 32 bytes");
+    static_assert(sizeof(RecordingIndexEntry) == 16, "RecordingIndexEntry must be 16 bytes");
+    static_assert(sizeof(RecordingFooter) == 24, "RecordingFooter must be 24 bytes");
+
+    class ScanRecording
+    {
+    public:
+        static const uint16_t VERSION = 2;
+        static const uint32_t SCAN_MAGIC = 0x4E414353; // "SCAN"
+        static const uint32_t MAX_NODES = 8192;
+
+        // A packed scan that doesn't compress is stored raw behind its own header
+        static const uint32_t MAX_PAYLOAD_SIZE = MAX_NODES * sizeof(RecordedNode) + 64;
+
+        static RecordingHeader makeHeader(const sl_lidar_response_device_info_t& info, uint64_t startTime, ScanEncoding encoding = SCAN_ENCODING_RAW);
+        static bool isValidHeader(const RecordingHeader& header);
+        static bool isValidFooter(const RecordingFooter& footer, uint64_t fileSize);
+
+        // Checks a scan header and, if given, its payload against the checksum
+        static bool isValidScan(const RecordedScanHeader& scan, const void* payload = nullptr);
+
+        static const char* getEncodingName(ScanEncoding encoding);
+
+        // Reads the index from the footer, or rebuilds it by walking the scan
+        // records when the footer is missing or damaged. Returns false if the
+        // file is not a recording at all.
+        static bool readIndex(const std::string& path, RecordingHeader& header, std::vector<RecordingIndexEntry>& index, bool* hadFooter = nullptr);
+
+        // Drops any partially written scan at the end of the file and appends
+        // a fresh index and footer. Returns the number of recovered scans, or
+        // -1 if the file could not be recovered.
+        static long recover(const std::string& path);
+
+        // Walks the scan records that follow the header and stops at the first
+        // one that is damaged or cut short. Returns the end of the last valid record.
+        static uint64_t walkScans(FILE* file, uint64_t fileSize, std::vector<RecordingIndexEntry>& index);
+        static uint64_t walkScans(const uint8_t* data, uint64_t size, std::vector<RecordingIndexEntry>& index);
+    };
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lidar/ScanFrame.hpp"
+#include "lidar/ScanRecording.hpp"
+#include "lidar/ScanCodec.hpp"
+#include "lidar/SpscRing.hpp"
+
+// Wire format of a scan stream (all fields little-endian):
+//
+// Every frame is a RecordedScanHeader and its payload, the same as a scan in
+// a recording, except that the timestamp is from em::monotonicMicros() and
+// the sequence is the frame's. Over TCP the frames follow each other on the
+// stream. Over UDP a frame is cut into fragments, each sent as a datagram
+// led by a StreamDatagramHeader.
+//
+// Packed frames are predicted from the frame before, so a subscriber that
+// joins late or misses a frame waits for the next key frame.
+
+namespace em
+{
+#pragma pack(push, 1)
+    struct StreamDatagramHeader
+    {
+        uint32_t magic;             // ScanServer::DATAGRAM_MAGIC
+        uint32_t sequence;          // Sequence of the frame this is part of
+        uint32_t frameSize;         // Bytes in the whole frame
+        uint32_t offset;            // Where this fragment goes in the frame
+        uint16_t fragment;
+        uint16_t fragmentCount;
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(StreamDatagramHeader) == 20, "StreamDatagramHeader must be 20 bytes");
+
+    // Publishes frames to other processes over UDP, loopback or multicast,
+    // and TCP. publish() only copies the frame, everything else happens on
+    // the server's own I/O thread, so a slow subscriber never holds up
+    // acquisition. A TCP subscriber that can't keep up has frames dropped
+    // for it alone once its queue is full.
+    class ScanServer
+    {
+    public:
+        static const uint32_t DATAGRAM_MAGIC = 0x444E4353; // "SCND"
+
+        struct Config
+        {
+            std::string udpAddress;     // Loopback or a multicast group, empty for no UDP
+            uint16_t udpPort;
+            std::string tcpAddress;     // Address to listen on, empty for no TCP
+            uint16_t tcpPort;           // 0 picks a free port
+            ScanEncoding encoding;
+            uint32_t keyInterval;       // Frames between key frames when packed
+            size_t datagramSize;        // Largest datagram, headers included
+            size_t maxQueuedBytes;      // Per TCP subscriber
+
+            // Kernel send buffer of a TCP subscriber. Kept small so a slow
+            // subscriber's backlog queues up here, where it is dropped a
+            // whole frame at a time, instead of going stale in the kernel.
+            int socketBufferSize;
+
+            Config();
+        };
+
+        struct SubscriberStats
+        {
+            std::string address;
+            uint64_t framesSent = 0;
+            uint64_t framesDropped = 0;
+            uint64_t bytesSent = 0;
+        };
+
+        // capacity is the number of frames waiting for the I/O thread
+        ScanServer(size_t capacity = 4);
+        ~ScanServer();
+
+        ScanServer(const ScanServer&) = delete;
+        ScanServer& operator=(const ScanServer&) = delete;
+
+        bool start(const Config& config);
+        void stop();
+
+        bool isRunning() const;
+        const Config& getConfig() const;
+
+        // The port the TCP listener ended up on
+        uint16_t getTcpPort() const;
+
+        // Only call this from one thread at a time. Returns false if the
+        // server isn't running or the I/O thread is too far behind.
+        bool publish(const ScanFrame& frame);
+
+        uint64_t getFramesPublished() const;
+
+        // Frames dropped before the I/O thread got to them
+        uint64_t getFramesDropped() const;
+
+        // UDP first when enabled, then every connected TCP subscriber
+        std::vector<SubscriberStats> getSubscribers() const;
+    private:
+        struct Slot
+        {
+            std::vector<ScanNode> nodes;
+            uint32_t count;
+            uint32_t sequence;
+            uint64_t timestamp;
+        };
+
+        struct Subscriber
+        {
+            int socket;
+            std::vector<uint8_t> pending;
+            size_t sent;
+            bool started;               // Has had a key frame
+            bool synced;                // Has had every frame since
+            SubscriberStats stats;
+        };
+
+        Config m_config;
+        SpscRing<Slot> m_ring;
+
+        int m_udpSocket;
+        int m_tcpSocket;
+        int m_wake[2];
+        uint16_t m_tcpPort;
+        uint32_t m_udpHost;             // Network byte order
+
+        // Only the I/O thread changes these. It holds m_statsMutex just for
+        // the stats and for adding or removing subscribers, never for I/O.
+        std::vector<Subscriber> m_subscribers;
+        SubscriberStats m_udpStats;
+        mutable std::mutex m_statsMutex;
+
+        ScanEncoder m_encoder;
+        std::vector<uint8_t> m_frame;
+        std::vector<uint8_t> m_packed;
+        std::vector<uint8_t> m_datagram;
+
+        std::atomic<bool> m_running;
+        std::atomic<int> m_producers;
+        std::atomic<bool> m_shouldStop;
+        std::thread m_thread;
+
+        std::atomic<uint64_t> m_framesPublished;
+        std::atomic<uint64_t> m_framesDropped;
+
+        bool openSockets();
+        void closeSockets();
+
+        // Builds m_frame from a slot, returns whether it is a key frame
+        bool encodeFrame(const Slot& slot);
+
+        void sendDatagrams(uint32_t sequence);
+        void queueFrame(Subscriber& subscriber, bool key);
+        bool flush(Subscriber& subscriber);
+        void acceptSubscribers();
+
+        static void ioThread(ScanServer* server);
+    };
+}
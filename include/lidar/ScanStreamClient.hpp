@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "lidar/ScanServer.hpp"
+
+namespace em
+{
+    // Reference subscriber for a ScanServer stream, over either transport.
+    // Reassembles and checks every frame: fragments must add up, checksums
+    // must match, sequences must go forward. Frames that fail are counted
+    // and never handed out.
+    class ScanStreamClient
+    {
+    public:
+        struct Stats
+        {
+            uint64_t framesReceived = 0;
+            uint64_t framesMissed = 0;      // Gaps in the sequence
+            uint64_t framesCorrupt = 0;     // Bad checksum, header or fragment
+            uint64_t framesLate = 0;        // At or behind a frame already received
+            uint64_t framesSkipped = 0;     // Packed frames received before a key frame
+            uint64_t bytesReceived = 0;
+        };
+
+        ScanStreamClient();
+        ~ScanStreamClient();
+
+        ScanStreamClient(const ScanStreamClient&) = delete;
+        ScanStreamClient& operator=(const ScanStreamClient&) = delete;
+
+        bool connectTcp(const std::string& address, uint16_t port);
+
+        // Joins the group if address is a multicast one
+        bool listenUdp(const std::string& address, uint16_t port);
+
+        void close();
+        bool isOpen() const;
+
+        // Waits up to timeout milliseconds for the next good frame. Returns
+        // false on a timeout or once a TCP server has gone away.
+        bool receive(std::vector<ScanNode>& nodes, uint32_t& sequence, uint64_t& timestamp, unsigned int timeout);
+
+        const Stats& getStats() const;
+    private:
+        int m_socket;
+        bool m_datagrams;
+
+        std::vector<uint8_t> m_buffer;
+        size_t m_buffered;              // TCP bytes not yet handed out
+        size_t m_frameSize;             // Of the frame that was just completed
+
+        // Fragments of the frame being put back together
+        uint32_t m_assembling;
+        size_t m_fragmentsLeft;
+        std::vector<bool> m_fragments;
+
+        bool m_started;
+        uint32_t m_lastSequence;
+
+        ScanDecoder m_decoder;
+        Stats m_stats;
+
+        // Both return true once a whole frame is in m_buffer
+        bool readFrame(int timeout);
+        bool readDatagram(int timeout);
+
+        bool acceptFrame(const uint8_t* frame, size_t size, std::vector<ScanNode>& nodes, uint32_t& sequence, uint64_t& timestamp);
+    };
+}
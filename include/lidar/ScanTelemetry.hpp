@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+
+#include "lidar/LatencyHistogram.hpp"
+#include "lidar/ScanFrame.hpp"
+
+namespace em
+{
+    // Where the time goes between a scan's first byte arriving and it being
+    // on screen. Each scan carries its first byte, completion and publish
+    // times in its ScanFrame. The consumer adds when it picked the scan up
+    // and when the frame showing it was presented.
+    //
+    // The acquisition thread calls scanPublished(). scanConsumed() and
+    // scanPresented() belong to the consuming thread. Readers may look at the
+    // histograms and counters from anywhere.
+    class ScanTelemetry
+    {
+    public:
+        enum Interval
+        {
+            ACQUISITION,    // First byte to scan complete
+            PUBLISH,        // Scan complete to published to the consumer
+            QUEUE,          // Published to picked up by the consumer
+            RENDER,         // Picked up to presented
+            SCAN_TO_PHOTON, // First byte to presented
+            INTERVAL_COUNT
+        };
+
+        static const uint64_t DEFAULT_LATE_THRESHOLD = 100000;
+
+        ScanTelemetry();
+
+        ScanTelemetry(const ScanTelemetry&) = delete;
+        ScanTelemetry& operator=(const ScanTelemetry&) = delete;
+
+        void scanPublished(const ScanFrame& frame);
+        void scanConsumed(const ScanFrame& frame, uint64_t now);
+        void scanPresented(uint64_t now);
+
+        // Scans whose scan to photon latency is over this are counted as late
+        void setLateThreshold(uint64_t micros);
+        uint64_t getLateThreshold() const;
+
+        const LatencyHistogram& getHistogram(Interval interval) const;
+
+        uint64_t getPublished() const;
+        uint64_t getConsumed() const;
+        uint64_t getPresented() const;
+
+        // Published scans the consumer never saw because a newer one replaced
+        // them first
+        uint64_t getDropped() const;
+        uint64_t getLate() const;
+
+        void reset();
+
+        // Writes the counters and every interval's percentiles as one JSON
+        // object, all times in microseconds
+        void writeJSON(FILE* file, const char* name) const;
+
+        static const char* getIntervalName(Interval interval);
+    private:
+        LatencyHistogram m_histograms[INTERVAL_COUNT];
+
+        std::atomic<uint64_t> m_published;
+        std::atomic<uint64_t> m_consumed;
+        std::atomic<uint64_t> m_presented;
+        std::atomic<uint64_t> m_dropped;
+        std::atomic<uint64_t> m_late;
+        std::atomic<uint64_t> m_lateThreshold;
+
+        // Consumer side only
+        uint64_t m_lastSequence;
+        uint64_t m_pendingFirstByte;
+        uint64_t m_pendingConsumed;
+    };
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "lidar/ScanFrame.hpp"
+#include "lidar/SpscRing.hpp"
+
+namespace em
+{
+    // A slice of a revolution, published as soon as the scan moves past it
+    struct ScanSector
+    {
+        // Sequence counts sectors, timestamps cover the sector alone
+        ScanFrame frame;
+
+        uint64_t revolution = 0;    // Sync flags seen by the stream so far
+        uint16_t index = 0;         // 0 starts at 0 degrees
+        uint16_t count = 0;         // Sectors per revolution
+
+        float getStartAngle() const { return 360.0f * index / count; }
+        float getEndAngle() const { return 360.0f * (index + 1) / count; }
+    };
+
+    // Cuts the node stream of a device into fixed angular sectors and hands
+    // each one to a consumer thread the moment the scan leaves it, instead of
+    // waiting for the whole revolution.
+    //
+    // feed() and endRevolution() belong to the acquisition thread, next() and
+    // release() to a single consumer. Sectors are queued rather than replaced
+    // so a consumer can keep a rolling sweep; when it falls too far behind the
+    // newest sectors are dropped and counted.
+    class SectorStream
+    {
+    public:
+        static const size_t DEFAULT_SECTORS = 16;
+        static const size_t DEFAULT_CAPACITY = 64;
+
+        SectorStream(size_t sectors = DEFAULT_SECTORS, size_t capacity = DEFAULT_CAPACITY, size_t maxNodes = 8192);
+
+        SectorStream(const SectorStream&) = delete;
+        SectorStream& operator=(const SectorStream&) = delete;
+
+        size_t getSectorCount() const;
+
+        // Nodes in arrival order, a sync flag starts a new revolution.
+        // timestamp is when they arrived, from monotonicMicros().
+        void feed(const ScanNode* nodes, size_t count, uint64_t timestamp);
+
+        // One whole revolution sorted by angle, for sources that can't deliver
+        // nodes any earlier. Sync flags are ignored.
+        void feedRevolution(const ScanNode* nodes, size_t count, uint64_t firstByte, uint64_t timestamp);
+
+        // Drops the sector in progress, e.g. after the scan was restarted
+        void reset();
+
+        // Oldest unread sector or nullptr, valid until release(). Gaps in the
+        // sector sequence are sectors that were dropped.
+        const ScanSector* next();
+        void release();
+
+        uint64_t getPublished() const;
+        uint64_t getDropped() const;
+    private:
+        SpscRing<ScanSector> m_ring;
+        size_t m_sectors;
+
+        std::vector<ScanNode> m_pending;
+        int m_current;
+        uint64_t m_firstByte;
+        uint64_t m_revolution;
+        uint64_t m_sequence;
+
+        std::atomic<uint64_t> m_published;
+        std::atomic<uint64_t> m_dropped;
+
+        int sectorOf(const ScanNode& node) const;
+        void publish(uint64_t timestamp);
+    };
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "lidar/ScanDevice.hpp"
+
+#include "sl_lidar_driver.h"
+
+namespace em
+{
+    class SerialScanDevice : public ScanDevice
+    {
+    public:
+        SerialScanDevice(const std::string& port, int baudrate = 115200);
+        ~SerialScanDevice();
+
+        sl_result connect() override;
+        void disconnect() override;
+
+        sl_result getDeviceInfo(sl_lidar_response_device_info_t& info, unsigned int timeout = DEFAULT_TIMEOUT) override;
+        sl_result getHealth(sl_lidar_response_device_health_t& health, unsigned int timeout = DEFAULT_TIMEOUT) override;
+
+        sl_result startScan() override;
+        sl_result stop() override;
+
+        sl_result grabScanDataHq(ScanNode* nodes, size_t& count, unsigned int timeout = DEFAULT_TIMEOUT) override;
+        sl_result ascendScanData(ScanNode* nodes, size_t count) override;
+    private:
+        std::string m_port;
+        int m_baudrate;
+
+        sl::ILidarDriver* m_driver;
+        sl::IChannel* m_channel;
+    };
+}
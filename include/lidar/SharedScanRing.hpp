@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "lidar/ScanFrame.hpp"
+
+// Layout of a shared scan ring, a POSIX shared memory object:
+//
+//   SharedRingHeader
+//   slot[slotCount], each slotSize bytes:
+//     SharedSlotHeader
+//     angles, distances, qualities, flags   (capacity entries each, 64 byte aligned)
+//
+// Frame n goes into slot n % slotCount. A slot's generation is 2n + 1 while
+// frame n is being written and 2n + 2 once it is complete, which makes it a
+// seqlock: a reader checks the generation before and after reading and knows
+// the frame was overwritten under it if the two differ. Readers never write
+// to the ring, so any number of them can map it.
+
+namespace em
+{
+    struct SharedRingHeader
+    {
+        char magic[4];                      // "RPLS"
+        uint16_t version;
+        uint16_t headerSize;
+        uint32_t slotCount;
+        uint32_t capacity;                  // Nodes per slot
+        uint64_t slotSize;                  // Bytes per slot
+        std::atomic<uint64_t> published;    // Frames completed so far
+        uint32_t writerPid;                 // Process that created the ring
+        uint8_t reserved[28];
+    };
+
+    struct SharedSlotHeader
+    {
+        std::atomic<uint64_t> generation;
+        uint64_t sequence;
+        uint64_t timestamp;                 // From em::monotonicMicros()
+        uint32_t count;
+        uint8_t reserved[36];
+    };
+
+    static_assert(sizeof(SharedRingHeader) == 64, "SharedRingHeader must be 64 bytes");
+    static_assert(sizeof(SharedSlotHeader) == 64, "SharedSlotHeader must be 64 bytes");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "The ring needs lock free 64 bit atomics to be shared");
+
+    // The writing side, owned by the process with the device. Creates the
+    // shared memory object and removes its name again on close.
+    class SharedScanRing
+    {
+    public:
+        static const uint16_t VERSION = 1;
+
+        SharedScanRing();
+        ~SharedScanRing();
+
+        SharedScanRing(const SharedScanRing&) = delete;
+        SharedScanRing& operator=(const SharedScanRing&) = delete;
+
+        // name is a shared memory name such as "/rplidar-0"
+        bool create(const std::string& name, size_t slotCount = 16, size_t capacity = 8192);
+        void close();
+
+        bool isOpen() const;
+        const std::string& getName() const;
+
+        // Only call this from one thread at a time. Nodes past the capacity
+        // are dropped.
+        bool publish(const ScanFrame& frame);
+
+        uint64_t getPublished() const;
+
+        static size_t getSlotSize(size_t capacity);
+    private:
+        std::string m_name;
+        uint8_t* m_data;
+        size_t m_size;
+
+        std::atomic<bool> m_open;
+        std::atomic<int> m_producers;
+    };
+
+    // The reading side, for any process on the same machine. Reads happen
+    // in place without locks or system calls. A frame read in place is only
+    // good if validate() still agrees afterwards.
+    class SharedScanReader
+    {
+    public:
+        // Arrays of one frame inside the ring
+        struct View
+        {
+            const uint16_t* angles = nullptr;
+            const uint32_t* distances = nullptr;
+            const uint8_t* qualities = nullptr;
+            const uint8_t* flags = nullptr;
+            size_t count = 0;
+            uint64_t sequence = 0;
+            uint64_t timestamp = 0;
+            uint64_t frame = 0;             // Index in the ring's own count
+            uint64_t generation = 0;
+        };
+
+        SharedScanReader();
+        ~SharedScanReader();
+
+        SharedScanReader(const SharedScanReader&) = delete;
+        SharedScanReader& operator=(const SharedScanReader&) = delete;
+
+        bool open(const std::string& name);
+        void close();
+        bool isOpen() const;
+
+        uint32_t getSlotCount() const;
+        uint32_t getCapacity() const;
+
+        // Frames the writer has completed, the latest one is getPublished() - 1
+        uint64_t getPublished() const;
+
+        // Points view at frame, false if it isn't written yet or has already
+        // been overwritten
+        bool acquire(uint64_t frame, View& view) const;
+
+        // Whether the frame behind view is still there, call it once done
+        // reading the view
+        bool validate(const View& view) const;
+
+        // Copies the newest frame, false if there is none yet
+        bool readLatest(ScanFrame& frame);
+
+        // Copies the frame after the last one read. Frames the writer
+        // overwrote before they were read are skipped and counted.
+        bool readNext(ScanFrame& frame);
+        uint64_t getMissed() const;
+    private:
+        const uint8_t* m_data;
+        size_t m_size;
+        const SharedRingHeader* m_header;
+
+        uint64_t m_next;
+        uint64_t m_missed;
+
+        bool copy(uint64_t frame, ScanFrame& out) const;
+    };
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "lidar/ScanDevice.hpp"
+
+#include <vector>
+#include <random>
+#include <chrono>
+
+namespace em
+{
+    // All lengths are in millimeters and all speeds in millimeters per second
+    struct SimulatedWall
+    {
+        float x0, y0;
+        float x1, y1;
+    };
+
+    // Circles travel in a straight line and bounce off the world bounds
+    struct SimulatedCircle
+    {
+        float x, y;
+        float radius;
+        float vx, vy;
+    };
+
+    struct SimulatedWorld
+    {
+        std::vector<SimulatedWall> walls;
+        std::vector<SimulatedCircle> circles;
+
+        float minX = -5000.0f;
+        float minY = -3000.0f;
+        float maxX = 5000.0f;
+        float maxY = 3000.0f;
+
+        // A 10 x 6 m room with a pillar and two people walking around
+        static SimulatedWorld defaultWorld();
+
+        void addBox(float minX, float minY, float maxX, float maxY);
+
+        void circlePosition(const SimulatedCircle& circle, float time, float& x, float& y) const;
+
+        // Distance along the ray to the nearest surface, or 0 if nothing is hit
+        float castRay(float x, float y, float angle, float time) const;
+    };
+
+    struct SimulatorParams
+    {
+        int sampleRate = 8000;      // Points per second, 2000 to 32000
+        float rpm = 600.0f;
+        float noise = 0.0f;         // Standard deviation of the range noise
+        float dropout = 0.0f;       // Probability that a sample returns nothing
+        float maxRange = 12000.0f;
+        bool realtime = true;       // Pace revolutions to the wall clock
+        uint32_t seed = 1;
+
+        // The sensor drives around at a constant velocity in its own frame,
+        // in mm/s and degrees/s, starting at the origin when the scan starts
+        float vx = 0.0f;
+        float vy = 0.0f;
+        float spin = 0.0f;
+
+        // Reads "sim://key=value,..." where the keys are rate, rpm, noise,
+        // dropout, range, realtime, seed, vx, vy and spin
+        static SimulatorParams parse(const std::string& port);
+    };
+
+    class SimulatedScanDevice : public ScanDevice
+    {
+    public:
+        static const char* const DEFAULT_PORT;
+
+        SimulatedScanDevice(const SimulatorParams& params = SimulatorParams(), const SimulatedWorld& world = SimulatedWorld::defaultWorld());
+
+        sl_result connect() override;
+        void disconnect() override;
+
+        sl_result getDeviceInfo(sl_lidar_response_device_info_t& info, unsigned int timeout = DEFAULT_TIMEOUT) override;
+        sl_result getHealth(sl_lidar_response_device_health_t& health, unsigned int timeout = DEFAULT_TIMEOUT) override;
+
+        sl_result startScan() override;
+        sl_result stop() override;
+
+        sl_result grabScanDataHq(ScanNode* nodes, size_t& count, unsigned int timeout = DEFAULT_TIMEOUT) override;
+        sl_result ascendScanData(ScanNode* nodes, size_t count) override;
+        uint64_t getScanStartTime() const override;
+        bool setNodeListener(NodeListener listener, void* user) override;
+
+        SimulatedWorld& getWorld();
+        const SimulatorParams& getParams() const;
+        size_t getSamplesPerRevolution() const;
+        float getRevolutionPeriod() const;
+
+        static bool isSimulatorPort(const std::string& port);
+    private:
+        SimulatorParams m_params;
+        SimulatedWorld m_world;
+
+        bool m_connected;
+        bool m_scanning;
+        uint64_t m_revolution;
+        std::chrono::steady_clock::time_point m_scanStart;
+        uint64_t m_revolutionStart;
+
+        NodeListener m_listener;
+        void* m_listenerUser;
+
+        std::mt19937 m_random;
+    };
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace em
+{
+    // Bounded single-producer, single-consumer queue of preallocated slots.
+    //
+    // The producer fills claim() and calls push(), the consumer reads front()
+    // and calls pop(). Slots are reused in place, so T can hold buffers that
+    // are sized once up front. Nothing is ever overwritten: when the consumer
+    // falls behind, claim() returns nullptr and the producer decides what to
+    // drop.
+    template<typename T>
+    class SpscRing
+    {
+    public:
+        SpscRing(size_t capacity) :
+            m_slots(capacity + 1),
+            m_head(0),
+            m_tail(0)
+        {
+        }
+
+        SpscRing(const SpscRing&) = delete;
+        SpscRing& operator=(const SpscRing&) = delete;
+
+        size_t capacity() const
+        {
+            return m_slots.size() - 1;
+        }
+
+        // Producer side
+        T* claim()
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+
+            if(next(head) == m_tail.load(std::memory_order_acquire))
+                return nullptr;
+
+            return &m_slots[head];
+        }
+
+        void push()
+        {
+            m_head.store(next(m_head.load(std::memory_order_relaxed)), std::memory_order_release);
+        }
+
+        // Consumer side
+        T* front()
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+
+            if(tail == m_head.load(std::memory_order_acquire))
+                return nullptr;
+
+            return &m_slots[tail];
+        }
+
+        void pop()
+        {
+            m_tail.store(next(m_tail.load(std::memory_order_relaxed)), std::memory_order_release);
+        }
+
+        // Only while neither side is running, e.g. to size the slots
+        T& slot(size_t index)
+        {
+            return m_slots[index];
+        }
+
+        size_t slotCount() const
+        {
+            return m_slots.size();
+        }
+    private:
+        std::vector<T> m_slots;
+        std::atomic<size_t> m_head;
+        std::atomic<size_t> m_tail;
+
+        size_t next(size_t index) const
+        {
+            return index + 1 == m_slots.size() ? 0 : index + 1;
+        }
+    };
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "lidar/ScanFrame.hpp"
+#include "lidar/ScanGrid.hpp"
+
+namespace em
+{
+    // Smooths scans over time for mostly static scenes. Every revolution is
+    // resampled onto angular bins and each bin keeps a running estimate,
+    // updated in one pass over the bins. A bin whose new range is far from
+    // its estimate starts over from it, so things that move show up within a
+    // revolution instead of smearing.
+    //
+    // Uses the same implementation ScanFilter picked.
+    class TemporalFilter
+    {
+    public:
+        enum Mode
+        {
+            EMA,        // Exponential moving average
+            MEDIAN      // Median of the last few revolutions
+        };
+
+        struct Config
+        {
+            Mode mode;
+            float resolution;       // Degrees per bin
+            float alpha;            // EMA weight of the newest revolution, 0 to 1
+            int window;             // MEDIAN over 3 or 5 revolutions
+            float resetDistance;    // Millimeters
+            int maxMisses;          // Revolutions a bin keeps its estimate without a return
+
+            Config();
+        };
+
+        TemporalFilter(const Config& config = Config());
+
+        TemporalFilter(const TemporalFilter&) = delete;
+        TemporalFilter& operator=(const TemporalFilter&) = delete;
+
+        // Starts over with no estimates
+        void configure(const Config& config);
+        const Config& getConfig() const;
+        void reset();
+
+        // Folds a revolution in
+        void update(const ScanFrame& frame);
+
+        // One node per bin at its center, 0 distance for bins without an
+        // estimate. Carries the sequence and times of the last revolution.
+        const ScanFrame& getFrame() const;
+        size_t size() const;
+
+        uint64_t getSequence() const;
+        uint64_t getRevolutions() const;
+
+        // Bins that started over in the last revolution
+        uint32_t getLastResets() const;
+
+        static const char* getModeName(Mode mode);
+    private:
+        Config m_config;
+        ScanGrid m_grid;
+        ScanFrame m_frame;
+
+        // Per bin, in millimeters. history holds window rows of bins.
+        std::vector<float> m_estimates;
+        std::vector<float> m_misses;
+        std::vector<float> m_history;
+
+        uint64_t m_revolutions;
+        uint32_t m_lastResets;
+    };
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace em
+{
+    // Single-producer, single-consumer triple buffer.
+    //
+    // The producer fills back() and calls publish(), which swaps the back slot
+    // with the shared middle slot. The consumer calls update(), which swaps the
+    // middle slot into front() only if something new was published. Neither
+    // side blocks, and a slot is never visible to both threads at once, so the
+    // consumer always sees a complete frame.
+    template<typename T>
+    class TripleBuffer
+    {
+    public:
+        TripleBuffer() :
+            m_middle(1),
+            m_back(0),
+            m_front(2)
+        {
+        }
+
+        TripleBuffer(const TripleBuffer&) = delete;
+        TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+        // Producer side
+        T& back()
+        {
+            return m_slots[m_back];
+        }
+
+        void publish()
+        {
+            uint8_t previous = m_middle.exchange(m_back | FRESH_BIT, std::memory_order_acq_rel);
+            m_back = previous & INDEX_MASK;
+        }
+
+        // Consumer side
+        bool update()
+        {
+            if(!(m_middle.load(std::memory_order_relaxed) & FRESH_BIT))
+                return false;
+
+            uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+            m_front = previous & INDEX_MASK;
+
+            return true;
+        }
+
+        const T& front() const
+        {
+            return m_slots[m_front];
+        }
+
+        // Only safe before the producer and consumer threads are started
+        T& slot(int index)
+        {
+            return m_slots[index];
+        }
+    private:
+        static constexpr uint8_t INDEX_MASK = 0x3;
+        static constexpr uint8_t FRESH_BIT = 0x4;
+
+        T m_slots[3];
+
+        alignas(64) std::atomic<uint8_t> m_middle;
+        alignas(64) uint8_t m_back;
+        alignas(64) uint8_t m_front;
+    };
+}
@@ -0,0 +1,312 @@
+#include <HeadlessApp.hpp>
+
+#include <lidar/Clock.hpp>
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace em;
+
+namespace
+{
+    volatile std::sig_atomic_t interrupted = 0;
+
+    void onSignal(int)
+    {
+        interrupted = 1;
+    }
+
+    bool parseNumber(const char* text, uint64_t& value)
+    {
+        char* end;
+        value = strtoull(text, &end, 10);
+
+        return *text && !*end && *text != '-';
+    }
+
+    inline uint64_t elapsed(uint64_t from, uint64_t to)
+    {
+        return to > from ? to - from : 0;
+    }
+}
+
+bool HeadlessParams::isRequested(int argc, char** argv)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--headless") == 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool HeadlessParams::parse(int argc, char** argv, HeadlessParams& params)
+{
+    static Logger logger("HeadlessParams");
+
+    for(int i = 1; i < argc; i++)
+    {
+        const char* option = argv[i];
+        bool takesValue = strcmp(option, "--headless") == 0 || strcmp(option, "--scans") == 0
+            || strcmp(option, "--duration") == 0 || strcmp(option, "--interval") == 0
+            || strcmp(option, "--record") == 0 || strcmp(option, "--telemetry") == 0;
+
+        if(takesValue && i + 1 == argc)
+        {
+            logger.errorf("%s needs a value", option);
+            return false;
+        }
+
+        uint64_t number = 0;
+        bool numeric = strcmp(option, "--scans") == 0 || strcmp(option, "--duration") == 0
+            || strcmp(option, "--interval") == 0;
+
+        if(numeric && !parseNumber(argv[i + 1], number))
+        {
+            logger.errorf("%s takes a whole number, got \"%s\"", option, argv[i + 1]);
+            return false;
+        }
+
+        if(strcmp(option, "--headless") == 0)
+            params.port = argv[++i];
+        else if(strcmp(option, "--scans") == 0)
+            params.scans = number, i++;
+        else if(strcmp(option, "--duration") == 0)
+            params.duration = (unsigned int) number, i++;
+        else if(strcmp(option, "--interval") == 0)
+            params.interval = (unsigned int) number, i++;
+        else if(strcmp(option, "--record") == 0)
+            params.recordPath = argv[++i];
+        else if(strcmp(option, "--telemetry") == 0)
+            params.telemetryPath = argv[++i];
+        else if(strcmp(option, "--per-scan") == 0)
+            params.perScan = true;
+        else if(strcmp(option, "--compress") == 0)
+            params.compress = true;
+        else
+        {
+            logger.errorf("Unknown option %s", option);
+            return false;
+        }
+    }
+
+    if(params.port.empty())
+    {
+        logger.errorf("--headless needs a port");
+        return false;
+    }
+
+    return true;
+}
+
+void HeadlessParams::printUsage(const char* program)
+{
+    printf("Usage: %s --headless <port> [options]\n"
+        "  --scans <count>       stop after this many scans\n"
+        "  --duration <seconds>  stop after this long\n"
+        "  --interval <ms>       time between summaries, 0 for none (default 1000)\n"
+        "  --per-scan            print a line for every scan\n"
+        "  --record <path>       record every scan once connected\n"
+        "  --compress            pack the recorded scans\n"
+        "  --telemetry <path>    write latency telemetry as JSON at the end\n",
+        program);
+}
+
+HeadlessApp::HeadlessApp() :
+    m_logger("HeadlessApp"),
+    m_shouldClose(false),
+    m_initialized(false),
+    m_recording(false),
+    m_startTime(0),
+    m_firstScanTime(0),
+    m_scans(0),
+    m_nodes(0),
+    m_summaryTime(0),
+    m_summaryScans(0),
+    m_summaryNodes(0),
+    m_summaryDropped(0)
+{
+}
+
+bool HeadlessApp::start(const HeadlessParams& params)
+{
+    m_params = params;
+    m_startTime = monotonicMicros();
+    m_summaryTime = m_startTime;
+
+    // Ctrl+C and the service manager end the run cleanly, so a recording and
+    // the telemetry still get written
+    interrupted = 0;
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    m_grabber = std::make_unique<LIDARFrameGrabber>(params.port);
+
+    // Subscribed before the first scan can be published. A few scans of slack
+    // cover a slow stdout, anything beyond that is counted as dropped.
+    m_subscriber = m_grabber->getBus().subscribe("headless", 16);
+
+    m_grabber->start();
+
+    m_logger.infof("Acquiring from %s", params.port.c_str());
+
+    m_initialized = true;
+
+    return true;
+}
+
+bool HeadlessApp::shouldClose()
+{
+    return m_shouldClose;
+}
+
+bool HeadlessApp::runLoop()
+{
+    if(!m_initialized)
+    {
+        m_logger.errorf("Application has not been initialized");
+        return false;
+    }
+
+    if(interrupted)
+    {
+        m_logger.infof("Interrupted");
+        m_shouldClose = true;
+        return true;
+    }
+
+    if(!m_recording && !m_params.recordPath.empty() && m_grabber->isConnected())
+    {
+        if(!m_grabber->startRecording(m_params.recordPath, m_params.compress ? SCAN_ENCODING_PACKED : SCAN_ENCODING_RAW))
+        {
+            m_logger.errorf("Unable to record to %s", m_params.recordPath.c_str());
+            return false;
+        }
+
+        m_recording = true;
+    }
+
+    // Sleeps until the next scan, so an idle run costs next to nothing
+    ScanBus::FrameRef frame = m_subscriber->next(100);
+    uint64_t now = monotonicMicros();
+
+    if(frame)
+    {
+        m_grabber->getTelemetry().scanConsumed(*frame, now);
+
+        if(!m_scans)
+        {
+            m_firstScanTime = now;
+            m_logger.infof("First scan %.1f ms after starting", (now - m_startTime) / 1000.0f);
+        }
+
+        m_scans++;
+        m_nodes += frame->size();
+
+        if(m_params.perScan)
+            printScan(*frame, m_subscriber->getStats());
+
+        if(m_params.scans && m_scans >= m_params.scans)
+            m_shouldClose = true;
+    }
+
+    if(m_params.interval && now - m_summaryTime >= m_params.interval * 1000ull)
+        printSummary(now);
+
+    if(m_params.duration && now - m_startTime >= m_params.duration * 1000000ull)
+        m_shouldClose = true;
+
+    return true;
+}
+
+bool HeadlessApp::terminate()
+{
+    if(!m_initialized)
+    {
+        m_logger.errorf("Application has not been initialized");
+        return false;
+    }
+
+    // Scans since the last summary would otherwise go unreported
+    uint64_t now = monotonicMicros();
+
+    if(m_summaryScans != m_scans || !m_params.interval)
+        printSummary(now);
+
+    m_subscriber.reset();
+    m_grabber->stopRecording();
+    m_grabber->stop();
+
+    double seconds = elapsed(m_firstScanTime, now) / 1000000.0;
+    m_logger.infof("%llu scans, %llu nodes, %.1f scans/s",
+        (unsigned long long) m_scans, (unsigned long long) m_nodes,
+        m_scans > 1 && seconds > 0.0 ? (m_scans - 1) / seconds : 0.0);
+
+    bool written = m_params.telemetryPath.empty() || writeTelemetry();
+
+    if(!written)
+        m_logger.errorf("Failed to write telemetry to %s", m_params.telemetryPath.c_str());
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+
+    m_initialized = false;
+
+    return written;
+}
+
+LIDARFrameGrabber* HeadlessApp::getLIDARFrameGrabber()
+{
+    return m_grabber.get();
+}
+
+void HeadlessApp::printScan(const ScanFrame& frame, const ScanBus::SubscriberStats& stats)
+{
+    size_t longest = frame.longestIndex();
+
+    printf("scan %llu nodes %zu longest %.0f mm at %.1f deg acquisition %llu us delay %llu us\n",
+        (unsigned long long) frame.getSequence(), frame.size(),
+        frame.empty() ? 0.0f : frame.distance(longest), frame.empty() ? 0.0f : frame.angle(longest),
+        (unsigned long long) elapsed(frame.getFirstByteTime(), frame.getTimestamp()),
+        (unsigned long long) stats.delayMicros);
+}
+
+void HeadlessApp::printSummary(uint64_t now)
+{
+    const LatencyHistogram& acquisition = m_grabber->getTelemetry().getHistogram(ScanTelemetry::ACQUISITION);
+    ScanBus::SubscriberStats stats = m_subscriber->getStats();
+
+    uint64_t scans = m_scans - m_summaryScans;
+    uint64_t nodes = m_nodes - m_summaryNodes;
+    double seconds = elapsed(m_summaryTime, now) / 1000000.0;
+
+    m_logger.infof("%s: %s, %llu scans (%.1f/s), %.0f nodes/scan, %.1f rev/s, acquisition p50 %llu us p99 %llu us, max delay %llu us, %llu dropped",
+        m_params.port.c_str(), LIDARFrameGrabber::getConnectionStateName(m_grabber->getConnectionState()),
+        (unsigned long long) scans, seconds > 0.0 ? scans / seconds : 0.0, scans ? (double) nodes / scans : 0.0,
+        m_grabber->getRevolutionsPerSecond(),
+        (unsigned long long) acquisition.getPercentile(50.0), (unsigned long long) acquisition.getPercentile(99.0),
+        (unsigned long long) stats.maxDelayMicros, (unsigned long long) (stats.dropped - m_summaryDropped));
+
+    m_summaryTime = now;
+    m_summaryScans = m_scans;
+    m_summaryNodes = m_nodes;
+    m_summaryDropped = stats.dropped;
+}
+
+bool HeadlessApp::writeTelemetry()
+{
+    FILE* file = fopen(m_params.telemetryPath.c_str(), "w");
+
+    if(!file)
+        return false;
+
+    // Same layout as the visualizer's telemetry dumps
+    fprintf(file, "{\"timestamp\": %llu, \"devices\": [\n  ", (unsigned long long) monotonicMicros());
+    m_grabber->getTelemetry().writeJSON(file, m_params.port.c_str());
+    fprintf(file, "\n]}\n");
+
+    return fclose(file) == 0;
+}
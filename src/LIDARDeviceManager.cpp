@@ -0,0 +1,613 @@
+#include "LIDARDeviceManager.hpp"
+
+#include "lidar/PolarToCartesian.hpp"
+#include "lidar/Clock.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+static const float PI = 3.14159265358979f;
+
+LIDARDeviceManager::Extrinsics::Extrinsics() :
+    x(0.0f), y(0.0f), z(0.0f),
+    roll(0.0f), pitch(0.0f), yaw(0.0f)
+{
+}
+
+void LIDARDeviceManager::Extrinsics::toMatrix(float* m) const
+{
+    float cr = cosf(roll * PI / 180.0f), sr = sinf(roll * PI / 180.0f);
+    float cp = cosf(pitch * PI / 180.0f), sp = sinf(pitch * PI / 180.0f);
+    float cy = cosf(yaw * PI / 180.0f), sy = sinf(yaw * PI / 180.0f);
+
+    // Yaw * pitch * roll, stored column by column
+    m[0] = cy * cp;
+    m[1] = sy * cp;
+    m[2] = -sp;
+    m[3] = 0.0f;
+
+    m[4] = cy * sp * sr - sy * cr;
+    m[5] = sy * sp * sr + cy * cr;
+    m[6] = cp * sr;
+    m[7] = 0.0f;
+
+    m[8] = cy * sp * cr + sy * sr;
+    m[9] = sy * sp * cr - cy * sr;
+    m[10] = cp * cr;
+    m[11] = 0.0f;
+
+    m[12] = x;
+    m[13] = y;
+    m[14] = z;
+    m[15] = 1.0f;
+}
+
+LIDARDeviceManager::LIDARDeviceManager() :
+    m_maxSkew(150000),
+    m_dirty(false)
+{
+}
+
+LIDARDeviceManager::~LIDARDeviceManager()
+{
+    removeAll();
+}
+
+size_t LIDARDeviceManager::addDevice(const std::string& port, const Extrinsics& extrinsics)
+{
+    std::unique_ptr<Device> device = std::make_unique<Device>();
+    device->grabber = std::make_unique<LIDARFrameGrabber>(port);
+    device->extrinsics = extrinsics;
+    extrinsics.toMatrix(device->matrix);
+
+    device->grabber->start();
+    m_devices.push_back(std::move(device));
+    m_dirty = true;
+
+    return m_devices.size() - 1;
+}
+
+void LIDARDeviceManager::removeDevice(size_t index)
+{
+    if(index >= m_devices.size())
+        return;
+
+    m_devices[index]->grabber->stop();
+    m_devices.erase(m_devices.begin() + index);
+    m_dirty = true;
+}
+
+void LIDARDeviceManager::removeAll()
+{
+    while(!m_devices.empty())
+        removeDevice(m_devices.size() - 1);
+}
+
+size_t LIDARDeviceManager::getDeviceCount() const
+{
+    return m_devices.size();
+}
+
+LIDARFrameGrabber* LIDARDeviceManager::getGrabber(size_t index)
+{
+    return index < m_devices.size() ? m_devices[index]->grabber.get() : nullptr;
+}
+
+bool LIDARDeviceManager::hasPort(const std::string& port) const
+{
+    for(const std::unique_ptr<Device>& device : m_devices)
+    {
+        if(device->grabber->getPort() == port)
+            return true;
+    }
+
+    return false;
+}
+
+void LIDARDeviceManager::setExtrinsics(size_t index, const Extrinsics& extrinsics)
+{
+    Device& device = *m_devices[index];
+    device.extrinsics = extrinsics;
+    extrinsics.toMatrix(device.matrix);
+    m_dirty = true;
+}
+
+const LIDARDeviceManager::Extrinsics& LIDARDeviceManager::getExtrinsics(size_t index) const
+{
+    return m_devices[index]->extrinsics;
+}
+
+void LIDARDeviceManager::setMaxSkew(uint64_t micros)
+{
+    m_maxSkew = micros;
+    m_dirty = true;
+}
+
+uint64_t LIDARDeviceManager::getMaxSkew() const
+{
+    return m_maxSkew;
+}
+
+void LIDARDeviceManager::setMotionModel(std::shared_ptr<em::MotionModel> model)
+{
+    m_motion = std::move(model);
+    m_dirty = true;
+}
+
+const std::shared_ptr<em::MotionModel>& LIDARDeviceManager::getMotionModel() const
+{
+    return m_motion;
+}
+
+void LIDARDeviceManager::setSmoothing(size_t index, bool enabled, const em::TemporalFilter::Config& config)
+{
+    Device& device = *m_devices[index];
+
+    if(!enabled)
+        device.smoothing.reset();
+    else if(!device.smoothing)
+        device.smoothing = std::make_unique<em::TemporalFilter>(config);
+    else
+        device.smoothing->configure(config);
+
+    m_dirty = true;
+}
+
+const em::TemporalFilter* LIDARDeviceManager::getSmoothing(size_t index) const
+{
+    return m_devices[index]->smoothing.get();
+}
+
+void LIDARDeviceManager::setRecordingEncoding(size_t index, em::ScanEncoding encoding)
+{
+    m_devices[index]->recordingEncoding = encoding;
+}
+
+em::ScanEncoding LIDARDeviceManager::getRecordingEncoding(size_t index) const
+{
+    return m_devices[index]->recordingEncoding;
+}
+
+uint64_t LIDARDeviceManager::getStaleCount(size_t index) const
+{
+    return m_devices[index]->staleCount;
+}
+
+const LIDARDeviceManager::FusedFrame& LIDARDeviceManager::getFusedFrame() const
+{
+    return m_fused;
+}
+
+const LIDARDeviceManager::FusedFrame& LIDARDeviceManager::fuse()
+{
+    bool changed = m_dirty;
+    uint64_t newest = 0;
+    size_t total = 0;
+
+    for(const std::unique_ptr<Device>& device : m_devices)
+    {
+        device->frame = &device->grabber->latestFrame();
+
+        // The smoothed view stands in for the scan, folding in each
+        // revolution once
+        if(device->smoothing)
+        {
+            if(device->frame->getSequence() && device->frame->getSequence() != device->smoothing->getSequence())
+                device->smoothing->update(*device->frame);
+
+            device->frame = &device->smoothing->getFrame();
+        }
+
+        const LIDARFrameGrabber::Frame& frame = *device->frame;
+
+        if(frame.getSequence() != device->fusedSequence)
+            changed = true;
+
+        if(frame.getSequence())
+            newest = std::max(newest, frame.getTimestamp());
+
+        total += frame.size();
+    }
+
+    if(!changed)
+        return m_fused;
+
+    reserve(total);
+
+    m_fused.sources.clear();
+    m_fused.size = 0;
+    m_fused.radius = 0.0f;
+    m_fused.timestamp = newest;
+
+    for(size_t i = 0; i < m_devices.size(); i++)
+    {
+        Device& device = *m_devices[i];
+
+        const LIDARFrameGrabber::Frame& frame = *device.frame;
+
+        if(!frame.getSequence())
+            continue;
+
+        if(newest - frame.getTimestamp() > m_maxSkew)
+        {
+            if(frame.getSequence() != device.fusedSequence)
+                device.staleCount++;
+
+            device.fusedSequence = frame.getSequence();
+            continue;
+        }
+
+        // Each scan is converted straight from the grabber's buffer into the
+        // fused arrays, already in rig coordinates
+        size_t first = m_fused.size;
+        em::PolarToCartesian::convert(frame, m_fused.x.data() + first, m_fused.y.data() + first, m_fused.z.data() + first, 1.0f, device.matrix);
+
+        if(m_motion)
+            m_deskew.apply(frame, *m_motion, m_fused.x.data() + first, m_fused.y.data() + first, newest);
+
+        std::fill(m_fused.device.begin() + first, m_fused.device.begin() + first + frame.size(), (uint8_t) i);
+
+        FusedSource source;
+        source.device = i;
+        source.first = first;
+        source.count = frame.size();
+        source.sequence = frame.getSequence();
+        source.timestamp = frame.getTimestamp();
+        m_fused.sources.push_back(source);
+        m_fused.size += frame.size();
+
+        if(!frame.empty())
+        {
+            float offset = sqrtf(device.matrix[12] * device.matrix[12] + device.matrix[13] * device.matrix[13] + device.matrix[14] * device.matrix[14]);
+            m_fused.radius = std::max(m_fused.radius, frame.distance(frame.longestIndex()) + offset);
+        }
+
+        device.fusedSequence = frame.getSequence();
+    }
+
+    m_fused.revision++;
+    m_dirty = false;
+
+    return m_fused;
+}
+
+void LIDARDeviceManager::framePresented()
+{
+    uint64_t now = em::monotonicMicros();
+
+    for(const std::unique_ptr<Device>& device : m_devices)
+        device->grabber->getTelemetry().scanPresented(now);
+}
+
+void LIDARDeviceManager::resetTelemetry()
+{
+    for(const std::unique_ptr<Device>& device : m_devices)
+        device->grabber->getTelemetry().reset();
+}
+
+bool LIDARDeviceManager::dumpTelemetry(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+
+    if(!file)
+        return false;
+
+    fprintf(file, "{\"timestamp\": %llu, \"devices\": [", (unsigned long long) em::monotonicMicros());
+
+    for(size_t i = 0; i < m_devices.size(); i++)
+    {
+        fprintf(file, i ? ",\n  " : "\n  ");
+        m_devices[i]->grabber->getTelemetry().writeJSON(file, m_devices[i]->grabber->getPort().c_str());
+    }
+
+    fprintf(file, "\n]}\n");
+
+    return fclose(file) == 0;
+}
+
+void LIDARDeviceManager::reserve(size_t size)
+{
+    if(size <= m_fused.x.size())
+        return;
+
+    m_fused.x.resize(size);
+    m_fused.y.resize(size);
+    m_fused.z.resize(size);
+    m_fused.device.resize(size);
+}
+
+// Lua lidar library functions
+
+int LIDARDeviceManager::lua_openLidarLib(lua_State* L)
+{
+    static const luaL_Reg lidarLib[] =
+    {
+        {"getDeviceCount", lua_getDeviceCount},
+        {"getPort", lua_getPort},
+        {"getLatency", lua_getLatency},
+        {"getCounters", lua_getCounters},
+        {"dumpTelemetry", lua_dumpTelemetry},
+        {"resetTelemetry", lua_resetTelemetry},
+        {"getRange", lua_getRange},
+        {"getRanges", lua_getRanges},
+        {"setGrid", lua_setGrid},
+        {"setFilter", lua_setFilter},
+        {"getFilterStats", lua_getFilterStats},
+        {"setSmoothing", lua_setSmoothing},
+        {nullptr, nullptr}
+    };
+
+    luaL_newlibtable(L, lidarLib);
+    lua_pushlightuserdata(L, this);
+    luaL_setfuncs(L, lidarLib, 1);
+    lua_setglobal(L, "lidar");
+
+    return 0;
+}
+
+LIDARDeviceManager* LIDARDeviceManager::lua_getManager(lua_State* L)
+{
+    return static_cast<LIDARDeviceManager*>(lua_touserdata(L, lua_upvalueindex(1)));
+}
+
+LIDARFrameGrabber* LIDARDeviceManager::lua_getGrabber(lua_State* L, int index)
+{
+    // Devices are numbered from 1 on the Lua side
+    lua_Integer device = luaL_checkinteger(L, index);
+    LIDARFrameGrabber* grabber = device > 0 ? lua_getManager(L)->getGrabber((size_t) device - 1) : nullptr;
+
+    if(!grabber)
+        luaL_error(L, "No LIDAR device %d", (int) device);
+
+    return grabber;
+}
+
+int LIDARDeviceManager::lua_getDeviceCount(lua_State* L)
+{
+    lua_pushinteger(L, (lua_Integer) lua_getManager(L)->getDeviceCount());
+    return 1;
+}
+
+int LIDARDeviceManager::lua_getPort(lua_State* L)
+{
+    lua_pushstring(L, lua_getGrabber(L, 1)->getPort().c_str());
+    return 1;
+}
+
+int LIDARDeviceManager::lua_getLatency(lua_State* L)
+{
+    LIDARFrameGrabber* grabber = lua_getGrabber(L, 1);
+    const char* name = luaL_optstring(L, 2, "scanToPhoton");
+
+    int interval = 0;
+    while(interval < em::ScanTelemetry::INTERVAL_COUNT && strcmp(name, em::ScanTelemetry::getIntervalName((em::ScanTelemetry::Interval) interval)))
+        interval++;
+
+    if(interval == em::ScanTelemetry::INTERVAL_COUNT)
+        return luaL_error(L, "Unknown latency interval %s", name);
+
+    const em::LatencyHistogram& histogram = grabber->getTelemetry().getHistogram((em::ScanTelemetry::Interval) interval);
+
+    // Milliseconds, like the rest of the UI
+    lua_newtable(L);
+    lua_pushinteger(L, (lua_Integer) histogram.getCount());
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, histogram.getMin() / 1000.0);
+    lua_setfield(L, -2, "min");
+    lua_pushnumber(L, histogram.getMean() / 1000.0);
+    lua_setfield(L, -2, "mean");
+    lua_pushnumber(L, histogram.getPercentile(50.0) / 1000.0);
+    lua_setfield(L, -2, "p50");
+    lua_pushnumber(L, histogram.getPercentile(90.0) / 1000.0);
+    lua_setfield(L, -2, "p90");
+    lua_pushnumber(L, histogram.getPercentile(99.0) / 1000.0);
+    lua_setfield(L, -2, "p99");
+    lua_pushnumber(L, histogram.getMax() / 1000.0);
+    lua_setfield(L, -2, "max");
+
+    return 1;
+}
+
+int LIDARDeviceManager::lua_getCounters(lua_State* L)
+{
+    const em::ScanTelemetry& telemetry = lua_getGrabber(L, 1)->getTelemetry();
+
+    lua_newtable(L);
+    lua_pushinteger(L, (lua_Integer) telemetry.getPublished());
+    lua_setfield(L, -2, "published");
+    lua_pushinteger(L, (lua_Integer) telemetry.getConsumed());
+    lua_setfield(L, -2, "consumed");
+    lua_pushinteger(L, (lua_Integer) telemetry.getPresented());
+    lua_setfield(L, -2, "presented");
+    lua_pushinteger(L, (lua_Integer) telemetry.getDropped());
+    lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, (lua_Integer) telemetry.getLate());
+    lua_setfield(L, -2, "late");
+
+    return 1;
+}
+
+int LIDARDeviceManager::lua_dumpTelemetry(lua_State* L)
+{
+    const char* path = luaL_checkstring(L, 1);
+    lua_pushboolean(L, lua_getManager(L)->dumpTelemetry(path));
+    return 1;
+}
+
+int LIDARDeviceManager::lua_resetTelemetry(lua_State* L)
+{
+    lua_getManager(L)->resetTelemetry();
+    return 0;
+}
+
+int LIDARDeviceManager::lua_getRange(lua_State* L)
+{
+    LIDARFrameGrabber* grabber = lua_getGrabber(L, 1);
+    float degrees = (float) luaL_checknumber(L, 2);
+
+    lua_pushnumber(L, grabber->getScanGrid().range(degrees));
+    return 1;
+}
+
+int LIDARDeviceManager::lua_getRanges(lua_State* L)
+{
+    const em::ScanGrid& grid = lua_getGrabber(L, 1)->getScanGrid();
+
+    lua_createtable(L, (int) grid.size(), 1);
+
+    for(size_t i = 0; i < grid.size(); i++)
+    {
+        lua_pushnumber(L, grid.rangeAt(i));
+        lua_rawseti(L, -2, (lua_Integer) i + 1);
+    }
+
+    lua_pushnumber(L, grid.getResolution());
+    lua_setfield(L, -2, "resolution");
+
+    return 1;
+}
+
+int LIDARDeviceManager::lua_setGrid(lua_State* L)
+{
+    LIDARFrameGrabber* grabber = lua_getGrabber(L, 1);
+    float resolution = (float) luaL_checknumber(L, 2);
+    const char* name = luaL_optstring(L, 3, "min");
+
+    int reduction = em::ScanGrid::MIN;
+    while(reduction <= em::ScanGrid::MEAN && strcmp(name, em::ScanGrid::getReductionName((em::ScanGrid::Reduction) reduction)))
+        reduction++;
+
+    if(reduction > em::ScanGrid::MEAN)
+        return luaL_error(L, "Unknown grid reduction %s", name);
+
+    if(resolution <= 0.0f)
+        return luaL_error(L, "Grid resolution must be positive");
+
+    grabber->setScanGrid(resolution, (em::ScanGrid::Reduction) reduction);
+    return 0;
+}
+
+int LIDARDeviceManager::lua_setFilter(lua_State* L)
+{
+    LIDARFrameGrabber* grabber = lua_getGrabber(L, 1);
+    const char* name = luaL_checkstring(L, 2);
+
+    int stage = 0;
+    while(stage < em::ScanFilter::STAGE_COUNT && strcmp(name, em::ScanFilter::getStageName((em::ScanFilter::Stage) stage)))
+        stage++;
+
+    if(stage == em::ScanFilter::STAGE_COUNT)
+        return luaL_error(L, "Unknown filter stage %s", name);
+
+    em::ScanFilter::Config config = grabber->getFilterConfig();
+    config.enabled[stage] = lua_isnone(L, 3) || lua_toboolean(L, 3);
+
+    // Each stage's parameters follow, anything left out stays as it was
+    switch(stage)
+    {
+    case em::ScanFilter::RANGE:
+        config.minRange = (float) luaL_optnumber(L, 4, config.minRange);
+        config.maxRange = (float) luaL_optnumber(L, 5, config.maxRange);
+        break;
+    case em::ScanFilter::QUALITY:
+        config.minQuality = (uint8_t) std::min<lua_Integer>(std::max<lua_Integer>(luaL_optinteger(L, 4, config.minQuality), 0), 255);
+        break;
+    case em::ScanFilter::SHADOW:
+        config.shadowAngle = (float) luaL_optnumber(L, 4, config.shadowAngle);
+        config.neighbors = (int) luaL_optinteger(L, 5, config.neighbors);
+        break;
+    case em::ScanFilter::MIXED_PIXEL:
+        config.mixedPixelJump = (float) luaL_optnumber(L, 4, config.mixedPixelJump);
+        break;
+    case em::ScanFilter::ISOLATED:
+        config.isolatedDistance = (float) luaL_optnumber(L, 4, config.isolatedDistance);
+        config.neighbors = (int) luaL_optinteger(L, 5, config.neighbors);
+        break;
+    case em::ScanFilter::MEDIAN:
+        config.medianWindow = (int) luaL_optinteger(L, 4, config.medianWindow);
+
+        if(config.medianWindow != 3 && config.medianWindow != 5)
+            return luaL_error(L, "Median window must be 3 or 5");
+        break;
+    }
+
+    grabber->setFilterConfig(config);
+    return 0;
+}
+
+int LIDARDeviceManager::lua_getFilterStats(lua_State* L)
+{
+    LIDARFrameGrabber* grabber = lua_getGrabber(L, 1);
+    const em::ScanFilter& filter = grabber->getFilter();
+    em::ScanFilter::Config config = grabber->getFilterConfig();
+
+    lua_createtable(L, 0, em::ScanFilter::STAGE_COUNT + 1);
+    lua_pushinteger(L, (lua_Integer) filter.getRuns());
+    lua_setfield(L, -2, "runs");
+
+    for(int i = 0; i < em::ScanFilter::STAGE_COUNT; i++)
+    {
+        em::ScanFilter::Stage stage = (em::ScanFilter::Stage) i;
+
+        lua_createtable(L, 0, 4);
+        lua_pushboolean(L, config.enabled[i]);
+        lua_setfield(L, -2, "enabled");
+        lua_pushnumber(L, filter.getMeanMicros(stage));
+        lua_setfield(L, -2, "micros");
+        lua_pushinteger(L, (lua_Integer) filter.getRejected(stage));
+        lua_setfield(L, -2, "rejected");
+        lua_pushinteger(L, (lua_Integer) filter.getLastRejected(stage));
+        lua_setfield(L, -2, "lastRejected");
+        lua_setfield(L, -2, em::ScanFilter::getStageName(stage));
+    }
+
+    return 1;
+}
+
+int LIDARDeviceManager::lua_setSmoothing(lua_State* L)
+{
+    LIDARDeviceManager* manager = lua_getManager(L);
+    lua_getGrabber(L, 1);
+    size_t index = (size_t) luaL_checkinteger(L, 1) - 1;
+
+    // false or nil turns it off
+    if(!lua_toboolean(L, 2))
+    {
+        manager->setSmoothing(index, false);
+        return 0;
+    }
+
+    const char* name = luaL_checkstring(L, 2);
+    const em::TemporalFilter* current = manager->getSmoothing(index);
+    em::TemporalFilter::Config config = current ? current->getConfig() : em::TemporalFilter::Config();
+
+    if(!strcmp(name, em::TemporalFilter::getModeName(em::TemporalFilter::EMA)))
+    {
+        config.mode = em::TemporalFilter::EMA;
+        config.alpha = (float) luaL_optnumber(L, 3, config.alpha);
+
+        if(config.alpha <= 0.0f || config.alpha > 1.0f)
+            return luaL_error(L, "Smoothing weight must be in (0, 1]");
+    }
+    else if(!strcmp(name, em::TemporalFilter::getModeName(em::TemporalFilter::MEDIAN)))
+    {
+        config.mode = em::TemporalFilter::MEDIAN;
+        config.window = (int) luaL_optinteger(L, 3, config.window);
+
+        if(config.window != 3 && config.window != 5)
+            return luaL_error(L, "Median window must be 3 or 5");
+    }
+    else
+        return luaL_error(L, "Unknown smoothing mode %s", name);
+
+    config.resolution = (float) luaL_optnumber(L, 4, config.resolution);
+    config.resetDistance = (float) luaL_optnumber(L, 5, config.resetDistance);
+
+    if(config.resolution <= 0.0f)
+        return luaL_error(L, "Smoothing resolution must be positive");
+
+    manager->setSmoothing(index, true, config);
+    return 0;
+}
@@ -1,94 +1,83 @@
 #include "LIDARFrameGrabber.hpp"
 
-#if defined(__linux__) || defined(__APPLE__)
-#include <dirent.h>
-#include <fcntl.h>
-#include <unistd.h>
-#elif defined(_WIN32)
-#include <windows.h>
-#endif
+#include "lidar/SimulatedScanDevice.hpp"
+#include "lidar/DeviceDiscovery.hpp"
+#include "lidar/Clock.hpp"
 
 #include <string>
 #include <vector>
 #include "Logger.hpp"
 #include <cstring>
-#include <GLFW/glfw3.h>
 #include <algorithm>
+#include <chrono>
 
 
 em::Logger logger("LIDARFrameGrabber");
 
+typedef std::chrono::steady_clock Clock;
+
 std::vector<std::string> LIDARFrameGrabber::getAvailableDevices()
 {
-    std::vector<std::string> devices;
-
-#ifdef __linux__
-    DIR *dir;
-    struct dirent *ent;
-    if ((dir = opendir("/dev")) != nullptr)
-    {
-        while ((ent = readdir(dir)) != nullptr)
-        {
-            std::string deviceName = ent->d_name;
-            if (deviceName.substr(0, 3) == "tty")
-            {
-                std::string fullPath = "/dev/" + deviceName;
-                int fd = open(fullPath.c_str(), O_RDWR | O_NOCTTY);
-                if (fd != -1) // if open is successful
-                {
-                    devices.push_back(fullPath);
-                    close(fd); // don't forget to close the file descriptor
-                }
-            }
-        }
-        closedir(dir);
-    }
-#elif __APPLE__
-    DIR *dir;
-    struct dirent *ent;
-    if ((dir = opendir("/dev")) != nullptr)
-    {
-        while ((ent = readdir(dir)) != nullptr)
-        {
-            std::string deviceName = ent->d_name;
-            if (deviceName.substr(0, 3) == "cu." || deviceName.substr(0, 4) == "tty.")
-            {
-                devices.push_back("/dev/" + deviceName);
-            }
-        }
-
-        closedir(dir);
-    }
-#elif defined(_WIN32)
-    // Get the available COM ports
-    for (int i = 1; i <= 256; i++)
-    {
-        std::string portName = "COM" + std::to_string(i);
-        HANDLE hComm = CreateFileA(portName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
-        if (hComm != INVALID_HANDLE_VALUE)
-        {
-            devices.push_back(portName);
-            CloseHandle(hComm);
-        }
-    }
-#endif
+    std::vector<std::string> devices = em::DeviceDiscovery().scan();
+    devices.push_back(em::SimulatedScanDevice::DEFAULT_PORT);
 
     return devices;
 }
 
+LIDARFrameGrabber::ReconnectPolicy::ReconnectPolicy() :
+    commandTimeout(1000),
+    scanTimeout(em::ScanDevice::DEFAULT_TIMEOUT),
+    maxStalls(3),
+    maxRestarts(2),
+    initialBackoff(250),
+    maxBackoff(8000)
+{
+}
+
 LIDARFrameGrabber::LIDARFrameGrabber(std::string port) :
     m_port(port),
-    m_message("Idle"),
     m_status(IDLE),
+    m_state(DISCONNECTED),
+    m_message("Idle"),
+    m_fps(0.0f),
+    m_revolutionTime(0.0f),
+    m_revolutionsPerSecond(0.0f),
+    m_revolutions(0),
+    m_scanRestarts(0),
+    m_scanMode(STREAMING),
+    m_reconnects(0),
+    m_failedAttempts(0),
+    m_device(em::ScanDevice::create(port)),
+    m_scanNodes(8192),
+    m_framePool(em::ScanFrame::getStorageSize(8192), 3, true),
+    m_sequence(0),
+    m_lastCompleted(0),
+    m_liveSectors(false),
+    m_filterChanged(false),
+    m_nodesSequence(0),
     m_shouldStop(false)
 {
 }
 
+LIDARFrameGrabber::~LIDARFrameGrabber()
+{
+    // A still running acquisition thread would otherwise terminate the process
+    stop();
+}
+
 void LIDARFrameGrabber::start()
 {
-    m_status = PENDING;
-    m_message = "Starting";
-    m_nodes.reserve(8192);
+    setState(CONNECTING, "Starting");
+
+    // Size every slot up front so that publishing a scan never allocates
+    for(int i = 0; i < 3; i++)
+    {
+        if(!m_frames.slot(i).reserve(8192, m_framePool))
+            m_frames.slot(i).reserve(8192);
+    }
+
+    m_liveSectors = m_device->setNodeListener(onNodes, this);
+
     m_thread = std::thread(workerThread, this);
 }
 
@@ -99,7 +88,11 @@ void LIDARFrameGrabber::stop()
     if (m_thread.joinable())
         m_thread.join();
 
-    m_status = IDLE;
+    m_recorder.close();
+    m_server.stop();
+    m_shared.close();
+
+    setState(DISCONNECTED, "Idle");
 }
 
 const std::string& LIDARFrameGrabber::getPort() const
@@ -112,23 +105,27 @@ LIDARFrameGrabber::Status LIDARFrameGrabber::getStatus() const
     return m_status;
 }
 
-const std::string& LIDARFrameGrabber::getStatusMessage() const
+std::string LIDARFrameGrabber::getStatusMessage() const
 {
+    std::lock_guard<std::mutex> lock(m_messageMutex);
     return m_message;
 }
 
-const std::string& LIDARFrameGrabber::getSerialNumber() const
+std::string LIDARFrameGrabber::getSerialNumber() const
 {
+    std::lock_guard<std::mutex> lock(m_messageMutex);
     return m_serialNumber;
 }
 
-const std::string& LIDARFrameGrabber::getFirmwareVersion() const
+std::string LIDARFrameGrabber::getFirmwareVersion() const
 {
+    std::lock_guard<std::mutex> lock(m_messageMutex);
     return m_firmwareVersion;
 }
 
-const std::string& LIDARFrameGrabber::getHardwareVersion() const
+std::string LIDARFrameGrabber::getHardwareVersion() const
 {
+    std::lock_guard<std::mutex> lock(m_messageMutex);
     return m_hardwareVersion;
 }
 
@@ -142,156 +139,547 @@ float LIDARFrameGrabber::getFPS() const
     return m_fps;
 }
 
+float LIDARFrameGrabber::getRevolutionTime() const
+{
+    return m_revolutionTime;
+}
+
+float LIDARFrameGrabber::getRevolutionsPerSecond() const
+{
+    return m_revolutionsPerSecond;
+}
+
+uint64_t LIDARFrameGrabber::getRevolutionCount() const
+{
+    return m_revolutions;
+}
+
+uint32_t LIDARFrameGrabber::getScanRestarts() const
+{
+    return m_scanRestarts;
+}
+
+void LIDARFrameGrabber::setScanMode(ScanMode mode)
+{
+    m_scanMode = mode;
+}
+
+LIDARFrameGrabber::ScanMode LIDARFrameGrabber::getScanMode() const
+{
+    return m_scanMode;
+}
+
+void LIDARFrameGrabber::setReconnectPolicy(const ReconnectPolicy& policy)
+{
+    m_policy = policy;
+}
+
+const LIDARFrameGrabber::ReconnectPolicy& LIDARFrameGrabber::getReconnectPolicy() const
+{
+    return m_policy;
+}
+
+LIDARFrameGrabber::ConnectionState LIDARFrameGrabber::getConnectionState() const
+{
+    return m_state;
+}
+
+uint32_t LIDARFrameGrabber::getReconnects() const
+{
+    return m_reconnects;
+}
+
+uint32_t LIDARFrameGrabber::getFailedAttempts() const
+{
+    return m_failedAttempts;
+}
+
+const char* LIDARFrameGrabber::getConnectionStateName(ConnectionState state)
+{
+    switch(state)
+    {
+    case DISCONNECTED: return "disconnected";
+    case CONNECTING: return "connecting";
+    case IDENTIFYING: return "identifying";
+    case CHECKING_HEALTH: return "checking health";
+    case STARTING_SCAN: return "starting scan";
+    case SCANNING: return "scanning";
+    case BACKING_OFF: return "backing off";
+    }
+
+    return "unknown";
+}
+
+void LIDARFrameGrabber::setState(ConnectionState state, const std::string& message)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_messageMutex);
+        m_message = message;
+    }
+
+    switch(state)
+    {
+    case DISCONNECTED: m_status = IDLE; break;
+    case SCANNING: m_status = OK; break;
+    case BACKING_OFF: m_status = ERROR; break;
+    default: m_status = PENDING; break;
+    }
+
+    m_state = state;
+}
+
+const LIDARFrameGrabber::Frame& LIDARFrameGrabber::latestFrame()
+{
+    if(m_frames.update())
+        m_telemetry.scanConsumed(m_frames.front(), em::monotonicMicros());
+
+    return m_frames.front();
+}
+
+em::ScanTelemetry& LIDARFrameGrabber::getTelemetry()
+{
+    return m_telemetry;
+}
+
+em::SectorStream& LIDARFrameGrabber::getSectorStream()
+{
+    return m_sectors;
+}
+
+bool LIDARFrameGrabber::hasLiveSectors() const
+{
+    return m_liveSectors;
+}
+
 const std::vector<LIDARFrameGrabber::Node>& LIDARFrameGrabber::getNodes() const
 {
+    const Frame& frame = m_frames.front();
+
+    if(m_nodesSequence != frame.getSequence() || m_nodes.size() != frame.size())
+    {
+        const float* angles = frame.degrees();
+        const float* distances = frame.millimeters();
+
+        m_nodes.resize(frame.size());
+
+        for(size_t i = 0; i < frame.size(); i++)
+        {
+            m_nodes[i].angle = angles[i];
+            m_nodes[i].distance = distances[i];
+        }
+
+        m_nodesSequence = frame.getSequence();
+    }
+
     return m_nodes;
 }
 
-const LIDARFrameGrabber::Node& LIDARFrameGrabber::longestNode() const
+LIDARFrameGrabber::Node LIDARFrameGrabber::longestNode() const
+{
+    const Frame& frame = m_frames.front();
+    Node node;
+
+    if(!frame.empty())
+    {
+        node.angle = frame.angle(frame.longestIndex());
+        node.distance = frame.distance(frame.longestIndex());
+    }
+
+    return node;
+}
+
+const em::ScanGrid& LIDARFrameGrabber::getScanGrid() const
+{
+    const Frame& frame = m_frames.front();
+
+    if(m_grid.getSequence() != frame.getSequence())
+        m_grid.build(frame);
+
+    return m_grid;
+}
+
+void LIDARFrameGrabber::setScanGrid(float resolution, em::ScanGrid::Reduction reduction)
+{
+    m_grid.configure(resolution, reduction);
+}
+
+void LIDARFrameGrabber::setFilterConfig(const em::ScanFilter::Config& config)
+{
+    std::lock_guard<std::mutex> lock(m_filterMutex);
+    m_filterConfig = config;
+    m_filterChanged = true;
+}
+
+em::ScanFilter::Config LIDARFrameGrabber::getFilterConfig() const
+{
+    std::lock_guard<std::mutex> lock(m_filterMutex);
+    return m_filterConfig;
+}
+
+const em::ScanFilter& LIDARFrameGrabber::getFilter() const
+{
+    return m_filter;
+}
+
+em::ScanDevice* LIDARFrameGrabber::getDevice()
+{
+    return m_device.get();
+}
+
+bool LIDARFrameGrabber::startRecording(const std::string& path, em::ScanEncoding encoding)
+{
+    if(!isConnected())
+        return false;
+
+    return m_recorder.open(path, getInfo(), encoding);
+}
+
+void LIDARFrameGrabber::stopRecording()
+{
+    m_recorder.close();
+}
+
+const em::ScanRecorder& LIDARFrameGrabber::getRecorder() const
+{
+    return m_recorder;
+}
+
+em::ScanServer& LIDARFrameGrabber::getServer()
+{
+    return m_server;
+}
+
+bool LIDARFrameGrabber::startSharing(const std::string& name)
+{
+    return m_shared.create(name);
+}
+
+void LIDARFrameGrabber::stopSharing()
+{
+    m_shared.close();
+}
+
+const em::SharedScanRing& LIDARFrameGrabber::getSharedRing() const
+{
+    return m_shared;
+}
+
+const em::FramePool& LIDARFrameGrabber::getFramePool() const
+{
+    return m_framePool;
+}
+
+em::ScanBus& LIDARFrameGrabber::getBus()
 {
-    return m_longestNode;
+    return m_bus;
 }
 
-LIDARFrameGrabber::LIDARHealth LIDARFrameGrabber::getHealth()
+LIDARFrameGrabber::LIDARHealth LIDARFrameGrabber::getHealth() const
 {
+    std::lock_guard<std::mutex> lock(m_messageMutex);
     return m_health;
 }
 
-LIDARFrameGrabber::LIDARInfo LIDARFrameGrabber::getInfo()
+LIDARFrameGrabber::LIDARInfo LIDARFrameGrabber::getInfo() const
 {
+    std::lock_guard<std::mutex> lock(m_messageMutex);
     return m_info;
 }
 
 void LIDARFrameGrabber::workerThread(LIDARFrameGrabber* grabber)
 {
-    sl_result result;
-    sl::ILidarDriver* driver = *sl::createLidarDriver();
-
-    grabber->m_channel = *sl::createSerialPortChannel(grabber->m_port.c_str(), 115200);
+    em::ScanDevice* device = grabber->m_device.get();
+    const ReconnectPolicy& policy = grabber->m_policy;
+    unsigned int backoff = policy.initialBackoff;
 
-    if(SL_IS_FAIL(driver->connect(grabber->m_channel)))
+    while(!grabber->m_shouldStop)
     {
-        grabber->m_status = ERROR;
-        grabber->m_message = "Failed to connect to serial port";
-        logger.errorf("Failed to connect to serail port: %s", grabber->m_port.c_str());
-        return;
+        std::string failure;
+
+        if(bringUp(*grabber, device, failure))
+        {
+            // Only comes back once stopped or once the device is gone
+            uint64_t revolutions = grabber->m_revolutions;
+            scanLoop(*grabber, device, failure);
+
+            if(grabber->m_revolutions != revolutions)
+                backoff = policy.initialBackoff;
+        }
+
+        device->stop();
+        device->disconnect();
+
+        if(grabber->m_shouldStop)
+            break;
+
+        grabber->m_failedAttempts++;
+
+        char message[256];
+        snprintf(message, sizeof(message), "%s, retrying in %.1f s", failure.c_str(), backoff / 1000.0f);
+        grabber->setState(BACKING_OFF, message);
+        logger.warnf("%s: %s", grabber->m_port.c_str(), message);
+
+        // Frames, telemetry and the recording carry on from where they were,
+        // the consumer just sees no new scans for a while
+        Clock::time_point retry = Clock::now() + std::chrono::milliseconds(backoff);
+
+        while(!grabber->m_shouldStop && Clock::now() < retry)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        backoff = std::min(backoff * 2, policy.maxBackoff);
     }
-    grabber->m_message = "Connected to serial port";
+}
 
-    result = driver->getDeviceInfo(grabber->m_info);
+bool LIDARFrameGrabber::bringUp(LIDARFrameGrabber& grabber, em::ScanDevice* device, std::string& failure)
+{
+    const ReconnectPolicy& policy = grabber.m_policy;
 
-    if(SL_IS_FAIL(result))
+    grabber.setState(CONNECTING, "Connecting to serial port");
+
+    if(SL_IS_FAIL(device->connect()))
     {
-        grabber->m_status = ERROR;
-        if(result == SL_RESULT_OPERATION_TIMEOUT)
-            grabber->m_message = "Operation timed out";
-        else
-            grabber->m_message = "Failed to get device info";
+        failure = "Failed to connect to serial port";
+        logger.errorf("Failed to connect to serial port: %s", grabber.m_port.c_str());
+        return false;
+    }
 
-        logger.errorf("Failed to get device info");
+    grabber.setState(IDENTIFYING, "Connected to serial port");
 
-        return;
-    }
-    grabber->m_message = "Device info received";
-    printLidarInfo(*grabber);
+    // Filled in locally and swapped in under the message lock, since other
+    // threads read them while a reconnect is going on
+    LIDARInfo info;
+    LIDARHealth health;
 
-    result = driver->getHealth(grabber->m_health);
+    sl_result result = device->getDeviceInfo(info, policy.commandTimeout);
 
-    if(SL_IS_OK(result))
+    if(SL_IS_FAIL(result))
     {
-        switch(grabber->m_health.status) {
-        case SL_LIDAR_STATUS_OK:
-            grabber->m_message = "Device health status is OK";
-            logger.infof("Health status is OK");
-            break;
-        case SL_LIDAR_STATUS_WARNING:
-            grabber->m_status = ERROR;
-            grabber->m_message = "Device health status is WARNING";
-            logger.warnf("Health status is WARNING");
-            break;
-        case SL_LIDAR_STATUS_ERROR:
-            grabber->m_status = ERROR;
-            grabber->m_message = "Device health status is ERROR";
-            logger.errorf("Health status is ERROR");
-            break;
-        }
+        failure = result == SL_RESULT_OPERATION_TIMEOUT ? "Operation timed out" : "Failed to get device info";
+        logger.errorf("Failed to get device info");
+        return false;
     }
-    else
+
+    printLidarInfo(grabber, info);
+    grabber.setState(CHECKING_HEALTH, "Device info received");
+
+    result = device->getHealth(health, policy.commandTimeout);
+
+    if(SL_IS_FAIL(result))
     {
-        grabber->m_status = ERROR;
-        grabber->m_message = "Failed to get device health";
+        failure = "Failed to get device health";
         logger.errorf("Failed to get device health");
+        return false;
     }
 
-    grabber->m_status = OK;
-    logger.infof("LIDAR frame grabber started");
+    {
+        std::lock_guard<std::mutex> lock(grabber.m_messageMutex);
+        grabber.m_health = health;
+    }
 
-    // driver->startScan(false, true);
-    while(!grabber->m_shouldStop)
+    switch(health.status)
     {
-        driver->startScan(false, true);
-        double time = glfwGetTime();
-        captureFrame(*grabber, driver);
-        grabber->m_fps = 1.0f / (glfwGetTime() - time);
-        grabber->m_lastFrameTime = time;
+    case SL_LIDAR_STATUS_OK:
+        logger.infof("Health status is OK");
+        break;
+    case SL_LIDAR_STATUS_WARNING:
+        // The device still scans, so carry on
+        logger.warnf("Health status is WARNING");
+        break;
+    case SL_LIDAR_STATUS_ERROR:
+        failure = "Device health status is ERROR";
+        logger.errorf("Health status is ERROR");
+        return false;
     }
 
-    driver->stop();
-    driver->disconnect();
+    return true;
+}
+
+void LIDARFrameGrabber::scanLoop(LIDARFrameGrabber& grabber, em::ScanDevice* device, std::string& failure)
+{
+    const ReconnectPolicy& policy = grabber.m_policy;
+    bool warning = grabber.getHealth().status == SL_LIDAR_STATUS_WARNING;
+    sl_result result;
+
+    int stalls = 0;
+    int restarts = 0;
+    bool scanning = false;
+
+    Clock::time_point lastRevolution = Clock::now();
+    Clock::time_point windowStart = lastRevolution;
+    uint32_t windowRevolutions = 0;
+
+    grabber.setState(STARTING_SCAN, "Starting scan");
+
+    while(!grabber.m_shouldStop)
+    {
+        // In streaming mode the scan is started once and only restarted
+        // after it stalls. The legacy mode re-issues it every revolution.
+        if(!scanning || grabber.m_scanMode == RESTART_PER_FRAME)
+        {
+            result = device->startScan();
+
+            if(SL_IS_FAIL(result) && result != SL_RESULT_ALREADY_DONE)
+            {
+                logger.errorf("Failed to start scan");
+
+                if(++restarts > policy.maxRestarts)
+                {
+                    failure = "Failed to start scan";
+                    return;
+                }
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+
+            scanning = true;
+
+            // The next revolution doesn't follow on from the last one
+            grabber.m_lastCompleted = 0;
+        }
+
+        Clock::time_point start = Clock::now();
+        result = captureFrame(grabber, device);
+        Clock::time_point end = Clock::now();
+
+        if(SL_IS_FAIL(result))
+        {
+            if(++stalls < policy.maxStalls)
+                continue;
+
+            if(++restarts > policy.maxRestarts)
+            {
+                failure = "Lost the device";
+                return;
+            }
+
+            logger.warnf("Scan stalled after %d failed revolutions, restarting it", stalls);
+            device->stop();
+            grabber.m_sectors.reset();
+            scanning = false;
+            stalls = 0;
+            grabber.m_scanRestarts++;
+            continue;
+        }
+
+        stalls = 0;
+        restarts = 0;
+
+        if(grabber.m_state != SCANNING)
+        {
+            // Revolutions carry over, so any from before mean this is a comeback
+            if(grabber.m_revolutions)
+                grabber.m_reconnects++;
+
+            grabber.setState(SCANNING, warning ? "Scanning, device health is WARNING" : "Scanning");
+            logger.infof("LIDAR frame grabber started");
+        }
+
+        grabber.m_fps = 1.0f / std::chrono::duration<float>(end - start).count();
+        grabber.m_revolutionTime = std::chrono::duration<float, std::milli>(end - lastRevolution).count();
+        grabber.m_revolutions++;
+        lastRevolution = end;
+
+        windowRevolutions++;
+        float windowSeconds = std::chrono::duration<float>(end - windowStart).count();
+
+        if(windowSeconds >= 1.0f)
+        {
+            grabber.m_revolutionsPerSecond = windowRevolutions / windowSeconds;
+            windowRevolutions = 0;
+            windowStart = end;
+        }
+    }
 }
 
-void LIDARFrameGrabber::printLidarInfo(LIDARFrameGrabber& grabber)
+void LIDARFrameGrabber::printLidarInfo(LIDARFrameGrabber& grabber, const LIDARInfo& info)
 {
     char serialnum[64] = {0};
     char buffer[16] = {0};
     for (int i = 0; i < 16; i++)
     {
-        snprintf(buffer, sizeof(buffer) - 1, "%02X", grabber.m_info.serialnum[i]);
+        snprintf(buffer, sizeof(buffer) - 1, "%02X", info.serialnum[i]);
         strncat(serialnum, buffer, sizeof(serialnum) - 1);
     }
 
-    grabber.m_serialNumber = serialnum;
+    std::string serialNumber = serialnum;
+
+    snprintf(buffer, sizeof(buffer) - 1, "%d.%d", info.firmware_version >> 8, info.firmware_version & 0xFF);
+    std::string firmwareVersion = buffer;
 
-    snprintf(buffer, sizeof(buffer) - 1, "%d.%d", grabber.m_info.firmware_version >> 8, grabber.m_info.firmware_version & 0xFF);
-    grabber.m_firmwareVersion = buffer;
+    snprintf(buffer, sizeof(buffer) - 1, "%d", info.hardware_version);
+    std::string hardwareVersion = buffer;
 
-    snprintf(buffer, sizeof(buffer) - 1, "%d", grabber.m_info.hardware_version);
-    grabber.m_hardwareVersion = buffer;
+    {
+        std::lock_guard<std::mutex> lock(grabber.m_messageMutex);
+        grabber.m_info = info;
+        grabber.m_serialNumber.swap(serialNumber);
+        grabber.m_firmwareVersion.swap(firmwareVersion);
+        grabber.m_hardwareVersion.swap(hardwareVersion);
+    }
 
     logger.infof("Device Info:");
     logger.infof("  Serial Number:");
     logger.infof("    %s", serialnum);
-    logger.infof("  firmware_version: %d.%d", grabber.m_info.firmware_version >> 8, grabber.m_info.firmware_version & 0xFF);
-    logger.infof("  hardware_version: %d", grabber.m_info.hardware_version);
+    logger.infof("  firmware_version: %d.%d", info.firmware_version >> 8, info.firmware_version & 0xFF);
+    logger.infof("  hardware_version: %d", info.hardware_version);
 }
 
-sl_result LIDARFrameGrabber::captureFrame(LIDARFrameGrabber& grabber, sl::ILidarDriver* driver)
+sl_result LIDARFrameGrabber::captureFrame(LIDARFrameGrabber& grabber, em::ScanDevice* device)
 {
     sl_result result;
     
-    sl_lidar_response_measurement_node_hq_t nodes[8192];
-    size_t count = 8192;
+    em::ScanNode* nodes = grabber.m_scanNodes.data();
+    size_t count = grabber.m_scanNodes.size();
 
-    result = driver->grabScanDataHq(nodes, count);
+    uint64_t requested = em::monotonicMicros();
+    result = device->grabScanDataHq(nodes, count, grabber.m_policy.scanTimeout);
 
-    if(SL_IS_OK(result) || result == SL_RESULT_OPERATION_TIMEOUT)
+    // A timeout with nothing in it would replace the last scan with an empty
+    // one while the device is gone
+    if(result == SL_RESULT_OPERATION_TIMEOUT && !count)
     {
-        driver->ascendScanData(nodes, count);
+        logger.errorf("Failed to capture frame");
+    }
+    else if(SL_IS_OK(result) || result == SL_RESULT_OPERATION_TIMEOUT)
+    {
+        uint64_t timestamp = em::monotonicMicros();
 
-        grabber.m_nodes.clear();
-        grabber.m_longestNode.angle = 0.0f;
-        grabber.m_longestNode.distance = 0.0f;
+        // Devices that can't tell when the revolution began buffer it while
+        // the previous one is handed out, so it began where that one ended
+        uint64_t firstByte = device->getScanStartTime();
 
-        for (size_t i = 0; i < count; i++)
-        {
-            Node node;
-            node.angle = nodes[i].angle_z_q14 * 90.0f / (1 << 14);
-            node.distance = nodes[i].dist_mm_q2 / 4.0f;
-            grabber.m_nodes.push_back(node);
+        if(!firstByte)
+            firstByte = grabber.m_lastCompleted ? grabber.m_lastCompleted : requested;
 
-            if(node.distance > grabber.m_longestNode.distance)
-                grabber.m_longestNode = node;
+        grabber.m_lastCompleted = timestamp;
+
+        device->ascendScanData(nodes, count);
+
+        Frame& frame = grabber.m_frames.back();
+        frame.assign(nodes, count);
+        frame.setSequence(++grabber.m_sequence);
+        frame.setFirstByteTime(firstByte);
+        frame.setTimestamp(timestamp);
+
+        if(grabber.m_filterChanged.exchange(false))
+        {
+            std::lock_guard<std::mutex> lock(grabber.m_filterMutex);
+            grabber.m_filter.configure(grabber.m_filterConfig);
         }
+
+        grabber.m_filter.apply(frame);
+        frame.setPublishTime(em::monotonicMicros());
+        grabber.m_telemetry.scanPublished(frame);
+        grabber.m_server.publish(frame);
+        grabber.m_shared.publish(frame);
+        grabber.m_bus.publish(frame);
+        grabber.m_frames.publish();
+
+        if(!grabber.m_liveSectors)
+            grabber.m_sectors.feedRevolution(nodes, count, firstByte, timestamp);
+
+        grabber.m_recorder.write(nodes, count, timestamp);
     }
     else
     {
@@ -299,4 +687,9 @@ sl_result LIDARFrameGrabber::captureFrame(LIDARFrameGrabber& grabber, sl::ILidar
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+void LIDARFrameGrabber::onNodes(const em::ScanNode* nodes, size_t count, uint64_t timestamp, void* user)
+{
+    static_cast<LIDARFrameGrabber*>(user)->m_sectors.feed(nodes, count, timestamp);
+}
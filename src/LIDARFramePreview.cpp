@@ -2,9 +2,16 @@
 
 #include "GLInclude.hpp"
 #include "Visualizer.hpp"
+#include "lidar/Clock.hpp"
+
+#include <algorithm>
 
 LIDARFramePreview::LIDARFramePreview(const std::string& name) :
     SceneObject(LIDAR_FRAME_PREVIEW, name),
+    m_levelOfDetail(true),
+    m_pointCount(0),
+    m_vertexCount(0),
+    m_buildMicros(0.0),
     var(0)
 {
     VertexFormat vtxFmt;
@@ -17,50 +24,163 @@ LIDARFramePreview::LIDARFramePreview(const std::string& name) :
     m_meshBuilder = std::make_unique<MeshBuilder>(vtxFmt);
 }
 
+namespace
+{
+    // Point colour per device, cycled when there are more devices
+    const float DEVICE_COLORS[][3] = {
+        {1.0f, 1.0f, 1.0f},
+        {0.3f, 0.8f, 1.0f},
+        {1.0f, 0.7f, 0.2f},
+        {0.5f, 1.0f, 0.4f},
+        {1.0f, 0.4f, 0.8f}
+    };
+
+    const size_t DEVICE_COLOR_COUNT = sizeof(DEVICE_COLORS) / sizeof(DEVICE_COLORS[0]);
+
+    const float POINT_SIZE = 3.0f;
+
+    // How many pixels the unit circle spans on screen, 0 if it's behind the camera
+    float unitCirclePixels(const glm::mat4& modelViewProjection)
+    {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+        glm::vec4 center = modelViewProjection * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        glm::vec4 right = modelViewProjection * glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+        glm::vec4 up = modelViewProjection * glm::vec4(0.0f, 1.0f, 0.0f, 1.0f);
+
+        if(center.w <= 0.0f || right.w <= 0.0f || up.w <= 0.0f)
+            return 0.0f;
+
+        glm::vec2 halfViewport(viewport[2] * 0.5f, viewport[3] * 0.5f);
+        glm::vec2 origin = glm::vec2(center) / center.w;
+
+        float x = glm::length((glm::vec2(right) / right.w - origin) * halfViewport);
+        float y = glm::length((glm::vec2(up) / up.w - origin) * halfViewport);
+
+        return std::max(x, y);
+    }
+}
+
 void LIDARFramePreview::draw(Shader& shader)
 {   
     m_meshBuilder->reset();
 
-    LIDARFrameGrabber* grabber =  VisualizerApp::getInstance().getLIDARFrameGrabber();
+    LIDARDeviceManager& devices = VisualizerApp::getInstance().getDeviceManager();
 
-    if(!grabber || !grabber->isConnected())
+    if(!devices.getDeviceCount())
         return;
 
-    const std::vector<LIDARFrameGrabber::Node>& nodes = grabber->getNodes();
-    LIDARFrameGrabber::Node longestNode = grabber->longestNode();
+    // The timeline's x, y and yaw tracks describe how the sensor moves. It was
+    // just updated, so its current time is now.
+    auto timeline = getDynamics().timelines.find("motion");
+
+    if(timeline != getDynamics().timelines.end())
+    {
+        if(!m_motion)
+            m_motion = std::make_shared<TimelineMotionModel>();
+
+        m_motion->setTimeline(&timeline->second);
+        m_motion->sync(monotonicMicros());
+
+        if(devices.getMotionModel() != m_motion)
+            devices.setMotionModel(m_motion);
+    }
+    else if(m_motion)
+    {
+        if(devices.getMotionModel() == m_motion)
+            devices.setMotionModel(nullptr);
+
+        m_motion.reset();
+    }
+
+    const LIDARDeviceManager::FusedFrame& fused = devices.fuse();
+
+    if(fused.sources.empty())
+        return;
+
+    uint64_t start = monotonicMicros();
+
+    // Points are normalized so the farthest one lands on the unit circle
+    float scale = fused.radius > 0.0f ? 1.0f / fused.radius : 0.0f;
+
+    // No sweep reaches past the unit circle, so its size on screen bounds
+    // how many points are worth drawing
+    float radius = unitCirclePixels(shader.getProjectionMatrix() * getTransform().getMatrix());
+    size_t budget = m_levelOfDetail && radius > 0.0f ? ScanDecimator::getBudget(radius, POINT_SIZE) : fused.size;
+
+    m_pointCount = 0;
+    m_vertexCount = 0;
 
     m_meshBuilder->index(1, 0);
     m_meshBuilder->vertex(NULL, 0.0f, 0.0f, 0.0f, 0.0, 0.0, 0.0f, 0.5f, 0.0f, 1.0f);
 
-    for(const LIDARFrameGrabber::Node& node : nodes)
+    for(const LIDARDeviceManager::FusedSource& source : fused.sources)
     {
-        if (node.distance < 5.0f)
-            continue;
+        const float* color = DEVICE_COLORS[source.device % DEVICE_COLOR_COUNT];
+        const LIDARDeviceManager::Extrinsics& origin = devices.getExtrinsics(source.device);
+
+        // Dropped measurements come back as zero distance, right on the
+        // device, and are left out
+        m_decimator.decimate(fused.x.data() + source.first, fused.y.data() + source.first, source.count, origin.x, origin.y, budget);
+        m_pointCount += source.count;
 
-        float x = node.distance * cos(glm::radians(node.angle));
-        float y = node.distance * sin(glm::radians(node.angle));
+        for(uint32_t kept : m_decimator.getKept())
+        {
+            size_t point = source.first + kept;
 
-        x = x / longestNode.distance;
-        y = y / longestNode.distance;
+            m_meshBuilder->index(1, 0);
+            m_meshBuilder->vertex(NULL, fused.x[point] * scale, fused.y[point] * scale, 0.0f, 0.0, 0.0, color[0], color[1], color[2], 1.0f);
+        }
 
-        m_meshBuilder->index(1, 0);
-        m_meshBuilder->vertex(NULL, x, y, 0.0f, 0.0, 0.0, 1.0f, 1.0f, 1.0f, 1.0f);
+        m_vertexCount += m_decimator.getKept().size();
     }
 
+    m_buildMicros += ((double) (monotonicMicros() - start) - m_buildMicros) * 0.05;
+
     shader.setModelViewMatrix(getTransform().getMatrix());
 
-    glLineWidth(2.0f);
-    shader.setColor(glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-    shader.use();
-    m_meshBuilder->drawElements(GL_LINE_STRIP);
+    // The outline only makes sense for a single sweep
+    if(fused.sources.size() == 1)
+    {
+        glLineWidth(2.0f);
+        shader.setColor(glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+        shader.use();
+        m_meshBuilder->drawElements(GL_LINE_STRIP);
+    }
 
-    glPointSize(3.0f);
+    glPointSize(POINT_SIZE);
     shader.setColor(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
     shader.use();
     shader.setVertexColorEnabled(true);
     m_meshBuilder->drawElements(GL_POINTS);
 }
 
+void LIDARFramePreview::setLevelOfDetail(bool enabled)
+{
+    m_levelOfDetail = enabled;
+}
+
+bool LIDARFramePreview::getLevelOfDetail() const
+{
+    return m_levelOfDetail;
+}
+
+size_t LIDARFramePreview::getPointCount() const
+{
+    return m_pointCount;
+}
+
+size_t LIDARFramePreview::getVertexCount() const
+{
+    return m_vertexCount;
+}
+
+double LIDARFramePreview::getBuildMicros() const
+{
+    return m_buildMicros;
+}
+
 void LIDARFramePreview::update(float dt)
 {
     // Update the LIDAR frame preview
@@ -4,6 +4,12 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 
+#include <ctime>
+#include <algorithm>
+
+#include <lidar/ReplayScanDevice.hpp>
+#include <lidar/SimulatedScanDevice.hpp>
+
 using namespace em;
 
 static VisualizerApp* instance = nullptr;
@@ -66,6 +72,9 @@ bool VisualizerApp::start(AppParams& options)
     // Setup callbacks
     glfwSetWindowSizeCallback(m_window, onWindowResize);
 
+    // Serial ports are found in the background while the window comes up
+    m_discovery.start();
+
     // Setup scene
     m_scene.init();
 
@@ -117,6 +126,10 @@ bool VisualizerApp::runLoop()
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
     glfwSwapBuffers(m_window);
+
+    // Swapping is as close to the photons as we can see from here
+    m_devices.framePresented();
+
     glfwPollEvents();
     m_shouldClose = glfwWindowShouldClose(m_window);
 
@@ -142,8 +155,8 @@ bool VisualizerApp::terminate()
 
     m_scene.destroy();
 
-    if(m_frameGrabber)
-        m_frameGrabber->stop();
+    m_devices.removeAll();
+    m_discovery.stop();
 
     glfwTerminate();
 
@@ -192,7 +205,12 @@ GLFWwindow* VisualizerApp::getWindowHandle()
 
 LIDARFrameGrabber* VisualizerApp::getLIDARFrameGrabber()
 {
-    return m_frameGrabber.get();
+    return m_devices.getGrabber(0);
+}
+
+LIDARDeviceManager& VisualizerApp::getDeviceManager()
+{
+    return m_devices;
 }
 
 VisualizerApp& VisualizerApp::getInstance()
@@ -202,19 +220,30 @@ VisualizerApp& VisualizerApp::getInstance()
 
 void VisualizerApp::genUI()
 {
-    static std::vector<std::string> devices = LIDARFrameGrabber::getAvailableDevices();
+    static std::vector<std::string> devices = { SimulatedScanDevice::DEFAULT_PORT };
+    static uint64_t devicesRevision = 0;
+    static int itemCurrentIdx = 0; // Here we store our selection data as an index.
+    static bool streamingScan = true;
+    static bool nativeDecoder = false;
+
+    // Pick up whatever the discovery thread found, keeping the selection
+    if(m_discovery.getRevision() != devicesRevision)
+    {
+        std::string selected = devices[itemCurrentIdx];
+
+        devicesRevision = m_discovery.getRevision();
+        devices = m_discovery.getDevices();
+        devices.push_back(SimulatedScanDevice::DEFAULT_PORT);
+
+        auto it = std::find(devices.begin(), devices.end(), selected);
+        itemCurrentIdx = it != devices.end() ? (int) (it - devices.begin()) : 0;
+    }
 
     ImGui::SetNextWindowSize(ImVec2(350, 0));
     
     ImGui::Begin("Visualizer");
     ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate);
 
-    if (m_frameGrabber && m_frameGrabber->getFPS())
-        ImGui::Text("LIDAR FPS: %.1f", m_frameGrabber->getFPS());
-
-    ImGui::Text("Serial Port: %s", m_frameGrabber ? m_frameGrabber->getPort().c_str() : "None");
-
-    static int itemCurrentIdx = 0; // Here we store our selection data as an index.
     const char* combo_preview_value = devices[itemCurrentIdx].c_str(); // Pass the preview value of our combo
     if (ImGui::BeginCombo("Select Port", combo_preview_value))
     {
@@ -231,39 +260,421 @@ void VisualizerApp::genUI()
         ImGui::EndCombo();
     }
 
-    bool promptToDisconnect = m_frameGrabber && m_frameGrabber->getStatus() != LIDARFrameGrabber::IDLE;
-    if(ImGui::Button(promptToDisconnect ? "Disconnect" : "Connect")) {
-        if(promptToDisconnect)
+    static char recordingPath[256] = "scan.rplr";
+    ImGui::InputText("##Recording", recordingPath, sizeof(recordingPath));
+    ImGui::SameLine();
+
+    if(ImGui::Button("Replay Recording"))
+    {
+        std::string port = std::string("replay://") + recordingPath;
+
+        if(!m_devices.hasPort(port))
+            m_devices.addDevice(port);
+    }
+
+    if(ImGui::Button("Connect")) {
+        std::string port = devices[itemCurrentIdx];
+
+        if(nativeDecoder && !SimulatedScanDevice::isSimulatorPort(port))
+            port = "native://" + port;
+
+        // Several simulators may run at once, a serial port only once
+        if(SimulatedScanDevice::isSimulatorPort(port) || !m_devices.hasPort(port))
+        {
+            size_t index = m_devices.addDevice(port);
+            m_devices.getGrabber(index)->setScanMode(streamingScan ? LIDARFrameGrabber::STREAMING : LIDARFrameGrabber::RESTART_PER_FRAME);
+        }
+    }
+
+    ImGui::SameLine();
+
+    if(ImGui::Button("Reload Devices")) {
+        m_discovery.refresh();
+    }
+
+    if(ImGui::Checkbox("Streaming Scan", &streamingScan))
+    {
+        for(size_t i = 0; i < m_devices.getDeviceCount(); i++)
+            m_devices.getGrabber(i)->setScanMode(streamingScan ? LIDARFrameGrabber::STREAMING : LIDARFrameGrabber::RESTART_PER_FRAME);
+    }
+
+    ImGui::SameLine();
+    ImGui::Checkbox("Native Decoder", &nativeDecoder);
+
+    if(m_devices.getDeviceCount() > 1)
+    {
+        const LIDARDeviceManager::FusedFrame& fused = m_devices.getFusedFrame();
+        ImGui::Text("Fused: %zu points from %zu/%zu devices", fused.size, fused.sources.size(), m_devices.getDeviceCount());
+    }
+
+    if(LIDARFramePreview* preview = m_scene.getLIDARPreview())
+    {
+        bool levelOfDetail = preview->getLevelOfDetail();
+
+        if(ImGui::Checkbox("Level of Detail", &levelOfDetail))
+            preview->setLevelOfDetail(levelOfDetail);
+
+        ImGui::SameLine();
+        ImGui::Text("%zu/%zu points, %.0f us", preview->getVertexCount(), preview->getPointCount(), preview->getBuildMicros());
+    }
+
+    if(m_devices.getDeviceCount())
+    {
+        if(ImGui::Button("Dump Telemetry"))
+        {
+            char path[64];
+            time_t now = time(nullptr);
+            strftime(path, sizeof(path), "telemetry-%Y%m%d-%H%M%S.json", localtime(&now));
+
+            if(!m_devices.dumpTelemetry(path))
+                m_logger.errorf("Failed to write telemetry to %s", path);
+        }
+
+        ImGui::SameLine();
+
+        if(ImGui::Button("Reset Telemetry"))
+            m_devices.resetTelemetry();
+
+        // A "motion" timeline on the preview takes over from the sliders
+        const std::shared_ptr<MotionModel>& motion = m_devices.getMotionModel();
+
+        if(motion && motion->getType() == MotionModel::TIMELINE)
+        {
+            ImGui::Text("Deskew: following the motion timeline");
+        }
+        else
+        {
+            static bool deskew = false;
+            static float velocity[3] = {0.0f, 0.0f, 0.0f};
+
+            bool changed = ImGui::Checkbox("Deskew", &deskew);
+
+            if(deskew)
+                changed |= ImGui::DragFloat3("mm/s, deg/s", velocity, 10.0f);
+
+            if(changed)
+                m_devices.setMotionModel(deskew ? std::make_shared<ConstantVelocityModel>(velocity[0], velocity[1], velocity[2]) : nullptr);
+        }
+    }
+
+    for(size_t i = 0; i < m_devices.getDeviceCount(); i++)
+    {
+        ImGui::PushID((int) i);
+        bool removed = genDeviceUI(i);
+        ImGui::PopID();
+
+        if(removed)
+            break;
+    }
+
+    ImGui::End();
+}
+
+bool VisualizerApp::genDeviceUI(size_t index)
+{
+    LIDARFrameGrabber* grabber = m_devices.getGrabber(index);
+
+    if(!ImGui::CollapsingHeader(grabber->getPort().c_str(), ImGuiTreeNodeFlags_DefaultOpen))
+        return false;
+
+    ImGui::Text("Status: %s", grabber->getStatusMessage().c_str());
+
+    if(grabber->getReconnects() || grabber->getFailedAttempts())
+        ImGui::Text("Connection: %s (%u reconnects, %u failed attempts)",
+            LIDARFrameGrabber::getConnectionStateName(grabber->getConnectionState()),
+            grabber->getReconnects(),
+            grabber->getFailedAttempts());
+
+    if (grabber->getFPS())
+        ImGui::Text("LIDAR FPS: %.1f", grabber->getFPS());
+
+    if (grabber->getRevolutionCount())
+        ImGui::Text("Revolutions/s: %.1f (%.1f ms, %u restarts, %llu stale)",
+            grabber->getRevolutionsPerSecond(),
+            grabber->getRevolutionTime(),
+            grabber->getScanRestarts(),
+            (unsigned long long) m_devices.getStaleCount(index));
+
+    if(grabber->getDevice()->getType() == ScanDevice::REPLAY)
+        genReplayUI(*static_cast<ReplayScanDevice*>(grabber->getDevice()));
+
+    genTelemetryUI(grabber->getTelemetry());
+    genFilterUI(*grabber);
+
+    LIDARDeviceManager::Extrinsics extrinsics = m_devices.getExtrinsics(index);
+    bool moved = ImGui::DragFloat3("Position (mm)", &extrinsics.x, 5.0f);
+    moved |= ImGui::DragFloat3("Roll/Pitch/Yaw", &extrinsics.roll, 0.5f, -180.0f, 180.0f);
+
+    if(moved)
+        m_devices.setExtrinsics(index, extrinsics);
+
+    // Off, or one of the temporal filter's modes
+    const TemporalFilter* smoothing = m_devices.getSmoothing(index);
+    TemporalFilter::Config smoothingConfig = smoothing ? smoothing->getConfig() : TemporalFilter::Config();
+    int smoothingMode = smoothing ? smoothingConfig.mode + 1 : 0;
+    bool smoothingChanged = ImGui::Combo("Smoothing", &smoothingMode, "Off\0EMA\0Median\0");
+
+    if(smoothingMode == 1 + TemporalFilter::EMA)
+        smoothingChanged |= ImGui::SliderFloat("Weight", &smoothingConfig.alpha, 0.05f, 1.0f, "%.2f");
+    else if(smoothingMode == 1 + TemporalFilter::MEDIAN)
+        smoothingChanged |= ImGui::SliderInt("Revolutions", &smoothingConfig.window, 3, 5);
+
+    if(smoothingChanged)
+    {
+        smoothingConfig.mode = (TemporalFilter::Mode) std::max(smoothingMode - 1, 0);
+        m_devices.setSmoothing(index, smoothingMode != 0, smoothingConfig);
+    }
+
+    if(grabber->getStatus() == LIDARFrameGrabber::Status::OK)
+    {
+        ImGui::Text("Serial Number: %s", grabber->getSerialNumber().c_str());
+        ImGui::Text("Firmware Version: %s", grabber->getFirmwareVersion().c_str());
+        ImGui::Text("Hardware Version: %s", grabber->getHardwareVersion().c_str());
+    }
+
+    const ScanRecorder& recorder = grabber->getRecorder();
+
+    // A recording carries on while the device is away and picks up again
+    // once it reconnects
+    if(grabber->getStatus() == LIDARFrameGrabber::Status::OK || recorder.isOpen())
+    {
+        if(ImGui::Button(recorder.isOpen() ? "Stop Recording" : "Start Recording"))
+        {
+            if(recorder.isOpen())
+                grabber->stopRecording();
+            else
+            {
+                char path[64];
+                time_t now = time(nullptr);
+                size_t length = strftime(path, sizeof(path), "scan-%Y%m%d-%H%M%S", localtime(&now));
+                snprintf(path + length, sizeof(path) - length, "-%zu.rplr", index);
+                grabber->startRecording(path, m_devices.getRecordingEncoding(index));
+            }
+        }
+
+        ImGui::SameLine();
+
+        if(recorder.isOpen())
+        {
+            ImGui::Text("%llu scans, %.1f MB (%llu dropped)",
+                (unsigned long long) recorder.getScansWritten(),
+                recorder.getBytesWritten() / (1024.0f * 1024.0f),
+                (unsigned long long) recorder.getScansDropped());
+
+            if(recorder.getEncoding() == SCAN_ENCODING_PACKED && recorder.getBytesWritten())
+            {
+                ImGui::SameLine();
+                ImGui::Text("%.1fx", (double) recorder.getRawBytesWritten() / recorder.getBytesWritten());
+            }
+        }
+        else
         {
-            m_frameGrabber->stop();
-            m_frameGrabber.reset();
+            bool compress = m_devices.getRecordingEncoding(index) == SCAN_ENCODING_PACKED;
+
+            if(ImGui::Checkbox("Compress", &compress))
+                m_devices.setRecordingEncoding(index, compress ? SCAN_ENCODING_PACKED : SCAN_ENCODING_RAW);
         }
+
+        ImGui::SameLine();
+    }
+
+    ScanServer& server = grabber->getServer();
+
+    if(ImGui::Button(server.isRunning() ? "Stop Streaming" : "Start Streaming"))
+    {
+        if(server.isRunning())
+            server.stop();
         else
         {
-            m_frameGrabber = std::make_unique<LIDARFrameGrabber>(devices[itemCurrentIdx]);
-            m_frameGrabber->start();
+            // Each device gets its own pair of ports
+            ScanServer::Config config;
+            config.udpPort += (uint16_t) (2 * index);
+            config.tcpPort += (uint16_t) (2 * index);
+            server.start(config);
         }
     }
 
+    const SharedScanRing& shared = grabber->getSharedRing();
+
     ImGui::SameLine();
 
-    if(ImGui::Button("Reload Devices")) {
-        devices = LIDARFrameGrabber::getAvailableDevices();
+    if(ImGui::Button(shared.isOpen() ? "Stop Sharing" : "Start Sharing"))
+    {
+        if(shared.isOpen())
+            grabber->stopSharing();
+        else
+            grabber->startSharing("/rplidar-" + std::to_string(index));
     }
-    
-    if(m_frameGrabber)
+
+    if(shared.isOpen())
     {
-        ImGui::Text("Status: %s", m_frameGrabber->getStatusMessage().c_str());
+        ImGui::SameLine();
+        ImGui::Text("%s: %llu frames", shared.getName().c_str(), (unsigned long long) shared.getPublished());
+    }
 
-        if(m_frameGrabber->getStatus() == LIDARFrameGrabber::Status::OK)
+    if(server.isRunning())
+    {
+        for(const ScanServer::SubscriberStats& subscriber : server.getSubscribers())
         {
-            ImGui::Text("Serial Number: %s", m_frameGrabber->getSerialNumber().c_str());
-            ImGui::Text("Firmware Version: %s", m_frameGrabber->getFirmwareVersion().c_str());
-            ImGui::Text("Hardware Version: %s", m_frameGrabber->getHardwareVersion().c_str());
+            ImGui::Text("%s: %llu frames, %.1f MB (%llu dropped)", subscriber.address.c_str(),
+                (unsigned long long) subscriber.framesSent,
+                subscriber.bytesSent / (1024.0f * 1024.0f),
+                (unsigned long long) subscriber.framesDropped);
         }
     }
 
-    ImGui::End();
+    for(const ScanBus::SubscriberStats& subscriber : grabber->getBus().getSubscribers())
+    {
+        ImGui::Text("%s (%s): %llu frames, %llu behind, %.1f ms late (%llu dropped)", subscriber.name.c_str(),
+            ScanBus::getPolicyName(subscriber.policy),
+            (unsigned long long) subscriber.received,
+            (unsigned long long) subscriber.lag,
+            subscriber.delayMicros / 1000.0f,
+            (unsigned long long) subscriber.dropped);
+    }
+
+    if(ImGui::Button("Disconnect"))
+    {
+        m_devices.removeDevice(index);
+        return true;
+    }
+
+    return false;
+}
+
+void VisualizerApp::genTelemetryUI(const ScanTelemetry& telemetry)
+{
+    if(!ImGui::TreeNode("Latency"))
+        return;
+
+    ImGui::Text("%llu published, %llu presented, %llu dropped, %llu late",
+        (unsigned long long) telemetry.getPublished(),
+        (unsigned long long) telemetry.getPresented(),
+        (unsigned long long) telemetry.getDropped(),
+        (unsigned long long) telemetry.getLate());
+
+    for(int i = 0; i < ScanTelemetry::INTERVAL_COUNT; i++)
+    {
+        const LatencyHistogram& histogram = telemetry.getHistogram((ScanTelemetry::Interval) i);
+
+        ImGui::Text("%-12s p50 %6.2f  p99 %6.2f  max %6.2f ms",
+            ScanTelemetry::getIntervalName((ScanTelemetry::Interval) i),
+            histogram.getPercentile(50.0) / 1000.0f,
+            histogram.getPercentile(99.0) / 1000.0f,
+            histogram.getMax() / 1000.0f);
+    }
+
+    ImGui::TreePop();
+}
+
+void VisualizerApp::genFilterUI(LIDARFrameGrabber& grabber)
+{
+    if(!ImGui::TreeNode("Filters"))
+        return;
+
+    const ScanFilter& filter = grabber.getFilter();
+    ScanFilter::Config config = grabber.getFilterConfig();
+    bool changed = false;
+
+    for(int i = 0; i < ScanFilter::STAGE_COUNT; i++)
+    {
+        ScanFilter::Stage stage = (ScanFilter::Stage) i;
+
+        ImGui::PushID(i);
+        changed |= ImGui::Checkbox(ScanFilter::getStageName(stage), &config.enabled[i]);
+        ImGui::SameLine(120.0f);
+        ImGui::PushItemWidth(160.0f);
+
+        switch(stage)
+        {
+        case ScanFilter::RANGE:
+            changed |= ImGui::DragFloatRange2("mm", &config.minRange, &config.maxRange, 10.0f, 0.0f, 40000.0f, "%.0f");
+            break;
+        case ScanFilter::QUALITY:
+        {
+            int quality = config.minQuality;
+            if(ImGui::SliderInt("min", &quality, 0, 255))
+            {
+                config.minQuality = (uint8_t) quality;
+                changed = true;
+            }
+            break;
+        }
+        case ScanFilter::SHADOW:
+            changed |= ImGui::SliderFloat("deg", &config.shadowAngle, 1.0f, 30.0f, "%.1f");
+            break;
+        case ScanFilter::MIXED_PIXEL:
+            changed |= ImGui::DragFloat("jump mm", &config.mixedPixelJump, 5.0f, 10.0f, 5000.0f, "%.0f");
+            break;
+        case ScanFilter::ISOLATED:
+            changed |= ImGui::DragFloat("gap mm", &config.isolatedDistance, 5.0f, 10.0f, 5000.0f, "%.0f");
+            break;
+        case ScanFilter::MEDIAN:
+        {
+            int wide = config.medianWindow == 5;
+            if(ImGui::Combo("window", &wide, "3\0" "5\0"))
+            {
+                config.medianWindow = wide ? 5 : 3;
+                changed = true;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+
+        ImGui::PopItemWidth();
+
+        if(config.enabled[i])
+        {
+            ImGui::SameLine();
+            ImGui::Text("%6.1f us, %u removed", filter.getMeanMicros(stage), filter.getLastRejected(stage));
+        }
+
+        ImGui::PopID();
+    }
+
+    changed |= ImGui::SliderInt("Neighbors", &config.neighbors, 1, 3);
+
+    if(changed)
+        grabber.setFilterConfig(config);
+
+    ImGui::TreePop();
+}
+
+void VisualizerApp::genReplayUI(ReplayScanDevice& replay)
+{
+    static const char* speedNames[] = { "1x", "10x", "As fast as possible" };
+    static const float speeds[] = { 1.0f, 10.0f, 0.0f };
+
+    const MappedRecording& recording = replay.getRecording();
+
+    if(!recording.getScanCount())
+        return;
+
+    if(ImGui::Button(replay.isPaused() ? "Play" : "Pause"))
+        replay.setPaused(!replay.isPaused());
+
+    ImGui::SameLine();
+
+    bool looping = replay.isLooping();
+    if(ImGui::Checkbox("Loop", &looping))
+        replay.setLooping(looping);
+
+    int speedIdx = 0;
+    while(speedIdx < 2 && speeds[speedIdx] != replay.getSpeed())
+        speedIdx++;
+
+    if(ImGui::Combo("Speed", &speedIdx, speedNames, 3))
+        replay.setSpeed(speeds[speedIdx]);
+
+    int scan = (int) replay.getPosition();
+    if(ImGui::SliderInt("Scan", &scan, 0, (int) recording.getScanCount() - 1))
+        replay.seek(scan);
+
+    float seconds = replay.getPositionTime() / 1e6f;
+    if(ImGui::SliderFloat("Time", &seconds, 0.0f, recording.getDuration() / 1e6f, "%.2f s"))
+        replay.seekTime((uint64_t) (seconds * 1e6f));
 }
 
 void VisualizerApp::onWindowResize(GLFWwindow* window, int width, int height)
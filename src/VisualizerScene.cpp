@@ -195,6 +195,11 @@ void VisualizerScene::onWindowResize(int width, int height)
     framebuffer.resize(width, height);
 }
 
+LIDARFramePreview* VisualizerScene::getLIDARPreview()
+{
+    return lidarPreviewer.get();
+}
+
 LightObject& VisualizerScene::createLight(const std::string& name)
 {
     if(lights.size() == MAX_LIGHTS)
@@ -301,6 +306,7 @@ int VisualizerScene::lua_openSceneLib(lua_State* L)
 
     Compositor::lua_openCompositorLib(L);
     SceneObject::lua_openSceneObjectLib(L);
+    VisualizerApp::getInstance().getDeviceManager().lua_openLidarLib(L);
 
     luaL_newlib(L, sceneLib);
     lua_setglobal(L, "scene");
@@ -195,8 +195,8 @@ Track* Timeline::getTracki(size_t index)
 
 Track* Timeline::getTrack(const char* name)
 {
-    size_t index = tracksMap[name];
-    return index < tracksCount ? &tracks[index] : nullptr;
+    auto it = tracksMap.find(name);
+    return it != tracksMap.end() && it->second < tracksCount ? &tracks[it->second] : nullptr;
 }
 
 const Track* Timeline::getConstTracki(size_t index) const
@@ -207,8 +207,8 @@ const Track* Timeline::getConstTracki(size_t index) const
 
 const Track* Timeline::getConstTrack(const char* name) const
 {
-    size_t index = tracksMap[name];
-    return index < tracksCount ? &tracks[index] : nullptr;
+    auto it = tracksMap.find(name);
+    return it != tracksMap.end() && it->second < tracksCount ? &tracks[it->second] : nullptr;
 }
 
 float Timeline::getDuration() const
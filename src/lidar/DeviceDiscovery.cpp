@@ -0,0 +1,364 @@
+#include "lidar/DeviceDiscovery.hpp"
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include <cstring>
+#include <algorithm>
+
+using namespace em;
+
+namespace
+{
+    // Drivers of the USB to serial bridges LIDARs ship with, and generic ones
+    const char* const USB_SERIAL_DRIVERS[] = {
+        "cp210x",
+        "ftdi_sio",
+        "ch341",
+        "ch341-uart",
+        "pl2303",
+        "cdc_acm",
+        "usbserial_generic"
+    };
+
+    // Silicon Labs, FTDI, QinHeng and Prolific
+    const char* const USB_SERIAL_VENDORS[] = {
+        "10c4",
+        "0403",
+        "1a86",
+        "067b"
+    };
+
+    template<size_t N>
+    bool contains(const char* const (&list)[N], const std::string& value)
+    {
+        return std::find_if(list, list + N, [&](const char* item) { return value == item; }) != list + N;
+    }
+}
+
+DeviceDiscovery::DeviceDiscovery(const std::string& root) :
+    m_root(root),
+    m_revision(0),
+    m_shouldStop(false),
+    m_shouldRefresh(false),
+    m_wakePipe{-1, -1}
+{
+}
+
+DeviceDiscovery::~DeviceDiscovery()
+{
+    stop();
+}
+
+void DeviceDiscovery::start()
+{
+    if(m_thread.joinable())
+        return;
+
+    m_shouldStop = false;
+    m_shouldRefresh = false;
+
+#ifdef __linux__
+    if(pipe2(m_wakePipe, O_NONBLOCK | O_CLOEXEC) == -1)
+        m_wakePipe[0] = m_wakePipe[1] = -1;
+#endif
+
+    m_thread = std::thread(discoveryThread, this);
+}
+
+void DeviceDiscovery::stop()
+{
+    if(!m_thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shouldStop = true;
+    }
+
+    m_wake.notify_all();
+
+#ifdef __linux__
+    if(m_wakePipe[1] != -1 && write(m_wakePipe[1], "s", 1) < 0)
+    {
+        // The pipe is full, so the thread is awake anyway
+    }
+#endif
+
+    m_thread.join();
+
+#ifdef __linux__
+    for(int& fd : m_wakePipe)
+    {
+        if(fd != -1)
+            close(fd);
+
+        fd = -1;
+    }
+#endif
+}
+
+bool DeviceDiscovery::isRunning() const
+{
+    return m_thread.joinable();
+}
+
+void DeviceDiscovery::refresh()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shouldRefresh = true;
+    }
+
+    m_wake.notify_all();
+
+#ifdef __linux__
+    if(m_wakePipe[1] != -1 && write(m_wakePipe[1], "r", 1) < 0)
+    {
+        // The pipe is full, so the thread is awake anyway
+    }
+#endif
+}
+
+std::vector<std::string> DeviceDiscovery::getDevices() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_devices;
+}
+
+uint64_t DeviceDiscovery::getRevision() const
+{
+    return m_revision.load();
+}
+
+std::vector<std::string> DeviceDiscovery::scan() const
+{
+    std::vector<std::string> devices;
+
+#if defined(__linux__) || defined(__APPLE__)
+    DIR* dir = opendir((m_root + "/dev").c_str());
+
+    if(dir)
+    {
+        struct dirent* ent;
+
+        while((ent = readdir(dir)) != nullptr)
+        {
+            std::string name = ent->d_name;
+
+            if(isCandidate(name) && probe(name))
+                devices.push_back(m_root + "/dev/" + name);
+        }
+
+        closedir(dir);
+    }
+#elif defined(_WIN32)
+    for(int i = 1; i <= 256; i++)
+    {
+        std::string name = "COM" + std::to_string(i);
+
+        if(probe(name))
+            devices.push_back(name);
+    }
+#endif
+
+    std::sort(devices.begin(), devices.end());
+    return devices;
+}
+
+bool DeviceDiscovery::isCandidate(const std::string& name) const
+{
+#ifdef __linux__
+    if(name.compare(0, 3, "tty") != 0)
+        return false;
+
+    struct stat info;
+
+    // Without sysfs, go by the names USB serial ports get
+    if(stat((m_root + "/sys/class/tty").c_str(), &info) != 0)
+        return name.compare(0, 6, "ttyUSB") == 0 || name.compare(0, 6, "ttyACM") == 0;
+
+    std::string device = m_root + "/sys/class/tty/" + name + "/device";
+
+    char link[256];
+    ssize_t length = readlink((device + "/driver").c_str(), link, sizeof(link) - 1);
+
+    if(length > 0)
+    {
+        link[length] = '\0';
+        const char* driver = strrchr(link, '/');
+
+        if(contains(USB_SERIAL_DRIVERS, driver ? driver + 1 : link))
+            return true;
+    }
+
+    // The vendor is on the USB device, one or two levels above the tty's
+    // device depending on the driver
+    for(const char* up : { "/", "/../", "/../../" })
+    {
+        FILE* file = fopen((device + up + "idVendor").c_str(), "r");
+
+        if(!file)
+            continue;
+
+        char vendor[8] = {};
+        bool found = fgets(vendor, sizeof(vendor), file) != nullptr;
+        fclose(file);
+
+        if(found)
+            return contains(USB_SERIAL_VENDORS, std::string(vendor, strnlen(vendor, 4)));
+    }
+
+    return false;
+#elif defined(__APPLE__)
+    return name.compare(0, 3, "cu.") == 0 || name.compare(0, 4, "tty.") == 0;
+#else
+    return true;
+#endif
+}
+
+bool DeviceDiscovery::probe(const std::string& name) const
+{
+#ifdef __linux__
+    // Non-blocking, so a port waiting on its modem lines can't stall the scan
+    int fd = open((m_root + "/dev/" + name).c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if(fd == -1)
+        return false;
+
+    close(fd);
+    return true;
+#elif defined(_WIN32)
+    HANDLE handle = CreateFileA(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+
+    if(handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    CloseHandle(handle);
+    return true;
+#else
+    return true;
+#endif
+}
+
+void DeviceDiscovery::publish(std::vector<std::string>&& devices)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_revision && devices == m_devices)
+        return;
+
+    m_devices = std::move(devices);
+    m_revision++;
+}
+
+void DeviceDiscovery::update(const std::string& name, bool present)
+{
+    std::string path = m_root + "/dev/" + name;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = std::lower_bound(m_devices.begin(), m_devices.end(), path);
+    bool listed = it != m_devices.end() && *it == path;
+
+    if(present == listed)
+        return;
+
+    if(present)
+        m_devices.insert(it, path);
+    else
+        m_devices.erase(it);
+
+    m_revision++;
+}
+
+void DeviceDiscovery::discoveryThread(DeviceDiscovery* discovery)
+{
+#ifdef __linux__
+    // Watching starts before the first scan, so no port slips in between
+    int watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if(watch != -1 && inotify_add_watch(watch, (discovery->m_root + "/dev").c_str(),
+        IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO) == -1)
+    {
+        close(watch);
+        watch = -1;
+    }
+#endif
+
+    discovery->publish(discovery->scan());
+
+    while(!discovery->m_shouldStop)
+    {
+        if(discovery->m_shouldRefresh.exchange(false))
+        {
+            discovery->publish(discovery->scan());
+            continue;
+        }
+
+#ifdef __linux__
+        if(watch != -1 && discovery->m_wakePipe[0] != -1)
+        {
+            pollfd fds[2] = {
+                { watch, POLLIN, 0 },
+                { discovery->m_wakePipe[0], POLLIN, 0 }
+            };
+
+            if(poll(fds, 2, -1) <= 0)
+                continue;
+
+            char drain[64];
+            while(read(discovery->m_wakePipe[0], drain, sizeof(drain)) > 0);
+
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+
+            // Only the ports that changed are looked at again
+            while((length = read(watch, buffer, sizeof(buffer))) > 0)
+            {
+                for(char* next = buffer; next < buffer + length;)
+                {
+                    const inotify_event* event = (const inotify_event*) next;
+                    next += sizeof(inotify_event) + event->len;
+
+                    if(event->mask & IN_Q_OVERFLOW)
+                    {
+                        discovery->m_shouldRefresh = true;
+                        continue;
+                    }
+
+                    if(!event->len || strncmp(event->name, "tty", 3) != 0)
+                        continue;
+
+                    // sysfs may already be gone for a port that was unplugged
+                    bool removed = event->mask & (IN_DELETE | IN_MOVED_FROM);
+                    discovery->update(event->name, !removed && discovery->isCandidate(event->name) && discovery->probe(event->name));
+                }
+            }
+
+            continue;
+        }
+#endif
+
+        std::unique_lock<std::mutex> lock(discovery->m_mutex);
+        discovery->m_wake.wait(lock, [discovery]()
+        {
+            return discovery->m_shouldStop || discovery->m_shouldRefresh;
+        });
+    }
+
+#ifdef __linux__
+    if(watch != -1)
+        close(watch);
+#endif
+}
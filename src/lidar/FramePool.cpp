@@ -0,0 +1,254 @@
+#include "lidar/FramePool.hpp"
+
+#include "lidar/ScanFrame.hpp"
+#include "Logger.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace em;
+
+static Logger logger("FramePool");
+
+namespace
+{
+    size_t roundUp(size_t size, size_t multiple)
+    {
+        return (size + multiple - 1) / multiple * multiple;
+    }
+
+    // Pages are faulted in up front where the system allows, so the first
+    // scan through a block doesn't pay for it
+    const int MAP_FLAGS = MAP_PRIVATE | MAP_ANONYMOUS
+#ifdef MAP_POPULATE
+        | MAP_POPULATE
+#endif
+        ;
+
+    uint8_t* mapChunk(size_t size, bool hugePages, bool& huge)
+    {
+        huge = false;
+
+#ifdef MAP_HUGETLB
+        if(hugePages)
+        {
+            void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_FLAGS | MAP_HUGETLB, -1, 0);
+
+            if(data != MAP_FAILED)
+            {
+                huge = true;
+                return static_cast<uint8_t*>(data);
+            }
+        }
+#endif
+
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_FLAGS, -1, 0);
+
+        if(data == MAP_FAILED)
+            return nullptr;
+
+        // No huge pages reserved, the kernel may still back it with
+        // transparent ones
+#ifdef MADV_HUGEPAGE
+        if(hugePages)
+            madvise(data, size, MADV_HUGEPAGE);
+#endif
+
+        return static_cast<uint8_t*>(data);
+    }
+}
+
+FramePool::FramePool(size_t blockSize, size_t blocksPerChunk, bool hugePages) :
+    m_blockSize(roundUp(blockSize ? blockSize : 1, ScanFrame::ALIGNMENT)),
+    m_hugePages(hugePages),
+    m_chunkCount(0),
+    m_head(0),
+    m_blockCount(0),
+    m_free(0),
+    m_allocations(0),
+    m_acquired(0),
+    m_hasHugePages(false)
+{
+    // Whatever is left over at the end of the last page becomes blocks too
+    size_t pageSize = hugePages ? HUGE_PAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+    m_chunkSize = roundUp(m_blockSize * (blocksPerChunk ? blocksPerChunk : 1), pageSize);
+    m_blocksPerChunk = m_chunkSize / m_blockSize;
+
+    std::lock_guard<std::mutex> lock(m_growMutex);
+    grow();
+}
+
+FramePool::~FramePool()
+{
+    size_t chunks = m_chunkCount;
+
+    for(size_t i = 0; i < chunks; i++)
+        munmap(m_chunks[i].data, m_chunks[i].size);
+}
+
+void* FramePool::acquire()
+{
+    uint32_t index;
+
+    while(!pop(index))
+    {
+        std::lock_guard<std::mutex> lock(m_growMutex);
+
+        // Another thread may have grown the pool or given a block back while
+        // this one waited for the lock
+        if(m_free)
+            continue;
+
+        if(!grow())
+            return nullptr;
+    }
+
+    m_acquired++;
+
+    return blockAt(index);
+}
+
+void FramePool::release(void* block)
+{
+    if(!block)
+        return;
+
+    uint8_t* data = static_cast<uint8_t*>(block);
+    size_t chunks = m_chunkCount.load(std::memory_order_acquire);
+
+    for(size_t i = 0; i < chunks; i++)
+    {
+        const Chunk& chunk = m_chunks[i];
+
+        if(data >= chunk.data && data < chunk.data + m_blocksPerChunk * m_blockSize)
+        {
+            push((uint32_t) (i * m_blocksPerChunk + (data - chunk.data) / m_blockSize));
+            return;
+        }
+    }
+
+    logger.errorf("Released a block that isn't from this pool");
+}
+
+size_t FramePool::getBlockSize() const
+{
+    return m_blockSize;
+}
+
+size_t FramePool::getBlockCount() const
+{
+    return m_blockCount;
+}
+
+size_t FramePool::getFreeBlocks() const
+{
+    return m_free;
+}
+
+uint64_t FramePool::getAllocations() const
+{
+    return m_allocations;
+}
+
+uint64_t FramePool::getAcquired() const
+{
+    return m_acquired;
+}
+
+bool FramePool::hasHugePages() const
+{
+    return m_hasHugePages;
+}
+
+bool FramePool::grow()
+{
+    size_t count = m_chunkCount.load(std::memory_order_relaxed);
+
+    if(count == MAX_CHUNKS)
+    {
+        logger.errorf("All %zu chunks of %zu byte blocks are in use", count, m_blockSize);
+        return false;
+    }
+
+    bool huge;
+    uint8_t* data = mapChunk(m_chunkSize, m_hugePages, huge);
+
+    if(!data)
+    {
+        logger.errorf("Unable to map %zu bytes for %zu byte blocks", m_chunkSize, m_blockSize);
+        return false;
+    }
+
+    Chunk& chunk = m_chunks[count];
+    chunk.data = data;
+    chunk.size = m_chunkSize;
+    chunk.next.reset(new std::atomic<uint32_t>[m_blocksPerChunk]);
+
+    // Visible before any of its blocks can be popped, which the free list's
+    // release pushes take care of
+    m_chunkCount.store(count + 1, std::memory_order_release);
+    m_blockCount += m_blocksPerChunk;
+    m_allocations++;
+
+    if(huge)
+        m_hasHugePages = true;
+
+    // Pushed last to first so the chunk is handed out front to back
+    uint32_t first = (uint32_t) (count * m_blocksPerChunk);
+
+    for(size_t i = m_blocksPerChunk; i > 0; i--)
+        push(first + (uint32_t) i - 1);
+
+    return true;
+}
+
+bool FramePool::pop(uint32_t& index)
+{
+    uint64_t head = m_head.load(std::memory_order_acquire);
+
+    while(true)
+    {
+        uint32_t top = (uint32_t) head;
+
+        if(!top)
+            return false;
+
+        // The link may already be stale if another thread took top meanwhile,
+        // but then the tag has moved on and the exchange fails
+        uint32_t next = nextOf(top - 1).load(std::memory_order_relaxed);
+        uint64_t replacement = ((head >> 32) + 1) << 32 | next;
+
+        if(m_head.compare_exchange_weak(head, replacement, std::memory_order_acquire, std::memory_order_acquire))
+        {
+            m_free--;
+            index = top - 1;
+            return true;
+        }
+    }
+}
+
+void FramePool::push(uint32_t index)
+{
+    // Counted first so the count never drops below what is on the list
+    m_free++;
+
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    uint64_t replacement;
+
+    do
+    {
+        nextOf(index).store((uint32_t) head, std::memory_order_relaxed);
+        replacement = ((head >> 32) + 1) << 32 | (index + 1);
+    }
+    while(!m_head.compare_exchange_weak(head, replacement, std::memory_order_release, std::memory_order_relaxed));
+}
+
+std::atomic<uint32_t>& FramePool::nextOf(uint32_t index)
+{
+    return m_chunks[index / m_blocksPerChunk].next[index % m_blocksPerChunk];
+}
+
+uint8_t* FramePool::blockAt(uint32_t index) const
+{
+    return m_chunks[index / m_blocksPerChunk].data + (index % m_blocksPerChunk) * m_blockSize;
+}
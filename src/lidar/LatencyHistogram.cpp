@@ -0,0 +1,155 @@
+#include "lidar/LatencyHistogram.hpp"
+
+#include <limits>
+
+using namespace em;
+
+namespace
+{
+    const uint64_t SUB_BUCKETS = 1 << LatencyHistogram::SUB_BUCKET_BITS;
+    const uint64_t HALF_BUCKETS = SUB_BUCKETS >> 1;
+
+    inline int magnitude(uint64_t value)
+    {
+        int bit = 0;
+
+        while(value >>= 1)
+            bit++;
+
+        return bit;
+    }
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t micros)
+{
+    if(micros < SUB_BUCKETS)
+        return (size_t) micros;
+
+    int bit = magnitude(micros);
+
+    if(bit > MAX_MAGNITUDE)
+        return BUCKET_COUNT - 1;
+
+    // The top SUB_BUCKET_BITS bits pick the bucket within the power of two
+    int shift = bit - (SUB_BUCKET_BITS - 1);
+    uint64_t top = micros >> shift;
+
+    return (size_t) (SUB_BUCKETS + (shift - 1) * HALF_BUCKETS + (top - HALF_BUCKETS));
+}
+
+uint64_t LatencyHistogram::bucketLow(size_t index)
+{
+    if(index < SUB_BUCKETS)
+        return index;
+
+    uint64_t shift = (index - SUB_BUCKETS) / HALF_BUCKETS + 1;
+    uint64_t top = (index - SUB_BUCKETS) % HALF_BUCKETS + HALF_BUCKETS;
+
+    return top << shift;
+}
+
+uint64_t LatencyHistogram::bucketHigh(size_t index)
+{
+    if(index < SUB_BUCKETS)
+        return index;
+
+    if(index == BUCKET_COUNT - 1)
+        return std::numeric_limits<uint64_t>::max();
+
+    return bucketLow(index + 1) - 1;
+}
+
+void LatencyHistogram::record(uint64_t micros)
+{
+    m_buckets[bucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(micros, std::memory_order_relaxed);
+
+    uint64_t current = m_min.load(std::memory_order_relaxed);
+    while(micros < current && !m_min.compare_exchange_weak(current, micros, std::memory_order_relaxed));
+
+    current = m_max.load(std::memory_order_relaxed);
+    while(micros > current && !m_max.compare_exchange_weak(current, micros, std::memory_order_relaxed));
+}
+
+void LatencyHistogram::reset()
+{
+    for(size_t i = 0; i < BUCKET_COUNT; i++)
+        m_buckets[i].store(0, std::memory_order_relaxed);
+
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_min.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getCount() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getMin() const
+{
+    return getCount() ? m_min.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t LatencyHistogram::getMax() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::getMean() const
+{
+    uint64_t count = getCount();
+    return count ? (double) m_sum.load(std::memory_order_relaxed) / count : 0.0;
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const
+{
+    uint64_t total = 0;
+
+    for(size_t i = 0; i < BUCKET_COUNT; i++)
+        total += m_buckets[i].load(std::memory_order_relaxed);
+
+    if(!total)
+        return 0;
+
+    // The ends are known exactly
+    if(percentile <= 0.0)
+        return getMin();
+
+    if(percentile >= 100.0)
+        return getMax();
+
+    uint64_t rank = (uint64_t) (percentile / 100.0 * total + 0.5);
+    if(rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+
+    for(size_t i = 0; i < BUCKET_COUNT; i++)
+    {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+
+        if(seen >= rank)
+        {
+            // Middle of the bucket, kept within what was actually recorded
+            uint64_t high = bucketHigh(i);
+            uint64_t value = bucketLow(i) + (high - bucketLow(i)) / 2;
+            uint64_t min = getMin();
+            uint64_t max = getMax();
+
+            if(value < min)
+                return min;
+
+            return value < max ? value : max;
+        }
+    }
+
+    return getMax();
+}
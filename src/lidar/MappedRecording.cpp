@@ -0,0 +1,256 @@
+#include "lidar/MappedRecording.hpp"
+
+#include "lidar/Crc32.hpp"
+#include "Logger.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace em;
+
+static Logger logger("MappedRecording");
+
+MappedRecording::MappedRecording() :
+    m_data(nullptr),
+    m_size(0),
+    m_index(nullptr),
+    m_count(0),
+    m_decoded(SIZE_MAX)
+{
+}
+
+MappedRecording::~MappedRecording()
+{
+    close();
+}
+
+bool MappedRecording::open(const std::string& path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if(fd == -1)
+    {
+        logger.errorf("Unable to open recording %s", path.c_str());
+        return false;
+    }
+
+    struct stat info;
+
+    if(fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(RecordingHeader))
+    {
+        logger.errorf("%s is too small to be a recording", path.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if(data == MAP_FAILED)
+    {
+        logger.errorf("Unable to map recording %s", path.c_str());
+        return false;
+    }
+
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = info.st_size;
+
+    if(!ScanRecording::isValidHeader(getHeader()))
+    {
+        logger.errorf("%s is not a scan recording", path.c_str());
+        close();
+        return false;
+    }
+
+    const RecordingFooter* footer = reinterpret_cast<const RecordingFooter*>(m_data + m_size - sizeof(RecordingFooter));
+
+    if(m_size >= sizeof(RecordingHeader) + sizeof(RecordingFooter) && ScanRecording::isValidFooter(*footer, m_size) &&
+       crc32(m_data + footer->indexOffset, footer->count * sizeof(RecordingIndexEntry)) == footer->checksum)
+    {
+        m_index = reinterpret_cast<const RecordingIndexEntry*>(m_data + footer->indexOffset);
+        m_count = footer->count;
+    }
+    else
+    {
+        logger.warnf("%s was not closed cleanly, rebuilding its index", path.c_str());
+
+        ScanRecording::walkScans(m_data, m_size, m_rebuiltIndex);
+        m_index = m_rebuiltIndex.data();
+        m_count = m_rebuiltIndex.size();
+    }
+
+    return true;
+}
+
+void MappedRecording::close()
+{
+    if(m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+
+    m_data = nullptr;
+    m_size = 0;
+    m_index = nullptr;
+    m_count = 0;
+    m_rebuiltIndex.clear();
+    m_decoder.reset();
+    m_decoded = SIZE_MAX;
+}
+
+bool MappedRecording::isOpen() const
+{
+    return m_data != nullptr;
+}
+
+bool MappedRecording::hasFooter() const
+{
+    return m_index && m_rebuiltIndex.empty() && m_count > 0;
+}
+
+const RecordingHeader& MappedRecording::getHeader() const
+{
+    return *reinterpret_cast<const RecordingHeader*>(m_data);
+}
+
+size_t MappedRecording::getScanCount() const
+{
+    return m_count;
+}
+
+RecordedScanView MappedRecording::getScan(size_t index) const
+{
+    RecordedScanView view;
+
+    if(index >= m_count || m_index[index].offset + sizeof(RecordedScanHeader) > m_size)
+        return view;
+
+    const RecordedScanHeader* header = reinterpret_cast<const RecordedScanHeader*>(m_data + m_index[index].offset);
+
+    if(!ScanRecording::isValidScan(*header) || m_index[index].offset + sizeof(*header) + header->payloadSize > m_size)
+        return view;
+
+    view.header = header;
+    view.payload = reinterpret_cast<const uint8_t*>(header + 1);
+
+    if(header->encoding == SCAN_ENCODING_RAW)
+        view.nodes = reinterpret_cast<const RecordedNode*>(header + 1);
+
+    return view;
+}
+
+size_t MappedRecording::readScan(size_t index, ScanNode* nodes, size_t count)
+{
+    RecordedScanView view = getScan(index);
+
+    if(!view.header)
+        return 0;
+
+    size_t numNodes = std::min((size_t) view.header->nodeCount, count);
+
+    if(view.nodes)
+    {
+        memcpy(nodes, view.nodes, numNodes * sizeof(ScanNode));
+        return numNodes;
+    }
+
+    // Packed scans are predicted from the one before, so decode forward from
+    // the last scan decoded or from the key scan this one depends on
+    size_t first = index;
+
+    if(m_decoded == SIZE_MAX || m_decoded + 1 != index)
+    {
+        while(first > 0)
+        {
+            RecordedScanView key = getScan(first);
+
+            if(!key.header || ScanDecoder::getChain(key.payload, key.header->payloadSize) <= 0)
+                break;
+
+            first--;
+        }
+
+        m_decoder.reset();
+    }
+
+    m_scratch.resize(ScanRecording::MAX_NODES);
+
+    for(size_t i = first; i < index; i++)
+    {
+        size_t skipped = m_scratch.size();
+
+        if(!decodeScan(i, m_scratch.data(), skipped))
+            return 0;
+    }
+
+    size_t decoded = view.header->nodeCount;
+
+    if(numNodes == decoded)
+    {
+        if(!decodeScan(index, nodes, decoded))
+            return 0;
+    }
+    else
+    {
+        decoded = m_scratch.size();
+
+        if(!decodeScan(index, m_scratch.data(), decoded))
+            return 0;
+
+        memcpy(nodes, m_scratch.data(), numNodes * sizeof(ScanNode));
+    }
+
+    return numNodes;
+}
+
+bool MappedRecording::decodeScan(size_t index, ScanNode* nodes, size_t& count)
+{
+    RecordedScanView view = getScan(index);
+
+    if(!view.header || view.header->encoding != SCAN_ENCODING_PACKED ||
+       !m_decoder.decode(view.payload, view.header->payloadSize, nodes, count))
+    {
+        logger.warnf("Unable to decode scan %zu", index);
+        m_decoded = SIZE_MAX;
+        return false;
+    }
+
+    m_decoded = index;
+    return true;
+}
+
+uint64_t MappedRecording::getTimestamp(size_t index) const
+{
+    return index < m_count ? m_index[index].timestamp : 0;
+}
+
+uint64_t MappedRecording::getDuration() const
+{
+    return m_count ? m_index[m_count - 1].timestamp - m_index[0].timestamp : 0;
+}
+
+size_t MappedRecording::findScan(uint64_t timestamp) const
+{
+    size_t lo = 0;
+    size_t hi = m_count;
+
+    // First scan after timestamp, then step back one
+    while(lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if(m_index[mid].timestamp <= timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo > 0 ? lo - 1 : 0;
+}
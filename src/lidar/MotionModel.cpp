@@ -0,0 +1,292 @@
+#include "lidar/MotionModel.hpp"
+#include "lidar/Clock.hpp"
+
+#include "animation/Timeline.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace em;
+
+static const float DEGREES_TO_RADIANS = 3.14159265358979f / 180.0f;
+
+//----------------------------------------------------------------------------------------------
+// Pose2D
+//----------------------------------------------------------------------------------------------
+
+Pose2D Pose2D::compose(const Pose2D& other) const
+{
+    float c = std::cos(yaw * DEGREES_TO_RADIANS);
+    float s = std::sin(yaw * DEGREES_TO_RADIANS);
+
+    Pose2D pose;
+    pose.x = x + c * other.x - s * other.y;
+    pose.y = y + s * other.x + c * other.y;
+    pose.yaw = yaw + other.yaw;
+
+    return pose;
+}
+
+Pose2D Pose2D::inverse() const
+{
+    float c = std::cos(yaw * DEGREES_TO_RADIANS);
+    float s = std::sin(yaw * DEGREES_TO_RADIANS);
+
+    Pose2D pose;
+    pose.x = -(c * x + s * y);
+    pose.y = s * x - c * y;
+    pose.yaw = -yaw;
+
+    return pose;
+}
+
+Pose2D Pose2D::interpolate(const Pose2D& a, const Pose2D& b, float t)
+{
+    float turn = std::remainder(b.yaw - a.yaw, 360.0f);
+
+    Pose2D pose;
+    pose.x = a.x + (b.x - a.x) * t;
+    pose.y = a.y + (b.y - a.y) * t;
+    pose.yaw = a.yaw + turn * t;
+
+    return pose;
+}
+
+//----------------------------------------------------------------------------------------------
+// MotionModel
+//----------------------------------------------------------------------------------------------
+
+MotionModel::MotionModel(Type type) :
+    m_type(type)
+{
+}
+
+MotionModel::~MotionModel()
+{
+}
+
+MotionModel::Type MotionModel::getType() const
+{
+    return m_type;
+}
+
+const char* MotionModel::getTypeName(Type type)
+{
+    switch(type)
+    {
+    case CONSTANT_VELOCITY: return "constant velocity";
+    case POSE_STREAM: return "pose stream";
+    case TIMELINE: return "timeline";
+    }
+
+    return "unknown";
+}
+
+//----------------------------------------------------------------------------------------------
+// ConstantVelocityModel
+//----------------------------------------------------------------------------------------------
+
+ConstantVelocityModel::ConstantVelocityModel(float vx, float vy, float yawRate) :
+    MotionModel(CONSTANT_VELOCITY),
+    m_vx(vx),
+    m_vy(vy),
+    m_yawRate(yawRate),
+    m_reference(monotonicMicros())
+{
+}
+
+void ConstantVelocityModel::setVelocity(float vx, float vy, float yawRate)
+{
+    m_vx = vx;
+    m_vy = vy;
+    m_yawRate = yawRate;
+}
+
+float ConstantVelocityModel::getVelocityX() const
+{
+    return m_vx;
+}
+
+float ConstantVelocityModel::getVelocityY() const
+{
+    return m_vy;
+}
+
+float ConstantVelocityModel::getYawRate() const
+{
+    return m_yawRate;
+}
+
+void ConstantVelocityModel::setReferenceTime(uint64_t micros)
+{
+    m_reference = micros;
+}
+
+uint64_t ConstantVelocityModel::getReferenceTime() const
+{
+    return m_reference;
+}
+
+bool ConstantVelocityModel::getPose(uint64_t micros, Pose2D& pose) const
+{
+    float seconds = (float) ((int64_t) (micros - m_reference) * 1e-6);
+    pose = integrate(m_vx, m_vy, m_yawRate, seconds);
+    return true;
+}
+
+Pose2D ConstantVelocityModel::integrate(float vx, float vy, float yawRate, float seconds)
+{
+    float theta = yawRate * seconds * DEGREES_TO_RADIANS;
+
+    Pose2D pose;
+    pose.yaw = yawRate * seconds;
+
+    if(std::fabs(theta) < 1e-4f)
+    {
+        pose.x = vx * seconds;
+        pose.y = vy * seconds;
+        return pose;
+    }
+
+    // The velocity turns with the platform, which traces an arc
+    float s = std::sin(theta);
+    float c = std::cos(theta);
+    float scale = seconds / theta;
+
+    pose.x = (vx * s - vy * (1.0f - c)) * scale;
+    pose.y = (vx * (1.0f - c) + vy * s) * scale;
+
+    return pose;
+}
+
+//----------------------------------------------------------------------------------------------
+// PoseStream
+//----------------------------------------------------------------------------------------------
+
+PoseStream::PoseStream(size_t capacity, uint64_t maxExtrapolation) :
+    MotionModel(POSE_STREAM),
+    m_capacity(std::max<size_t>(capacity, 2)),
+    m_maxExtrapolation(maxExtrapolation)
+{
+}
+
+void PoseStream::push(uint64_t micros, const Pose2D& pose)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(!m_samples.empty() && micros <= m_samples.back().micros)
+        return;
+
+    if(m_samples.size() >= m_capacity)
+        m_samples.pop_front();
+
+    m_samples.push_back({ micros, pose });
+}
+
+void PoseStream::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_samples.clear();
+}
+
+size_t PoseStream::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_samples.size();
+}
+
+bool PoseStream::getPose(uint64_t micros, Pose2D& pose) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_samples.empty())
+        return false;
+
+    auto next = std::lower_bound(m_samples.begin(), m_samples.end(), micros, [](const Sample& sample, uint64_t micros)
+    {
+        return sample.micros < micros;
+    });
+
+    if(next == m_samples.begin() || next == m_samples.end())
+    {
+        const Sample& end = next == m_samples.end() ? m_samples.back() : m_samples.front();
+        uint64_t gap = micros > end.micros ? micros - end.micros : end.micros - micros;
+
+        if(gap > m_maxExtrapolation)
+            return false;
+
+        pose = end.pose;
+        return true;
+    }
+
+    const Sample& previous = *(next - 1);
+    float t = (float) (micros - previous.micros) / (float) (next->micros - previous.micros);
+    pose = Pose2D::interpolate(previous.pose, next->pose, t);
+
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------
+// TimelineMotionModel
+//----------------------------------------------------------------------------------------------
+
+TimelineMotionModel::TimelineMotionModel(const Timeline* timeline) :
+    MotionModel(TIMELINE),
+    m_timeline(timeline),
+    m_syncMicros(0),
+    m_syncTime(0.0f),
+    m_rate(0.0f)
+{
+}
+
+void TimelineMotionModel::setTimeline(const Timeline* timeline)
+{
+    m_timeline = timeline;
+}
+
+const Timeline* TimelineMotionModel::getTimeline() const
+{
+    return m_timeline;
+}
+
+void TimelineMotionModel::sync(uint64_t micros)
+{
+    if(!m_timeline)
+        return;
+
+    m_syncMicros = micros;
+    m_syncTime = m_timeline->getCurrentTime();
+
+    if(m_timeline->isStopped() || m_timeline->isPaused())
+        m_rate = 0.0f;
+    else
+        m_rate = m_timeline->isRewinding() ? -m_timeline->getSpeed() : m_timeline->getSpeed();
+}
+
+bool TimelineMotionModel::getPose(uint64_t micros, Pose2D& pose) const
+{
+    if(!m_timeline || !m_syncMicros)
+        return false;
+
+    float duration = m_timeline->getDuration();
+
+    if(duration <= 0.0f)
+        return false;
+
+    float time = m_syncTime + (float) ((int64_t) (micros - m_syncMicros) * 1e-6) * m_rate;
+
+    if(m_timeline->isLooping())
+        time -= duration * std::floor(time / duration);
+    else
+        time = std::clamp(time, 0.0f, duration);
+
+    const Track* x = m_timeline->getConstTrack("x");
+    const Track* y = m_timeline->getConstTrack("y");
+    const Track* yaw = m_timeline->getConstTrack("yaw");
+
+    pose.x = x ? x->getValue(time / duration) : 0.0f;
+    pose.y = y ? y->getValue(time / duration) : 0.0f;
+    pose.yaw = yaw ? yaw->getValue(time / duration) : 0.0f;
+
+    return true;
+}
@@ -0,0 +1,425 @@
+#include "lidar/NativeScanDevice.hpp"
+#include "lidar/Clock.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using namespace em;
+
+namespace
+{
+    const uint8_t SYNC_BYTE = 0xA5;
+    const uint8_t SYNC_BYTE2 = 0x5A;
+
+    const uint8_t CMD_STOP = 0x25;
+    const uint8_t CMD_SCAN = 0x20;
+    const uint8_t CMD_EXPRESS_SCAN = 0x82;
+    const uint8_t CMD_GET_DEVICE_INFO = 0x50;
+    const uint8_t CMD_GET_DEVICE_HEALTH = 0x52;
+    const uint8_t CMD_GET_LIDAR_CONF = 0x84;
+    const uint8_t CMD_SET_MOTOR_PWM = 0xF0;
+
+    const uint8_t ANS_TYPE_DEVICE_INFO = 0x04;
+    const uint8_t ANS_TYPE_DEVICE_HEALTH = 0x06;
+    const uint8_t ANS_TYPE_GET_LIDAR_CONF = 0x20;
+
+    const uint32_t CONF_SCAN_MODE_TYPICAL = 0x7C;
+
+    const uint16_t DEFAULT_MOTOR_PWM = 660;
+    const size_t MAX_REVOLUTION_NODES = 8192;
+
+    const char* PORT_PREFIX = "native://";
+
+    typedef std::chrono::steady_clock Clock;
+
+    unsigned int remainingMillis(Clock::time_point deadline)
+    {
+        Clock::time_point now = Clock::now();
+
+        if(now >= deadline)
+            return 0;
+
+        return (unsigned int) std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+    }
+}
+
+NativeScanDevice::NativeScanDevice(const std::string& port, int baudrate) :
+    ScanDevice(NATIVE),
+    m_port(port),
+    m_baudrate(baudrate),
+    m_channel(nullptr),
+    m_connected(false),
+    m_scanning(false),
+    m_hasCompleted(false),
+    m_readTime(0),
+    m_revolutionStart(0),
+    m_completedStart(0),
+    m_scanStart(0),
+    m_listener(nullptr),
+    m_listenerUser(nullptr)
+{
+    m_revolution.reserve(MAX_REVOLUTION_NODES);
+    m_completed.reserve(MAX_REVOLUTION_NODES);
+}
+
+NativeScanDevice::NativeScanDevice(sl::IChannel* channel) :
+    NativeScanDevice(std::string())
+{
+    m_channel = channel;
+}
+
+NativeScanDevice::~NativeScanDevice()
+{
+    disconnect();
+}
+
+sl_result NativeScanDevice::connect()
+{
+    if(m_connected)
+        return SL_RESULT_ALREADY_DONE;
+
+    if(!m_channel)
+        m_channel = *sl::createSerialPortChannel(m_port.c_str(), m_baudrate);
+
+    if(!m_channel || !m_channel->open())
+        return SL_RESULT_OPERATION_FAIL;
+
+    m_channel->clearReadCache();
+    m_connected = true;
+
+    return SL_RESULT_OK;
+}
+
+void NativeScanDevice::disconnect()
+{
+    if(m_connected)
+    {
+        stop();
+
+        // Spin the motor down, A-series units stop on DTR
+        uint8_t pwm[2] = { 0, 0 };
+        sendCommand(CMD_SET_MOTOR_PWM, pwm, sizeof(pwm));
+        m_channel->setDTR();
+
+        m_channel->close();
+        m_connected = false;
+    }
+
+    delete m_channel;
+    m_channel = nullptr;
+}
+
+sl_result NativeScanDevice::getDeviceInfo(sl_lidar_response_device_info_t& info, unsigned int timeout)
+{
+    sl_result result = sendCommand(CMD_GET_DEVICE_INFO);
+
+    if(SL_IS_FAIL(result))
+        return result;
+
+    return readResponse(ANS_TYPE_DEVICE_INFO, &info, sizeof(info), timeout);
+}
+
+sl_result NativeScanDevice::getHealth(sl_lidar_response_device_health_t& health, unsigned int timeout)
+{
+    sl_result result = sendCommand(CMD_GET_DEVICE_HEALTH);
+
+    if(SL_IS_FAIL(result))
+        return result;
+
+    return readResponse(ANS_TYPE_DEVICE_HEALTH, &health, sizeof(health), timeout);
+}
+
+sl_result NativeScanDevice::startScan()
+{
+    if(m_scanning)
+        return SL_RESULT_ALREADY_DONE;
+
+    if(!m_connected)
+        return SL_RESULT_OPERATION_FAIL;
+
+    // A-series units spin up on DTR, units with a motor controller take a PWM
+    // command and others ignore it
+    uint8_t pwm[2] = { DEFAULT_MOTOR_PWM & 0xFF, DEFAULT_MOTOR_PWM >> 8 };
+    m_channel->clearDTR();
+    sendCommand(CMD_SET_MOTOR_PWM, pwm, sizeof(pwm));
+
+    // Older firmware doesn't know scan modes and only does standard scans
+    uint16_t mode = 0;
+    sl_result result;
+
+    if(SL_IS_OK(queryTypicalScanMode(mode)) && mode != 0)
+    {
+        uint8_t payload[5] = { (uint8_t) mode, 0, 0, 0, 0 };
+        result = sendCommand(CMD_EXPRESS_SCAN, payload, sizeof(payload));
+    }
+    else
+        result = sendCommand(CMD_SCAN);
+
+    if(SL_IS_FAIL(result))
+        return result;
+
+    uint8_t descriptor[ProtocolDecoder::DESCRIPTOR_SIZE];
+    result = readDescriptor(descriptor, DEFAULT_TIMEOUT);
+
+    if(SL_IS_FAIL(result))
+        return result;
+
+    ProtocolDecoder::Format format;
+
+    if(!ProtocolDecoder::parseDescriptor(descriptor, format))
+        return SL_RESULT_FORMAT_NOT_SUPPORT;
+
+    m_decoder.setFormat(format);
+    m_revolution.clear();
+    m_hasCompleted = false;
+    m_scanning = true;
+
+    return SL_RESULT_OK;
+}
+
+sl_result NativeScanDevice::stop()
+{
+    if(!m_connected)
+        return SL_RESULT_OPERATION_FAIL;
+
+    sl_result result = sendCommand(CMD_STOP);
+
+    // The device needs a moment before it takes the next command
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    m_channel->clearReadCache();
+
+    m_scanning = false;
+
+    return result;
+}
+
+sl_result NativeScanDevice::grabScanDataHq(ScanNode* nodes, size_t& count, unsigned int timeout)
+{
+    if(!m_scanning)
+    {
+        count = 0;
+        return SL_RESULT_OPERATION_FAIL;
+    }
+
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout);
+
+    while(!m_hasCompleted)
+    {
+        unsigned int remaining = remainingMillis(deadline);
+
+        if(!remaining)
+        {
+            count = 0;
+            return SL_RESULT_OPERATION_TIMEOUT;
+        }
+
+        size_t ready = 0;
+        if(!m_channel->waitForData(1, remaining, &ready) && !ready)
+            continue;
+
+        int read = m_channel->read(m_readBuffer, sizeof(m_readBuffer));
+
+        if(read > 0)
+        {
+            m_readTime = monotonicMicros();
+            m_decoder.feed(m_readBuffer, read, onNodes, this);
+        }
+    }
+
+    count = std::min(count, m_completed.size());
+    memcpy(nodes, m_completed.data(), count * sizeof(ScanNode));
+    m_hasCompleted = false;
+    m_scanStart = m_completedStart;
+
+    return SL_RESULT_OK;
+}
+
+uint64_t NativeScanDevice::getScanStartTime() const
+{
+    return m_scanStart;
+}
+
+bool NativeScanDevice::setNodeListener(NodeListener listener, void* user)
+{
+    m_listener = listener;
+    m_listenerUser = user;
+    return true;
+}
+
+sl_result NativeScanDevice::ascendScanData(ScanNode* nodes, size_t count)
+{
+    // Revolutions come out of the decoder nearly sorted already
+    std::sort(nodes, nodes + count, [](const ScanNode& a, const ScanNode& b)
+    {
+        return a.angle_z_q14 < b.angle_z_q14;
+    });
+
+    return SL_RESULT_OK;
+}
+
+const ProtocolDecoder& NativeScanDevice::getDecoder() const
+{
+    return m_decoder;
+}
+
+bool NativeScanDevice::isNativePort(const std::string& port)
+{
+    return port.compare(0, strlen(PORT_PREFIX), PORT_PREFIX) == 0;
+}
+
+std::string NativeScanDevice::getSerialPath(const std::string& port)
+{
+    return isNativePort(port) ? port.substr(strlen(PORT_PREFIX)) : port;
+}
+
+sl_result NativeScanDevice::sendCommand(uint8_t command, const void* payload, size_t size)
+{
+    if(!m_connected)
+        return SL_RESULT_OPERATION_FAIL;
+
+    uint8_t packet[3 + 255 + 1];
+    size_t length = 0;
+
+    packet[length++] = SYNC_BYTE;
+    packet[length++] = command;
+
+    // Commands with a payload carry its size and an XOR checksum over the
+    // whole packet
+    if(payload)
+    {
+        packet[length++] = (uint8_t) size;
+        memcpy(packet + length, payload, size);
+        length += size;
+
+        uint8_t checksum = 0;
+        for(size_t i = 0; i < length; i++)
+            checksum ^= packet[i];
+
+        packet[length++] = checksum;
+    }
+
+    return m_channel->write(packet, length) == (int) length ? SL_RESULT_OK : SL_RESULT_OPERATION_FAIL;
+}
+
+sl_result NativeScanDevice::readDescriptor(uint8_t* descriptor, unsigned int timeout)
+{
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout);
+    size_t matched = 0;
+
+    // Skip whatever is left of earlier responses up to the sync bytes
+    while(matched < 2)
+    {
+        sl_result result = readExact(descriptor + matched, 1, remainingMillis(deadline));
+
+        if(SL_IS_FAIL(result))
+            return result;
+
+        if(descriptor[matched] == (matched ? SYNC_BYTE2 : SYNC_BYTE))
+            matched++;
+        else if(descriptor[matched] == SYNC_BYTE)
+        {
+            descriptor[0] = SYNC_BYTE;
+            matched = 1;
+        }
+        else
+            matched = 0;
+    }
+
+    return readExact(descriptor + 2, ProtocolDecoder::DESCRIPTOR_SIZE - 2, remainingMillis(deadline));
+}
+
+sl_result NativeScanDevice::readResponse(uint8_t type, void* payload, size_t size, unsigned int timeout)
+{
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout);
+    uint8_t descriptor[ProtocolDecoder::DESCRIPTOR_SIZE];
+
+    sl_result result = readDescriptor(descriptor, timeout);
+
+    if(SL_IS_FAIL(result))
+        return result;
+
+    uint32_t length = (descriptor[2] | (descriptor[3] << 8) | (descriptor[4] << 16) | ((uint32_t) descriptor[5] << 24)) & 0x3FFFFFFF;
+
+    if(descriptor[6] != type || length < size)
+        return SL_RESULT_INVALID_DATA;
+
+    return readExact(payload, size, remainingMillis(deadline));
+}
+
+sl_result NativeScanDevice::readExact(void* data, size_t size, unsigned int timeout)
+{
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout);
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    size_t received = 0;
+
+    while(received < size)
+    {
+        unsigned int remaining = remainingMillis(deadline);
+
+        if(!remaining)
+            return SL_RESULT_OPERATION_TIMEOUT;
+
+        size_t ready = 0;
+        if(!m_channel->waitForData(size - received, remaining, &ready) && !ready)
+            continue;
+
+        int read = m_channel->read(bytes + received, size - received);
+
+        if(read > 0)
+            received += read;
+    }
+
+    return SL_RESULT_OK;
+}
+
+sl_result NativeScanDevice::queryTypicalScanMode(uint16_t& mode)
+{
+    uint8_t request[4] = { CONF_SCAN_MODE_TYPICAL, 0, 0, 0 };
+    sl_result result = sendCommand(CMD_GET_LIDAR_CONF, request, sizeof(request));
+
+    if(SL_IS_FAIL(result))
+        return result;
+
+    uint8_t response[6];
+    result = readResponse(ANS_TYPE_GET_LIDAR_CONF, response, sizeof(response), 500);
+
+    if(SL_IS_FAIL(result))
+    {
+        m_channel->clearReadCache();
+        return result;
+    }
+
+    if(response[0] != CONF_SCAN_MODE_TYPICAL || response[1] || response[2] || response[3])
+        return SL_RESULT_INVALID_DATA;
+
+    mode = response[4] | (response[5] << 8);
+
+    return SL_RESULT_OK;
+}
+
+void NativeScanDevice::onNodes(const ScanNode* nodes, size_t count, void* user)
+{
+    NativeScanDevice* device = static_cast<NativeScanDevice*>(user);
+
+    for(size_t i = 0; i < count; i++)
+    {
+        // A revolution ends where the next one starts, or when it overflows
+        if((nodes[i].flag & 1 || device->m_revolution.size() == MAX_REVOLUTION_NODES) && !device->m_revolution.empty())
+        {
+            device->m_completed.swap(device->m_revolution);
+            device->m_revolution.clear();
+            device->m_hasCompleted = true;
+            device->m_completedStart = device->m_revolutionStart;
+        }
+
+        if(device->m_revolution.empty())
+            device->m_revolutionStart = device->m_readTime;
+
+        device->m_revolution.push_back(nodes[i]);
+    }
+
+    if(device->m_listener)
+        device->m_listener(nodes, count, device->m_readTime, device->m_listenerUser);
+}
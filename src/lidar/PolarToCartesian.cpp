@@ -0,0 +1,304 @@
+#include "lidar/PolarToCartesian.hpp"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define EM_POLAR_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define EM_TARGET_SSE2
+#define EM_TARGET_AVX2
+#else
+#define EM_TARGET_SSE2 __attribute__((target("sse2")))
+#define EM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace em;
+
+namespace
+{
+    // A q14 angle has 1 << 14 steps per quarter turn, bit 14 picks the odd
+    // quarters and bit 15 the lower half of the circle
+    const int QUARTER = 1 << 14;
+    const double PI = 3.14159265358979323846;
+
+    struct SineTable
+    {
+        float entries[QUARTER + 1];
+
+        SineTable()
+        {
+            for(int i = 0; i <= QUARTER; i++)
+                entries[i] = (float) std::sin(i * PI / 2.0 / QUARTER);
+        }
+    };
+
+    const SineTable table;
+
+    inline float tableSin(uint32_t angle)
+    {
+        uint32_t r = angle & (QUARTER - 1);
+        float value = table.entries[angle & QUARTER ? QUARTER - r : r];
+        return angle & (QUARTER << 1) ? -value : value;
+    }
+
+    inline float tableCos(uint32_t angle)
+    {
+        return tableSin((angle + QUARTER) & 0xFFFF);
+    }
+
+    struct Transform
+    {
+        float m[16];
+        bool enabled;
+
+        Transform(const float* transform) :
+            enabled(transform != nullptr)
+        {
+            for(int i = 0; i < 16; i++)
+                m[i] = transform ? transform[i] : (i % 5 == 0 ? 1.0f : 0.0f);
+        }
+    };
+
+    void convertScalar(const uint16_t* angles, const uint32_t* distances, size_t first, size_t count,
+        float* x, float* y, float* z, float scale, const Transform& t)
+    {
+        const float unit = scale * ScanFrame::MILLIMETERS_PER_UNIT;
+
+        for(size_t i = first; i < count; i++)
+        {
+            float d = (int32_t) distances[i] * unit;
+            float px = d * tableCos(angles[i]);
+            float py = d * tableSin(angles[i]);
+
+            if(t.enabled)
+            {
+                x[i] = t.m[0] * px + t.m[4] * py + t.m[12];
+                y[i] = t.m[1] * px + t.m[5] * py + t.m[13];
+
+                if(z)
+                    z[i] = t.m[2] * px + t.m[6] * py + t.m[14];
+            }
+            else
+            {
+                x[i] = px;
+                y[i] = py;
+
+                if(z)
+                    z[i] = 0.0f;
+            }
+        }
+    }
+
+#ifdef EM_POLAR_X86
+    EM_TARGET_SSE2 void convertSSE2(const uint16_t* angles, const uint32_t* distances, size_t count,
+        float* x, float* y, float* z, float scale, const Transform& t)
+    {
+        const __m128 unit = _mm_set1_ps(scale * ScanFrame::MILLIMETERS_PER_UNIT);
+        const __m128 m0 = _mm_set1_ps(t.m[0]), m1 = _mm_set1_ps(t.m[1]), m2 = _mm_set1_ps(t.m[2]);
+        const __m128 m4 = _mm_set1_ps(t.m[4]), m5 = _mm_set1_ps(t.m[5]), m6 = _mm_set1_ps(t.m[6]);
+        const __m128 m12 = _mm_set1_ps(t.m[12]), m13 = _mm_set1_ps(t.m[13]), m14 = _mm_set1_ps(t.m[14]);
+
+        size_t i = 0;
+
+        for(; i + 4 <= count; i += 4)
+        {
+            // SSE2 has no gather, the table lookups stay scalar
+            __m128 s = _mm_set_ps(tableSin(angles[i + 3]), tableSin(angles[i + 2]), tableSin(angles[i + 1]), tableSin(angles[i]));
+            __m128 c = _mm_set_ps(tableCos(angles[i + 3]), tableCos(angles[i + 2]), tableCos(angles[i + 1]), tableCos(angles[i]));
+            __m128 d = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*) (distances + i))), unit);
+
+            __m128 px = _mm_mul_ps(d, c);
+            __m128 py = _mm_mul_ps(d, s);
+
+            if(t.enabled)
+            {
+                _mm_storeu_ps(x + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, px), _mm_mul_ps(m4, py)), m12));
+                _mm_storeu_ps(y + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m1, px), _mm_mul_ps(m5, py)), m13));
+
+                if(z)
+                    _mm_storeu_ps(z + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m2, px), _mm_mul_ps(m6, py)), m14));
+            }
+            else
+            {
+                _mm_storeu_ps(x + i, px);
+                _mm_storeu_ps(y + i, py);
+
+                if(z)
+                    _mm_storeu_ps(z + i, _mm_setzero_ps());
+            }
+        }
+
+        convertScalar(angles, distances, i, count, x, y, z, scale, t);
+    }
+
+    EM_TARGET_AVX2 inline __m256 sinAVX2(__m256i angle)
+    {
+        const __m256i quarter = _mm256_set1_epi32(QUARTER);
+
+        __m256i r = _mm256_and_si256(angle, _mm256_set1_epi32(QUARTER - 1));
+        __m256i odd = _mm256_cmpeq_epi32(_mm256_and_si256(angle, quarter), quarter);
+        __m256i index = _mm256_blendv_epi8(r, _mm256_sub_epi32(quarter, r), odd);
+
+        // Moves bit 15 into the float sign bit
+        __m256i sign = _mm256_slli_epi32(_mm256_and_si256(angle, _mm256_set1_epi32(QUARTER << 1)), 16);
+
+        return _mm256_xor_ps(_mm256_i32gather_ps(table.entries, index, 4), _mm256_castsi256_ps(sign));
+    }
+
+    EM_TARGET_AVX2 void convertAVX2(const uint16_t* angles, const uint32_t* distances, size_t count,
+        float* x, float* y, float* z, float scale, const Transform& t)
+    {
+        const __m256 unit = _mm256_set1_ps(scale * ScanFrame::MILLIMETERS_PER_UNIT);
+        const __m256i quarter = _mm256_set1_epi32(QUARTER);
+        const __m256i wrap = _mm256_set1_epi32(0xFFFF);
+        const __m256 m0 = _mm256_set1_ps(t.m[0]), m1 = _mm256_set1_ps(t.m[1]), m2 = _mm256_set1_ps(t.m[2]);
+        const __m256 m4 = _mm256_set1_ps(t.m[4]), m5 = _mm256_set1_ps(t.m[5]), m6 = _mm256_set1_ps(t.m[6]);
+        const __m256 m12 = _mm256_set1_ps(t.m[12]), m13 = _mm256_set1_ps(t.m[13]), m14 = _mm256_set1_ps(t.m[14]);
+
+        size_t i = 0;
+
+        for(; i + 8 <= count; i += 8)
+        {
+            __m256i a = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) (angles + i)));
+            __m256 s = sinAVX2(a);
+            __m256 c = sinAVX2(_mm256_and_si256(_mm256_add_epi32(a, quarter), wrap));
+            __m256 d = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*) (distances + i))), unit);
+
+            __m256 px = _mm256_mul_ps(d, c);
+            __m256 py = _mm256_mul_ps(d, s);
+
+            if(t.enabled)
+            {
+                _mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m0, px), _mm256_mul_ps(m4, py)), m12));
+                _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m1, px), _mm256_mul_ps(m5, py)), m13));
+
+                if(z)
+                    _mm256_storeu_ps(z + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m2, px), _mm256_mul_ps(m6, py)), m14));
+            }
+            else
+            {
+                _mm256_storeu_ps(x + i, px);
+                _mm256_storeu_ps(y + i, py);
+
+                if(z)
+                    _mm256_storeu_ps(z + i, _mm256_setzero_ps());
+            }
+        }
+
+        convertScalar(angles, distances, i, count, x, y, z, scale, t);
+    }
+
+    bool cpuHasAVX2()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+
+        // The OS has to save the AVX registers too
+        if(!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6)
+            return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+    PolarToCartesian::Implementation detectImplementation()
+    {
+#ifdef EM_POLAR_X86
+        if(cpuHasAVX2())
+            return PolarToCartesian::AVX2;
+
+        return PolarToCartesian::SSE2;
+#else
+        return PolarToCartesian::SCALAR;
+#endif
+    }
+
+    PolarToCartesian::Implementation implementation = detectImplementation();
+}
+
+void PolarToCartesian::convert(const uint16_t* angles, const uint32_t* distances, size_t count,
+    float* x, float* y, float* z, float scale, const float* transform)
+{
+    Transform t(transform);
+
+    switch(implementation)
+    {
+#ifdef EM_POLAR_X86
+    case AVX2:
+        convertAVX2(angles, distances, count, x, y, z, scale, t);
+        break;
+    case SSE2:
+        convertSSE2(angles, distances, count, x, y, z, scale, t);
+        break;
+#endif
+    default:
+        convertScalar(angles, distances, 0, count, x, y, z, scale, t);
+        break;
+    }
+}
+
+void PolarToCartesian::convert(const ScanFrame& frame, float* x, float* y, float* z, float scale, const float* transform)
+{
+    convert(frame.angles(), frame.distances(), frame.size(), x, y, z, scale, transform);
+}
+
+float PolarToCartesian::sin(uint16_t angle)
+{
+    return tableSin(angle);
+}
+
+float PolarToCartesian::cos(uint16_t angle)
+{
+    return tableCos(angle);
+}
+
+bool PolarToCartesian::isSupported(Implementation implementation)
+{
+    switch(implementation)
+    {
+    case SCALAR:
+        return true;
+#ifdef EM_POLAR_X86
+    case SSE2:
+        return true;
+    case AVX2:
+        return cpuHasAVX2();
+#endif
+    default:
+        return false;
+    }
+}
+
+bool PolarToCartesian::setImplementation(Implementation impl)
+{
+    if(!isSupported(impl))
+        return false;
+
+    implementation = impl;
+    return true;
+}
+
+PolarToCartesian::Implementation PolarToCartesian::getImplementation()
+{
+    return implementation;
+}
+
+const char* PolarToCartesian::getImplementationName(Implementation implementation)
+{
+    switch(implementation)
+    {
+    case SCALAR: return "scalar";
+    case SSE2: return "sse2";
+    case AVX2: return "avx2";
+    }
+
+    return "unknown";
+}
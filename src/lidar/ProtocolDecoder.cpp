@@ -0,0 +1,462 @@
+#include "lidar/ProtocolDecoder.hpp"
+
+#include "lidar/Crc32.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace em;
+
+static_assert(sizeof(ScanNode) == 8, "HQ nodes are decoded in place and must match the wire layout");
+
+namespace
+{
+    const size_t STANDARD_SIZE = 5;
+    const size_t CAPSULE_SIZE = 84;
+    const size_t ULTRA_CAPSULE_SIZE = 132;
+    const size_t HQ_SIZE = 781;
+
+    const size_t CAPSULE_CABINS = 16;
+    const size_t DENSE_CAPSULE_CABINS = 40;
+    const size_t ULTRA_CAPSULE_CABINS = 32;
+    const size_t HQ_NODES = 96;
+
+    const uint8_t HQ_SYNC_BYTE = 0xA5;
+    const int FULL_TURN_Q6 = 360 << 6;
+    const int FULL_TURN_Q16 = 360 << 16;
+
+    inline uint16_t read16(const uint8_t* p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+
+    inline uint32_t read32(const uint8_t* p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    inline void makeNode(ScanNode& node, int angleQ6, int distQ2, int syncBit)
+    {
+        if(angleQ6 < 0)
+            angleQ6 += FULL_TURN_Q6;
+        if(angleQ6 >= FULL_TURN_Q6)
+            angleQ6 -= FULL_TURN_Q6;
+
+        // Same conversion the SDK applies when it widens nodes to HQ
+        node.angle_z_q14 = (angleQ6 << 8) / 90;
+        node.dist_mm_q2 = distQ2;
+        node.quality = distQ2 ? 0x2F << 2 : 0;
+        node.flag = syncBit;
+    }
+
+    // Capsules carry the start angle of their first cabin. The cabins of one
+    // capsule are spread evenly up to the start angle of the next one.
+    inline int capsuleStartQ8(const uint8_t* capsule)
+    {
+        return (read16(capsule + 2) & 0x7FFF) << 2;
+    }
+
+    inline int capsuleSpanQ8(const uint8_t* previous, const uint8_t* current)
+    {
+        int diff = capsuleStartQ8(current) - capsuleStartQ8(previous);
+
+        if(diff < 0)
+            diff += 360 << 8;
+
+        return diff;
+    }
+
+    // Ultra capsules store distances with a variable bit scale, larger
+    // distances lose more low bits
+    uint32_t decodeVarBitScale(uint32_t scaled, uint32_t& scaleLevel)
+    {
+        static const uint32_t scaledBase[] = { 3328, 1792, 1280, 512, 0 };
+        static const uint32_t scaleLevels[] = { 4, 3, 2, 1, 0 };
+        static const uint32_t targetBase[] = { 1 << 14, 1 << 12, 1 << 11, 1 << 9, 0 };
+
+        for(int i = 0; i < 5; i++)
+        {
+            int remain = (int) scaled - (int) scaledBase[i];
+
+            if(remain >= 0)
+            {
+                scaleLevel = scaleLevels[i];
+                return targetBase[i] + (remain << scaleLevel);
+            }
+        }
+
+        scaleLevel = 0;
+        return 0;
+    }
+
+    // The device pads the CRC input with zeros to a multiple of four bytes
+    uint32_t hqChecksum(const uint8_t* packet)
+    {
+        static const uint8_t padding[4] = { 0 };
+        const size_t size = HQ_SIZE - 4;
+
+        uint32_t crc = crc32(packet, size);
+
+        if(size % 4)
+            crc = crc32(padding, 4 - size % 4, crc);
+
+        return crc;
+    }
+}
+
+ProtocolDecoder::ProtocolDecoder(Format format) :
+    m_format(format),
+    m_pendingSize(0),
+    m_hasPrevious(false),
+    m_lastAngleQ16(-1),
+    m_batchSize(0)
+{
+}
+
+void ProtocolDecoder::setFormat(Format format)
+{
+    m_format = format;
+    reset();
+}
+
+ProtocolDecoder::Format ProtocolDecoder::getFormat() const
+{
+    return m_format;
+}
+
+void ProtocolDecoder::reset()
+{
+    m_pendingSize = 0;
+    m_hasPrevious = false;
+    m_lastAngleQ16 = -1;
+    m_batchSize = 0;
+    m_stats = Stats();
+}
+
+const ProtocolDecoder::Stats& ProtocolDecoder::getStats() const
+{
+    return m_stats;
+}
+
+size_t ProtocolDecoder::packetSize(Format format)
+{
+    switch(format)
+    {
+    case STANDARD: return STANDARD_SIZE;
+    case CAPSULE: return CAPSULE_SIZE;
+    case DENSE_CAPSULE: return CAPSULE_SIZE;
+    case ULTRA_CAPSULE: return ULTRA_CAPSULE_SIZE;
+    case HQ: return HQ_SIZE;
+    }
+
+    return 0;
+}
+
+bool ProtocolDecoder::parseDescriptor(const uint8_t* data, Format& format)
+{
+    if(data[0] != 0xA5 || data[1] != 0x5A)
+        return false;
+
+    switch(data[6])
+    {
+    case ANS_TYPE_STANDARD: format = STANDARD; break;
+    case ANS_TYPE_CAPSULE: format = CAPSULE; break;
+    case ANS_TYPE_DENSE_CAPSULE: format = DENSE_CAPSULE; break;
+    case ANS_TYPE_ULTRA_CAPSULE: format = ULTRA_CAPSULE; break;
+    case ANS_TYPE_HQ: format = HQ; break;
+    default: return false;
+    }
+
+    return true;
+}
+
+void ProtocolDecoder::feed(const uint8_t* data, size_t size, Callback callback, void* user)
+{
+    const size_t packet = packetSize(m_format);
+    size_t pos = 0;
+
+    // Finish a packet that was split across the previous call first
+    while(m_pendingSize && pos < size)
+    {
+        size_t take = std::min(packet - m_pendingSize, size - pos);
+        memcpy(m_pending + m_pendingSize, data + pos, take);
+        m_pendingSize += take;
+        pos += take;
+
+        if(m_pendingSize < packet)
+            break;
+
+        if(isPacketStart(m_pending, packet) && decodePacket(m_pending, callback, user))
+        {
+            m_pendingSize = 0;
+            break;
+        }
+
+        // Lost sync inside the staged bytes, slide to the next candidate
+        size_t skip = 1;
+        while(skip < m_pendingSize && !isPacketStart(m_pending + skip, m_pendingSize - skip))
+            skip++;
+
+        memmove(m_pending, m_pending + skip, m_pendingSize - skip);
+        m_pendingSize -= skip;
+        m_stats.skippedBytes += skip;
+    }
+
+    if(m_pendingSize)
+    {
+        flushBatch(callback, user);
+        return;
+    }
+
+    while(size - pos >= packet)
+    {
+        if(isPacketStart(data + pos, packet) && decodePacket(data + pos, callback, user))
+            pos += packet;
+        else
+        {
+            pos++;
+            m_stats.skippedBytes++;
+        }
+    }
+
+    while(pos < size && !isPacketStart(data + pos, size - pos))
+    {
+        pos++;
+        m_stats.skippedBytes++;
+    }
+
+    m_pendingSize = size - pos;
+    memcpy(m_pending, data + pos, m_pendingSize);
+
+    flushBatch(callback, user);
+}
+
+bool ProtocolDecoder::isPacketStart(const uint8_t* packet, size_t available) const
+{
+    switch(m_format)
+    {
+    case STANDARD:
+        // Sync bit and its inverse, then the angle check bit
+        if(((packet[0] ^ (packet[0] >> 1)) & 1) == 0)
+            return false;
+        return available < 2 || (packet[1] & 1);
+    case CAPSULE:
+    case DENSE_CAPSULE:
+    case ULTRA_CAPSULE:
+        if((packet[0] >> 4) != 0xA)
+            return false;
+        return available < 2 || (packet[1] >> 4) == 0x5;
+    case HQ:
+        return packet[0] == HQ_SYNC_BYTE;
+    }
+
+    return false;
+}
+
+bool ProtocolDecoder::decodePacket(const uint8_t* packet, Callback callback, void* user)
+{
+    if(m_format == STANDARD)
+    {
+        // One node per packet, so these are batched until the batch fills
+        // or the fed bytes run out
+        decodeStandard(packet, m_nodes[m_batchSize++]);
+        m_stats.packets++;
+        m_stats.nodes++;
+
+        if(m_batchSize == MAX_NODES_PER_PACKET)
+            flushBatch(callback, user);
+
+        return true;
+    }
+
+    if(m_format == HQ)
+    {
+        if(hqChecksum(packet) != read32(packet + HQ_SIZE - 4))
+        {
+            m_stats.checksumErrors++;
+            return false;
+        }
+
+        // HQ nodes are already in their final layout, hand them out in place
+        m_stats.packets++;
+        m_stats.nodes += HQ_NODES;
+        callback(reinterpret_cast<const ScanNode*>(packet + 9), HQ_NODES, user);
+        return true;
+    }
+
+    const size_t size = packetSize(m_format);
+    uint8_t checksum = 0;
+
+    for(size_t i = 2; i < size; i++)
+        checksum ^= packet[i];
+
+    if(checksum != ((packet[0] & 0xF) | ((packet[1] & 0xF) << 4)))
+    {
+        m_stats.checksumErrors++;
+        return false;
+    }
+
+    // The first capsule after a scan starts has no predecessor to pair with
+    if(read16(packet + 2) & 0x8000)
+    {
+        m_hasPrevious = false;
+        m_lastAngleQ16 = -1;
+    }
+
+    size_t count = 0;
+
+    if(m_hasPrevious)
+    {
+        switch(m_format)
+        {
+        case CAPSULE: count = decodeCapsule(packet); break;
+        case DENSE_CAPSULE: count = decodeDenseCapsule(packet); break;
+        case ULTRA_CAPSULE: count = decodeUltraCapsule(packet); break;
+        default: break;
+        }
+    }
+
+    memcpy(m_previous, packet, size);
+    m_hasPrevious = true;
+    m_stats.packets++;
+
+    if(count)
+    {
+        m_stats.nodes += count;
+        callback(m_nodes, count, user);
+    }
+
+    return true;
+}
+
+int ProtocolDecoder::isRevolutionStart(int angleQ16)
+{
+    // Checked against the uncompensated angle of the previous node, which only
+    // ever moves forward until it wraps
+    angleQ16 %= FULL_TURN_Q16;
+    int wrapped = angleQ16 < m_lastAngleQ16 ? 1 : 0;
+    m_lastAngleQ16 = angleQ16;
+
+    return wrapped;
+}
+
+void ProtocolDecoder::flushBatch(Callback callback, void* user)
+{
+    if(m_batchSize)
+        callback(m_nodes, m_batchSize, user);
+
+    m_batchSize = 0;
+}
+
+void ProtocolDecoder::decodeStandard(const uint8_t* packet, ScanNode& node)
+{
+    int angleQ6 = read16(packet + 1) >> 1;
+
+    node.angle_z_q14 = (angleQ6 << 8) / 90;
+    node.dist_mm_q2 = read16(packet + 3);
+    node.quality = (packet[0] >> 2) << 2;
+    node.flag = packet[0] & 1;
+}
+
+size_t ProtocolDecoder::decodeCapsule(const uint8_t* packet)
+{
+    const int incrementQ16 = capsuleSpanQ8(m_previous, packet) << 3;
+    int angleQ16 = capsuleStartQ8(m_previous) << 8;
+    size_t count = 0;
+
+    for(size_t i = 0; i < CAPSULE_CABINS; i++)
+    {
+        const uint8_t* cabin = m_previous + 4 + i * 5;
+        uint16_t distanceAngle1 = read16(cabin);
+        uint16_t distanceAngle2 = read16(cabin + 2);
+        uint8_t offsets = cabin[4];
+
+        int offset1Q3 = (offsets & 0xF) | ((distanceAngle1 & 0x3) << 4);
+        int offset2Q3 = (offsets >> 4) | ((distanceAngle2 & 0x3) << 4);
+
+        int sync = isRevolutionStart(angleQ16);
+        makeNode(m_nodes[count++], (angleQ16 - (offset1Q3 << 13)) >> 10, distanceAngle1 & 0xFFFC, sync);
+        angleQ16 += incrementQ16;
+
+        sync = isRevolutionStart(angleQ16);
+        makeNode(m_nodes[count++], (angleQ16 - (offset2Q3 << 13)) >> 10, distanceAngle2 & 0xFFFC, sync);
+        angleQ16 += incrementQ16;
+    }
+
+    return count;
+}
+
+size_t ProtocolDecoder::decodeDenseCapsule(const uint8_t* packet)
+{
+    const int incrementQ16 = (capsuleSpanQ8(m_previous, packet) << 8) / (int) DENSE_CAPSULE_CABINS;
+    int angleQ16 = capsuleStartQ8(m_previous) << 8;
+
+    for(size_t i = 0; i < DENSE_CAPSULE_CABINS; i++)
+    {
+        int sync = isRevolutionStart(angleQ16);
+        makeNode(m_nodes[i], angleQ16 >> 10, read16(m_previous + 4 + i * 2) << 2, sync);
+        angleQ16 += incrementQ16;
+    }
+
+    return DENSE_CAPSULE_CABINS;
+}
+
+size_t ProtocolDecoder::decodeUltraCapsule(const uint8_t* packet)
+{
+    const int incrementQ16 = (capsuleSpanQ8(m_previous, packet) << 3) / 3;
+    int angleQ16 = capsuleStartQ8(m_previous) << 8;
+    size_t count = 0;
+
+    for(size_t i = 0; i < ULTRA_CAPSULE_CABINS; i++)
+    {
+        uint32_t combined = read32(m_previous + 4 + i * 4);
+
+        // 12-bit major distance followed by two signed 10-bit predictions
+        int major = combined & 0xFFF;
+        int predict1 = ((int32_t) (combined << 10)) >> 22;
+        int predict2 = ((int32_t) combined) >> 22;
+
+        // The second prediction is relative to the next cabin's major
+        const uint8_t* next = i + 1 < ULTRA_CAPSULE_CABINS ? m_previous + 8 + i * 4 : packet + 4;
+        int major2 = read32(next) & 0xFFF;
+
+        uint32_t scale1, scale2;
+        major = decodeVarBitScale(major, scale1);
+        major2 = decodeVarBitScale(major2, scale2);
+
+        int base1 = major;
+        int base2 = major2;
+
+        if(!major && major2)
+        {
+            base1 = major2;
+            scale1 = scale2;
+        }
+
+        int distQ2[3];
+        distQ2[0] = major << 2;
+        distQ2[1] = predict1 == -512 || predict1 == 0x1FF ? 0 : ((predict1 << scale1) + base1) << 2;
+        distQ2[2] = predict2 == -512 || predict2 == 0x1FF ? 0 : ((predict2 << scale2) + base2) << 2;
+
+        for(int j = 0; j < 3; j++)
+        {
+            int sync = isRevolutionStart(angleQ16);
+
+            // Compensates the angle between the laser and the sensor, which
+            // depends on the distance
+            int offsetQ16 = (int) (7.5 * 3.1415926535 * (1 << 16) / 180.0);
+
+            if(distQ2[j] >= 50 * 4)
+            {
+                const int k1 = 98361;
+                const int k2 = k1 / distQ2[j];
+                offsetQ16 = (int) (8 * 3.1415926535 * (1 << 16) / 180) - (k2 << 6) - (k2 * k2 * k2) / 98304;
+            }
+
+            makeNode(m_nodes[count++], (angleQ16 - (int) (offsetQ16 * 180 / 3.14159265)) >> 10, distQ2[j], sync);
+            angleQ16 += incrementQ16;
+        }
+    }
+
+    return count;
+}
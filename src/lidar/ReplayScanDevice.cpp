@@ -0,0 +1,239 @@
+#include "lidar/ReplayScanDevice.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <thread>
+
+using namespace em;
+
+ReplayScanDevice::ReplayScanDevice(const std::string& path) :
+    ScanDevice(REPLAY),
+    m_path(path),
+    m_scanning(false),
+    m_speed(1.0f),
+    m_paused(false),
+    m_looping(true),
+    m_reanchor(true),
+    m_seekRequest(-1),
+    m_position(0),
+    m_next(0),
+    m_anchorTimestamp(0)
+{
+}
+
+sl_result ReplayScanDevice::connect()
+{
+    if(m_recording.isOpen())
+        return SL_RESULT_OK;
+
+    return m_recording.open(m_path) ? SL_RESULT_OK : SL_RESULT_OPERATION_FAIL;
+}
+
+void ReplayScanDevice::disconnect()
+{
+    m_scanning = false;
+    m_recording.close();
+}
+
+sl_result ReplayScanDevice::getDeviceInfo(sl_lidar_response_device_info_t& info, unsigned int timeout)
+{
+    if(!m_recording.isOpen())
+        return SL_RESULT_OPERATION_FAIL;
+
+    const RecordingHeader& header = m_recording.getHeader();
+
+    info.model = header.model;
+    info.firmware_version = header.firmwareVersion;
+    info.hardware_version = header.hardwareVersion;
+    memcpy(info.serialnum, header.serialNumber, sizeof(info.serialnum));
+
+    return SL_RESULT_OK;
+}
+
+sl_result ReplayScanDevice::getHealth(sl_lidar_response_device_health_t& health, unsigned int timeout)
+{
+    if(!m_recording.isOpen())
+        return SL_RESULT_OPERATION_FAIL;
+
+    health.status = SL_LIDAR_STATUS_OK;
+    health.error_code = 0;
+
+    return SL_RESULT_OK;
+}
+
+sl_result ReplayScanDevice::startScan()
+{
+    if(!m_recording.isOpen() || !m_recording.getScanCount())
+        return SL_RESULT_OPERATION_FAIL;
+
+    // Restarting after a stall continues where playback left off
+    m_scanning = true;
+    m_reanchor = true;
+
+    return SL_RESULT_OK;
+}
+
+sl_result ReplayScanDevice::stop()
+{
+    m_scanning = false;
+    return SL_RESULT_OK;
+}
+
+sl_result ReplayScanDevice::grabScanDataHq(ScanNode* nodes, size_t& count, unsigned int timeout)
+{
+    if(!m_scanning)
+    {
+        count = 0;
+        return SL_RESULT_OPERATION_FAIL;
+    }
+
+    size_t numScans = m_recording.getScanCount();
+    int64_t seek = m_seekRequest.exchange(-1);
+
+    if(seek >= 0)
+    {
+        m_next = std::min((size_t) seek, numScans - 1);
+        m_reanchor = true;
+
+        // Show the new position right away even while paused
+        if(m_paused)
+        {
+            count = deliver(m_next++, nodes, count);
+            return SL_RESULT_OK;
+        }
+    }
+
+    if(m_paused)
+    {
+        // Keep handing out the current scan at a modest rate
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        count = deliver(m_position, nodes, count);
+        m_reanchor = true;
+        return SL_RESULT_OK;
+    }
+
+    if(m_next >= numScans)
+    {
+        if(!m_looping)
+        {
+            m_paused = true;
+            count = deliver(numScans - 1, nodes, count);
+            return SL_RESULT_OK;
+        }
+
+        m_next = 0;
+        m_reanchor = true;
+    }
+
+    float speed = m_speed;
+    uint64_t timestamp = m_recording.getTimestamp(m_next);
+
+    if(speed > 0.0f)
+    {
+        if(m_reanchor.exchange(false))
+        {
+            m_anchorTime = Clock::now();
+            m_anchorTimestamp = timestamp;
+        }
+
+        std::chrono::duration<double, std::micro> offset((timestamp - m_anchorTimestamp) / (double) speed);
+        Clock::time_point due = m_anchorTime + std::chrono::duration_cast<Clock::duration>(offset);
+
+        // Skip over long gaps instead of waiting them out
+        if(due - Clock::now() > std::chrono::seconds(1))
+        {
+            m_anchorTime = Clock::now();
+            m_anchorTimestamp = timestamp;
+        }
+        else std::this_thread::sleep_until(due);
+    }
+
+    count = deliver(m_next++, nodes, count);
+
+    return SL_RESULT_OK;
+}
+
+sl_result ReplayScanDevice::ascendScanData(ScanNode* nodes, size_t count)
+{
+    // Recordings are written after the live device already sorted them
+    return SL_RESULT_OK;
+}
+
+void ReplayScanDevice::setSpeed(float speed)
+{
+    m_speed = std::max(speed, 0.0f);
+    m_reanchor = true;
+}
+
+float ReplayScanDevice::getSpeed() const
+{
+    return m_speed;
+}
+
+void ReplayScanDevice::setPaused(bool paused)
+{
+    m_paused = paused;
+    m_reanchor = true;
+}
+
+bool ReplayScanDevice::isPaused() const
+{
+    return m_paused;
+}
+
+void ReplayScanDevice::setLooping(bool looping)
+{
+    m_looping = looping;
+}
+
+bool ReplayScanDevice::isLooping() const
+{
+    return m_looping;
+}
+
+void ReplayScanDevice::seek(size_t scan)
+{
+    m_seekRequest = (int64_t) scan;
+}
+
+void ReplayScanDevice::seekTime(uint64_t timestamp)
+{
+    seek(m_recording.findScan(m_recording.getTimestamp(0) + timestamp));
+}
+
+size_t ReplayScanDevice::getPosition() const
+{
+    return m_position;
+}
+
+uint64_t ReplayScanDevice::getPositionTime() const
+{
+    return m_recording.getTimestamp(m_position) - m_recording.getTimestamp(0);
+}
+
+const MappedRecording& ReplayScanDevice::getRecording() const
+{
+    return m_recording;
+}
+
+bool ReplayScanDevice::isReplayPort(const std::string& port)
+{
+    return port.compare(0, strlen("replay://"), "replay://") == 0;
+}
+
+std::string ReplayScanDevice::getReplayPath(const std::string& port)
+{
+    return isReplayPort(port) ? port.substr(strlen("replay://")) : port;
+}
+
+size_t ReplayScanDevice::deliver(size_t scan, ScanNode* nodes, size_t count)
+{
+    size_t numNodes = m_recording.readScan(scan, nodes, count);
+
+    if(!numNodes && !m_recording.getScan(scan).header)
+        return 0;
+
+    m_position = scan;
+
+    return numNodes;
+}
@@ -0,0 +1,457 @@
+#include "lidar/ScanBus.hpp"
+
+#include "lidar/Clock.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace em;
+
+static Logger logger("ScanBus");
+
+ScanBus::PooledFrame::PooledFrame(ScanBus* owner, size_t capacity) :
+    references(0),
+    bus(owner),
+    index(0),
+    publishedAt(0)
+{
+    if(!frame.reserve(capacity, owner->m_storage))
+        frame.reserve(capacity);
+}
+
+ScanBus::FrameRef::FrameRef() :
+    m_frame(nullptr)
+{
+}
+
+ScanBus::FrameRef::FrameRef(PooledFrame* frame) :
+    m_frame(frame)
+{
+}
+
+ScanBus::FrameRef::~FrameRef()
+{
+    reset();
+}
+
+ScanBus::FrameRef::FrameRef(const FrameRef& other) :
+    m_frame(other.m_frame)
+{
+    if(m_frame)
+        m_frame->references.fetch_add(1, std::memory_order_relaxed);
+}
+
+ScanBus::FrameRef::FrameRef(FrameRef&& other) :
+    m_frame(other.m_frame)
+{
+    other.m_frame = nullptr;
+}
+
+ScanBus::FrameRef& ScanBus::FrameRef::operator=(const FrameRef& other)
+{
+    if(other.m_frame)
+        other.m_frame->references.fetch_add(1, std::memory_order_relaxed);
+
+    reset();
+    m_frame = other.m_frame;
+
+    return *this;
+}
+
+ScanBus::FrameRef& ScanBus::FrameRef::operator=(FrameRef&& other)
+{
+    if(this != &other)
+    {
+        reset();
+        m_frame = other.m_frame;
+        other.m_frame = nullptr;
+    }
+
+    return *this;
+}
+
+void ScanBus::FrameRef::reset()
+{
+    // The last reference hands the frame back for the producer to refill
+    if(m_frame && m_frame->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        m_frame->bus->recycle(m_frame);
+
+    m_frame = nullptr;
+}
+
+const ScanFrame* ScanBus::FrameRef::get() const
+{
+    return m_frame ? &m_frame->frame : nullptr;
+}
+
+const ScanFrame& ScanBus::FrameRef::operator*() const
+{
+    return m_frame->frame;
+}
+
+const ScanFrame* ScanBus::FrameRef::operator->() const
+{
+    return &m_frame->frame;
+}
+
+ScanBus::FrameRef::operator bool() const
+{
+    return m_frame != nullptr;
+}
+
+int ScanBus::FrameRef::useCount() const
+{
+    return m_frame ? m_frame->references.load(std::memory_order_relaxed) : 0;
+}
+
+ScanBus::Subscriber::Subscriber(ScanBus* bus, const std::string& name, size_t queueSize, OverflowPolicy policy, unsigned int blockTimeout) :
+    m_bus(bus),
+    m_name(name),
+    m_policy(policy),
+    m_blockTimeout(blockTimeout),
+    m_queue(std::max(queueSize, (size_t) 1), nullptr),
+    m_head(0),
+    m_queued(0),
+    m_closed(false)
+{
+    m_stats.name = name;
+    m_stats.policy = policy;
+}
+
+ScanBus::Subscriber::~Subscriber()
+{
+    close();
+}
+
+ScanBus::FrameRef ScanBus::Subscriber::next(unsigned int timeout)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if(timeout)
+        m_notEmpty.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return m_closed || m_queued; });
+
+    if(!m_queued)
+        return FrameRef();
+
+    PooledFrame* frame = m_queue[m_head];
+    m_head = (m_head + 1) % m_queue.size();
+    m_queued--;
+
+    m_stats.received++;
+    m_stats.lag = m_bus->getPublished() - frame->index;
+    m_stats.delayMicros = monotonicMicros() - frame->publishedAt;
+    m_stats.maxDelayMicros = std::max(m_stats.maxDelayMicros, m_stats.delayMicros);
+
+    lock.unlock();
+    m_notFull.notify_one();
+
+    // The queue's reference moves to the caller
+    return FrameRef(frame);
+}
+
+void ScanBus::Subscriber::close()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if(!m_closed)
+        m_bus->m_live.fetch_sub(1, std::memory_order_relaxed);
+
+    m_closed = true;
+
+    while(m_queued)
+    {
+        FrameRef dropped(m_queue[m_head]);
+        m_head = (m_head + 1) % m_queue.size();
+        m_queued--;
+    }
+
+    lock.unlock();
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+}
+
+bool ScanBus::Subscriber::isClosed() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_closed;
+}
+
+const std::string& ScanBus::Subscriber::getName() const
+{
+    return m_name;
+}
+
+size_t ScanBus::Subscriber::getQueued() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queued;
+}
+
+ScanBus::SubscriberStats ScanBus::Subscriber::getStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    SubscriberStats stats = m_stats;
+    stats.queued = m_queued;
+
+    return stats;
+}
+
+void ScanBus::Subscriber::push(PooledFrame* frame)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if(m_closed)
+        return;
+
+    if(m_queued == m_queue.size() && m_policy == BLOCK)
+    {
+        uint64_t start = monotonicMicros();
+        m_stats.blocked++;
+
+        m_notFull.wait_for(lock, std::chrono::milliseconds(m_blockTimeout), [this] { return m_closed || m_queued < m_queue.size(); });
+        m_stats.blockedMicros += monotonicMicros() - start;
+
+        if(m_closed)
+            return;
+    }
+
+    if(m_queued == m_queue.size())
+        dropOldest();
+
+    frame->references.fetch_add(1, std::memory_order_relaxed);
+    m_queue[(m_head + m_queued) % m_queue.size()] = frame;
+    m_queued++;
+    m_stats.maxQueued = std::max(m_stats.maxQueued, m_queued);
+
+    lock.unlock();
+    m_notEmpty.notify_one();
+}
+
+void ScanBus::Subscriber::dropOldest()
+{
+    FrameRef dropped(m_queue[m_head]);
+    m_head = (m_head + 1) % m_queue.size();
+    m_queued--;
+    m_stats.dropped++;
+}
+
+ScanBus::ScanBus(size_t capacity, size_t poolSize) :
+    m_capacity(capacity),
+    m_storage(ScanFrame::getStorageSize(capacity), poolSize, true),
+    m_claimed(nullptr),
+    m_published(0),
+    m_live(0)
+{
+    m_frames.reserve(poolSize);
+    m_free.reserve(poolSize);
+
+    for(size_t i = 0; i < poolSize; i++)
+    {
+        m_frames.emplace_back(new PooledFrame(this, capacity));
+        m_free.push_back(m_frames.back().get());
+    }
+}
+
+ScanBus::~ScanBus()
+{
+    std::vector<std::shared_ptr<Subscriber>> subscribers;
+
+    {
+        std::lock_guard<std::mutex> lock(m_subscribersMutex);
+
+        for(const std::weak_ptr<Subscriber>& weak : m_subscribers)
+        {
+            if(std::shared_ptr<Subscriber> subscriber = weak.lock())
+                subscribers.push_back(std::move(subscriber));
+        }
+
+        m_subscribers.clear();
+    }
+
+    for(const std::shared_ptr<Subscriber>& subscriber : subscribers)
+        subscriber->close();
+
+    m_latest.reset();
+}
+
+ScanFrame& ScanBus::claim()
+{
+    if(!m_claimed)
+        m_claimed = allocate();
+
+    return m_claimed->frame;
+}
+
+void ScanBus::publish()
+{
+    PooledFrame* frame = m_claimed;
+
+    if(!frame)
+        return;
+
+    m_claimed = nullptr;
+
+    // Fill the float caches up front, so readers on other threads only ever
+    // find them valid and never write to the frame
+    frame->frame.degrees();
+    frame->frame.millimeters();
+    frame->index = m_published + 1;
+    frame->publishedAt = monotonicMicros();
+    m_published++;
+
+    // Pushing happens outside the lock, a BLOCK subscriber waiting for room
+    // must not hold up subscribe() and getSubscribers() as well
+    {
+        std::lock_guard<std::mutex> lock(m_subscribersMutex);
+        size_t live = 0;
+
+        for(size_t i = 0; i < m_subscribers.size(); i++)
+        {
+            std::shared_ptr<Subscriber> subscriber = m_subscribers[i].lock();
+
+            if(!subscriber)
+                continue;
+
+            m_publishing.push_back(std::move(subscriber));
+            m_subscribers[live++] = m_subscribers[i];
+        }
+
+        m_subscribers.resize(live);
+    }
+
+    for(const std::shared_ptr<Subscriber>& subscriber : m_publishing)
+        subscriber->push(frame);
+
+    m_publishing.clear();
+
+    // The producer's reference becomes latest()'s, the previous frame's is
+    // dropped outside the lock
+    FrameRef previous;
+
+    {
+        std::lock_guard<std::mutex> lock(m_latestMutex);
+        previous = std::move(m_latest);
+        m_latest = FrameRef(frame);
+    }
+}
+
+void ScanBus::publish(const ScanFrame& frame)
+{
+    // Nobody to hand it to, so skip the copy and the float conversions
+    if(!m_live.load(std::memory_order_relaxed))
+    {
+        m_published++;
+        return;
+    }
+
+    claim().copyFrom(frame);
+    publish();
+}
+
+std::shared_ptr<ScanBus::Subscriber> ScanBus::subscribe(const std::string& name, size_t queueSize, OverflowPolicy policy, unsigned int blockTimeout)
+{
+    std::shared_ptr<Subscriber> subscriber(new Subscriber(this, name, queueSize, policy, blockTimeout));
+
+    {
+        std::lock_guard<std::mutex> lock(m_subscribersMutex);
+        m_subscribers.push_back(subscriber);
+        m_live.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return subscriber;
+}
+
+ScanBus::FrameRef ScanBus::latest() const
+{
+    std::lock_guard<std::mutex> lock(m_latestMutex);
+    return m_latest;
+}
+
+std::vector<ScanBus::SubscriberStats> ScanBus::getSubscribers() const
+{
+    std::vector<std::shared_ptr<Subscriber>> subscribers;
+    std::vector<SubscriberStats> stats;
+
+    {
+        std::lock_guard<std::mutex> lock(m_subscribersMutex);
+
+        for(const std::weak_ptr<Subscriber>& weak : m_subscribers)
+        {
+            if(std::shared_ptr<Subscriber> subscriber = weak.lock())
+                subscribers.push_back(std::move(subscriber));
+        }
+    }
+
+    for(const std::shared_ptr<Subscriber>& subscriber : subscribers)
+        stats.push_back(subscriber->getStats());
+
+    return stats;
+}
+
+uint64_t ScanBus::getPublished() const
+{
+    return m_published;
+}
+
+size_t ScanBus::getPoolSize() const
+{
+    std::lock_guard<std::mutex> lock(m_poolMutex);
+    return m_frames.size();
+}
+
+size_t ScanBus::getFreeFrames() const
+{
+    std::lock_guard<std::mutex> lock(m_poolMutex);
+    return m_free.size();
+}
+
+const FramePool& ScanBus::getStorage() const
+{
+    return m_storage;
+}
+
+const char* ScanBus::getPolicyName(OverflowPolicy policy)
+{
+    switch(policy)
+    {
+    case DROP_OLDEST: return "drop oldest";
+    case BLOCK: return "block";
+    }
+
+    return "unknown";
+}
+
+ScanBus::PooledFrame* ScanBus::allocate()
+{
+    std::lock_guard<std::mutex> lock(m_poolMutex);
+    PooledFrame* frame;
+
+    if(m_free.empty())
+    {
+        // Every frame is queued or held by a subscriber, so there is one more
+        // from now on. recycle() never allocates since the free list can
+        // hold all of them.
+        m_frames.emplace_back(new PooledFrame(this, m_capacity));
+        m_free.reserve(m_frames.size());
+        frame = m_frames.back().get();
+
+        logger.infof("Grew the frame pool to %zu frames", m_frames.size());
+    }
+    else
+    {
+        frame = m_free.back();
+        m_free.pop_back();
+    }
+
+    frame->references.store(1, std::memory_order_relaxed);
+
+    return frame;
+}
+
+void ScanBus::recycle(PooledFrame* frame)
+{
+    std::lock_guard<std::mutex> lock(m_poolMutex);
+    m_free.push_back(frame);
+}
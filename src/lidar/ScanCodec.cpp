@@ -0,0 +1,475 @@
+#include "lidar/ScanCodec.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace em;
+
+namespace
+{
+    const size_t GROUP = 16;
+    const uint8_t SYNC = SL_LIDAR_RESP_HQ_FLAG_SYNCBIT;
+
+    inline uint32_t zigzag(int32_t value)
+    {
+        return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+    }
+
+    inline int32_t unzigzag(uint32_t value)
+    {
+        return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+    }
+
+    inline int bitWidth(uint32_t value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return value ? 32 - __builtin_clz(value) : 0;
+#else
+        int width = 0;
+        while(value)
+        {
+            width++;
+            value >>= 1;
+        }
+        return width;
+#endif
+    }
+
+    // Expected angle of node i, step is 16.16 fixed point
+    inline uint16_t expectedAngle(uint16_t first, uint32_t step, size_t i)
+    {
+        return (uint16_t) (first + (uint16_t) (((uint64_t) i * step) >> 16));
+    }
+
+    // Bytes packStream() may write for count values
+    size_t packedBound(size_t count)
+    {
+        return (count + GROUP - 1) / GROUP * (1 + GROUP * 4);
+    }
+
+    // Writes count values as groups of 16, a width byte and 16 values of that
+    // many bits. The last group is padded with zeros.
+    uint8_t* packStream(uint8_t* out, const uint32_t* values, size_t count)
+    {
+        for(size_t g = 0; g < count; g += GROUP)
+        {
+            size_t n = std::min(count - g, GROUP);
+            uint32_t any = 0;
+
+            for(size_t i = 0; i < n; i++)
+                any |= values[g + i];
+
+            int width = bitWidth(any);
+            *out++ = (uint8_t) width;
+
+            if(!width)
+                continue;
+
+            uint64_t bits = 0;
+            int used = 0;
+
+            for(size_t i = 0; i < GROUP; i++)
+            {
+                bits |= (uint64_t) (i < n ? values[g + i] : 0) << used;
+                used += width;
+
+                while(used >= 8)
+                {
+                    *out++ = (uint8_t) bits;
+                    bits >>= 8;
+                    used -= 8;
+                }
+            }
+        }
+
+        return out;
+    }
+
+    // Reads count values written by packStream(), false if the data runs out
+    bool unpackStream(const uint8_t*& in, const uint8_t* end, uint32_t* values, size_t count)
+    {
+        for(size_t g = 0; g < count; g += GROUP)
+        {
+            size_t n = std::min(count - g, GROUP);
+
+            if(in >= end)
+                return false;
+
+            int width = *in++;
+
+            if(width > 32 || end - in < 2 * width)
+                return false;
+
+            if(!width)
+            {
+                std::fill(values + g, values + g + n, 0);
+                continue;
+            }
+
+            const uint8_t* group = in;
+            const uint64_t mask = ((uint64_t) 1 << width) - 1;
+            uint64_t bits = 0;
+            int used = 0;
+
+            for(size_t i = 0; i < n; i++)
+            {
+                while(used < width)
+                {
+                    bits |= (uint64_t) *in++ << used;
+                    used += 8;
+                }
+
+                values[g + i] = (uint32_t) (bits & mask);
+                bits >>= width;
+                used -= width;
+            }
+
+            in = group + 2 * width;
+        }
+
+        return true;
+    }
+
+    uint8_t* writeVarint(uint8_t* out, uint32_t value)
+    {
+        while(value >= 0x80)
+        {
+            *out++ = (uint8_t) (value | 0x80);
+            value >>= 7;
+        }
+
+        *out++ = (uint8_t) value;
+        return out;
+    }
+
+    bool readVarint(const uint8_t*& in, const uint8_t* end, uint32_t& value)
+    {
+        value = 0;
+
+        for(int shift = 0; shift < 35; shift += 7)
+        {
+            if(in >= end)
+                return false;
+
+            uint8_t byte = *in++;
+            value |= (uint32_t) (byte & 0x7F) << shift;
+
+            if(!(byte & 0x80))
+                return true;
+        }
+
+        return false;
+    }
+
+    inline bool isDropped(const uint8_t* mask, size_t i)
+    {
+        return mask && (mask[i >> 3] >> (i & 7)) & 1;
+    }
+}
+
+ScanPredictor::ScanPredictor() :
+    m_previous((size_t) 1 << BIN_BITS, 0),
+    m_primed(false)
+{
+}
+
+void ScanPredictor::reset()
+{
+    m_primed = false;
+}
+
+bool ScanPredictor::isPrimed() const
+{
+    return m_primed;
+}
+
+const uint32_t* ScanPredictor::previous() const
+{
+    return m_previous.data();
+}
+
+void ScanPredictor::update(const ScanNode* nodes, size_t count)
+{
+    std::fill(m_previous.begin(), m_previous.end(), 0);
+
+    for(size_t i = 0; i < count; i++)
+    {
+        if(nodes[i].dist_mm_q2)
+            m_previous[binOf(nodes[i].angle_z_q14)] = nodes[i].dist_mm_q2;
+    }
+
+    m_primed = true;
+}
+
+ScanEncoder::ScanEncoder(uint32_t keyInterval) :
+    m_keyInterval(1),
+    m_chain(0)
+{
+    setKeyInterval(keyInterval);
+}
+
+void ScanEncoder::setKeyInterval(uint32_t keyInterval)
+{
+    m_keyInterval = std::min(std::max(keyInterval, 1u), 65535u);
+    reset();
+}
+
+uint32_t ScanEncoder::getKeyInterval() const
+{
+    return m_keyInterval;
+}
+
+void ScanEncoder::reset()
+{
+    m_chain = 0;
+    m_predictor.reset();
+}
+
+size_t ScanEncoder::encode(const ScanNode* nodes, size_t count, std::vector<uint8_t>& out)
+{
+    if(!m_predictor.isPrimed())
+        m_chain = 0;
+
+    const bool key = m_chain == 0;
+    const uint32_t* previous = m_predictor.previous();
+
+    PackedScanHeader header;
+    memset(&header, 0, sizeof(header));
+
+    header.nodeCount = (uint32_t) count;
+    header.chain = (uint16_t) m_chain;
+    header.firstAngle = count ? nodes[0].angle_z_q14 : 0;
+    header.angleStep = count > 1 ? (uint32_t) (((uint64_t) ((nodes[count - 1].angle_z_q14 - header.firstAngle) & 0xFFFF) << 16) / (count - 1)) : 0;
+
+    m_angles.resize(count);
+    m_distances.resize(count);
+    m_qualities.resize(count);
+    m_dropped.resize(count);
+
+    const size_t maskSize = (count + 7) / 8;
+    out.resize(sizeof(header) + maskSize + 4 * packedBound(count) + count * 6);
+
+    uint8_t* mask = out.data() + sizeof(header);
+    uint8_t* exceptions = out.data() + out.size() - count * 6;
+    uint8_t* exception = exceptions;
+
+    memset(mask, 0, maskSize);
+
+    size_t valid = 0;
+    size_t dropped = 0;
+    size_t lastException = 0;
+    uint32_t lastDistance = 0;
+    uint8_t lastQuality = 0;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        const ScanNode& node = nodes[i];
+
+        m_angles[i] = zigzag((int16_t) (node.angle_z_q14 - expectedAngle(header.firstAngle, header.angleStep, i)));
+
+        if(node.dist_mm_q2)
+        {
+            uint32_t predicted = key ? 0 : previous[ScanPredictor::binOf(node.angle_z_q14)];
+            predicted = predicted ? predicted : lastDistance;
+
+            m_distances[valid] = zigzag((int32_t) (node.dist_mm_q2 - predicted));
+            m_qualities[valid] = zigzag((int8_t) (node.quality - lastQuality));
+            lastDistance = node.dist_mm_q2;
+            lastQuality = node.quality;
+            valid++;
+        }
+        else
+        {
+            mask[i >> 3] |= (uint8_t) (1 << (i & 7));
+            m_dropped[dropped++] = node.quality;
+        }
+
+        if(node.flag != (i == 0 ? SYNC : 0))
+        {
+            exception = writeVarint(exception, (uint32_t) (i - lastException));
+            *exception++ = node.flag;
+            lastException = i;
+            header.exceptions++;
+        }
+    }
+
+    if(dropped)
+        header.flags |= PACKED_DROPOUTS;
+
+    uint8_t* end = out.data() + sizeof(header) + (dropped ? maskSize : 0);
+    end = packStream(end, m_angles.data(), count);
+    end = packStream(end, m_distances.data(), valid);
+    end = packStream(end, m_qualities.data(), valid);
+    end = packStream(end, m_dropped.data(), dropped);
+
+    // The exceptions were written past the end of the streams' room
+    size_t exceptionSize = exception - exceptions;
+    memmove(end, exceptions, exceptionSize);
+    end += exceptionSize;
+
+    size_t size = end - out.data();
+
+    if(size > sizeof(header) + count * sizeof(ScanNode))
+    {
+        header.flags = PACKED_STORED;
+        header.exceptions = 0;
+        size = sizeof(header) + count * sizeof(ScanNode);
+        memcpy(out.data() + sizeof(header), nodes, count * sizeof(ScanNode));
+    }
+
+    memcpy(out.data(), &header, sizeof(header));
+    out.resize(size);
+
+    m_predictor.update(nodes, count);
+    m_chain = (m_chain + 1) % m_keyInterval;
+
+    return size;
+}
+
+size_t ScanEncoder::getMaxEncodedSize(size_t count)
+{
+    return sizeof(PackedScanHeader) + count * sizeof(ScanNode);
+}
+
+ScanDecoder::ScanDecoder() :
+    m_chain(-1)
+{
+}
+
+void ScanDecoder::reset()
+{
+    m_chain = -1;
+    m_predictor.reset();
+}
+
+int ScanDecoder::getChain(const uint8_t* data, size_t size)
+{
+    PackedScanHeader header;
+
+    if(size < sizeof(header))
+        return -1;
+
+    memcpy(&header, data, sizeof(header));
+    return header.chain;
+}
+
+bool ScanDecoder::decode(const uint8_t* data, size_t size, ScanNode* nodes, size_t& count)
+{
+    PackedScanHeader header;
+
+    if(size < sizeof(header))
+        return false;
+
+    memcpy(&header, data, sizeof(header));
+
+    const size_t n = header.nodeCount;
+    const bool key = header.chain == 0;
+
+    if(n > count || (!key && (m_chain < 0 || header.chain != m_chain + 1)))
+        return false;
+
+    const uint8_t* in = data + sizeof(header);
+    const uint8_t* end = data + size;
+
+    // Whatever fails from here leaves the decoder waiting for a key scan
+    m_chain = -1;
+
+    if(header.flags & PACKED_STORED)
+    {
+        if(size != sizeof(header) + n * sizeof(ScanNode))
+            return false;
+
+        memcpy(nodes, in, n * sizeof(ScanNode));
+    }
+    else
+    {
+        const uint8_t* mask = nullptr;
+        size_t dropped = 0;
+
+        if(header.flags & PACKED_DROPOUTS)
+        {
+            if((size_t) (end - in) < (n + 7) / 8)
+                return false;
+
+            mask = in;
+            in += (n + 7) / 8;
+
+            for(size_t i = 0; i < n; i++)
+                dropped += isDropped(mask, i);
+        }
+
+        const size_t valid = n - dropped;
+        const uint32_t* previous = m_predictor.previous();
+        m_values.resize(n);
+
+        if(!unpackStream(in, end, m_values.data(), n))
+            return false;
+
+        for(size_t i = 0; i < n; i++)
+        {
+            nodes[i].angle_z_q14 = (uint16_t) (expectedAngle(header.firstAngle, header.angleStep, i) + unzigzag(m_values[i]));
+            nodes[i].flag = i == 0 ? SYNC : 0;
+        }
+
+        if(!unpackStream(in, end, m_values.data(), valid))
+            return false;
+
+        uint32_t lastDistance = 0;
+
+        for(size_t i = 0, v = 0; i < n; i++)
+        {
+            if(isDropped(mask, i))
+            {
+                nodes[i].dist_mm_q2 = 0;
+                continue;
+            }
+
+            uint32_t predicted = key ? 0 : previous[ScanPredictor::binOf(nodes[i].angle_z_q14)];
+            predicted = predicted ? predicted : lastDistance;
+
+            lastDistance = nodes[i].dist_mm_q2 = predicted + (uint32_t) unzigzag(m_values[v++]);
+        }
+
+        if(!unpackStream(in, end, m_values.data(), valid))
+            return false;
+
+        uint8_t lastQuality = 0;
+
+        for(size_t i = 0, v = 0; i < n; i++)
+        {
+            if(!isDropped(mask, i))
+                lastQuality = nodes[i].quality = (uint8_t) (lastQuality + unzigzag(m_values[v++]));
+        }
+
+        if(!unpackStream(in, end, m_values.data(), dropped))
+            return false;
+
+        for(size_t i = 0, v = 0; i < n; i++)
+        {
+            if(isDropped(mask, i))
+                nodes[i].quality = (uint8_t) m_values[v++];
+        }
+
+        size_t index = 0;
+
+        for(uint32_t e = 0; e < header.exceptions; e++)
+        {
+            uint32_t delta;
+
+            if(!readVarint(in, end, delta) || in >= end || index + delta >= n)
+                return false;
+
+            index += delta;
+            nodes[index].flag = *in++;
+        }
+
+        if(in != end)
+            return false;
+    }
+
+    m_predictor.update(nodes, n);
+    m_chain = header.chain;
+    count = n;
+
+    return true;
+}
@@ -0,0 +1,177 @@
+#include "lidar/ScanDecimator.hpp"
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+using namespace em;
+
+namespace
+{
+    // angle_z_q14 covers a full turn in 16 bits
+    const int TURN_BITS = 16;
+
+    // Squared millimeters, closer than this to the origin is a dropped return
+    const float DROPPED = 25.0f;
+
+    const float PI = 3.14159265358979f;
+
+    // One pass, keeping the nearest and farthest point of each run of points
+    // that fall in the same bucket. ranges only have to order points, 0 is a
+    // dropped return. The updates are written as selects, since branches on
+    // noisy ranges would mispredict often.
+    template<typename Bucket>
+    void keepExtremes(std::vector<uint32_t>& kept, const float* ranges, size_t count, Bucket bucket)
+    {
+        const float NONE = std::numeric_limits<float>::max();
+
+        size_t current = 0;
+        size_t nearest = 0;
+        size_t farthest = 0;
+        float low = NONE;
+        float high = 0.0f;
+
+        auto flush = [&]()
+        {
+            if(high == 0.0f)
+                return;
+
+            kept.push_back((uint32_t) std::min(nearest, farthest));
+
+            if(nearest != farthest)
+                kept.push_back((uint32_t) std::max(nearest, farthest));
+        };
+
+        for(size_t i = 0; i < count; i++)
+        {
+            float r = ranges[i];
+            size_t b = bucket(i);
+
+            if(b != current)
+            {
+                flush();
+                current = b;
+                low = NONE;
+                high = 0.0f;
+            }
+
+            bool closer = r > 0.0f && r < low;
+            bool farther = r > high;
+
+            nearest = closer ? i : nearest;
+            low = closer ? r : low;
+            farthest = farther ? i : farthest;
+            high = farther ? r : high;
+        }
+
+        flush();
+    }
+}
+
+ScanDecimator::ScanDecimator()
+{
+}
+
+size_t ScanDecimator::decimate(const ScanFrame& frame, size_t budget)
+{
+    const size_t count = frame.size();
+    const uint16_t* angles = frame.angles();
+    const uint32_t* distances = frame.distances();
+    const uint64_t buckets = std::max<size_t>(budget / 2, 1);
+
+    m_kept.clear();
+
+    if(budget >= count)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            if(distances[i])
+                m_kept.push_back((uint32_t) i);
+        }
+
+        return m_kept.size();
+    }
+
+    m_ranges.resize(count);
+
+    for(size_t i = 0; i < count; i++)
+        m_ranges[i] = (float) distances[i];
+
+    keepExtremes(m_kept, m_ranges.data(), count,
+        [angles, buckets](size_t i) { return (size_t) ((angles[i] * buckets) >> TURN_BITS); });
+
+    return m_kept.size();
+}
+
+size_t ScanDecimator::decimate(const float* x, const float* y, size_t count, float originX, float originY, size_t budget)
+{
+    const uint64_t buckets = std::max<size_t>(budget / 2, 1);
+
+    // Squared ranges will do to order points
+    m_ranges.resize(count);
+
+    for(size_t i = 0; i < count; i++)
+    {
+        float dx = x[i] - originX;
+        float dy = y[i] - originY;
+        float r = dx * dx + dy * dy;
+
+        m_ranges[i] = r < DROPPED ? 0.0f : r;
+    }
+
+    m_kept.clear();
+
+    if(budget >= count)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            if(m_ranges[i] > 0.0f)
+                m_kept.push_back((uint32_t) i);
+        }
+
+        return m_kept.size();
+    }
+
+    // Points only move forward, so the boundaries of the buckets, at
+    // (b + 1) * count / buckets, are walked without dividing
+    const size_t step = (size_t) (count / buckets);
+    const size_t remainder = (size_t) (count % buckets);
+    size_t bucket = 0;
+    size_t next = step;
+    size_t error = remainder;
+
+    keepExtremes(m_kept, m_ranges.data(), count,
+        [=](size_t i) mutable
+        {
+            while(i >= next)
+            {
+                bucket++;
+                next += step;
+                error += remainder;
+
+                if(error >= buckets)
+                {
+                    next++;
+                    error -= buckets;
+                }
+            }
+
+            return bucket;
+        });
+
+    return m_kept.size();
+}
+
+const std::vector<uint32_t>& ScanDecimator::getKept() const
+{
+    return m_kept;
+}
+
+size_t ScanDecimator::getBudget(float radiusPixels, float pointSize)
+{
+    // A bucket per point width along the outermost circle, two points each
+    float circumference = 2.0f * PI * std::max(radiusPixels, 0.0f);
+    float buckets = std::ceil(circumference / std::max(pointSize, 1.0f));
+
+    return 2 * std::max<size_t>((size_t) buckets, 1);
+}
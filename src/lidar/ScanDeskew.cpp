@@ -0,0 +1,156 @@
+#include "lidar/ScanDeskew.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace em;
+
+namespace
+{
+    const float DEGREES_TO_RADIANS = 3.14159265358979f / 180.0f;
+
+    // angle_z_q14 covers a full turn in 16 bits
+    const float TURN = 1 << 16;
+
+    bool hasInterval(const ScanFrame& frame)
+    {
+        return frame.getFirstByteTime() && frame.getFirstByteTime() < frame.getTimestamp();
+    }
+}
+
+ScanDeskew::ScanDeskew(size_t knots)
+{
+    setKnots(knots);
+}
+
+void ScanDeskew::setKnots(size_t knots)
+{
+    m_knots = std::min<size_t>(std::max<size_t>(knots, 1), 1024);
+    m_transforms.resize((m_knots + 1) * 4);
+}
+
+size_t ScanDeskew::getKnots() const
+{
+    return m_knots;
+}
+
+bool ScanDeskew::apply(const ScanFrame& frame, const MotionModel& model, float* x, float* y, uint64_t reference)
+{
+    const size_t count = frame.size();
+
+    if(!count)
+        return true;
+
+    if(!hasInterval(frame))
+        return false;
+
+    const uint64_t start = frame.getFirstByteTime();
+    const uint64_t span = frame.getTimestamp() - start;
+
+    Pose2D target;
+
+    if(!model.getPose(reference ? reference : frame.getTimestamp(), target))
+        return false;
+
+    Pose2D inverse = target.inverse();
+    float* transforms = m_transforms.data();
+
+    for(size_t k = 0; k <= m_knots; k++)
+    {
+        Pose2D pose;
+
+        if(!model.getPose(start + span * k / m_knots, pose))
+            return false;
+
+        Pose2D relative = inverse.compose(pose);
+        transforms[k * 4 + 0] = std::cos(relative.yaw * DEGREES_TO_RADIANS);
+        transforms[k * 4 + 1] = std::sin(relative.yaw * DEGREES_TO_RADIANS);
+        transforms[k * 4 + 2] = relative.x;
+        transforms[k * 4 + 3] = relative.y;
+    }
+
+    if(m_phases.size() < count)
+        m_phases.resize(count);
+
+    // How far through the sweep each node is, in knots. Subtracting in 16
+    // bits wraps nodes before the sync node around to the end of the turn.
+    const uint16_t* angles = frame.angles();
+    const uint16_t first = sweepStart(frame);
+    const float scale = m_knots / TURN;
+    float* phases = m_phases.data();
+
+    for(size_t i = 0; i < count; i++)
+        phases[i] = (uint16_t) (angles[i] - first) * scale;
+
+    const uint32_t* distances = frame.distances();
+    size_t i = 0;
+
+    // Nodes between the same two knots sit next to each other whether the
+    // frame is in capture or angle order, so each run gets a tight loop
+    while(i < count)
+    {
+        size_t knot = (size_t) phases[i];
+        size_t end = i + 1;
+
+        while(end < count && (size_t) phases[end] == knot)
+            end++;
+
+        const float* a = transforms + knot * 4;
+        const float* b = a + 4;
+        const float base = (float) knot;
+
+        for(size_t j = i; j < end; j++)
+        {
+            float t = phases[j] - base;
+            float c = a[0] + (b[0] - a[0]) * t;
+            float s = a[1] + (b[1] - a[1]) * t;
+            float tx = a[2] + (b[2] - a[2]) * t;
+            float ty = a[3] + (b[3] - a[3]) * t;
+
+            float px = x[j];
+            float py = y[j];
+            float nx = c * px - s * py + tx;
+            float ny = s * px + c * py + ty;
+
+            x[j] = distances[j] ? nx : px;
+            y[j] = distances[j] ? ny : py;
+        }
+
+        i = end;
+    }
+
+    return true;
+}
+
+bool ScanDeskew::nodeTimes(const ScanFrame& frame, uint64_t* times)
+{
+    if(!hasInterval(frame))
+        return false;
+
+    const uint16_t* angles = frame.angles();
+    const uint16_t first = sweepStart(frame);
+    const uint64_t start = frame.getFirstByteTime();
+    const uint64_t span = frame.getTimestamp() - start;
+
+    for(size_t i = 0; i < frame.size(); i++)
+        times[i] = start + (span * (uint16_t) (angles[i] - first) >> 16);
+
+    return true;
+}
+
+uint16_t ScanDeskew::sweepStart(const ScanFrame& frame)
+{
+    if(frame.empty())
+        return 0;
+
+    const uint8_t* flags = frame.flags();
+
+    for(size_t i = 0; i < frame.size(); i++)
+    {
+        if(flags[i] & SL_LIDAR_RESP_HQ_FLAG_SYNCBIT)
+            return frame.angles()[i];
+    }
+
+    // Without a sync node the frame is taken to be in capture order
+    return frame.angles()[0];
+}
@@ -0,0 +1,22 @@
+#include "lidar/ScanDevice.hpp"
+
+#include "lidar/SerialScanDevice.hpp"
+#include "lidar/NativeScanDevice.hpp"
+#include "lidar/SimulatedScanDevice.hpp"
+#include "lidar/ReplayScanDevice.hpp"
+
+using namespace em;
+
+std::unique_ptr<ScanDevice> ScanDevice::create(const std::string& port)
+{
+    if(SimulatedScanDevice::isSimulatorPort(port))
+        return std::make_unique<SimulatedScanDevice>(SimulatorParams::parse(port));
+
+    if(ReplayScanDevice::isReplayPort(port))
+        return std::make_unique<ReplayScanDevice>(ReplayScanDevice::getReplayPath(port));
+
+    if(NativeScanDevice::isNativePort(port))
+        return std::make_unique<NativeScanDevice>(NativeScanDevice::getSerialPath(port));
+
+    return std::make_unique<SerialScanDevice>(port);
+}
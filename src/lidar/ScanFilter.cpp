@@ -0,0 +1,677 @@
+#include "lidar/ScanFilter.hpp"
+#include "lidar/MedianNetwork.hpp"
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define EM_FILTER_X86
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#define EM_TARGET_SSE2
+#else
+#define EM_TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+#endif
+
+using namespace em;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // Nodes copied from the other end of the turn onto each side, enough for
+    // the widest neighborhood any stage looks at
+    const size_t PAD = 4;
+
+    // angle_z_q14 covers a full turn in 16 bits
+    const int32_t TURN = 1 << 16;
+    const float RADIANS_PER_UNIT = 6.28318530717958647692f / TURN;
+
+    // Nodes farther apart than this don't shadow each other, there is a gap
+    // in the scan between them
+    const float MAX_SHADOW_GAP = 5.0f * 6.28318530717958647692f / 360.0f;
+
+    int32_t toUnits(float millimeters)
+    {
+        // Well past any device's range, and small enough to add 1 to
+        return (int32_t) std::min(std::max(millimeters, 0.0f), 1e8f) * 4;
+    }
+
+    size_t countScalar(const uint32_t* distances, size_t first, size_t count)
+    {
+        size_t valid = 0;
+
+        for(size_t i = first; i < count; i++)
+            valid += distances[i] != 0;
+
+        return valid;
+    }
+
+    void rangeScalar(uint32_t* distances, size_t first, size_t count, int32_t low, int32_t high)
+    {
+        for(size_t i = first; i < count; i++)
+        {
+            int32_t d = (int32_t) distances[i];
+            distances[i] = d >= low && d <= high ? d : 0;
+        }
+    }
+
+    void qualityScalar(uint32_t* distances, const uint8_t* qualities, size_t first, size_t count, uint8_t minimum)
+    {
+        for(size_t i = first; i < count; i++)
+            distances[i] = qualities[i] >= minimum ? distances[i] : 0;
+    }
+
+    // The neighbor stages read p, the padded copy, and write out
+
+    void shadowScalar(const int32_t* p, const int32_t* a, uint32_t* out, size_t first, size_t count, int neighbors, float tangent)
+    {
+        for(size_t i = first; i < count; i++)
+        {
+            float r1 = (float) p[i];
+            bool veiled = false;
+
+            for(int k = -neighbors; k <= neighbors; k++)
+            {
+                // Short series are exact to a few ulps below MAX_SHADOW_GAP
+                float r2 = (float) p[i + k];
+                float delta = std::abs(a[i + k] - a[i]) * RADIANS_PER_UNIT;
+                float d2 = delta * delta;
+                float s = delta * (1.0f - d2 * (1.0f / 6.0f));
+                float c = 1.0f - d2 * 0.5f * (1.0f - d2 * (1.0f / 12.0f));
+
+                // The line to the neighbor against the beam, seen from this
+                // node. Within shadowAngle of it, or of the reverse, is a veil.
+                float y = r2 * s;
+                float x = r1 - r2 * c;
+
+                veiled |= r2 != 0.0f && delta > 0.0f && delta < MAX_SHADOW_GAP && y < std::abs(x) * tangent;
+            }
+
+            out[i] = veiled ? 0 : p[i];
+        }
+    }
+
+    void mixedPixelScalar(const int32_t* p, uint32_t* out, size_t first, size_t count, int32_t jump)
+    {
+        for(size_t i = first; i < count; i++)
+        {
+            int32_t a = p[i - 1];
+            int32_t b = p[i + 1];
+            int32_t c = p[i];
+
+            bool mixed = a && b && std::abs(c - a) > jump && std::abs(c - b) > jump && (c > a) != (c > b);
+            out[i] = mixed ? 0 : c;
+        }
+    }
+
+    void isolatedScalar(const int32_t* p, uint32_t* out, size_t first, size_t count, int neighbors, int32_t distance)
+    {
+        for(size_t i = first; i < count; i++)
+        {
+            int32_t c = p[i];
+            bool supported = false;
+
+            for(int k = 1; k <= neighbors; k++)
+            {
+                supported |= p[i - k] && std::abs(c - p[i - k]) <= distance;
+                supported |= p[i + k] && std::abs(c - p[i + k]) <= distance;
+            }
+
+            out[i] = supported ? c : 0;
+        }
+    }
+
+    void medianScalar(const int32_t* p, uint32_t* out, size_t first, size_t count, int window)
+    {
+        auto min = [](int32_t a, int32_t b) { return std::min(a, b); };
+        auto max = [](int32_t a, int32_t b) { return std::max(a, b); };
+
+        for(size_t i = first; i < count; i++)
+        {
+            // Dropped neighbors count as this node so they don't pull the
+            // median down, and a dropped node stays dropped
+            int32_t c = p[i];
+            int32_t l1 = p[i - 1] ? p[i - 1] : c;
+            int32_t r1 = p[i + 1] ? p[i + 1] : c;
+            int32_t median;
+
+            if(window == 3)
+                median = median3(l1, c, r1, min, max);
+            else
+            {
+                int32_t l2 = p[i - 2] ? p[i - 2] : c;
+                int32_t r2 = p[i + 2] ? p[i + 2] : c;
+                median = median5(l2, l1, c, r1, r2, min, max);
+            }
+
+            out[i] = c ? median : 0;
+        }
+    }
+
+#ifdef EM_FILTER_X86
+    // SSE2 has neither signed 32 bit min and max nor abs, they are built
+    // from compares
+
+    EM_TARGET_SSE2 inline __m128i select(__m128i mask, __m128i a, __m128i b)
+    {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    }
+
+    EM_TARGET_SSE2 inline __m128i min32(__m128i a, __m128i b)
+    {
+        return select(_mm_cmpgt_epi32(a, b), b, a);
+    }
+
+    EM_TARGET_SSE2 inline __m128i max32(__m128i a, __m128i b)
+    {
+        return select(_mm_cmpgt_epi32(a, b), a, b);
+    }
+
+    EM_TARGET_SSE2 inline __m128i abs32(__m128i a)
+    {
+        __m128i sign = _mm_srai_epi32(a, 31);
+        return _mm_sub_epi32(_mm_xor_si128(a, sign), sign);
+    }
+
+    EM_TARGET_SSE2 inline __m128i load(const void* p)
+    {
+        return _mm_loadu_si128((const __m128i*) p);
+    }
+
+    EM_TARGET_SSE2 inline void store(void* p, __m128i v)
+    {
+        _mm_storeu_si128((__m128i*) p, v);
+    }
+
+    EM_TARGET_SSE2 size_t countSSE2(const uint32_t* distances, size_t count)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i dropped = zero;
+        size_t i = 0;
+
+        // Lanes count down by one for every dropped node
+        for(; i + 4 <= count; i += 4)
+            dropped = _mm_add_epi32(dropped, _mm_cmpeq_epi32(load(distances + i), zero));
+
+        int32_t lanes[4];
+        store(lanes, dropped);
+
+        return i + lanes[0] + lanes[1] + lanes[2] + lanes[3] + countScalar(distances, i, count);
+    }
+
+    EM_TARGET_SSE2 void rangeSSE2(uint32_t* distances, size_t count, int32_t low, int32_t high)
+    {
+        const __m128i below = _mm_set1_epi32(low - 1);
+        const __m128i above = _mm_set1_epi32(high + 1);
+        size_t i = 0;
+
+        for(; i + 4 <= count; i += 4)
+        {
+            __m128i d = load(distances + i);
+            __m128i keep = _mm_and_si128(_mm_cmpgt_epi32(d, below), _mm_cmplt_epi32(d, above));
+            store(distances + i, _mm_and_si128(d, keep));
+        }
+
+        rangeScalar(distances, i, count, low, high);
+    }
+
+    EM_TARGET_SSE2 void qualitySSE2(uint32_t* distances, const uint8_t* qualities, size_t count, uint8_t minimum)
+    {
+        const __m128i threshold = _mm_set1_epi8((char) minimum);
+        size_t i = 0;
+
+        // Sixteen quality bytes at a time, each byte mask widened to the four
+        // distances it covers
+        for(; i + 16 <= count; i += 16)
+        {
+            __m128i q = load(qualities + i);
+            __m128i keep = _mm_cmpeq_epi8(_mm_max_epu8(q, threshold), q);
+            __m128i low = _mm_unpacklo_epi8(keep, keep);
+            __m128i high = _mm_unpackhi_epi8(keep, keep);
+
+            store(distances + i, _mm_and_si128(load(distances + i), _mm_unpacklo_epi16(low, low)));
+            store(distances + i + 4, _mm_and_si128(load(distances + i + 4), _mm_unpackhi_epi16(low, low)));
+            store(distances + i + 8, _mm_and_si128(load(distances + i + 8), _mm_unpacklo_epi16(high, high)));
+            store(distances + i + 12, _mm_and_si128(load(distances + i + 12), _mm_unpackhi_epi16(high, high)));
+        }
+
+        qualityScalar(distances, qualities, i, count, minimum);
+    }
+
+    EM_TARGET_SSE2 void shadowSSE2(const int32_t* p, const int32_t* a, uint32_t* out, size_t count, int neighbors, float tangent)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 unit = _mm_set1_ps(RADIANS_PER_UNIT);
+        const __m128 gap = _mm_set1_ps(MAX_SHADOW_GAP);
+        const __m128 slope = _mm_set1_ps(tangent);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 sixth = _mm_set1_ps(1.0f / 6.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 twelfth = _mm_set1_ps(1.0f / 12.0f);
+        const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        size_t i = 0;
+
+        for(; i + 4 <= count; i += 4)
+        {
+            __m128i center = load(p + i);
+            __m128i angle = load(a + i);
+            __m128 r1 = _mm_cvtepi32_ps(center);
+            __m128i veiled = zero;
+
+            for(int k = -neighbors; k <= neighbors; k++)
+            {
+                if(!k)
+                    continue;
+
+                __m128i neighbor = load(p + i + k);
+                __m128 r2 = _mm_cvtepi32_ps(neighbor);
+                __m128 delta = _mm_mul_ps(_mm_cvtepi32_ps(abs32(_mm_sub_epi32(load(a + i + k), angle))), unit);
+                __m128 d2 = _mm_mul_ps(delta, delta);
+                __m128 s = _mm_mul_ps(delta, _mm_sub_ps(one, _mm_mul_ps(d2, sixth)));
+                __m128 c = _mm_sub_ps(one, _mm_mul_ps(_mm_mul_ps(d2, half), _mm_sub_ps(one, _mm_mul_ps(d2, twelfth))));
+
+                __m128 y = _mm_mul_ps(r2, s);
+                __m128 x = _mm_and_ps(_mm_sub_ps(r1, _mm_mul_ps(r2, c)), magnitude);
+
+                __m128 grazing = _mm_cmplt_ps(y, _mm_mul_ps(x, slope));
+                __m128 near = _mm_and_ps(_mm_cmpgt_ps(delta, _mm_setzero_ps()), _mm_cmplt_ps(delta, gap));
+                __m128i hit = _mm_castps_si128(_mm_and_ps(grazing, near));
+
+                veiled = _mm_or_si128(veiled, _mm_andnot_si128(_mm_cmpeq_epi32(neighbor, zero), hit));
+            }
+
+            store(out + i, _mm_andnot_si128(veiled, center));
+        }
+
+        shadowScalar(p, a, out, i, count, neighbors, tangent);
+    }
+
+    EM_TARGET_SSE2 void mixedPixelSSE2(const int32_t* p, uint32_t* out, size_t count, int32_t jump)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i limit = _mm_set1_epi32(jump);
+        size_t i = 0;
+
+        for(; i + 4 <= count; i += 4)
+        {
+            __m128i a = load(p + i - 1);
+            __m128i b = load(p + i + 1);
+            __m128i c = load(p + i);
+
+            __m128i missing = _mm_or_si128(_mm_cmpeq_epi32(a, zero), _mm_cmpeq_epi32(b, zero));
+            __m128i far = _mm_and_si128(
+                _mm_cmpgt_epi32(abs32(_mm_sub_epi32(c, a)), limit),
+                _mm_cmpgt_epi32(abs32(_mm_sub_epi32(c, b)), limit));
+            __m128i between = _mm_xor_si128(_mm_cmpgt_epi32(c, a), _mm_cmpgt_epi32(c, b));
+            __m128i mixed = _mm_andnot_si128(missing, _mm_and_si128(far, between));
+
+            store(out + i, _mm_andnot_si128(mixed, c));
+        }
+
+        mixedPixelScalar(p, out, i, count, jump);
+    }
+
+    EM_TARGET_SSE2 void isolatedSSE2(const int32_t* p, uint32_t* out, size_t count, int neighbors, int32_t distance)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i limit = _mm_set1_epi32(distance + 1);
+        size_t i = 0;
+
+        for(; i + 4 <= count; i += 4)
+        {
+            __m128i c = load(p + i);
+            __m128i supported = zero;
+
+            for(int k = 1; k <= neighbors; k++)
+            {
+                for(int side = -k; side <= k; side += 2 * k)
+                {
+                    __m128i n = load(p + i + side);
+                    __m128i close = _mm_cmplt_epi32(abs32(_mm_sub_epi32(c, n)), limit);
+                    supported = _mm_or_si128(supported, _mm_andnot_si128(_mm_cmpeq_epi32(n, zero), close));
+                }
+            }
+
+            store(out + i, _mm_and_si128(c, supported));
+        }
+
+        isolatedScalar(p, out, i, count, neighbors, distance);
+    }
+
+    EM_TARGET_SSE2 void medianSSE2(const int32_t* p, uint32_t* out, size_t count, int window)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        auto min = [](__m128i a, __m128i b) { return min32(a, b); };
+        auto max = [](__m128i a, __m128i b) { return max32(a, b); };
+        size_t i = 0;
+
+        for(; i + 4 <= count; i += 4)
+        {
+            __m128i c = load(p + i);
+            __m128i l1 = load(p + i - 1);
+            __m128i r1 = load(p + i + 1);
+            __m128i median;
+
+            l1 = select(_mm_cmpeq_epi32(l1, zero), c, l1);
+            r1 = select(_mm_cmpeq_epi32(r1, zero), c, r1);
+
+            if(window == 3)
+                median = median3(l1, c, r1, min, max);
+            else
+            {
+                __m128i l2 = load(p + i - 2);
+                __m128i r2 = load(p + i + 2);
+
+                l2 = select(_mm_cmpeq_epi32(l2, zero), c, l2);
+                r2 = select(_mm_cmpeq_epi32(r2, zero), c, r2);
+
+                median = median5(l2, l1, c, r1, r2, min, max);
+            }
+
+            store(out + i, _mm_andnot_si128(_mm_cmpeq_epi32(c, zero), median));
+        }
+
+        medianScalar(p, out, i, count, window);
+    }
+#endif
+
+    ScanFilter::Implementation detectImplementation()
+    {
+#ifdef EM_FILTER_X86
+        return ScanFilter::SSE2;
+#else
+        return ScanFilter::SCALAR;
+#endif
+    }
+
+    ScanFilter::Implementation implementation = detectImplementation();
+
+    size_t countReturns(const uint32_t* distances, size_t count)
+    {
+#ifdef EM_FILTER_X86
+        if(implementation == ScanFilter::SSE2)
+            return countSSE2(distances, count);
+#endif
+
+        return countScalar(distances, 0, count);
+    }
+}
+
+ScanFilter::Config::Config() :
+    minRange(150.0f),
+    maxRange(12000.0f),
+    minQuality(10),
+    neighbors(2),
+    shadowAngle(10.0f),
+    mixedPixelJump(300.0f),
+    isolatedDistance(100.0f),
+    medianWindow(3)
+{
+    std::fill(enabled, enabled + STAGE_COUNT, false);
+}
+
+ScanFilter::ScanFilter(const Config& config) :
+    m_runs(0)
+{
+    configure(config);
+    resetStats();
+}
+
+void ScanFilter::configure(const Config& config)
+{
+    m_config = config;
+    m_config.neighbors = std::min(std::max(config.neighbors, 1), 3);
+    m_config.medianWindow = config.medianWindow > 3 ? 5 : 3;
+}
+
+const ScanFilter::Config& ScanFilter::getConfig() const
+{
+    return m_config;
+}
+
+bool ScanFilter::isEnabled() const
+{
+    return std::find(m_config.enabled, m_config.enabled + STAGE_COUNT, true) != m_config.enabled + STAGE_COUNT;
+}
+
+void ScanFilter::apply(ScanFrame& frame)
+{
+    if(!isEnabled())
+        return;
+
+    const size_t count = frame.size();
+    const bool sse2 = implementation == SSE2;
+    uint32_t* distances = frame.distances();
+    size_t valid = countReturns(distances, count);
+
+    for(int s = 0; s < STAGE_COUNT; s++)
+    {
+        // Too few nodes to have neighbors on both sides
+        if(!m_config.enabled[s] || (s >= SHADOW && count <= PAD * 2))
+            continue;
+
+        Clock::time_point start = Clock::now();
+        const int32_t* p = nullptr;
+        const int32_t* a = nullptr;
+
+        if(s >= SHADOW)
+        {
+            pad(frame, s == SHADOW);
+            p = m_distances.data() + PAD;
+            a = m_angles.data() + PAD;
+        }
+
+        switch(s)
+        {
+        case RANGE:
+        {
+            int32_t low = toUnits(m_config.minRange);
+            int32_t high = toUnits(m_config.maxRange);
+#ifdef EM_FILTER_X86
+            if(sse2)
+            {
+                rangeSSE2(distances, count, low, high);
+                break;
+            }
+#endif
+            rangeScalar(distances, 0, count, low, high);
+            break;
+        }
+        case QUALITY:
+#ifdef EM_FILTER_X86
+            if(sse2)
+            {
+                qualitySSE2(distances, frame.qualities(), count, m_config.minQuality);
+                break;
+            }
+#endif
+            qualityScalar(distances, frame.qualities(), 0, count, m_config.minQuality);
+            break;
+        case SHADOW:
+        {
+            float tangent = std::tan(std::min(std::max(m_config.shadowAngle, 0.0f), 89.0f) * 3.14159265358979f / 180.0f);
+#ifdef EM_FILTER_X86
+            if(sse2)
+            {
+                shadowSSE2(p, a, distances, count, m_config.neighbors, tangent);
+                break;
+            }
+#endif
+            shadowScalar(p, a, distances, 0, count, m_config.neighbors, tangent);
+            break;
+        }
+        case MIXED_PIXEL:
+#ifdef EM_FILTER_X86
+            if(sse2)
+            {
+                mixedPixelSSE2(p, distances, count, toUnits(m_config.mixedPixelJump));
+                break;
+            }
+#endif
+            mixedPixelScalar(p, distances, 0, count, toUnits(m_config.mixedPixelJump));
+            break;
+        case ISOLATED:
+#ifdef EM_FILTER_X86
+            if(sse2)
+            {
+                isolatedSSE2(p, distances, count, m_config.neighbors, toUnits(m_config.isolatedDistance));
+                break;
+            }
+#endif
+            isolatedScalar(p, distances, 0, count, m_config.neighbors, toUnits(m_config.isolatedDistance));
+            break;
+        case MEDIAN:
+#ifdef EM_FILTER_X86
+            if(sse2)
+            {
+                medianSSE2(p, distances, count, m_config.medianWindow);
+                break;
+            }
+#endif
+            medianScalar(p, distances, 0, count, m_config.medianWindow);
+            break;
+        }
+
+        uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        size_t remaining = countReturns(distances, count);
+
+        m_stageRuns[s]++;
+        m_nanos[s] += nanos;
+        m_rejected[s] += valid - remaining;
+        m_lastRejected[s] = (uint32_t) (valid - remaining);
+        valid = remaining;
+    }
+
+    m_runs++;
+
+    // The farthest node may have been filtered out
+    frame.resize(count);
+}
+
+uint64_t ScanFilter::getRuns() const
+{
+    return m_runs.load();
+}
+
+double ScanFilter::getMeanMicros(Stage stage) const
+{
+    uint64_t runs = m_stageRuns[stage].load();
+    return runs ? m_nanos[stage].load() / 1000.0 / runs : 0.0;
+}
+
+uint64_t ScanFilter::getRejected(Stage stage) const
+{
+    return m_rejected[stage].load();
+}
+
+uint32_t ScanFilter::getLastRejected(Stage stage) const
+{
+    return m_lastRejected[stage].load();
+}
+
+void ScanFilter::resetStats()
+{
+    m_runs = 0;
+
+    for(int s = 0; s < STAGE_COUNT; s++)
+    {
+        m_stageRuns[s] = 0;
+        m_nanos[s] = 0;
+        m_rejected[s] = 0;
+        m_lastRejected[s] = 0;
+    }
+}
+
+void ScanFilter::pad(const ScanFrame& frame, bool angles)
+{
+    const size_t count = frame.size();
+    const uint32_t* distances = frame.distances();
+
+    if(m_distances.size() < count + PAD * 2)
+    {
+        m_distances.resize(count + PAD * 2);
+        m_angles.resize(count + PAD * 2);
+    }
+
+    int32_t* p = m_distances.data() + PAD;
+    std::copy(distances, distances + count, p);
+
+    for(size_t k = 1; k <= PAD; k++)
+    {
+        p[-(ptrdiff_t) k] = p[count - k];
+        p[count + k - 1] = p[k - 1];
+    }
+
+    if(!angles)
+        return;
+
+    // Angles keep increasing across the ends so differences stay small
+    const uint16_t* source = frame.angles();
+    int32_t* a = m_angles.data() + PAD;
+    std::copy(source, source + count, a);
+
+    for(size_t k = 1; k <= PAD; k++)
+    {
+        a[-(ptrdiff_t) k] = a[count - k] - TURN;
+        a[count + k - 1] = a[k - 1] + TURN;
+    }
+}
+
+const char* ScanFilter::getStageName(Stage stage)
+{
+    switch(stage)
+    {
+    case RANGE: return "range";
+    case QUALITY: return "quality";
+    case SHADOW: return "shadow";
+    case MIXED_PIXEL: return "mixedPixel";
+    case ISOLATED: return "isolated";
+    case MEDIAN: return "median";
+    default: break;
+    }
+
+    return "unknown";
+}
+
+bool ScanFilter::isSupported(Implementation implementation)
+{
+    switch(implementation)
+    {
+    case SCALAR:
+        return true;
+#ifdef EM_FILTER_X86
+    case SSE2:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+bool ScanFilter::setImplementation(Implementation impl)
+{
+    if(!isSupported(impl))
+        return false;
+
+    implementation = impl;
+    return true;
+}
+
+ScanFilter::Implementation ScanFilter::getImplementation()
+{
+    return implementation;
+}
+
+const char* ScanFilter::getImplementationName(Implementation implementation)
+{
+    switch(implementation)
+    {
+    case SCALAR: return "scalar";
+    case SSE2: return "sse2";
+    }
+
+    return "unknown";
+}
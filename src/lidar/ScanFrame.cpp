@@ -0,0 +1,375 @@
+#include "lidar/ScanFrame.hpp"
+
+#include <new>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+
+using namespace em;
+
+namespace
+{
+    std::atomic<uint64_t> heapAllocations(0);
+
+    size_t alignUp(size_t size)
+    {
+        return (size + ScanFrame::ALIGNMENT - 1) & ~(ScanFrame::ALIGNMENT - 1);
+    }
+
+    void* allocate(size_t size)
+    {
+        return ::operator new(size, std::align_val_t(ScanFrame::ALIGNMENT));
+    }
+
+    void release(void* data)
+    {
+        ::operator delete(data, std::align_val_t(ScanFrame::ALIGNMENT));
+    }
+
+    // Offsets of the arrays in a frame's storage, each on its own cache lines
+    struct StorageLayout
+    {
+        size_t distances;
+        size_t qualities;
+        size_t flags;
+        size_t degrees;
+        size_t millimeters;
+        size_t size;
+
+        StorageLayout(size_t capacity)
+        {
+            distances = alignUp(capacity * sizeof(uint16_t));
+            qualities = distances + alignUp(capacity * sizeof(uint32_t));
+            flags = qualities + alignUp(capacity);
+            degrees = flags + alignUp(capacity);
+            millimeters = degrees + alignUp(capacity * sizeof(float));
+            size = millimeters + alignUp(capacity * sizeof(float));
+        }
+    };
+}
+
+ScanFrame::ScanFrame(size_t capacity) :
+    m_capacity(0),
+    m_size(0),
+    m_longest(0),
+    m_sequence(0),
+    m_timestamp(0),
+    m_firstByteTime(0),
+    m_publishTime(0),
+    m_storage(nullptr),
+    m_pool(nullptr),
+    m_angles(nullptr),
+    m_distances(nullptr),
+    m_qualities(nullptr),
+    m_flags(nullptr),
+    m_degrees(nullptr),
+    m_millimeters(nullptr),
+    m_degreesValid(false),
+    m_millimetersValid(false)
+{
+    reserve(capacity);
+}
+
+ScanFrame::~ScanFrame()
+{
+    if(m_pool)
+        m_pool->release(m_storage);
+    else if(m_storage)
+        release(m_storage);
+}
+
+void ScanFrame::reserve(size_t capacity)
+{
+    if(capacity <= m_capacity)
+        return;
+
+    heapAllocations++;
+    adopt(static_cast<uint8_t*>(allocate(StorageLayout(capacity).size)), capacity, nullptr);
+}
+
+bool ScanFrame::reserve(size_t capacity, FramePool& pool)
+{
+    if(m_pool == &pool && capacity <= m_capacity)
+        return true;
+
+    capacity = std::max(capacity, m_capacity);
+
+    if(getStorageSize(capacity) > pool.getBlockSize())
+        return false;
+
+    void* block = pool.acquire();
+
+    if(!block)
+        return false;
+
+    adopt(static_cast<uint8_t*>(block), capacity, &pool);
+
+    return true;
+}
+
+bool ScanFrame::isPooled() const
+{
+    return m_pool != nullptr;
+}
+
+size_t ScanFrame::getStorageSize(size_t capacity)
+{
+    return StorageLayout(capacity).size;
+}
+
+uint64_t ScanFrame::getHeapAllocations()
+{
+    return heapAllocations;
+}
+
+void ScanFrame::adopt(uint8_t* storage, size_t capacity, FramePool* pool)
+{
+    const StorageLayout layout(capacity);
+
+    uint16_t* angles = reinterpret_cast<uint16_t*>(storage);
+    uint32_t* distances = reinterpret_cast<uint32_t*>(storage + layout.distances);
+    uint8_t* qualities = storage + layout.qualities;
+    uint8_t* flags = storage + layout.flags;
+
+    if(m_size)
+    {
+        memcpy(angles, m_angles, m_size * sizeof(uint16_t));
+        memcpy(distances, m_distances, m_size * sizeof(uint32_t));
+        memcpy(qualities, m_qualities, m_size);
+        memcpy(flags, m_flags, m_size);
+    }
+
+    if(m_pool)
+        m_pool->release(m_storage);
+    else if(m_storage)
+        release(m_storage);
+
+    m_storage = storage;
+    m_pool = pool;
+    m_angles = angles;
+    m_distances = distances;
+    m_qualities = qualities;
+    m_flags = flags;
+    m_degrees = reinterpret_cast<float*>(storage + layout.degrees);
+    m_millimeters = reinterpret_cast<float*>(storage + layout.millimeters);
+    m_capacity = capacity;
+
+    invalidate();
+}
+
+size_t ScanFrame::capacity() const
+{
+    return m_capacity;
+}
+
+size_t ScanFrame::size() const
+{
+    return m_size;
+}
+
+bool ScanFrame::empty() const
+{
+    return m_size == 0;
+}
+
+void ScanFrame::assign(const ScanNode* nodes, size_t count)
+{
+    m_size = count < m_capacity ? count : m_capacity;
+
+    for(size_t i = 0; i < m_size; i++)
+    {
+        m_angles[i] = nodes[i].angle_z_q14;
+        m_distances[i] = nodes[i].dist_mm_q2;
+        m_qualities[i] = nodes[i].quality;
+        m_flags[i] = nodes[i].flag;
+    }
+
+    findLongest();
+    invalidate();
+}
+
+void ScanFrame::clear()
+{
+    m_size = 0;
+    m_longest = 0;
+    invalidate();
+}
+
+void ScanFrame::copyFrom(const ScanFrame& other)
+{
+    m_size = other.m_size < m_capacity ? other.m_size : m_capacity;
+
+    memcpy(m_angles, other.m_angles, m_size * sizeof(uint16_t));
+    memcpy(m_distances, other.m_distances, m_size * sizeof(uint32_t));
+    memcpy(m_qualities, other.m_qualities, m_size);
+    memcpy(m_flags, other.m_flags, m_size);
+
+    m_sequence = other.m_sequence;
+    m_timestamp = other.m_timestamp;
+    m_firstByteTime = other.m_firstByteTime;
+    m_publishTime = other.m_publishTime;
+
+    findLongest();
+    invalidate();
+}
+
+void ScanFrame::resize(size_t count)
+{
+    m_size = count < m_capacity ? count : m_capacity;
+    findLongest();
+    invalidate();
+}
+
+const uint16_t* ScanFrame::angles() const
+{
+    return m_angles;
+}
+
+const uint32_t* ScanFrame::distances() const
+{
+    return m_distances;
+}
+
+const uint8_t* ScanFrame::qualities() const
+{
+    return m_qualities;
+}
+
+const uint8_t* ScanFrame::flags() const
+{
+    return m_flags;
+}
+
+uint16_t* ScanFrame::angles()
+{
+    invalidate();
+    return m_angles;
+}
+
+uint32_t* ScanFrame::distances()
+{
+    invalidate();
+    return m_distances;
+}
+
+uint8_t* ScanFrame::qualities()
+{
+    return m_qualities;
+}
+
+uint8_t* ScanFrame::flags()
+{
+    return m_flags;
+}
+
+float ScanFrame::angle(size_t i) const
+{
+    return m_angles[i] * DEGREES_PER_UNIT;
+}
+
+float ScanFrame::distance(size_t i) const
+{
+    return m_distances[i] * MILLIMETERS_PER_UNIT;
+}
+
+void ScanFrame::anglesToDegrees(float* out) const
+{
+    const uint16_t* angles = m_angles;
+
+    for(size_t i = 0; i < m_size; i++)
+        out[i] = angles[i] * DEGREES_PER_UNIT;
+}
+
+void ScanFrame::distancesToMillimeters(float* out) const
+{
+    const uint32_t* distances = m_distances;
+
+    // Distances are far below 2^31, converting through int32 vectorizes on
+    // every target unlike the unsigned conversion
+    for(size_t i = 0; i < m_size; i++)
+        out[i] = (int32_t) distances[i] * MILLIMETERS_PER_UNIT;
+}
+
+const float* ScanFrame::degrees() const
+{
+    if(!m_degreesValid)
+    {
+        anglesToDegrees(m_degrees);
+        m_degreesValid = true;
+    }
+
+    return m_degrees;
+}
+
+const float* ScanFrame::millimeters() const
+{
+    if(!m_millimetersValid)
+    {
+        distancesToMillimeters(m_millimeters);
+        m_millimetersValid = true;
+    }
+
+    return m_millimeters;
+}
+
+size_t ScanFrame::longestIndex() const
+{
+    return m_longest;
+}
+
+void ScanFrame::setSequence(uint64_t sequence)
+{
+    m_sequence = sequence;
+}
+
+uint64_t ScanFrame::getSequence() const
+{
+    return m_sequence;
+}
+
+void ScanFrame::setTimestamp(uint64_t timestamp)
+{
+    m_timestamp = timestamp;
+}
+
+uint64_t ScanFrame::getTimestamp() const
+{
+    return m_timestamp;
+}
+
+void ScanFrame::setFirstByteTime(uint64_t timestamp)
+{
+    m_firstByteTime = timestamp;
+}
+
+uint64_t ScanFrame::getFirstByteTime() const
+{
+    return m_firstByteTime;
+}
+
+void ScanFrame::setPublishTime(uint64_t timestamp)
+{
+    m_publishTime = timestamp;
+}
+
+uint64_t ScanFrame::getPublishTime() const
+{
+    return m_publishTime;
+}
+
+void ScanFrame::invalidate()
+{
+    m_degreesValid = false;
+    m_millimetersValid = false;
+}
+
+void ScanFrame::findLongest()
+{
+    m_longest = 0;
+
+    for(size_t i = 1; i < m_size; i++)
+    {
+        if(m_distances[i] > m_distances[m_longest])
+            m_longest = i;
+    }
+}
@@ -0,0 +1,185 @@
+#include "lidar/ScanGrid.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace em;
+
+namespace
+{
+    // angle_z_q14 covers a full turn in 16 bits
+    const uint32_t TURN = 1 << 16;
+    const uint32_t EMPTY = 0xFFFFFFFF;
+}
+
+ScanGrid::ScanGrid(float resolution, Reduction reduction) :
+    m_resolution(0.0f),
+    m_reduction(reduction),
+    m_bins(0),
+    m_sequence(0),
+    m_timestamp(0)
+{
+    configure(resolution, reduction);
+}
+
+void ScanGrid::configure(float resolution, Reduction reduction)
+{
+    float bins = resolution > 0.0f ? std::round(360.0f / resolution) : 720.0f;
+
+    m_bins = (uint32_t) std::min(std::max(bins, 1.0f), (float) TURN);
+    m_resolution = 360.0f / m_bins;
+    m_reduction = reduction;
+
+    m_ranges.assign(m_bins, 0.0f);
+    m_accumulator.resize(m_bins);
+    m_counts.resize(m_bins);
+    m_sequence = 0;
+    m_timestamp = 0;
+}
+
+float ScanGrid::getResolution() const
+{
+    return m_resolution;
+}
+
+ScanGrid::Reduction ScanGrid::getReduction() const
+{
+    return m_reduction;
+}
+
+size_t ScanGrid::size() const
+{
+    return m_bins;
+}
+
+void ScanGrid::build(const ScanFrame& frame)
+{
+    const size_t count = frame.size();
+    const uint16_t* angles = frame.angles();
+    const uint32_t* distances = frame.distances();
+    const uint32_t bins = m_bins;
+
+    if(m_indices.size() < count)
+        m_indices.resize(count);
+
+    // Position of every node in bins, scaled by 1 << 16. The top half is the
+    // bin and the bottom half how far into it the node is. Plain integer math
+    // the compiler vectorizes.
+    uint32_t* positions = m_indices.data();
+
+    for(size_t i = 0; i < count; i++)
+        positions[i] = angles[i] * bins;
+
+    uint32_t* accumulator = m_accumulator.data();
+    uint32_t* counts = m_counts.data();
+
+    switch(m_reduction)
+    {
+    case MIN:
+        std::fill(m_accumulator.begin(), m_accumulator.end(), EMPTY);
+
+        for(size_t i = 0; i < count; i++)
+        {
+            uint32_t bin = positions[i] >> 16;
+
+            if(distances[i] && distances[i] < accumulator[bin])
+                accumulator[bin] = distances[i];
+        }
+
+        for(uint32_t b = 0; b < bins; b++)
+            m_ranges[b] = accumulator[b] == EMPTY ? 0.0f : (int32_t) accumulator[b] * ScanFrame::MILLIMETERS_PER_UNIT;
+        break;
+    case NEAREST:
+        std::fill(m_accumulator.begin(), m_accumulator.end(), 0);
+        std::fill(m_counts.begin(), m_counts.end(), EMPTY);
+
+        for(size_t i = 0; i < count; i++)
+        {
+            uint32_t bin = positions[i] >> 16;
+            uint32_t offset = (uint32_t) std::abs((int32_t) (positions[i] & 0xFFFF) - (int32_t) (TURN / 2));
+
+            // counts holds how far the chosen node is from the bin center
+            if(distances[i] && offset < counts[bin])
+            {
+                counts[bin] = offset;
+                accumulator[bin] = distances[i];
+            }
+        }
+
+        for(uint32_t b = 0; b < bins; b++)
+            m_ranges[b] = (int32_t) accumulator[b] * ScanFrame::MILLIMETERS_PER_UNIT;
+        break;
+    case MEAN:
+        std::fill(m_accumulator.begin(), m_accumulator.end(), 0);
+        std::fill(m_counts.begin(), m_counts.end(), 0);
+
+        for(size_t i = 0; i < count; i++)
+        {
+            uint32_t bin = positions[i] >> 16;
+
+            if(distances[i])
+            {
+                accumulator[bin] += distances[i];
+                counts[bin]++;
+            }
+        }
+
+        for(uint32_t b = 0; b < bins; b++)
+            m_ranges[b] = counts[b] ? (float) accumulator[b] / counts[b] * ScanFrame::MILLIMETERS_PER_UNIT : 0.0f;
+        break;
+    }
+
+    m_sequence = frame.getSequence();
+    m_timestamp = frame.getTimestamp();
+}
+
+float ScanGrid::range(float degrees) const
+{
+    return m_ranges[binOf(degrees)];
+}
+
+float ScanGrid::rangeAt(size_t bin) const
+{
+    return m_ranges[bin];
+}
+
+const float* ScanGrid::ranges() const
+{
+    return m_ranges.data();
+}
+
+size_t ScanGrid::binOf(float degrees) const
+{
+    float wrapped = degrees - 360.0f * std::floor(degrees / 360.0f);
+    size_t bin = (size_t) (wrapped / m_resolution);
+
+    // A tiny negative angle wraps to exactly 360, which is bin 0
+    return bin < m_bins ? bin : 0;
+}
+
+float ScanGrid::binCenter(size_t bin) const
+{
+    return (bin + 0.5f) * m_resolution;
+}
+
+uint64_t ScanGrid::getSequence() const
+{
+    return m_sequence;
+}
+
+uint64_t ScanGrid::getTimestamp() const
+{
+    return m_timestamp;
+}
+
+const char* ScanGrid::getReductionName(Reduction reduction)
+{
+    switch(reduction)
+    {
+    case MIN: return "min";
+    case NEAREST: return "nearest";
+    case MEAN: return "mean";
+    }
+
+    return "unknown";
+}
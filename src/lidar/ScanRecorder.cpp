@@ -0,0 +1,272 @@
+#include "lidar/ScanRecorder.hpp"
+
+#include "lidar/Clock.hpp"
+#include "lidar/Crc32.hpp"
+#include "Logger.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace em;
+
+static Logger logger("ScanRecorder");
+
+ScanRecorder::ScanRecorder(size_t capacity) :
+    m_file(nullptr),
+    m_offset(0),
+    m_startTimestamp(0),
+    m_encoding(SCAN_ENCODING_RAW),
+    m_slots(std::max(capacity, (size_t) 1)),
+    m_head(0),
+    m_tail(0),
+    m_sequence(0),
+    m_open(false),
+    m_producers(0),
+    m_shouldStop(false),
+    m_scansWritten(0),
+    m_scansDropped(0),
+    m_bytesWritten(0),
+    m_rawBytesWritten(0)
+{
+    for(Slot& slot : m_slots)
+        slot.nodes.resize(8192);
+}
+
+ScanRecorder::~ScanRecorder()
+{
+    close();
+}
+
+bool ScanRecorder::open(const std::string& path, const sl_lidar_response_device_info_t& info, ScanEncoding encoding, uint32_t keyInterval)
+{
+    close();
+
+    m_file = fopen(path.c_str(), "wb");
+
+    if(!m_file)
+    {
+        logger.errorf("Unable to open %s for recording", path.c_str());
+        return false;
+    }
+
+    uint64_t startTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    RecordingHeader header = ScanRecording::makeHeader(info, startTime, encoding);
+
+    if(fwrite(&header, sizeof(header), 1, m_file) != 1)
+    {
+        logger.errorf("Unable to write recording header to %s", path.c_str());
+        fclose(m_file);
+        m_file = nullptr;
+        return false;
+    }
+
+    fflush(m_file);
+
+    m_path = path;
+    m_offset = sizeof(header);
+    m_startTimestamp = monotonicMicros();
+    m_index.clear();
+    m_encoding = encoding;
+    m_encoder.setKeyInterval(keyInterval);
+    m_head = 0;
+    m_tail = 0;
+    m_sequence = 0;
+    m_scansWritten = 0;
+    m_scansDropped = 0;
+    m_bytesWritten = sizeof(header);
+    m_rawBytesWritten = sizeof(header);
+    m_shouldStop = false;
+
+    m_thread = std::thread(writerThread, this);
+    m_open = true;
+
+    logger.infof("Recording %s scans to %s", ScanRecording::getEncodingName(encoding), path.c_str());
+
+    return true;
+}
+
+void ScanRecorder::close()
+{
+    if(!m_file)
+        return;
+
+    // Let any write() that saw the recorder open finish handing over its scan
+    m_open = false;
+    while(m_producers)
+        std::this_thread::yield();
+
+    m_shouldStop = true;
+    m_wake.notify_one();
+
+    if(m_thread.joinable())
+        m_thread.join();
+
+    if(!writeIndex())
+        logger.errorf("Unable to write the index of %s, it can be rebuilt with ScanRecording::recover", m_path.c_str());
+
+    fclose(m_file);
+    m_file = nullptr;
+
+    logger.infof("Recorded %llu scans to %s (%llu dropped)",
+        (unsigned long long) m_scansWritten.load(), m_path.c_str(), (unsigned long long) m_scansDropped.load());
+}
+
+bool ScanRecorder::isOpen() const
+{
+    return m_open;
+}
+
+const std::string& ScanRecorder::getPath() const
+{
+    return m_path;
+}
+
+ScanEncoding ScanRecorder::getEncoding() const
+{
+    return m_encoding;
+}
+
+bool ScanRecorder::write(const ScanNode* nodes, size_t count, uint64_t timestamp)
+{
+    m_producers++;
+
+    if(!m_open)
+    {
+        m_producers--;
+        return false;
+    }
+
+    // Sequence numbers keep counting through drops so gaps show in the file
+    uint32_t sequence = m_sequence++;
+    size_t head = m_head.load(std::memory_order_relaxed);
+
+    if(head - m_tail.load(std::memory_order_acquire) >= m_slots.size())
+    {
+        m_scansDropped++;
+        m_producers--;
+        return false;
+    }
+
+    Slot& slot = m_slots[head % m_slots.size()];
+    slot.count = (uint32_t) std::min(count, slot.nodes.size());
+    slot.sequence = sequence;
+    slot.timestamp = timestamp > m_startTimestamp ? timestamp - m_startTimestamp : 0;
+    memcpy(slot.nodes.data(), nodes, slot.count * sizeof(RecordedNode));
+
+    m_head.store(head + 1, std::memory_order_release);
+    m_producers--;
+
+    m_wake.notify_one();
+
+    return true;
+}
+
+uint64_t ScanRecorder::getScansWritten() const
+{
+    return m_scansWritten;
+}
+
+uint64_t ScanRecorder::getScansDropped() const
+{
+    return m_scansDropped;
+}
+
+uint64_t ScanRecorder::getBytesWritten() const
+{
+    return m_bytesWritten;
+}
+
+uint64_t ScanRecorder::getRawBytesWritten() const
+{
+    return m_rawBytesWritten;
+}
+
+bool ScanRecorder::writeSlot(const Slot& slot)
+{
+    RecordedScanHeader scan;
+    memset(&scan, 0, sizeof(scan));
+
+    const void* payload = slot.nodes.data();
+
+    scan.magic = ScanRecording::SCAN_MAGIC;
+    scan.sequence = slot.sequence;
+    scan.timestamp = slot.timestamp;
+    scan.nodeCount = slot.count;
+    scan.payloadSize = slot.count * sizeof(RecordedNode);
+    scan.encoding = m_encoding;
+
+    if(m_encoding == SCAN_ENCODING_PACKED)
+    {
+        scan.payloadSize = (uint32_t) m_encoder.encode(reinterpret_cast<const ScanNode*>(slot.nodes.data()), slot.count, m_packed);
+        payload = m_packed.data();
+    }
+
+    scan.checksum = crc32(payload, scan.payloadSize);
+
+    if(fwrite(&scan, sizeof(scan), 1, m_file) != 1 ||
+       fwrite(payload, 1, scan.payloadSize, m_file) != scan.payloadSize)
+    {
+        // Rewind so a partial record doesn't end up in the middle of the file,
+        // and start over from a key scan since this one never made it
+        fflush(m_file);
+        fseeko(m_file, m_offset, SEEK_SET);
+        m_encoder.reset();
+        return false;
+    }
+
+    // Flush every scan so that a crash loses at most the scan in flight
+    fflush(m_file);
+
+    m_index.push_back({ m_offset, scan.timestamp });
+    m_offset += sizeof(scan) + scan.payloadSize;
+    m_bytesWritten += sizeof(scan) + scan.payloadSize;
+    m_rawBytesWritten += sizeof(scan) + slot.count * sizeof(RecordedNode);
+
+    return true;
+}
+
+bool ScanRecorder::writeIndex()
+{
+    RecordingFooter footer;
+    memset(&footer, 0, sizeof(footer));
+
+    footer.indexOffset = m_offset;
+    footer.count = (uint32_t) m_index.size();
+    footer.checksum = crc32(m_index.data(), m_index.size() * sizeof(RecordingIndexEntry));
+    memcpy(footer.magic, "RIDX", 4);
+
+    bool written = fwrite(m_index.data(), sizeof(RecordingIndexEntry), m_index.size(), m_file) == m_index.size() &&
+                   fwrite(&footer, sizeof(footer), 1, m_file) == 1;
+
+    return fflush(m_file) == 0 && written;
+}
+
+void ScanRecorder::writerThread(ScanRecorder* recorder)
+{
+    while(true)
+    {
+        size_t tail = recorder->m_tail.load(std::memory_order_relaxed);
+
+        if(tail == recorder->m_head.load(std::memory_order_acquire))
+        {
+            if(recorder->m_shouldStop)
+                break;
+
+            std::unique_lock<std::mutex> lock(recorder->m_mutex);
+            recorder->m_wake.wait_for(lock, std::chrono::milliseconds(10));
+            continue;
+        }
+
+        const Slot& slot = recorder->m_slots[tail % recorder->m_slots.size()];
+
+        if(recorder->writeSlot(slot))
+            recorder->m_scansWritten++;
+        else
+        {
+            logger.errorf("Failed to write scan %u to %s", slot.sequence, recorder->m_path.c_str());
+            recorder->m_scansDropped++;
+        }
+
+        recorder->m_tail.store(tail + 1, std::memory_order_release);
+    }
+}
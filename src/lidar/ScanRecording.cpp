@@ -0,0 +1,220 @@
+#include "lidar/ScanRecording.hpp"
+
+#include "lidar/Crc32.hpp"
+#include "lidar/ScanCodec.hpp"
+
+#include <cstring>
+#include <unistd.h>
+#include <sys/types.h>
+
+using namespace em;
+
+static uint64_t fileSizeOf(FILE* file)
+{
+    fseeko(file, 0, SEEK_END);
+    return (uint64_t) ftello(file);
+}
+
+RecordingHeader ScanRecording::makeHeader(const sl_lidar_response_device_info_t& info, uint64_t startTime, ScanEncoding encoding)
+{
+    RecordingHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, "RPLR", 4);
+    header.version = encoding == SCAN_ENCODING_RAW ? 1 : VERSION;
+    header.headerSize = sizeof(RecordingHeader);
+    header.model = info.model;
+    header.hardwareVersion = info.hardware_version;
+    header.firmwareVersion = info.firmware_version;
+    memcpy(header.serialNumber, info.serialnum, sizeof(header.serialNumber));
+    header.startTime = startTime;
+
+    return header;
+}
+
+bool ScanRecording::isValidHeader(const RecordingHeader& header)
+{
+    return memcmp(header.magic, "RPLR", 4) == 0 &&
+           header.version <= VERSION &&
+           header.headerSize == sizeof(RecordingHeader);
+}
+
+bool ScanRecording::isValidFooter(const RecordingFooter& footer, uint64_t fileSize)
+{
+    if(memcmp(footer.magic, "RIDX", 4) != 0)
+        return false;
+
+    if(footer.indexOffset < sizeof(RecordingHeader))
+        return false;
+
+    return footer.indexOffset + (uint64_t) footer.count * sizeof(RecordingIndexEntry) + sizeof(RecordingFooter) == fileSize;
+}
+
+bool ScanRecording::isValidScan(const RecordedScanHeader& scan, const void* payload)
+{
+    if(scan.magic != SCAN_MAGIC || scan.payloadSize > MAX_PAYLOAD_SIZE)
+        return false;
+
+    if(scan.encoding == SCAN_ENCODING_RAW)
+    {
+        if(scan.payloadSize != scan.nodeCount * sizeof(RecordedNode))
+            return false;
+    }
+    else if(scan.encoding == SCAN_ENCODING_PACKED)
+    {
+        if(scan.nodeCount > MAX_NODES || scan.payloadSize < sizeof(PackedScanHeader))
+            return false;
+    }
+    else return false;
+
+    return !payload || crc32(payload, scan.payloadSize) == scan.checksum;
+}
+
+uint64_t ScanRecording::walkScans(FILE* file, uint64_t fileSize, std::vector<RecordingIndexEntry>& index)
+{
+    std::vector<uint8_t> payload(MAX_PAYLOAD_SIZE);
+    uint64_t offset = sizeof(RecordingHeader);
+
+    index.clear();
+
+    while(offset + sizeof(RecordedScanHeader) <= fileSize)
+    {
+        RecordedScanHeader scan;
+
+        fseeko(file, offset, SEEK_SET);
+        if(fread(&scan, sizeof(scan), 1, file) != 1 || !isValidScan(scan))
+            break;
+
+        if(offset + sizeof(scan) + scan.payloadSize > fileSize)
+            break;
+
+        if(fread(payload.data(), 1, scan.payloadSize, file) != scan.payloadSize || !isValidScan(scan, payload.data()))
+            break;
+
+        index.push_back({ offset, scan.timestamp });
+        offset += sizeof(scan) + scan.payloadSize;
+    }
+
+    return offset;
+}
+
+uint64_t ScanRecording::walkScans(const uint8_t* data, uint64_t size, std::vector<RecordingIndexEntry>& index)
+{
+    uint64_t offset = sizeof(RecordingHeader);
+
+    index.clear();
+
+    while(offset + sizeof(RecordedScanHeader) <= size)
+    {
+        const RecordedScanHeader* scan = reinterpret_cast<const RecordedScanHeader*>(data + offset);
+
+        if(!isValidScan(*scan) || offset + sizeof(*scan) + scan->payloadSize > size)
+            break;
+
+        if(!isValidScan(*scan, scan + 1))
+            break;
+
+        index.push_back({ offset, scan->timestamp });
+        offset += sizeof(*scan) + scan->payloadSize;
+    }
+
+    return offset;
+}
+
+bool ScanRecording::readIndex(const std::string& path, RecordingHeader& header, std::vector<RecordingIndexEntry>& index, bool* hadFooter)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+
+    if(!file)
+        return false;
+
+    if(hadFooter)
+        *hadFooter = false;
+
+    if(fread(&header, sizeof(header), 1, file) != 1 || !isValidHeader(header))
+    {
+        fclose(file);
+        return false;
+    }
+
+    uint64_t fileSize = fileSizeOf(file);
+    RecordingFooter footer;
+
+    if(fileSize >= sizeof(RecordingHeader) + sizeof(RecordingFooter))
+    {
+        fseeko(file, fileSize - sizeof(footer), SEEK_SET);
+
+        if(fread(&footer, sizeof(footer), 1, file) == 1 && isValidFooter(footer, fileSize))
+        {
+            index.resize(footer.count);
+            fseeko(file, footer.indexOffset, SEEK_SET);
+
+            if(fread(index.data(), sizeof(RecordingIndexEntry), footer.count, file) == footer.count &&
+               crc32(index.data(), index.size() * sizeof(RecordingIndexEntry)) == footer.checksum)
+            {
+                if(hadFooter)
+                    *hadFooter = true;
+
+                fclose(file);
+                return true;
+            }
+        }
+    }
+
+    walkScans(file, fileSize, index);
+    fclose(file);
+
+    return true;
+}
+
+long ScanRecording::recover(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "r+b");
+
+    if(!file)
+        return -1;
+
+    RecordingHeader header;
+
+    if(fread(&header, sizeof(header), 1, file) != 1 || !isValidHeader(header))
+    {
+        fclose(file);
+        return -1;
+    }
+
+    std::vector<RecordingIndexEntry> index;
+    uint64_t end = walkScans(file, fileSizeOf(file), index);
+
+    fflush(file);
+    if(ftruncate(fileno(file), end) != 0)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    RecordingFooter footer;
+    memset(&footer, 0, sizeof(footer));
+    footer.indexOffset = end;
+    footer.count = (uint32_t) index.size();
+    footer.checksum = crc32(index.data(), index.size() * sizeof(RecordingIndexEntry));
+    memcpy(footer.magic, "RIDX", 4);
+
+    fseeko(file, end, SEEK_SET);
+    bool written = fwrite(index.data(), sizeof(RecordingIndexEntry), index.size(), file) == index.size() &&
+                   fwrite(&footer, sizeof(footer), 1, file) == 1;
+
+    fclose(file);
+
+    return written ? (long) index.size() : -1;
+}
+
+const char* ScanRecording::getEncodingName(ScanEncoding encoding)
+{
+    switch(encoding)
+    {
+    case SCAN_ENCODING_RAW: return "raw";
+    case SCAN_ENCODING_PACKED: return "packed";
+    }
+
+    return "unknown";
+}
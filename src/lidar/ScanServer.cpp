@@ -0,0 +1,587 @@
+#include "lidar/ScanServer.hpp"
+
+#include "lidar/Crc32.hpp"
+#include "Logger.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+using namespace em;
+
+static Logger logger("ScanServer");
+
+namespace
+{
+    bool setNonBlocking(int fd)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+
+    std::string describe(const char* scheme, const sockaddr_in& address)
+    {
+        char host[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+
+        return std::string(scheme) + host + ":" + std::to_string(ntohs(address.sin_port));
+    }
+
+    void closeSocket(int& fd)
+    {
+        if(fd != -1)
+            ::close(fd);
+
+        fd = -1;
+    }
+}
+
+ScanServer::Config::Config() :
+    udpAddress("127.0.0.1"),
+    udpPort(7500),
+    tcpAddress("127.0.0.1"),
+    tcpPort(7501),
+    encoding(SCAN_ENCODING_PACKED),
+    keyInterval(10),
+    datagramSize(1400),
+    maxQueuedBytes(1024 * 1024),
+    socketBufferSize(256 * 1024)
+{
+}
+
+ScanServer::ScanServer(size_t capacity) :
+    m_ring(std::max(capacity, (size_t) 1)),
+    m_udpSocket(-1),
+    m_tcpSocket(-1),
+    m_wake{ -1, -1 },
+    m_tcpPort(0),
+    m_udpHost(0),
+    m_running(false),
+    m_producers(0),
+    m_shouldStop(false),
+    m_framesPublished(0),
+    m_framesDropped(0)
+{
+    for(size_t i = 0; i < m_ring.slotCount(); i++)
+        m_ring.slot(i).nodes.resize(ScanRecording::MAX_NODES);
+}
+
+ScanServer::~ScanServer()
+{
+    stop();
+}
+
+bool ScanServer::start(const Config& config)
+{
+    stop();
+
+    m_config = config;
+    m_config.datagramSize = std::min(std::max(m_config.datagramSize, sizeof(StreamDatagramHeader) + 64), (size_t) 65507);
+
+    if(!openSockets())
+    {
+        closeSockets();
+        return false;
+    }
+
+    // Frames left over from a previous run would go out of order
+    while(m_ring.front())
+        m_ring.pop();
+
+    m_encoder.setKeyInterval(m_config.keyInterval);
+    m_framesPublished = 0;
+    m_framesDropped = 0;
+    m_shouldStop = false;
+
+    m_thread = std::thread(ioThread, this);
+    m_running = true;
+
+    logger.infof("Streaming %s scans over%s%s", ScanRecording::getEncodingName(m_config.encoding),
+        m_udpSocket != -1 ? (" " + m_udpStats.address).c_str() : "",
+        m_tcpSocket != -1 ? (" tcp://" + m_config.tcpAddress + ":" + std::to_string(m_tcpPort)).c_str() : "");
+
+    return true;
+}
+
+void ScanServer::stop()
+{
+    if(!m_running)
+        return;
+
+    // Let any publish() that saw the server running finish with the pipe
+    m_running = false;
+    while(m_producers)
+        std::this_thread::yield();
+
+    m_shouldStop = true;
+
+    char wake = 0;
+    if(write(m_wake[1], &wake, 1) < 0) {}
+
+    m_thread.join();
+    closeSockets();
+
+    logger.infof("Stopped streaming after %llu frames (%llu dropped)",
+        (unsigned long long) m_framesPublished, (unsigned long long) m_framesDropped);
+}
+
+bool ScanServer::isRunning() const
+{
+    return m_running;
+}
+
+const ScanServer::Config& ScanServer::getConfig() const
+{
+    return m_config;
+}
+
+uint16_t ScanServer::getTcpPort() const
+{
+    return m_tcpPort;
+}
+
+bool ScanServer::publish(const ScanFrame& frame)
+{
+    m_producers++;
+
+    if(!m_running)
+    {
+        m_producers--;
+        return false;
+    }
+
+    Slot* slot = m_ring.claim();
+
+    if(!slot)
+    {
+        m_framesDropped++;
+        m_producers--;
+        return false;
+    }
+
+    const size_t count = std::min(frame.size(), slot->nodes.size());
+    const uint16_t* angles = frame.angles();
+    const uint32_t* distances = frame.distances();
+    const uint8_t* qualities = frame.qualities();
+    const uint8_t* flags = frame.flags();
+
+    for(size_t i = 0; i < count; i++)
+        slot->nodes[i] = { angles[i], distances[i], qualities[i], flags[i] };
+
+    slot->count = (uint32_t) count;
+    slot->sequence = (uint32_t) frame.getSequence();
+    slot->timestamp = frame.getTimestamp();
+
+    m_ring.push();
+    m_framesPublished++;
+
+    // The I/O thread may be waiting in poll()
+    char wake = 0;
+    if(write(m_wake[1], &wake, 1) < 0) {}
+
+    m_producers--;
+
+    return true;
+}
+
+uint64_t ScanServer::getFramesPublished() const
+{
+    return m_framesPublished;
+}
+
+uint64_t ScanServer::getFramesDropped() const
+{
+    return m_framesDropped;
+}
+
+std::vector<ScanServer::SubscriberStats> ScanServer::getSubscribers() const
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+
+    std::vector<SubscriberStats> subscribers;
+
+    if(m_udpSocket != -1)
+        subscribers.push_back(m_udpStats);
+
+    for(const Subscriber& subscriber : m_subscribers)
+        subscribers.push_back(subscriber.stats);
+
+    return subscribers;
+}
+
+bool ScanServer::openSockets()
+{
+    if(pipe(m_wake) != 0 || !setNonBlocking(m_wake[0]) || !setNonBlocking(m_wake[1]))
+    {
+        logger.errorf("Unable to create the wake pipe");
+        return false;
+    }
+
+    if(!m_config.udpAddress.empty())
+    {
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(m_config.udpPort);
+
+        if(inet_pton(AF_INET, m_config.udpAddress.c_str(), &address.sin_addr) != 1)
+        {
+            logger.errorf("%s is not an IPv4 address", m_config.udpAddress.c_str());
+            return false;
+        }
+
+        m_udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+
+        if(m_udpSocket == -1 || !setNonBlocking(m_udpSocket))
+        {
+            logger.errorf("Unable to create the UDP socket: %s", strerror(errno));
+            return false;
+        }
+
+        // Room for a few frames worth of fragments
+        int bufferSize = 1024 * 1024;
+        setsockopt(m_udpSocket, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+
+        if(IN_MULTICAST(ntohl(address.sin_addr.s_addr)))
+        {
+            // Stay on this box and its own subscribers
+            unsigned char ttl = 1;
+            unsigned char loop = 1;
+            setsockopt(m_udpSocket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+            setsockopt(m_udpSocket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+        }
+
+        m_udpHost = address.sin_addr.s_addr;
+        m_udpStats = SubscriberStats();
+        m_udpStats.address = describe("udp://", address);
+    }
+
+    if(!m_config.tcpAddress.empty())
+    {
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(m_config.tcpPort);
+
+        if(inet_pton(AF_INET, m_config.tcpAddress.c_str(), &address.sin_addr) != 1)
+        {
+            logger.errorf("%s is not an IPv4 address", m_config.tcpAddress.c_str());
+            return false;
+        }
+
+        m_tcpSocket = socket(AF_INET, SOCK_STREAM, 0);
+
+        int reuse = 1;
+        setsockopt(m_tcpSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        socklen_t length = sizeof(address);
+
+        if(m_tcpSocket == -1 ||
+           bind(m_tcpSocket, (sockaddr*) &address, sizeof(address)) != 0 ||
+           listen(m_tcpSocket, 8) != 0 ||
+           !setNonBlocking(m_tcpSocket) ||
+           getsockname(m_tcpSocket, (sockaddr*) &address, &length) != 0)
+        {
+            logger.errorf("Unable to listen on %s:%u: %s", m_config.tcpAddress.c_str(), m_config.tcpPort, strerror(errno));
+            return false;
+        }
+
+        m_tcpPort = ntohs(address.sin_port);
+    }
+
+    return true;
+}
+
+void ScanServer::closeSockets()
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+
+    for(Subscriber& subscriber : m_subscribers)
+        closeSocket(subscriber.socket);
+
+    m_subscribers.clear();
+
+    closeSocket(m_udpSocket);
+    closeSocket(m_tcpSocket);
+    closeSocket(m_wake[0]);
+    closeSocket(m_wake[1]);
+}
+
+bool ScanServer::encodeFrame(const Slot& slot)
+{
+    RecordedScanHeader header;
+    memset(&header, 0, sizeof(header));
+
+    const void* payload = slot.nodes.data();
+    bool key = true;
+
+    header.magic = ScanRecording::SCAN_MAGIC;
+    header.sequence = slot.sequence;
+    header.timestamp = slot.timestamp;
+    header.nodeCount = slot.count;
+    header.payloadSize = slot.count * sizeof(ScanNode);
+    header.encoding = m_config.encoding;
+
+    if(m_config.encoding == SCAN_ENCODING_PACKED)
+    {
+        header.payloadSize = (uint32_t) m_encoder.encode(slot.nodes.data(), slot.count, m_packed);
+        payload = m_packed.data();
+        key = ScanDecoder::getChain(m_packed.data(), m_packed.size()) == 0;
+    }
+
+    header.checksum = crc32(payload, header.payloadSize);
+
+    m_frame.resize(sizeof(header) + header.payloadSize);
+    memcpy(m_frame.data(), &header, sizeof(header));
+    memcpy(m_frame.data() + sizeof(header), payload, header.payloadSize);
+
+    return key;
+}
+
+void ScanServer::sendDatagrams(uint32_t sequence)
+{
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(m_config.udpPort);
+    address.sin_addr.s_addr = m_udpHost;
+
+    const size_t body = m_config.datagramSize - sizeof(StreamDatagramHeader);
+    const size_t fragments = (m_frame.size() + body - 1) / body;
+
+    m_datagram.resize(m_config.datagramSize);
+
+    StreamDatagramHeader header;
+    header.magic = DATAGRAM_MAGIC;
+    header.sequence = sequence;
+    header.frameSize = (uint32_t) m_frame.size();
+    header.fragmentCount = (uint16_t) fragments;
+
+    size_t bytes = 0;
+    bool dropped = false;
+
+    for(size_t f = 0; f < fragments && !dropped; f++)
+    {
+        size_t offset = f * body;
+        size_t size = std::min(body, m_frame.size() - offset);
+
+        header.offset = (uint32_t) offset;
+        header.fragment = (uint16_t) f;
+
+        memcpy(m_datagram.data(), &header, sizeof(header));
+        memcpy(m_datagram.data() + sizeof(header), m_frame.data() + offset, size);
+
+        ssize_t sent = sendto(m_udpSocket, m_datagram.data(), sizeof(header) + size, MSG_NOSIGNAL, (sockaddr*) &address, sizeof(address));
+
+        if(sent == (ssize_t) (sizeof(header) + size))
+            bytes += sent;
+        else
+            dropped = true;
+    }
+
+    // A frame missing a fragment is lost to every receiver
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    m_udpStats.bytesSent += bytes;
+
+    if(dropped)
+        m_udpStats.framesDropped++;
+    else
+        m_udpStats.framesSent++;
+}
+
+void ScanServer::queueFrame(Subscriber& subscriber, bool key)
+{
+    // A packed frame is no use without the one before it, so a subscriber
+    // waits for the next key frame after joining or missing a frame
+    if(!key && !subscriber.synced)
+    {
+        if(subscriber.started)
+        {
+            std::lock_guard<std::mutex> lock(m_statsMutex);
+            subscriber.stats.framesDropped++;
+        }
+
+        return;
+    }
+
+    if(subscriber.pending.size() - subscriber.sent + m_frame.size() > m_config.maxQueuedBytes)
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        subscriber.stats.framesDropped++;
+        subscriber.synced = false;
+        return;
+    }
+
+    if(subscriber.sent == subscriber.pending.size())
+    {
+        subscriber.pending.clear();
+        subscriber.sent = 0;
+    }
+
+    subscriber.pending.insert(subscriber.pending.end(), m_frame.begin(), m_frame.end());
+    subscriber.started = true;
+    subscriber.synced = true;
+
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    subscriber.stats.framesSent++;
+}
+
+bool ScanServer::flush(Subscriber& subscriber)
+{
+    while(subscriber.sent < subscriber.pending.size())
+    {
+        ssize_t sent = send(subscriber.socket, subscriber.pending.data() + subscriber.sent,
+            subscriber.pending.size() - subscriber.sent, MSG_NOSIGNAL);
+
+        if(sent > 0)
+        {
+            subscriber.sent += sent;
+
+            std::lock_guard<std::mutex> lock(m_statsMutex);
+            subscriber.stats.bytesSent += sent;
+        }
+        else if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            break;
+        else
+            return false;
+    }
+
+    if(subscriber.sent == subscriber.pending.size())
+    {
+        subscriber.pending.clear();
+        subscriber.sent = 0;
+    }
+
+    return true;
+}
+
+void ScanServer::acceptSubscribers()
+{
+    while(true)
+    {
+        sockaddr_in address;
+        socklen_t length = sizeof(address);
+
+        int fd = accept(m_tcpSocket, (sockaddr*) &address, &length);
+
+        if(fd == -1)
+            break;
+
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &m_config.socketBufferSize, sizeof(m_config.socketBufferSize));
+
+        if(!setNonBlocking(fd))
+        {
+            ::close(fd);
+            continue;
+        }
+
+        Subscriber subscriber;
+        subscriber.socket = fd;
+        subscriber.sent = 0;
+        subscriber.started = false;
+        subscriber.synced = false;
+        subscriber.stats.address = describe("tcp://", address);
+
+        logger.infof("Subscriber %s connected", subscriber.stats.address.c_str());
+
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_subscribers.push_back(std::move(subscriber));
+    }
+}
+
+void ScanServer::ioThread(ScanServer* server)
+{
+    std::vector<pollfd> fds;
+
+    while(!server->m_shouldStop)
+    {
+        fds.clear();
+        fds.push_back({ server->m_wake[0], POLLIN, 0 });
+        fds.push_back({ server->m_tcpSocket, POLLIN, 0 });
+
+        for(const Subscriber& subscriber : server->m_subscribers)
+            fds.push_back({ subscriber.socket, (short) (POLLIN | (subscriber.pending.empty() ? 0 : POLLOUT)), 0 });
+
+        poll(fds.data(), fds.size(), 100);
+
+        char drain[64];
+        while(read(server->m_wake[0], drain, sizeof(drain)) > 0) {}
+
+        // Subscribers never send anything, so readable means they hung up
+        for(size_t i = 0; i < server->m_subscribers.size(); i++)
+        {
+            Subscriber& subscriber = server->m_subscribers[i];
+
+            if(fds[i + 2].revents & (POLLIN | POLLERR | POLLHUP))
+            {
+                char buffer[256];
+                ssize_t received = recv(subscriber.socket, buffer, sizeof(buffer), 0);
+
+                if(received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+                    closeSocket(subscriber.socket);
+            }
+        }
+
+        if(fds[1].revents & POLLIN)
+            server->acceptSubscribers();
+
+        while(const Slot* slot = server->m_ring.front())
+        {
+            uint32_t sequence = slot->sequence;
+            bool key = server->encodeFrame(*slot);
+
+            // The frame is copied out, so the slot can take the next one
+            server->m_ring.pop();
+
+            if(server->m_udpSocket != -1)
+                server->sendDatagrams(sequence);
+
+            for(Subscriber& subscriber : server->m_subscribers)
+            {
+                if(subscriber.socket != -1)
+                    server->queueFrame(subscriber, key);
+            }
+        }
+
+        for(Subscriber& subscriber : server->m_subscribers)
+        {
+            if(subscriber.socket != -1 && !server->flush(subscriber))
+                closeSocket(subscriber.socket);
+        }
+
+        // Closed subscribers are moved out intact, so they can still be
+        // reported once the lock is let go
+        std::vector<Subscriber> closed;
+
+        {
+            std::lock_guard<std::mutex> lock(server->m_statsMutex);
+
+            auto gone = std::stable_partition(server->m_subscribers.begin(), server->m_subscribers.end(),
+                [](const Subscriber& subscriber) { return subscriber.socket != -1; });
+
+            closed.assign(std::make_move_iterator(gone), std::make_move_iterator(server->m_subscribers.end()));
+            server->m_subscribers.erase(gone, server->m_subscribers.end());
+        }
+
+        for(const Subscriber& subscriber : closed)
+        {
+            logger.infof("Subscriber %s disconnected after %llu frames (%llu dropped)", subscriber.stats.address.c_str(),
+                (unsigned long long) subscriber.stats.framesSent, (unsigned long long) subscriber.stats.framesDropped);
+        }
+    }
+}
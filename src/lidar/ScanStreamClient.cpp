@@ -0,0 +1,365 @@
+#include "lidar/ScanStreamClient.hpp"
+
+#include "lidar/Clock.hpp"
+#include "Logger.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+using namespace em;
+
+static Logger logger("ScanStreamClient");
+
+namespace
+{
+    const size_t MAX_FRAME_SIZE = sizeof(RecordedScanHeader) + ScanRecording::MAX_PAYLOAD_SIZE;
+
+    // Milliseconds left until deadline, in monotonicMicros()
+    int remaining(uint64_t deadline)
+    {
+        uint64_t now = monotonicMicros();
+        return now < deadline ? (int) ((deadline - now + 999) / 1000) : 0;
+    }
+
+    bool waitReadable(int socket, int timeout)
+    {
+        pollfd fd = { socket, POLLIN, 0 };
+        return poll(&fd, 1, timeout) > 0;
+    }
+}
+
+ScanStreamClient::ScanStreamClient() :
+    m_socket(-1),
+    m_datagrams(false),
+    m_buffered(0),
+    m_frameSize(0),
+    m_assembling(0),
+    m_fragmentsLeft(0),
+    m_started(false),
+    m_lastSequence(0)
+{
+}
+
+ScanStreamClient::~ScanStreamClient()
+{
+    close();
+}
+
+bool ScanStreamClient::connectTcp(const std::string& address, uint16_t port)
+{
+    close();
+
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+
+    if(inet_pton(AF_INET, address.c_str(), &server.sin_addr) != 1)
+    {
+        logger.errorf("%s is not an IPv4 address", address.c_str());
+        return false;
+    }
+
+    m_socket = socket(AF_INET, SOCK_STREAM, 0);
+
+    if(m_socket == -1 || connect(m_socket, (sockaddr*) &server, sizeof(server)) != 0)
+    {
+        logger.errorf("Unable to connect to %s:%u: %s", address.c_str(), port, strerror(errno));
+        close();
+        return false;
+    }
+
+    m_datagrams = false;
+    m_buffer.resize(MAX_FRAME_SIZE);
+
+    return true;
+}
+
+bool ScanStreamClient::listenUdp(const std::string& address, uint16_t port)
+{
+    close();
+
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+
+    in_addr group;
+
+    if(inet_pton(AF_INET, address.c_str(), &group) != 1)
+    {
+        logger.errorf("%s is not an IPv4 address", address.c_str());
+        return false;
+    }
+
+    const bool multicast = IN_MULTICAST(ntohl(group.s_addr));
+
+    // Several subscribers on one box share a multicast port
+    local.sin_addr.s_addr = multicast ? htonl(INADDR_ANY) : group.s_addr;
+
+    m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+
+    int reuse = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    int bufferSize = 4 * 1024 * 1024;
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    if(m_socket == -1 || bind(m_socket, (sockaddr*) &local, sizeof(local)) != 0)
+    {
+        logger.errorf("Unable to listen on %s:%u: %s", address.c_str(), port, strerror(errno));
+        close();
+        return false;
+    }
+
+    if(multicast)
+    {
+        ip_mreq request;
+        request.imr_multiaddr = group;
+        request.imr_interface.s_addr = htonl(INADDR_ANY);
+
+        if(setsockopt(m_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) != 0)
+        {
+            logger.errorf("Unable to join %s: %s", address.c_str(), strerror(errno));
+            close();
+            return false;
+        }
+    }
+
+    m_datagrams = true;
+    m_buffer.resize(MAX_FRAME_SIZE + 65536);
+
+    return true;
+}
+
+void ScanStreamClient::close()
+{
+    if(m_socket != -1)
+        ::close(m_socket);
+
+    m_socket = -1;
+    m_buffered = 0;
+    m_fragmentsLeft = 0;
+    m_started = false;
+    m_decoder.reset();
+}
+
+bool ScanStreamClient::isOpen() const
+{
+    return m_socket != -1;
+}
+
+bool ScanStreamClient::receive(std::vector<ScanNode>& nodes, uint32_t& sequence, uint64_t& timestamp, unsigned int timeout)
+{
+    const uint64_t deadline = monotonicMicros() + timeout * 1000ull;
+
+    while(m_socket != -1)
+    {
+        bool complete = m_datagrams ? readDatagram(remaining(deadline)) : readFrame(remaining(deadline));
+
+        if(complete)
+        {
+            // The frame sits at the start of the buffer, or right after the
+            // datagram scratch space for UDP
+            const uint8_t* frame = m_datagrams ? m_buffer.data() + 65536 : m_buffer.data();
+            bool accepted = acceptFrame(frame, m_frameSize, nodes, sequence, timestamp);
+
+            if(!m_datagrams)
+            {
+                memmove(m_buffer.data(), m_buffer.data() + m_frameSize, m_buffered - m_frameSize);
+                m_buffered -= m_frameSize;
+            }
+
+            if(accepted)
+                return true;
+        }
+        else if(!remaining(deadline))
+            return false;
+    }
+
+    return false;
+}
+
+const ScanStreamClient::Stats& ScanStreamClient::getStats() const
+{
+    return m_stats;
+}
+
+bool ScanStreamClient::readFrame(int timeout)
+{
+    RecordedScanHeader header;
+
+    while(true)
+    {
+        size_t needed = sizeof(header);
+
+        if(m_buffered >= sizeof(header))
+        {
+            memcpy(&header, m_buffer.data(), sizeof(header));
+
+            // Nothing after a bad header can be trusted to line up
+            if(!ScanRecording::isValidScan(header))
+            {
+                logger.errorf("Stream out of step, disconnecting");
+                m_stats.framesCorrupt++;
+                close();
+                return false;
+            }
+
+            needed += header.payloadSize;
+
+            if(m_buffered >= needed)
+            {
+                m_frameSize = needed;
+                m_stats.bytesReceived += needed;
+                return true;
+            }
+        }
+
+        if(!waitReadable(m_socket, timeout))
+            return false;
+
+        ssize_t received = recv(m_socket, m_buffer.data() + m_buffered, m_buffer.size() - m_buffered, 0);
+
+        if(received <= 0)
+        {
+            if(received < 0 && errno == EINTR)
+                continue;
+
+            logger.infof("Server went away");
+            close();
+            return false;
+        }
+
+        m_buffered += received;
+    }
+}
+
+bool ScanStreamClient::readDatagram(int timeout)
+{
+    if(!waitReadable(m_socket, timeout))
+        return false;
+
+    uint8_t* datagram = m_buffer.data();
+    uint8_t* frame = m_buffer.data() + 65536;
+
+    ssize_t received = recv(m_socket, datagram, 65536, 0);
+
+    if(received < (ssize_t) sizeof(StreamDatagramHeader))
+        return false;
+
+    StreamDatagramHeader header;
+    memcpy(&header, datagram, sizeof(header));
+
+    size_t size = received - sizeof(header);
+    m_stats.bytesReceived += received;
+
+    if(header.magic != ScanServer::DATAGRAM_MAGIC || !header.fragmentCount || header.fragment >= header.fragmentCount ||
+       header.frameSize > MAX_FRAME_SIZE || header.offset + size > header.frameSize)
+    {
+        m_stats.framesCorrupt++;
+        return false;
+    }
+
+    if(m_started && header.sequence <= m_lastSequence)
+    {
+        if(header.fragment == 0)
+            m_stats.framesLate++;
+
+        return false;
+    }
+
+    // A newer frame abandons the one in progress, which then shows up as a
+    // gap once the newer one is complete
+    if(!m_fragmentsLeft || header.sequence > m_assembling)
+    {
+        m_assembling = header.sequence;
+        m_fragments.assign(header.fragmentCount, false);
+        m_fragmentsLeft = header.fragmentCount;
+        m_frameSize = header.frameSize;
+    }
+    else if(header.sequence < m_assembling)
+        return false;
+
+    if(header.fragmentCount != m_fragments.size() || header.frameSize != m_frameSize)
+    {
+        m_stats.framesCorrupt++;
+        m_fragmentsLeft = 0;
+        return false;
+    }
+
+    if(m_fragments[header.fragment])
+        return false;
+
+    m_fragments[header.fragment] = true;
+    memcpy(frame + header.offset, datagram + sizeof(header), size);
+
+    return --m_fragmentsLeft == 0;
+}
+
+bool ScanStreamClient::acceptFrame(const uint8_t* frame, size_t size, std::vector<ScanNode>& nodes, uint32_t& sequence, uint64_t& timestamp)
+{
+    RecordedScanHeader header;
+
+    if(size < sizeof(header))
+    {
+        m_stats.framesCorrupt++;
+        return false;
+    }
+
+    memcpy(&header, frame, sizeof(header));
+
+    const uint8_t* payload = frame + sizeof(header);
+
+    if(sizeof(header) + header.payloadSize > size || !ScanRecording::isValidScan(header, payload))
+    {
+        m_stats.framesCorrupt++;
+        return false;
+    }
+
+    if(m_started && header.sequence <= m_lastSequence)
+    {
+        m_stats.framesLate++;
+        return false;
+    }
+
+    if(m_started)
+        m_stats.framesMissed += header.sequence - m_lastSequence - 1;
+
+    m_started = true;
+    m_lastSequence = header.sequence;
+
+    if(header.encoding == SCAN_ENCODING_RAW)
+        nodes.assign(reinterpret_cast<const ScanNode*>(payload), reinterpret_cast<const ScanNode*>(payload) + header.nodeCount);
+    else
+    {
+        nodes.resize(ScanRecording::MAX_NODES);
+        size_t count = nodes.size();
+
+        if(!m_decoder.decode(payload, header.payloadSize, nodes.data(), count))
+        {
+            // Without the frame before it a packed frame waits for a key frame
+            if(ScanDecoder::getChain(payload, header.payloadSize) > 0)
+                m_stats.framesSkipped++;
+            else
+                m_stats.framesCorrupt++;
+
+            return false;
+        }
+
+        nodes.resize(count);
+    }
+
+    sequence = header.sequence;
+    timestamp = header.timestamp;
+    m_stats.framesReceived++;
+
+    return true;
+}
@@ -0,0 +1,171 @@
+#include "lidar/ScanTelemetry.hpp"
+
+using namespace em;
+
+namespace
+{
+    inline uint64_t elapsed(uint64_t from, uint64_t to)
+    {
+        return to > from ? to - from : 0;
+    }
+}
+
+ScanTelemetry::ScanTelemetry() :
+    m_published(0),
+    m_consumed(0),
+    m_presented(0),
+    m_dropped(0),
+    m_late(0),
+    m_lateThreshold(DEFAULT_LATE_THRESHOLD),
+    m_lastSequence(0),
+    m_pendingFirstByte(0),
+    m_pendingConsumed(0)
+{
+}
+
+void ScanTelemetry::scanPublished(const ScanFrame& frame)
+{
+    m_histograms[ACQUISITION].record(elapsed(frame.getFirstByteTime(), frame.getTimestamp()));
+    m_histograms[PUBLISH].record(elapsed(frame.getTimestamp(), frame.getPublishTime()));
+    m_published.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ScanTelemetry::scanConsumed(const ScanFrame& frame, uint64_t now)
+{
+    if(!frame.getSequence() || frame.getSequence() == m_lastSequence)
+        return;
+
+    // Sequences skipped since the last pickup were overwritten unseen
+    if(m_lastSequence && frame.getSequence() > m_lastSequence + 1)
+        m_dropped.fetch_add(frame.getSequence() - m_lastSequence - 1, std::memory_order_relaxed);
+
+    m_lastSequence = frame.getSequence();
+
+    m_histograms[QUEUE].record(elapsed(frame.getPublishTime(), now));
+    m_consumed.fetch_add(1, std::memory_order_relaxed);
+
+    m_pendingFirstByte = frame.getFirstByteTime();
+    m_pendingConsumed = now;
+}
+
+void ScanTelemetry::scanPresented(uint64_t now)
+{
+    if(!m_pendingConsumed)
+        return;
+
+    uint64_t scanToPhoton = elapsed(m_pendingFirstByte, now);
+
+    m_histograms[RENDER].record(elapsed(m_pendingConsumed, now));
+    m_histograms[SCAN_TO_PHOTON].record(scanToPhoton);
+    m_presented.fetch_add(1, std::memory_order_relaxed);
+
+    if(scanToPhoton > m_lateThreshold.load(std::memory_order_relaxed))
+        m_late.fetch_add(1, std::memory_order_relaxed);
+
+    m_pendingConsumed = 0;
+}
+
+void ScanTelemetry::setLateThreshold(uint64_t micros)
+{
+    m_lateThreshold = micros;
+}
+
+uint64_t ScanTelemetry::getLateThreshold() const
+{
+    return m_lateThreshold;
+}
+
+const LatencyHistogram& ScanTelemetry::getHistogram(Interval interval) const
+{
+    return m_histograms[interval];
+}
+
+uint64_t ScanTelemetry::getPublished() const
+{
+    return m_published.load(std::memory_order_relaxed);
+}
+
+uint64_t ScanTelemetry::getConsumed() const
+{
+    return m_consumed.load(std::memory_order_relaxed);
+}
+
+uint64_t ScanTelemetry::getPresented() const
+{
+    return m_presented.load(std::memory_order_relaxed);
+}
+
+uint64_t ScanTelemetry::getDropped() const
+{
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t ScanTelemetry::getLate() const
+{
+    return m_late.load(std::memory_order_relaxed);
+}
+
+void ScanTelemetry::reset()
+{
+    for(int i = 0; i < INTERVAL_COUNT; i++)
+        m_histograms[i].reset();
+
+    m_published = 0;
+    m_consumed = 0;
+    m_presented = 0;
+    m_dropped = 0;
+    m_late = 0;
+}
+
+void ScanTelemetry::writeJSON(FILE* file, const char* name) const
+{
+    fprintf(file, "{\"name\": \"");
+
+    // Ports can be Windows paths
+    for(const char* c = name; *c; c++)
+    {
+        if(*c == '"' || *c == '\\')
+            fputc('\\', file);
+
+        fputc(*c, file);
+    }
+
+    fprintf(file, "\", \"published\": %llu, \"consumed\": %llu, \"presented\": %llu, \"dropped\": %llu, \"late\": %llu, \"lateThreshold\": %llu",
+        (unsigned long long) getPublished(),
+        (unsigned long long) getConsumed(),
+        (unsigned long long) getPresented(),
+        (unsigned long long) getDropped(),
+        (unsigned long long) getLate(),
+        (unsigned long long) getLateThreshold());
+
+    for(int i = 0; i < INTERVAL_COUNT; i++)
+    {
+        const LatencyHistogram& histogram = m_histograms[i];
+
+        fprintf(file, ", \"%s\": {\"count\": %llu, \"min\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+            getIntervalName((Interval) i),
+            (unsigned long long) histogram.getCount(),
+            (unsigned long long) histogram.getMin(),
+            histogram.getMean(),
+            (unsigned long long) histogram.getPercentile(50.0),
+            (unsigned long long) histogram.getPercentile(90.0),
+            (unsigned long long) histogram.getPercentile(99.0),
+            (unsigned long long) histogram.getPercentile(99.9),
+            (unsigned long long) histogram.getMax());
+    }
+
+    fprintf(file, "}");
+}
+
+const char* ScanTelemetry::getIntervalName(Interval interval)
+{
+    switch(interval)
+    {
+    case ACQUISITION: return "acquisition";
+    case PUBLISH: return "publish";
+    case QUEUE: return "queue";
+    case RENDER: return "render";
+    case SCAN_TO_PHOTON: return "scanToPhoton";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,154 @@
+#include "lidar/SectorStream.hpp"
+#include "lidar/Clock.hpp"
+
+#include <algorithm>
+
+using namespace em;
+
+SectorStream::SectorStream(size_t sectors, size_t capacity, size_t maxNodes) :
+    m_ring(capacity),
+    m_sectors(std::max<size_t>(1, std::min<size_t>(sectors, 256))),
+    m_current(-1),
+    m_firstByte(0),
+    m_revolution(0),
+    m_sequence(0),
+    m_published(0),
+    m_dropped(0)
+{
+    // Nodes bunch up where the sensor slows down, so leave sectors room for
+    // several times their share of a revolution
+    size_t sectorNodes = std::min(maxNodes, maxNodes * 4 / m_sectors);
+
+    for(size_t i = 0; i < m_ring.slotCount(); i++)
+        m_ring.slot(i).frame.reserve(sectorNodes);
+
+    m_pending.reserve(sectorNodes);
+}
+
+size_t SectorStream::getSectorCount() const
+{
+    return m_sectors;
+}
+
+void SectorStream::feed(const ScanNode* nodes, size_t count, uint64_t timestamp)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        const ScanNode& node = nodes[i];
+        int sector = sectorOf(node);
+
+        if(node.flag & SL_LIDAR_RESP_HQ_FLAG_SYNCBIT)
+        {
+            publish(timestamp);
+            m_revolution++;
+            m_current = sector;
+        }
+        else if(sector != m_current)
+        {
+            // Angles jitter around sector edges, only ever move forward
+            int ahead = (sector - m_current + (int) m_sectors) % (int) m_sectors;
+
+            if(m_current < 0 || ahead <= (int) m_sectors / 2)
+            {
+                publish(timestamp);
+                m_current = sector;
+            }
+        }
+
+        if(m_pending.empty())
+            m_firstByte = timestamp;
+
+        if(m_pending.size() < m_pending.capacity())
+            m_pending.push_back(node);
+    }
+}
+
+void SectorStream::feedRevolution(const ScanNode* nodes, size_t count, uint64_t firstByte, uint64_t timestamp)
+{
+    reset();
+    m_revolution++;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        int sector = sectorOf(nodes[i]);
+
+        if(sector != m_current)
+        {
+            publish(timestamp);
+            m_current = sector;
+
+            // Nothing is known about when each part arrived
+            m_firstByte = firstByte;
+        }
+
+        if(m_pending.size() < m_pending.capacity())
+            m_pending.push_back(nodes[i]);
+    }
+
+    publish(timestamp);
+    m_current = -1;
+}
+
+void SectorStream::reset()
+{
+    m_pending.clear();
+    m_current = -1;
+}
+
+const ScanSector* SectorStream::next()
+{
+    return m_ring.front();
+}
+
+void SectorStream::release()
+{
+    m_ring.pop();
+}
+
+uint64_t SectorStream::getPublished() const
+{
+    return m_published.load(std::memory_order_relaxed);
+}
+
+uint64_t SectorStream::getDropped() const
+{
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+int SectorStream::sectorOf(const ScanNode& node) const
+{
+    // A full turn is 1 << 16 in angle_z_q14 units
+    return (int) ((node.angle_z_q14 * m_sectors) >> 16);
+}
+
+void SectorStream::publish(uint64_t timestamp)
+{
+    if(m_pending.empty() || m_current < 0)
+    {
+        m_pending.clear();
+        return;
+    }
+
+    ScanSector* sector = m_ring.claim();
+    m_sequence++;
+
+    if(!sector)
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        m_pending.clear();
+        return;
+    }
+
+    sector->frame.assign(m_pending.data(), m_pending.size());
+    sector->frame.setSequence(m_sequence);
+    sector->frame.setFirstByteTime(m_firstByte);
+    sector->frame.setTimestamp(timestamp);
+    sector->frame.setPublishTime(monotonicMicros());
+    sector->revolution = m_revolution;
+    sector->index = (uint16_t) m_current;
+    sector->count = (uint16_t) m_sectors;
+
+    m_ring.push();
+    m_published.fetch_add(1, std::memory_order_relaxed);
+    m_pending.clear();
+}
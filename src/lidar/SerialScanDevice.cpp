@@ -0,0 +1,78 @@
+#include "lidar/SerialScanDevice.hpp"
+
+using namespace em;
+
+SerialScanDevice::SerialScanDevice(const std::string& port, int baudrate) :
+    ScanDevice(SERIAL),
+    m_port(port),
+    m_baudrate(baudrate),
+    m_driver(nullptr),
+    m_channel(nullptr)
+{
+}
+
+SerialScanDevice::~SerialScanDevice()
+{
+    disconnect();
+}
+
+sl_result SerialScanDevice::connect()
+{
+    if(!m_driver)
+        m_driver = *sl::createLidarDriver();
+
+    if(!m_channel)
+        m_channel = *sl::createSerialPortChannel(m_port.c_str(), m_baudrate);
+
+    if(!m_driver || !m_channel)
+        return SL_RESULT_OPERATION_FAIL;
+
+    return m_driver->connect(m_channel);
+}
+
+void SerialScanDevice::disconnect()
+{
+    if(m_driver)
+    {
+        m_driver->disconnect();
+        delete m_driver;
+        m_driver = nullptr;
+    }
+
+    delete m_channel;
+    m_channel = nullptr;
+}
+
+sl_result SerialScanDevice::getDeviceInfo(sl_lidar_response_device_info_t& info, unsigned int timeout)
+{
+    return m_driver->getDeviceInfo(info, timeout);
+}
+
+sl_result SerialScanDevice::getHealth(sl_lidar_response_device_health_t& health, unsigned int timeout)
+{
+    return m_driver->getHealth(health, timeout);
+}
+
+sl_result SerialScanDevice::startScan()
+{
+    return m_driver->startScan(false, true);
+}
+
+sl_result SerialScanDevice::stop()
+{
+    // Called after a failed connect too, when there may be no driver
+    if(!m_driver)
+        return SL_RESULT_OPERATION_FAIL;
+
+    return m_driver->stop();
+}
+
+sl_result SerialScanDevice::grabScanDataHq(ScanNode* nodes, size_t& count, unsigned int timeout)
+{
+    return m_driver->grabScanDataHq(nodes, count, timeout);
+}
+
+sl_result SerialScanDevice::ascendScanData(ScanNode* nodes, size_t count)
+{
+    return m_driver->ascendScanData(nodes, count);
+}
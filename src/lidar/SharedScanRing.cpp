@@ -0,0 +1,460 @@
+#include "lidar/SharedScanRing.hpp"
+
+#include "Logger.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace em;
+
+static Logger logger("SharedScanRing");
+
+namespace
+{
+    size_t alignUp(size_t size)
+    {
+        return (size + ScanFrame::ALIGNMENT - 1) & ~(ScanFrame::ALIGNMENT - 1);
+    }
+
+    // Offsets of the arrays from the start of a slot
+    struct SlotLayout
+    {
+        size_t angles;
+        size_t distances;
+        size_t qualities;
+        size_t flags;
+        size_t size;
+
+        SlotLayout(size_t capacity)
+        {
+            angles = sizeof(SharedSlotHeader);
+            distances = angles + alignUp(capacity * sizeof(uint16_t));
+            qualities = distances + alignUp(capacity * sizeof(uint32_t));
+            flags = qualities + alignUp(capacity);
+            size = flags + alignUp(capacity);
+        }
+    };
+
+    inline uint8_t* slotAt(uint8_t* data, const SharedRingHeader& header, uint64_t frame)
+    {
+        return data + sizeof(SharedRingHeader) + (frame % header.slotCount) * header.slotSize;
+    }
+
+    inline const uint8_t* slotAt(const uint8_t* data, const SharedRingHeader& header, uint64_t frame)
+    {
+        return data + sizeof(SharedRingHeader) + (frame % header.slotCount) * header.slotSize;
+    }
+
+    // Whether an existing ring was left behind by a writer that is gone. A
+    // ring still being set up, or whose writer can't be told, counts as live.
+    bool isStale(const std::string& name, pid_t& writer)
+    {
+        writer = 0;
+
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+
+        if(fd == -1)
+            return errno == ENOENT;
+
+        struct stat info;
+        void* data = MAP_FAILED;
+
+        if(fstat(fd, &info) == 0 && (size_t) info.st_size >= sizeof(SharedRingHeader))
+            data = mmap(nullptr, sizeof(SharedRingHeader), PROT_READ, MAP_SHARED, fd, 0);
+
+        ::close(fd);
+
+        if(data == MAP_FAILED)
+            return false;
+
+        writer = (pid_t) static_cast<const SharedRingHeader*>(data)->writerPid;
+        munmap(data, sizeof(SharedRingHeader));
+
+        return writer && kill(writer, 0) == -1 && errno == ESRCH;
+    }
+}
+
+SharedScanRing::SharedScanRing() :
+    m_data(nullptr),
+    m_size(0),
+    m_open(false),
+    m_producers(0)
+{
+}
+
+SharedScanRing::~SharedScanRing()
+{
+    close();
+}
+
+bool SharedScanRing::create(const std::string& name, size_t slotCount, size_t capacity)
+{
+    close();
+
+    slotCount = std::max(slotCount, (size_t) 2);
+    capacity = std::max(capacity, (size_t) 1);
+
+    const size_t slotSize = getSlotSize(capacity);
+    const size_t size = sizeof(SharedRingHeader) + slotCount * slotSize;
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+
+    // A ring left behind by a writer that crashed is replaced, readers still
+    // mapping it keep the old one. One whose writer is alive is left alone.
+    if(fd == -1 && errno == EEXIST)
+    {
+        pid_t writer;
+
+        if(!isStale(name, writer))
+        {
+            logger.errorf("Shared memory %s is already in use by process %d", name.c_str(), (int) writer);
+            return false;
+        }
+
+        logger.infof("Replacing shared memory %s left behind by process %d", name.c_str(), (int) writer);
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+
+    if(fd == -1)
+    {
+        logger.errorf("Unable to create shared memory %s: %s", name.c_str(), strerror(errno));
+        return false;
+    }
+
+    if(ftruncate(fd, size) != 0)
+    {
+        logger.errorf("Unable to size shared memory %s to %zu bytes", name.c_str(), size);
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if(data == MAP_FAILED)
+    {
+        logger.errorf("Unable to map shared memory %s", name.c_str());
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    m_data = static_cast<uint8_t*>(data);
+    m_size = size;
+    m_name = name;
+
+    // The object starts out zeroed, which is every slot empty
+    SharedRingHeader* header = new(m_data) SharedRingHeader;
+    header->writerPid = (uint32_t) getpid();
+    header->version = VERSION;
+    header->headerSize = sizeof(SharedRingHeader);
+    header->slotCount = (uint32_t) slotCount;
+    header->capacity = (uint32_t) capacity;
+    header->slotSize = slotSize;
+    header->published.store(0, std::memory_order_relaxed);
+
+    for(size_t i = 0; i < slotCount; i++)
+        new(slotAt(m_data, *header, i)) SharedSlotHeader;
+
+    // Readers check the magic last, so it goes in once the rest is there
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, "RPLS", 4);
+
+    m_open = true;
+
+    logger.infof("Sharing scans through %s, %zu slots of %zu nodes", name.c_str(), slotCount, capacity);
+
+    return true;
+}
+
+void SharedScanRing::close()
+{
+    if(!m_data)
+        return;
+
+    // Let any publish() that saw the ring open finish with it
+    m_open = false;
+    while(m_producers)
+        std::this_thread::yield();
+
+    munmap(m_data, m_size);
+    shm_unlink(m_name.c_str());
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+bool SharedScanRing::isOpen() const
+{
+    return m_open;
+}
+
+const std::string& SharedScanRing::getName() const
+{
+    return m_name;
+}
+
+bool SharedScanRing::publish(const ScanFrame& frame)
+{
+    m_producers++;
+
+    if(!m_open)
+    {
+        m_producers--;
+        return false;
+    }
+
+    SharedRingHeader& header = *reinterpret_cast<SharedRingHeader*>(m_data);
+    const SlotLayout layout(header.capacity);
+    const uint64_t n = header.published.load(std::memory_order_relaxed);
+
+    uint8_t* slot = slotAt(m_data, header, n);
+    SharedSlotHeader& slotHeader = *reinterpret_cast<SharedSlotHeader*>(slot);
+
+    // Odd while writing, so readers of the frame this slot held see it go
+    slotHeader.generation.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const size_t count = std::min(frame.size(), (size_t) header.capacity);
+
+    memcpy(slot + layout.angles, frame.angles(), count * sizeof(uint16_t));
+    memcpy(slot + layout.distances, frame.distances(), count * sizeof(uint32_t));
+    memcpy(slot + layout.qualities, frame.qualities(), count);
+    memcpy(slot + layout.flags, frame.flags(), count);
+
+    slotHeader.sequence = frame.getSequence();
+    slotHeader.timestamp = frame.getTimestamp();
+    slotHeader.count = (uint32_t) count;
+
+    slotHeader.generation.store(2 * n + 2, std::memory_order_release);
+    header.published.store(n + 1, std::memory_order_release);
+
+    m_producers--;
+
+    return true;
+}
+
+uint64_t SharedScanRing::getPublished() const
+{
+    return m_data ? reinterpret_cast<const SharedRingHeader*>(m_data)->published.load(std::memory_order_acquire) : 0;
+}
+
+size_t SharedScanRing::getSlotSize(size_t capacity)
+{
+    return SlotLayout(capacity).size;
+}
+
+SharedScanReader::SharedScanReader() :
+    m_data(nullptr),
+    m_size(0),
+    m_header(nullptr),
+    m_next(0),
+    m_missed(0)
+{
+}
+
+SharedScanReader::~SharedScanReader()
+{
+    close();
+}
+
+bool SharedScanReader::open(const std::string& name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+
+    if(fd == -1)
+    {
+        logger.errorf("Unable to open shared memory %s", name.c_str());
+        return false;
+    }
+
+    struct stat info;
+
+    if(fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(SharedRingHeader))
+    {
+        logger.errorf("%s is too small to be a scan ring", name.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if(data == MAP_FAILED)
+    {
+        logger.errorf("Unable to map shared memory %s", name.c_str());
+        return false;
+    }
+
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = info.st_size;
+
+    const SharedRingHeader* header = reinterpret_cast<const SharedRingHeader*>(m_data);
+    bool valid = memcmp(header->magic, "RPLS", 4) == 0;
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if(!valid || header->version != SharedScanRing::VERSION || header->headerSize != sizeof(SharedRingHeader) ||
+       !header->slotCount || header->slotSize != SharedScanRing::getSlotSize(header->capacity) ||
+       sizeof(SharedRingHeader) + header->slotCount * header->slotSize > m_size)
+    {
+        logger.errorf("%s is not a scan ring", name.c_str());
+        close();
+        return false;
+    }
+
+    m_header = header;
+    m_next = getPublished();
+    m_missed = 0;
+
+    return true;
+}
+
+void SharedScanReader::close()
+{
+    if(m_data)
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+
+    m_data = nullptr;
+    m_size = 0;
+    m_header = nullptr;
+}
+
+bool SharedScanReader::isOpen() const
+{
+    return m_header != nullptr;
+}
+
+uint32_t SharedScanReader::getSlotCount() const
+{
+    return m_header ? m_header->slotCount : 0;
+}
+
+uint32_t SharedScanReader::getCapacity() const
+{
+    return m_header ? m_header->capacity : 0;
+}
+
+uint64_t SharedScanReader::getPublished() const
+{
+    return m_header ? m_header->published.load(std::memory_order_acquire) : 0;
+}
+
+bool SharedScanReader::acquire(uint64_t frame, View& view) const
+{
+    if(!m_header || frame >= getPublished())
+        return false;
+
+    const uint8_t* slot = slotAt(m_data, *m_header, frame);
+    const SharedSlotHeader& slotHeader = *reinterpret_cast<const SharedSlotHeader*>(slot);
+    const uint64_t generation = slotHeader.generation.load(std::memory_order_acquire);
+
+    if(generation != 2 * frame + 2)
+        return false;
+
+    // Anything read from here on may be torn, validate() tells
+    const SlotLayout layout(m_header->capacity);
+
+    view.angles = reinterpret_cast<const uint16_t*>(slot + layout.angles);
+    view.distances = reinterpret_cast<const uint32_t*>(slot + layout.distances);
+    view.qualities = slot + layout.qualities;
+    view.flags = slot + layout.flags;
+    view.count = std::min((size_t) slotHeader.count, (size_t) m_header->capacity);
+    view.sequence = slotHeader.sequence;
+    view.timestamp = slotHeader.timestamp;
+    view.frame = frame;
+    view.generation = generation;
+
+    return true;
+}
+
+bool SharedScanReader::validate(const View& view) const
+{
+    if(!m_header)
+        return false;
+
+    const SharedSlotHeader& slotHeader = *reinterpret_cast<const SharedSlotHeader*>(slotAt(m_data, *m_header, view.frame));
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slotHeader.generation.load(std::memory_order_relaxed) == view.generation;
+}
+
+bool SharedScanReader::readLatest(ScanFrame& frame)
+{
+    while(true)
+    {
+        uint64_t published = getPublished();
+
+        if(!published)
+            return false;
+
+        // Only fails if the writer lapped the whole ring meanwhile
+        if(copy(published - 1, frame))
+            return true;
+    }
+}
+
+bool SharedScanReader::readNext(ScanFrame& frame)
+{
+    while(true)
+    {
+        uint64_t published = getPublished();
+
+        if(m_next >= published)
+            return false;
+
+        // The oldest slot may already be taking the next frame
+        uint64_t oldest = published >= m_header->slotCount ? published - m_header->slotCount + 1 : 0;
+
+        if(m_next < oldest)
+        {
+            m_missed += oldest - m_next;
+            m_next = oldest;
+        }
+
+        if(copy(m_next++, frame))
+            return true;
+
+        m_missed++;
+    }
+}
+
+uint64_t SharedScanReader::getMissed() const
+{
+    return m_missed;
+}
+
+bool SharedScanReader::copy(uint64_t index, ScanFrame& out) const
+{
+    View view;
+
+    if(!acquire(index, view))
+        return false;
+
+    out.reserve(m_header->capacity);
+
+    memcpy(out.angles(), view.angles, view.count * sizeof(uint16_t));
+    memcpy(out.distances(), view.distances, view.count * sizeof(uint32_t));
+    memcpy(out.qualities(), view.qualities, view.count);
+    memcpy(out.flags(), view.flags, view.count);
+
+    if(!validate(view))
+        return false;
+
+    out.resize(view.count);
+    out.setSequence(view.sequence);
+    out.setTimestamp(view.timestamp);
+
+    return true;
+}
@@ -0,0 +1,366 @@
+#include "lidar/SimulatedScanDevice.hpp"
+#include "lidar/Clock.hpp"
+#include "lidar/MotionModel.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+
+using namespace em;
+
+const char* const SimulatedScanDevice::DEFAULT_PORT = "sim://rate=8000,rpm=600,noise=10";
+
+static const float PI = 3.14159265358979f;
+
+// Folds a position moving along [lo, hi] back and forth
+static float bounce(float start, float velocity, float time, float lo, float hi)
+{
+    float span = hi - lo;
+
+    if(span <= 0.0f)
+        return lo;
+
+    float u = std::fmod(start - lo + velocity * time, 2.0f * span);
+
+    if(u < 0.0f)
+        u += 2.0f * span;
+
+    return lo + (u <= span ? u : 2.0f * span - u);
+}
+
+//----------------------------------------------------------------------------------------------
+// SimulatedWorld
+//----------------------------------------------------------------------------------------------
+
+SimulatedWorld SimulatedWorld::defaultWorld()
+{
+    SimulatedWorld world;
+
+    world.addBox(world.minX, world.minY, world.maxX, world.maxY);
+    world.addBox(1500.0f, -2200.0f, 2100.0f, -1600.0f);
+
+    world.circles.push_back({ -2000.0f, 1000.0f, 250.0f, 900.0f, 400.0f });
+    world.circles.push_back({ 1000.0f, 1800.0f, 200.0f, -600.0f, -1100.0f });
+
+    return world;
+}
+
+void SimulatedWorld::addBox(float minX, float minY, float maxX, float maxY)
+{
+    walls.push_back({ minX, minY, maxX, minY });
+    walls.push_back({ maxX, minY, maxX, maxY });
+    walls.push_back({ maxX, maxY, minX, maxY });
+    walls.push_back({ minX, maxY, minX, minY });
+}
+
+void SimulatedWorld::circlePosition(const SimulatedCircle& circle, float time, float& x, float& y) const
+{
+    x = bounce(circle.x, circle.vx, time, minX + circle.radius, maxX - circle.radius);
+    y = bounce(circle.y, circle.vy, time, minY + circle.radius, maxY - circle.radius);
+}
+
+float SimulatedWorld::castRay(float x, float y, float angle, float time) const
+{
+    float dx = std::cos(angle);
+    float dy = std::sin(angle);
+    float nearest = INFINITY;
+
+    for(const SimulatedWall& wall : walls)
+    {
+        float ex = wall.x1 - wall.x0;
+        float ey = wall.y1 - wall.y0;
+        float denom = dx * ey - dy * ex;
+
+        if(std::fabs(denom) < 1e-6f)
+            continue;
+
+        float px = wall.x0 - x;
+        float py = wall.y0 - y;
+        float t = (px * ey - py * ex) / denom;
+        float s = (px * dy - py * dx) / denom;
+
+        if(t > 0.0f && s >= 0.0f && s <= 1.0f && t < nearest)
+            nearest = t;
+    }
+
+    for(const SimulatedCircle& circle : circles)
+    {
+        float cx, cy;
+        circlePosition(circle, time, cx, cy);
+
+        float ox = x - cx;
+        float oy = y - cy;
+        float b = ox * dx + oy * dy;
+        float c = ox * ox + oy * oy - circle.radius * circle.radius;
+        float disc = b * b - c;
+
+        if(disc < 0.0f)
+            continue;
+
+        float root = std::sqrt(disc);
+        float t = -b - root;
+
+        if(t <= 0.0f)
+            t = -b + root;
+
+        if(t > 0.0f && t < nearest)
+            nearest = t;
+    }
+
+    return std::isinf(nearest) ? 0.0f : nearest;
+}
+
+//----------------------------------------------------------------------------------------------
+// SimulatorParams
+//----------------------------------------------------------------------------------------------
+
+SimulatorParams SimulatorParams::parse(const std::string& port)
+{
+    SimulatorParams params;
+
+    if(!SimulatedScanDevice::isSimulatorPort(port))
+        return params;
+
+    std::string options = port.substr(strlen("sim://"));
+    size_t pos = 0;
+
+    while(pos < options.size())
+    {
+        size_t end = options.find(',', pos);
+        if(end == std::string::npos)
+            end = options.size();
+
+        std::string option = options.substr(pos, end - pos);
+        size_t equals = option.find('=');
+
+        if(equals != std::string::npos)
+        {
+            std::string key = option.substr(0, equals);
+            const char* value = option.c_str() + equals + 1;
+
+            if(key == "rate")
+                params.sampleRate = std::clamp(atoi(value), 2000, 32000);
+            else if(key == "rpm")
+                params.rpm = std::clamp((float) atof(value), 60.0f, 1200.0f);
+            else if(key == "noise")
+                params.noise = std::max((float) atof(value), 0.0f);
+            else if(key == "dropout")
+                params.dropout = std::clamp((float) atof(value), 0.0f, 1.0f);
+            else if(key == "range")
+                params.maxRange = std::max((float) atof(value), 0.0f);
+            else if(key == "realtime")
+                params.realtime = atoi(value) != 0;
+            else if(key == "seed")
+                params.seed = (uint32_t) strtoul(value, nullptr, 10);
+            else if(key == "vx")
+                params.vx = (float) atof(value);
+            else if(key == "vy")
+                params.vy = (float) atof(value);
+            else if(key == "spin")
+                params.spin = (float) atof(value);
+        }
+
+        pos = end + 1;
+    }
+
+    return params;
+}
+
+//----------------------------------------------------------------------------------------------
+// SimulatedScanDevice
+//----------------------------------------------------------------------------------------------
+
+SimulatedScanDevice::SimulatedScanDevice(const SimulatorParams& params, const SimulatedWorld& world) :
+    ScanDevice(SIMULATED),
+    m_params(params),
+    m_world(world),
+    m_connected(false),
+    m_scanning(false),
+    m_revolution(0),
+    m_revolutionStart(0),
+    m_listener(nullptr),
+    m_listenerUser(nullptr),
+    m_random(params.seed)
+{
+}
+
+sl_result SimulatedScanDevice::connect()
+{
+    m_connected = true;
+    return SL_RESULT_OK;
+}
+
+void SimulatedScanDevice::disconnect()
+{
+    m_connected = false;
+    m_scanning = false;
+}
+
+sl_result SimulatedScanDevice::getDeviceInfo(sl_lidar_response_device_info_t& info, unsigned int timeout)
+{
+    if(!m_connected)
+        return SL_RESULT_OPERATION_FAIL;
+
+    memset(&info, 0, sizeof(info));
+    info.model = 0x18;
+    info.firmware_version = (1 << 8) | 29;
+    info.hardware_version = 7;
+    memcpy(info.serialnum, "SIMULATEDLIDAR00", sizeof(info.serialnum));
+
+    return SL_RESULT_OK;
+}
+
+sl_result SimulatedScanDevice::getHealth(sl_lidar_response_device_health_t& health, unsigned int timeout)
+{
+    if(!m_connected)
+        return SL_RESULT_OPERATION_FAIL;
+
+    health.status = SL_LIDAR_STATUS_OK;
+    health.error_code = 0;
+
+    return SL_RESULT_OK;
+}
+
+sl_result SimulatedScanDevice::startScan()
+{
+    if(!m_connected)
+        return SL_RESULT_OPERATION_FAIL;
+
+    if(m_scanning)
+        return SL_RESULT_ALREADY_DONE;
+
+    m_scanning = true;
+    m_revolution = 0;
+    m_scanStart = std::chrono::steady_clock::now();
+
+    return SL_RESULT_OK;
+}
+
+sl_result SimulatedScanDevice::stop()
+{
+    m_scanning = false;
+    return SL_RESULT_OK;
+}
+
+sl_result SimulatedScanDevice::grabScanDataHq(ScanNode* nodes, size_t& count, unsigned int timeout)
+{
+    if(!m_scanning)
+    {
+        count = 0;
+        return SL_RESULT_OPERATION_FAIL;
+    }
+
+    float period = getRevolutionPeriod();
+    size_t samples = std::min(getSamplesPerRevolution(), count);
+
+    typedef std::chrono::steady_clock::duration Duration;
+
+    // Realtime revolutions come out about a millisecond's worth of samples at
+    // a time, as they would from a sensor
+    std::chrono::steady_clock::time_point revolutionStart = m_scanStart + std::chrono::duration_cast<Duration>(std::chrono::duration<double>(m_revolution * (double) period));
+    size_t chunk = m_params.realtime ? std::max<size_t>(1, (size_t) (m_params.sampleRate / 1000.0f)) : samples;
+
+    if(m_params.realtime)
+        m_revolutionStart = std::chrono::duration_cast<std::chrono::microseconds>(revolutionStart.time_since_epoch()).count();
+    else
+        m_revolutionStart = monotonicMicros();
+
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::normal_distribution<float> gaussian(0.0f, m_params.noise > 0.0f ? m_params.noise : 1.0f);
+
+    float step = 360.0f / samples;
+    float startAngle = uniform(m_random) * step;
+    float startTime = m_revolution * period;
+
+    for(size_t first = 0; first < samples; first += chunk)
+    {
+        size_t last = std::min(first + chunk, samples);
+
+        if(m_params.realtime)
+        {
+            // The revolution's last chunk is due when the period is up
+            double due = last == samples ? period : (double) last / m_params.sampleRate;
+            std::this_thread::sleep_until(revolutionStart + std::chrono::duration_cast<Duration>(std::chrono::duration<double>(due)));
+        }
+
+        for(size_t i = first; i < last; i++)
+        {
+            float angle = startAngle + i * step;
+            float time = startTime + (float) i / m_params.sampleRate;
+            Pose2D pose = ConstantVelocityModel::integrate(m_params.vx, m_params.vy, m_params.spin, time);
+            float distance = m_world.castRay(pose.x, pose.y, (angle + pose.yaw) * PI / 180.0f, time);
+
+            if(distance > m_params.maxRange)
+                distance = 0.0f;
+
+            if(m_params.dropout > 0.0f && uniform(m_random) < m_params.dropout)
+                distance = 0.0f;
+
+            if(distance > 0.0f && m_params.noise > 0.0f)
+                distance = std::max(distance + gaussian(m_random), 1.0f);
+
+            ScanNode& node = nodes[i];
+            node.angle_z_q14 = (uint16_t) (angle * (1 << 14) / 90.0f);
+            node.dist_mm_q2 = (uint32_t) (distance * 4.0f);
+            node.quality = distance > 0.0f ? (uint8_t) (255.0f - 191.0f * std::min(distance / m_params.maxRange, 1.0f)) : 0;
+            node.flag = i == 0 ? SL_LIDAR_RESP_HQ_FLAG_SYNCBIT : 0;
+        }
+
+        if(m_listener)
+            m_listener(nodes + first, last - first, monotonicMicros(), m_listenerUser);
+    }
+
+    count = samples;
+    m_revolution++;
+
+    return SL_RESULT_OK;
+}
+
+uint64_t SimulatedScanDevice::getScanStartTime() const
+{
+    return m_revolutionStart;
+}
+
+bool SimulatedScanDevice::setNodeListener(NodeListener listener, void* user)
+{
+    m_listener = listener;
+    m_listenerUser = user;
+    return true;
+}
+
+sl_result SimulatedScanDevice::ascendScanData(ScanNode* nodes, size_t count)
+{
+    std::sort(nodes, nodes + count, [](const ScanNode& a, const ScanNode& b)
+    {
+        return a.angle_z_q14 < b.angle_z_q14;
+    });
+
+    return SL_RESULT_OK;
+}
+
+SimulatedWorld& SimulatedScanDevice::getWorld()
+{
+    return m_world;
+}
+
+const SimulatorParams& SimulatedScanDevice::getParams() const
+{
+    return m_params;
+}
+
+size_t SimulatedScanDevice::getSamplesPerRevolution() const
+{
+    return (size_t) (m_params.sampleRate * 60.0f / m_params.rpm);
+}
+
+float SimulatedScanDevice::getRevolutionPeriod() const
+{
+    return 60.0f / m_params.rpm;
+}
+
+bool SimulatedScanDevice::isSimulatorPort(const std::string& port)
+{
+    return port.compare(0, strlen("sim://"), "sim://") == 0;
+}
@@ -0,0 +1,364 @@
+#include "lidar/TemporalFilter.hpp"
+#include "lidar/ScanFilter.hpp"
+#include "lidar/MedianNetwork.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define EM_TEMPORAL_X86
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#define EM_TARGET_SSE2
+#else
+#define EM_TARGET_SSE2 __attribute__((target("sse2")))
+#endif
+#endif
+
+using namespace em;
+
+namespace
+{
+    // angle_z_q14 covers a full turn in 16 bits
+    const uint32_t TURN = 1 << 16;
+    const int MAX_WINDOW = 5;
+
+    // A bin's state is its estimate and how many revolutions in a row it went
+    // without a return, both in floats so the SIMD paths need no conversions
+    struct Bins
+    {
+        const float* ranges;
+        float* estimates;
+        float* misses;
+        float* history[MAX_WINDOW];
+        int window;
+        int slot;
+        float alpha;
+        float reset;
+        float maxMisses;
+    };
+
+    uint32_t emaScalar(const Bins& bins, size_t first, size_t count)
+    {
+        uint32_t resets = 0;
+
+        for(size_t b = first; b < count; b++)
+        {
+            float m = bins.ranges[b];
+            float e = bins.estimates[b];
+
+            bool has = m > 0.0f;
+            bool far = std::abs(m - e) > bins.reset;
+            bool restart = e == 0.0f || far;
+
+            float next = has ? (restart ? m : e + bins.alpha * (m - e)) : e;
+            float missed = has ? 0.0f : bins.misses[b] + 1.0f;
+
+            resets += has && far && e != 0.0f;
+            bins.misses[b] = missed;
+            bins.estimates[b] = missed > bins.maxMisses ? 0.0f : next;
+        }
+
+        return resets;
+    }
+
+    uint32_t medianScalar(const Bins& bins, size_t first, size_t count)
+    {
+        auto min = [](float a, float b) { return std::min(a, b); };
+        auto max = [](float a, float b) { return std::max(a, b); };
+        uint32_t resets = 0;
+
+        for(size_t b = first; b < count; b++)
+        {
+            float m = bins.ranges[b];
+            float e = bins.estimates[b];
+
+            bool has = m > 0.0f;
+            bool far = std::abs(m - e) > bins.reset;
+            bool restart = e == 0.0f || far;
+
+            // Starting over fills the whole window, a missed return repeats
+            // the estimate so the median holds still
+            for(int k = 0; k < bins.window; k++)
+                bins.history[k][b] = has && restart ? m : bins.history[k][b];
+
+            bins.history[bins.slot][b] = has ? m : e;
+
+            float median = bins.window == 3 ?
+                median3(bins.history[0][b], bins.history[1][b], bins.history[2][b], min, max) :
+                median5(bins.history[0][b], bins.history[1][b], bins.history[2][b], bins.history[3][b], bins.history[4][b], min, max);
+
+            float missed = has ? 0.0f : bins.misses[b] + 1.0f;
+
+            resets += has && far && e != 0.0f;
+            bins.misses[b] = missed;
+            bins.estimates[b] = missed > bins.maxMisses ? 0.0f : median;
+        }
+
+        return resets;
+    }
+
+    void toUnitsScalar(const float* estimates, uint32_t* distances, size_t first, size_t count)
+    {
+        for(size_t b = first; b < count; b++)
+            distances[b] = (uint32_t) (estimates[b] / ScanFrame::MILLIMETERS_PER_UNIT + 0.5f);
+    }
+
+#ifdef EM_TEMPORAL_X86
+    const uint8_t BITS[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+    EM_TARGET_SSE2 inline __m128 select(__m128 mask, __m128 a, __m128 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    // The parts of a bin update both modes share, see emaScalar()
+    struct Lanes
+    {
+        __m128 m;
+        __m128 e;
+        __m128 has;
+        __m128 restart;
+        __m128 missed;
+        int resets;
+    };
+
+    EM_TARGET_SSE2 inline Lanes loadLanes(const Bins& bins, size_t b)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+        Lanes lanes;
+        lanes.m = _mm_loadu_ps(bins.ranges + b);
+        lanes.e = _mm_loadu_ps(bins.estimates + b);
+        lanes.has = _mm_cmpgt_ps(lanes.m, zero);
+
+        __m128 empty = _mm_cmpeq_ps(lanes.e, zero);
+        __m128 far = _mm_cmpgt_ps(_mm_and_ps(_mm_sub_ps(lanes.m, lanes.e), magnitude), _mm_set1_ps(bins.reset));
+
+        lanes.restart = _mm_or_ps(empty, far);
+        lanes.missed = _mm_andnot_ps(lanes.has, _mm_add_ps(_mm_loadu_ps(bins.misses + b), _mm_set1_ps(1.0f)));
+        lanes.resets = BITS[_mm_movemask_ps(_mm_and_ps(lanes.has, _mm_andnot_ps(empty, far)))];
+
+        return lanes;
+    }
+
+    EM_TARGET_SSE2 inline void storeLanes(const Bins& bins, size_t b, const Lanes& lanes, __m128 next)
+    {
+        _mm_storeu_ps(bins.misses + b, lanes.missed);
+        _mm_storeu_ps(bins.estimates + b, _mm_andnot_ps(_mm_cmpgt_ps(lanes.missed, _mm_set1_ps(bins.maxMisses)), next));
+    }
+
+    EM_TARGET_SSE2 uint32_t emaSSE2(const Bins& bins, size_t count)
+    {
+        const __m128 alpha = _mm_set1_ps(bins.alpha);
+        uint32_t resets = 0;
+        size_t b = 0;
+
+        for(; b + 4 <= count; b += 4)
+        {
+            Lanes lanes = loadLanes(bins, b);
+
+            __m128 blend = _mm_add_ps(lanes.e, _mm_mul_ps(alpha, _mm_sub_ps(lanes.m, lanes.e)));
+            __m128 next = select(lanes.has, select(lanes.restart, lanes.m, blend), lanes.e);
+
+            storeLanes(bins, b, lanes, next);
+            resets += lanes.resets;
+        }
+
+        return resets + emaScalar(bins, b, count);
+    }
+
+    EM_TARGET_SSE2 uint32_t medianSSE2(const Bins& bins, size_t count)
+    {
+        auto min = [](__m128 a, __m128 b) { return _mm_min_ps(a, b); };
+        auto max = [](__m128 a, __m128 b) { return _mm_max_ps(a, b); };
+        uint32_t resets = 0;
+        size_t b = 0;
+
+        for(; b + 4 <= count; b += 4)
+        {
+            Lanes lanes = loadLanes(bins, b);
+            __m128 fill = _mm_and_ps(lanes.has, lanes.restart);
+            __m128 h[MAX_WINDOW];
+
+            for(int k = 0; k < bins.window; k++)
+                h[k] = select(fill, lanes.m, _mm_loadu_ps(bins.history[k] + b));
+
+            h[bins.slot] = select(lanes.has, lanes.m, lanes.e);
+
+            for(int k = 0; k < bins.window; k++)
+                _mm_storeu_ps(bins.history[k] + b, h[k]);
+
+            __m128 median = bins.window == 3 ?
+                median3(h[0], h[1], h[2], min, max) :
+                median5(h[0], h[1], h[2], h[3], h[4], min, max);
+
+            storeLanes(bins, b, lanes, median);
+            resets += lanes.resets;
+        }
+
+        return resets + medianScalar(bins, b, count);
+    }
+
+    EM_TARGET_SSE2 void toUnitsSSE2(const float* estimates, uint32_t* distances, size_t count)
+    {
+        const __m128 scale = _mm_set1_ps(1.0f / ScanFrame::MILLIMETERS_PER_UNIT);
+        const __m128 half = _mm_set1_ps(0.5f);
+        size_t b = 0;
+
+        for(; b + 4 <= count; b += 4)
+        {
+            __m128 units = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(estimates + b), scale), half);
+            _mm_storeu_si128((__m128i*) (distances + b), _mm_cvttps_epi32(units));
+        }
+
+        toUnitsScalar(estimates, distances, b, count);
+    }
+#endif
+}
+
+TemporalFilter::Config::Config() :
+    mode(EMA),
+    resolution(0.5f),
+    alpha(0.3f),
+    window(5),
+    resetDistance(200.0f),
+    maxMisses(5)
+{
+}
+
+TemporalFilter::TemporalFilter(const Config& config) :
+    m_revolutions(0),
+    m_lastResets(0)
+{
+    configure(config);
+}
+
+void TemporalFilter::configure(const Config& config)
+{
+    m_config = config;
+    m_config.alpha = std::min(std::max(config.alpha, 0.0f), 1.0f);
+    m_config.window = config.window > 3 ? 5 : 3;
+    m_config.maxMisses = std::max(config.maxMisses, 0);
+
+    // The mean of a bin's returns, so noise within a revolution is smoothed too
+    m_grid.configure(config.resolution, ScanGrid::MEAN);
+    m_config.resolution = m_grid.getResolution();
+
+    const size_t bins = m_grid.size();
+    m_frame.reserve(bins);
+
+    uint16_t* angles = m_frame.angles();
+    uint8_t* qualities = m_frame.qualities();
+    uint8_t* flags = m_frame.flags();
+
+    for(size_t b = 0; b < bins; b++)
+    {
+        angles[b] = (uint16_t) ((2 * b + 1) * TURN / (2 * bins));
+        qualities[b] = 0;
+        flags[b] = b == 0 ? SL_LIDAR_RESP_HQ_FLAG_SYNCBIT : 0;
+    }
+
+    reset();
+}
+
+const TemporalFilter::Config& TemporalFilter::getConfig() const
+{
+    return m_config;
+}
+
+void TemporalFilter::reset()
+{
+    const size_t bins = m_grid.size();
+
+    m_estimates.assign(bins, 0.0f);
+    m_misses.assign(bins, 0.0f);
+    m_history.assign(bins * m_config.window, 0.0f);
+
+    std::fill(m_frame.distances(), m_frame.distances() + bins, 0);
+    m_frame.resize(bins);
+    m_frame.setSequence(0);
+
+    m_revolutions = 0;
+    m_lastResets = 0;
+}
+
+void TemporalFilter::update(const ScanFrame& frame)
+{
+    m_grid.build(frame);
+
+    const size_t count = m_grid.size();
+
+    Bins bins;
+    bins.ranges = m_grid.ranges();
+    bins.estimates = m_estimates.data();
+    bins.misses = m_misses.data();
+    bins.window = m_config.window;
+    bins.slot = (int) (m_revolutions % m_config.window);
+    bins.alpha = m_config.alpha;
+    bins.reset = m_config.resetDistance;
+    bins.maxMisses = (float) m_config.maxMisses;
+
+    for(int k = 0; k < m_config.window; k++)
+        bins.history[k] = m_history.data() + k * count;
+
+    uint32_t* distances = m_frame.distances();
+
+#ifdef EM_TEMPORAL_X86
+    if(ScanFilter::getImplementation() == ScanFilter::SSE2)
+    {
+        m_lastResets = m_config.mode == EMA ? emaSSE2(bins, count) : medianSSE2(bins, count);
+        toUnitsSSE2(bins.estimates, distances, count);
+    }
+    else
+#endif
+    {
+        m_lastResets = m_config.mode == EMA ? emaScalar(bins, 0, count) : medianScalar(bins, 0, count);
+        toUnitsScalar(bins.estimates, distances, 0, count);
+    }
+
+    m_frame.resize(count);
+    m_frame.setSequence(frame.getSequence());
+    m_frame.setTimestamp(frame.getTimestamp());
+    m_frame.setFirstByteTime(frame.getFirstByteTime());
+    m_frame.setPublishTime(frame.getPublishTime());
+
+    m_revolutions++;
+}
+
+const ScanFrame& TemporalFilter::getFrame() const
+{
+    return m_frame;
+}
+
+size_t TemporalFilter::size() const
+{
+    return m_grid.size();
+}
+
+uint64_t TemporalFilter::getSequence() const
+{
+    return m_frame.getSequence();
+}
+
+uint64_t TemporalFilter::getRevolutions() const
+{
+    return m_revolutions;
+}
+
+uint32_t TemporalFilter::getLastResets() const
+{
+    return m_lastResets;
+}
+
+const char* TemporalFilter::getModeName(Mode mode)
+{
+    switch(mode)
+    {
+    case EMA: return "ema";
+    case MEDIAN: return "median";
+    }
+
+    return "unknown";
+}
@@ -1,10 +1,52 @@
 #include <Visualizer.hpp>
+#include <HeadlessApp.hpp>
 #include <Logger.hpp>
 
 static em::Logger logger("Main");
 
+// No window, GL or ImGui at all, only the device and its statistics
+static int runHeadless(int argc, char** argv)
+{
+    em::HeadlessParams params;
+
+    if(!em::HeadlessParams::parse(argc, argv, params))
+    {
+        em::HeadlessParams::printUsage(argv[0]);
+        return -1;
+    }
+
+    em::HeadlessApp application;
+
+    if(!application.start(params))
+    {
+        logger.fatalf("Unable to start headless acquisition!");
+        return -1;
+    }
+
+    while(!application.shouldClose())
+    {
+        if(!application.runLoop())
+        {
+            logger.fatalf("Headless acquisition has suffered a problem");
+            application.terminate();
+            return -2;
+        }
+    }
+
+    if(!application.terminate())
+    {
+        logger.errorf("Headless acquisition terminated ungracefully");
+        return -3;
+    }
+
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
+    if(em::HeadlessParams::isRequested(argc, argv))
+        return runHeadless(argc, argv);
+
     em::AppParams options;
 
     // options.width = 1280;
@@ -0,0 +1,2147 @@
+#include <gtest/gtest.h>
+
+#include <LIDARFrameGrabber.hpp>
+#include <LIDARDeviceManager.hpp>
+#include <lidar/TripleBuffer.hpp>
+#include <lidar/ScanFrame.hpp>
+#include <lidar/FramePool.hpp>
+#include <lidar/PolarToCartesian.hpp>
+#include <lidar/SimulatedScanDevice.hpp>
+#include <lidar/LatencyHistogram.hpp>
+#include <lidar/ScanTelemetry.hpp>
+#include <lidar/SectorStream.hpp>
+#include <lidar/ScanBus.hpp>
+#include <lidar/ScanGrid.hpp>
+#include <lidar/MotionModel.hpp>
+#include <lidar/ScanDeskew.hpp>
+#include <lidar/DeviceDiscovery.hpp>
+#include <lidar/ScanFilter.hpp>
+#include <lidar/TemporalFilter.hpp>
+#include <lidar/ScanDecimator.hpp>
+#include <animation/Timeline.hpp>
+
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace em;
+
+TEST(LIDAR, TripleBufferHandoff)
+{
+    TripleBuffer<int> buffer;
+    buffer.slot(0) = buffer.slot(1) = buffer.slot(2) = 0;
+
+    // Nothing published yet
+    ASSERT_FALSE(buffer.update());
+
+    buffer.back() = 1;
+    buffer.publish();
+    buffer.back() = 2;
+    buffer.publish();
+
+    // Consumer only ever sees the newest frame
+    ASSERT_TRUE(buffer.update());
+    ASSERT_EQ(buffer.front(), 2);
+    ASSERT_FALSE(buffer.update());
+    ASSERT_EQ(buffer.front(), 2);
+
+    buffer.back() = 3;
+    buffer.publish();
+    ASSERT_TRUE(buffer.update());
+    ASSERT_EQ(buffer.front(), 3);
+}
+
+TEST(LIDAR, TripleBufferStress)
+{
+    const uint64_t numFrames = 50000;
+
+    TripleBuffer<LIDARFrameGrabber::Frame> buffer;
+    const uint16_t* storage[3];
+
+    for(int i = 0; i < 3; i++)
+    {
+        buffer.slot(i).reserve(8192);
+        storage[i] = static_cast<const ScanFrame&>(buffer.slot(i)).angles();
+    }
+
+    std::atomic<bool> done(false);
+
+    std::thread producer([&]()
+    {
+        std::vector<ScanNode> nodes(8192);
+
+        for(uint64_t seq = 1; seq <= numFrames; seq++)
+        {
+            LIDARFrameGrabber::Frame& frame = buffer.back();
+            size_t count = 1 + (seq * 7919) % 8192;
+
+            for(size_t i = 0; i < count; i++)
+            {
+                nodes[i].angle_z_q14 = (uint16_t) seq;
+                nodes[i].dist_mm_q2 = (uint32_t) (i + 1);
+                nodes[i].quality = 0;
+                nodes[i].flag = 0;
+            }
+
+            frame.assign(nodes.data(), count);
+            frame.setSequence(seq);
+            buffer.publish();
+        }
+
+        done = true;
+    });
+
+    uint64_t lastSequence = 0;
+    uint64_t framesSeen = 0;
+    bool consistent = true;
+
+    while(consistent)
+    {
+        bool finished = done;
+
+        if(buffer.update())
+        {
+            const LIDARFrameGrabber::Frame& frame = buffer.front();
+            size_t expectedCount = 1 + (frame.getSequence() * 7919) % 8192;
+
+            consistent &= frame.getSequence() > lastSequence;
+            consistent &= frame.size() == expectedCount;
+            consistent &= frame.longestIndex() == expectedCount - 1;
+            consistent &= frame.distances()[frame.longestIndex()] == expectedCount;
+
+            for(size_t i = 0; i < frame.size(); i++)
+                consistent &= frame.angles()[i] == (uint16_t) frame.getSequence();
+
+            lastSequence = frame.getSequence();
+            framesSeen++;
+        }
+        else if(finished)
+            break;
+    }
+
+    producer.join();
+
+    ASSERT_TRUE(consistent) << "Torn frame observed after sequence " << lastSequence;
+    ASSERT_EQ(lastSequence, numFrames);
+    ASSERT_GT(framesSeen, 0u);
+
+    // No slot should ever have been reallocated
+    for(int i = 0; i < 3; i++)
+    {
+        bool found = false;
+        for(int j = 0; j < 3; j++)
+            found |= static_cast<const ScanFrame&>(buffer.slot(i)).angles() == storage[j];
+        ASSERT_TRUE(found);
+    }
+}
+
+TEST(LIDAR, ScanFrameLayout)
+{
+    ScanFrame frame(1000);
+
+    ASSERT_EQ(frame.capacity(), 1000u);
+    ASSERT_TRUE(frame.empty());
+
+    // Every array starts on its own cache line
+    ASSERT_EQ((uintptr_t) frame.angles() % ScanFrame::ALIGNMENT, 0u);
+    ASSERT_EQ((uintptr_t) frame.distances() % ScanFrame::ALIGNMENT, 0u);
+    ASSERT_EQ((uintptr_t) frame.qualities() % ScanFrame::ALIGNMENT, 0u);
+    ASSERT_EQ((uintptr_t) frame.flags() % ScanFrame::ALIGNMENT, 0u);
+    ASSERT_EQ((uintptr_t) frame.degrees() % ScanFrame::ALIGNMENT, 0u);
+
+    std::vector<ScanNode> nodes(1200);
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        nodes[i].angle_z_q14 = (uint16_t) (i * 54);
+        nodes[i].dist_mm_q2 = (uint32_t) ((i * 7919) % 40000);
+        nodes[i].quality = (uint8_t) i;
+        nodes[i].flag = i == 0;
+    }
+
+    // Nodes past the capacity are dropped
+    frame.assign(nodes.data(), nodes.size());
+    ASSERT_EQ(frame.size(), 1000u);
+
+    size_t longest = 0;
+    for(size_t i = 0; i < frame.size(); i++)
+    {
+        ASSERT_EQ(frame.angles()[i], nodes[i].angle_z_q14);
+        ASSERT_EQ(frame.distances()[i], nodes[i].dist_mm_q2);
+        ASSERT_EQ(frame.qualities()[i], nodes[i].quality);
+        ASSERT_EQ(frame.flags()[i], nodes[i].flag);
+
+        ASSERT_FLOAT_EQ(frame.degrees()[i], nodes[i].angle_z_q14 * 90.0f / (1 << 14));
+        ASSERT_FLOAT_EQ(frame.millimeters()[i], nodes[i].dist_mm_q2 / 4.0f);
+        ASSERT_FLOAT_EQ(frame.angle(i), frame.degrees()[i]);
+        ASSERT_FLOAT_EQ(frame.distance(i), frame.millimeters()[i]);
+
+        if(nodes[i].dist_mm_q2 > nodes[longest].dist_mm_q2)
+            longest = i;
+    }
+
+    ASSERT_EQ(frame.longestIndex(), longest);
+
+    // Float views follow the frame when it changes
+    nodes[0].dist_mm_q2 = 400000;
+    frame.assign(nodes.data(), 10);
+    ASSERT_EQ(frame.size(), 10u);
+    ASSERT_FLOAT_EQ(frame.millimeters()[0], 100000.0f);
+    ASSERT_EQ(frame.longestIndex(), 0u);
+
+    frame.distances()[3] = 800000;
+    frame.resize(5);
+    ASSERT_FLOAT_EQ(frame.millimeters()[3], 200000.0f);
+    ASSERT_EQ(frame.longestIndex(), 3u);
+}
+
+TEST(LIDAR, FramePoolRecycling)
+{
+    FramePool pool(ScanFrame::getStorageSize(1000), 2);
+    ASSERT_EQ(pool.getBlockSize() % ScanFrame::ALIGNMENT, 0u);
+    ASSERT_GE(pool.getBlockCount(), 2u);
+    ASSERT_EQ(pool.getAllocations(), 1u);
+
+    // Frames are carved out of blocks and give them back when they go
+    size_t blocks = pool.getBlockCount();
+    {
+        ScanFrame frame;
+        ASSERT_TRUE(frame.reserve(1000, pool));
+        ASSERT_TRUE(frame.isPooled());
+        ASSERT_EQ(frame.capacity(), 1000u);
+        ASSERT_EQ((uintptr_t) frame.angles() % ScanFrame::ALIGNMENT, 0u);
+        ASSERT_EQ((uintptr_t) frame.millimeters() % ScanFrame::ALIGNMENT, 0u);
+        ASSERT_EQ(pool.getFreeBlocks(), blocks - 1);
+
+        // Blocks too small for the capacity are refused
+        ASSERT_FALSE(frame.reserve(100000, pool));
+        ASSERT_TRUE(frame.isPooled());
+    }
+    ASSERT_EQ(pool.getFreeBlocks(), blocks);
+
+    // Moving a frame into a pool keeps its nodes
+    ScanFrame heap(10);
+    ScanNode node = {};
+    node.angle_z_q14 = 1 << 14;
+    node.dist_mm_q2 = 4000;
+    heap.assign(&node, 1);
+    uint64_t heapAllocations = ScanFrame::getHeapAllocations();
+    ASSERT_TRUE(heap.reserve(10, pool));
+    ASSERT_EQ(heap.size(), 1u);
+    ASSERT_EQ(heap.angles()[0], node.angle_z_q14);
+    ASSERT_EQ(ScanFrame::getHeapAllocations(), heapAllocations);
+
+    // Running dry maps one more chunk, after which blocks are reused
+    std::vector<void*> held;
+    for(size_t i = 0; i < blocks; i++)
+        held.push_back(pool.acquire());
+
+    ASSERT_EQ(pool.getAllocations(), 2u);
+    ASSERT_EQ(pool.getBlockCount(), 2 * blocks);
+
+    for(void* block : held)
+        pool.release(block);
+
+    for(int i = 0; i < 100; i++)
+        pool.release(pool.acquire());
+
+    ASSERT_EQ(pool.getAllocations(), 2u);
+    ASSERT_EQ(pool.getFreeBlocks(), 2 * blocks - 1);
+}
+
+TEST(LIDAR, FramePoolConcurrent)
+{
+    const int numThreads = 4;
+    const int numRounds = 100000;
+
+    FramePool pool(256, 8);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> threads;
+
+    // Every thread marks the blocks it holds, two holding one would show
+    for(int t = 0; t < numThreads; t++)
+    {
+        threads.emplace_back([&, t]()
+        {
+            void* held[3];
+
+            for(int round = 0; round < numRounds && !failed; round++)
+            {
+                for(void*& block : held)
+                {
+                    block = pool.acquire();
+                    memset(block, t + 1, 256);
+                }
+
+                for(void* block : held)
+                {
+                    const uint8_t* data = static_cast<const uint8_t*>(block);
+
+                    if(data[0] != t + 1 || data[255] != t + 1)
+                        failed = true;
+
+                    pool.release(block);
+                }
+            }
+        });
+    }
+
+    for(std::thread& thread : threads)
+        thread.join();
+
+    ASSERT_FALSE(failed);
+    ASSERT_EQ(pool.getFreeBlocks(), pool.getBlockCount());
+    ASSERT_EQ(pool.getAcquired(), (uint64_t) numThreads * numRounds * 3);
+    ASSERT_LE(pool.getBlockCount(), (size_t) numThreads * 3 + pool.getBlockCount() / pool.getAllocations());
+}
+
+static const double PI = 3.14159265358979323846;
+
+static void makePolarNodes(ScanFrame& frame, size_t count)
+{
+    std::vector<ScanNode> nodes(count);
+
+    for(size_t i = 0; i < count; i++)
+    {
+        nodes[i].angle_z_q14 = (uint16_t) (i * 40503);
+        nodes[i].dist_mm_q2 = (uint32_t) ((i * 7919) % 160000);
+        nodes[i].quality = 0;
+        nodes[i].flag = 0;
+    }
+
+    frame.assign(nodes.data(), count);
+}
+
+TEST(LIDAR, PolarToCartesianAccuracy)
+{
+    // Every q14 angle, with an odd count to exercise the scalar tails
+    const size_t count = 65536 + 7;
+
+    ScanFrame frame(count);
+    makePolarNodes(frame, count);
+
+    // Rotates 30 degrees and translates, as a column-major 4x4
+    const float c30 = (float) std::cos(PI / 6.0), s30 = (float) std::sin(PI / 6.0);
+    const float transform[16] = {
+        c30, s30, 0.5f, 0.0f,
+        -s30, c30, 0.25f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        100.0f, -50.0f, 10.0f, 1.0f
+    };
+
+    const PolarToCartesian::Implementation detected = PolarToCartesian::getImplementation();
+    const PolarToCartesian::Implementation implementations[] = {
+        PolarToCartesian::SCALAR,
+        PolarToCartesian::SSE2,
+        PolarToCartesian::AVX2
+    };
+
+    std::vector<float> x(count), y(count), z(count);
+
+    for(PolarToCartesian::Implementation implementation : implementations)
+    {
+        if(!PolarToCartesian::setImplementation(implementation))
+            continue;
+
+        PolarToCartesian::convert(frame, x.data(), y.data(), z.data(), 0.001f);
+
+        for(size_t i = 0; i < count; i++)
+        {
+            double angle = frame.angles()[i] * PI / 2.0 / (1 << 14);
+            double distance = frame.distances()[i] / 4.0 * 0.001;
+
+            ASSERT_NEAR(x[i], distance * std::cos(angle), 1e-5 + distance * 1e-6) << PolarToCartesian::getImplementationName(implementation);
+            ASSERT_NEAR(y[i], distance * std::sin(angle), 1e-5 + distance * 1e-6) << PolarToCartesian::getImplementationName(implementation);
+            ASSERT_EQ(z[i], 0.0f);
+        }
+
+        PolarToCartesian::convert(frame, x.data(), y.data(), z.data(), 0.001f, transform);
+
+        for(size_t i = 0; i < count; i++)
+        {
+            double angle = frame.angles()[i] * PI / 2.0 / (1 << 14);
+            double distance = frame.distances()[i] / 4.0 * 0.001;
+            double px = distance * std::cos(angle);
+            double py = distance * std::sin(angle);
+
+            ASSERT_NEAR(x[i], c30 * px - s30 * py + 100.0, 1e-4);
+            ASSERT_NEAR(y[i], s30 * px + c30 * py - 50.0, 1e-4);
+            ASSERT_NEAR(z[i], 0.5 * px + 0.25 * py + 10.0, 1e-4);
+        }
+    }
+
+    PolarToCartesian::setImplementation(detected);
+
+    // The table is exact at the quarter turns
+    ASSERT_EQ(PolarToCartesian::sin(0), 0.0f);
+    ASSERT_EQ(PolarToCartesian::sin(1 << 14), 1.0f);
+    ASSERT_EQ(PolarToCartesian::cos(1 << 15), -1.0f);
+    ASSERT_EQ(PolarToCartesian::sin(3 << 14), -1.0f);
+}
+
+TEST(LIDAR, PolarToCartesianBenchmark)
+{
+    const size_t count = 8192;
+    const int rounds = 2000;
+
+    ScanFrame frame(count);
+    makePolarNodes(frame, count);
+
+    std::vector<float> x(count), y(count);
+    float sink = 0.0f;
+
+    // The per-node path the preview used before, it is slow enough to need
+    // fewer rounds
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < rounds / 20; r++)
+    {
+        const float* degrees = frame.degrees();
+        const float* millimeters = frame.millimeters();
+
+        for(size_t i = 0; i < count; i++)
+        {
+            float radians = degrees[i] * 3.14159265f / 180.0f;
+            x[i] = millimeters[i] * std::cos(radians) / millimeters[frame.longestIndex()];
+            y[i] = millimeters[i] * std::sin(radians) / millimeters[frame.longestIndex()];
+        }
+
+        sink += x[r % count];
+    }
+    double baseline = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (count * (rounds / 20));
+    printf("%-8s %6.2f ns/node\n", "libm", baseline);
+
+    const PolarToCartesian::Implementation detected = PolarToCartesian::getImplementation();
+
+    for(int impl = PolarToCartesian::SCALAR; impl <= PolarToCartesian::AVX2; impl++)
+    {
+        PolarToCartesian::Implementation implementation = (PolarToCartesian::Implementation) impl;
+
+        if(!PolarToCartesian::setImplementation(implementation))
+            continue;
+
+        start = std::chrono::steady_clock::now();
+        for(int r = 0; r < rounds; r++)
+        {
+            PolarToCartesian::convert(frame, x.data(), y.data(), nullptr, 1.0f / frame.distance(frame.longestIndex()));
+            sink += x[r % count];
+        }
+        double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (count * rounds);
+        printf("%-8s %6.2f ns/node (%.1fx)\n", PolarToCartesian::getImplementationName(implementation), elapsed, baseline / elapsed);
+    }
+
+    PolarToCartesian::setImplementation(detected);
+    ASSERT_TRUE(std::isfinite(sink));
+}
+
+TEST(LIDAR, SimulatorGeometry)
+{
+    SimulatedWorld world;
+    world.addBox(-2000.0f, -2000.0f, 2000.0f, 2000.0f);
+
+    SimulatorParams params = SimulatorParams::parse("sim://rate=4000,rpm=600,realtime=0");
+    ASSERT_EQ(params.sampleRate, 4000);
+    ASSERT_FLOAT_EQ(params.rpm, 600.0f);
+    ASSERT_FALSE(params.realtime);
+
+    SimulatedScanDevice device(params, world);
+    ASSERT_EQ(device.getSamplesPerRevolution(), 400u);
+
+    // Scanning is refused until connected and started
+    ScanNode nodes[8192];
+    size_t count = 8192;
+    ASSERT_TRUE(SL_IS_FAIL(device.grabScanDataHq(nodes, count)));
+
+    ASSERT_TRUE(SL_IS_OK(device.connect()));
+    ASSERT_TRUE(SL_IS_OK(device.startScan()));
+
+    count = 8192;
+    ASSERT_TRUE(SL_IS_OK(device.grabScanDataHq(nodes, count)));
+    ASSERT_TRUE(SL_IS_OK(device.ascendScanData(nodes, count)));
+    ASSERT_EQ(count, 400u);
+
+    // Every ray must hit the square room at 2000 / max(|cos|, |sin|)
+    for(size_t i = 0; i < count; i++)
+    {
+        float angle = nodes[i].angle_z_q14 * 90.0f / (1 << 14) * 3.14159265f / 180.0f;
+        float expected = 2000.0f / std::max(std::fabs(std::cos(angle)), std::fabs(std::sin(angle)));
+
+        ASSERT_NEAR(nodes[i].dist_mm_q2 / 4.0f, expected, 2.0f) << "node " << i;
+        ASSERT_GT(nodes[i].quality, 0);
+
+        if(i > 0)
+        {
+            ASSERT_GE(nodes[i].angle_z_q14, nodes[i - 1].angle_z_q14);
+        }
+    }
+}
+
+TEST(LIDAR, SimulatorDropouts)
+{
+    SimulatedScanDevice device(SimulatorParams::parse("sim://rate=32000,rpm=300,dropout=0.25,noise=20,realtime=0"));
+    device.connect();
+    device.startScan();
+
+    ScanNode nodes[8192];
+    size_t total = 0;
+    size_t dropped = 0;
+
+    for(int revolution = 0; revolution < 4; revolution++)
+    {
+        size_t count = 8192;
+        ASSERT_TRUE(SL_IS_OK(device.grabScanDataHq(nodes, count)));
+        ASSERT_EQ(count, 6400u);
+
+        for(size_t i = 0; i < count; i++)
+            dropped += nodes[i].dist_mm_q2 == 0;
+
+        total += count;
+    }
+
+    // The default room is fully enclosed so only dropouts return nothing
+    ASSERT_NEAR((float) dropped / total, 0.25f, 0.02f);
+}
+
+TEST(LIDAR, SimulatedFrameGrabber)
+{
+    LIDARFrameGrabber grabber("sim://rate=8000,rpm=600,realtime=0");
+    grabber.start();
+
+    uint64_t sequence = 0;
+    for(int i = 0; i < 500 && sequence < 5; i++)
+    {
+        sequence = grabber.latestFrame().getSequence();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    ASSERT_TRUE(grabber.isConnected());
+    ASSERT_GE(sequence, 5u);
+    ASSERT_EQ(grabber.getNodes().size(), 800u);
+    ASSERT_GT(grabber.longestNode().distance, 0.0f);
+    ASSERT_EQ(grabber.getSerialNumber().substr(0, 4), "5349");
+
+    grabber.stop();
+}
+
+static bool waitForFrames(LIDARDeviceManager& devices, uint64_t count)
+{
+    for(int i = 0; i < 500; i++)
+    {
+        bool ready = true;
+
+        for(size_t d = 0; d < devices.getDeviceCount(); d++)
+            ready &= devices.getGrabber(d)->latestFrame().getSequence() >= count;
+
+        if(ready)
+            return true;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return false;
+}
+
+TEST(LIDAR, DeviceManagerFusion)
+{
+    LIDARDeviceManager devices;
+
+    LIDARDeviceManager::Extrinsics mount;
+    mount.x = 1000.0f;
+    mount.y = -250.0f;
+    mount.yaw = 90.0f;
+
+    devices.addDevice("sim://rate=8000,rpm=600,realtime=0,seed=1");
+    devices.addDevice("sim://rate=4000,rpm=600,realtime=0,seed=2", mount);
+    ASSERT_EQ(devices.getDeviceCount(), 2u);
+    ASSERT_TRUE(waitForFrames(devices, 3));
+
+    // Freeze both devices so the fused scans are the ones getNodes() sees
+    for(size_t d = 0; d < devices.getDeviceCount(); d++)
+    {
+        devices.getGrabber(d)->stop();
+        devices.getGrabber(d)->latestFrame();
+    }
+
+    const LIDARDeviceManager::FusedFrame& fused = devices.fuse();
+    ASSERT_EQ(fused.sources.size(), 2u);
+    ASSERT_EQ(fused.size, 1200u);
+    ASSERT_EQ(fused.sources[1].first, 800u);
+    ASSERT_EQ(fused.sources[1].count, 400u);
+    ASSERT_GT(fused.radius, 1000.0f);
+
+    for(size_t d = 0; d < 2; d++)
+    {
+        const LIDARDeviceManager::FusedSource& source = fused.sources[d];
+        const std::vector<LIDARFrameGrabber::Node>& nodes = devices.getGrabber(d)->getNodes();
+        ASSERT_EQ(nodes.size(), source.count);
+
+        for(size_t i = 0; i < source.count; i++)
+        {
+            float angle = nodes[i].angle * (float) PI / 180.0f;
+            float px = nodes[i].distance * cosf(angle);
+            float py = nodes[i].distance * sinf(angle);
+
+            // The second device is turned a quarter and moved
+            float ex = d ? mount.x - py : px;
+            float ey = d ? mount.y + px : py;
+
+            size_t point = source.first + i;
+            ASSERT_NEAR(fused.x[point], ex, 0.5f);
+            ASSERT_NEAR(fused.y[point], ey, 0.5f);
+            ASSERT_NEAR(fused.z[point], 0.0f, 0.5f);
+            ASSERT_EQ(fused.device[point], d);
+        }
+    }
+
+    // Nothing changed, so the frame is left alone
+    uint64_t revision = fused.revision;
+    devices.fuse();
+    ASSERT_EQ(fused.revision, revision);
+
+    mount.yaw = 0.0f;
+    devices.setExtrinsics(1, mount);
+    devices.fuse();
+    ASSERT_GT(fused.revision, revision);
+}
+
+TEST(LIDAR, DeviceManagerStaleScans)
+{
+    LIDARDeviceManager devices;
+    devices.addDevice("sim://rate=8000,rpm=600,realtime=0,seed=3");
+    devices.addDevice("sim://rate=8000,rpm=600,realtime=0,seed=4");
+    ASSERT_TRUE(waitForFrames(devices, 3));
+
+    // One device goes quiet while the other keeps scanning
+    devices.getGrabber(0)->stop();
+    devices.setMaxSkew(10000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_TRUE(waitForFrames(devices, 3));
+
+    const LIDARDeviceManager::FusedFrame& fused = devices.fuse();
+    ASSERT_EQ(fused.sources.size(), 1u);
+    ASSERT_EQ(fused.sources[0].device, 1u);
+    ASSERT_EQ(fused.size, 800u);
+    ASSERT_EQ(devices.getStaleCount(0), 1u);
+    ASSERT_EQ(devices.getStaleCount(1), 0u);
+
+    devices.removeDevice(0);
+    ASSERT_EQ(devices.getDeviceCount(), 1u);
+    ASSERT_FALSE(devices.hasPort("sim://rate=8000,rpm=600,realtime=0,seed=3"));
+    ASSERT_TRUE(devices.hasPort("sim://rate=8000,rpm=600,realtime=0,seed=4"));
+}
+
+TEST(LIDAR, LatencyHistogramPercentiles)
+{
+    LatencyHistogram histogram;
+    ASSERT_EQ(histogram.getPercentile(50.0), 0u);
+
+    // Buckets tile the range without gaps
+    for(size_t i = 1; i < LatencyHistogram::BUCKET_COUNT; i++)
+        ASSERT_EQ(LatencyHistogram::bucketLow(i), LatencyHistogram::bucketHigh(i - 1) + 1);
+
+    for(uint64_t value = 1; value < (1ull << 36); value = value * 3 / 2 + 1)
+    {
+        size_t index = LatencyHistogram::bucketIndex(value);
+        ASSERT_LE(LatencyHistogram::bucketLow(index), value);
+        ASSERT_GE(LatencyHistogram::bucketHigh(index), value);
+        ASSERT_LE(LatencyHistogram::bucketHigh(index) - LatencyHistogram::bucketLow(index), value / 32);
+    }
+
+    for(uint64_t value = 1; value <= 100000; value++)
+        histogram.record(value);
+
+    ASSERT_EQ(histogram.getCount(), 100000u);
+    ASSERT_EQ(histogram.getMin(), 1u);
+    ASSERT_EQ(histogram.getMax(), 100000u);
+    ASSERT_NEAR(histogram.getMean(), 50000.5, 0.01);
+    ASSERT_NEAR((double) histogram.getPercentile(50.0), 50000.0, 50000.0 * 0.03);
+    ASSERT_NEAR((double) histogram.getPercentile(99.0), 99000.0, 99000.0 * 0.03);
+    ASSERT_EQ(histogram.getPercentile(100.0), 100000u);
+
+    histogram.reset();
+    ASSERT_EQ(histogram.getCount(), 0u);
+    ASSERT_EQ(histogram.getMin(), 0u);
+}
+
+TEST(LIDAR, LatencyHistogramConcurrentRecords)
+{
+    LatencyHistogram histogram;
+    std::vector<std::thread> threads;
+
+    for(int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&histogram, t]()
+        {
+            for(uint64_t i = 0; i < 100000; i++)
+                histogram.record(t * 1000 + i % 1000);
+        });
+    }
+
+    for(std::thread& thread : threads)
+        thread.join();
+
+    ASSERT_EQ(histogram.getCount(), 400000u);
+    ASSERT_EQ(histogram.getMin(), 0u);
+    ASSERT_EQ(histogram.getMax(), 3999u);
+}
+
+TEST(LIDAR, ScanTelemetryStages)
+{
+    ScanTelemetry telemetry;
+    ScanFrame frame(16);
+
+    // Scans 1 and 2 go out, only 2 is picked up
+    for(uint64_t sequence = 1; sequence <= 2; sequence++)
+    {
+        uint64_t base = sequence * 100000;
+        frame.setSequence(sequence);
+        frame.setFirstByteTime(base);
+        frame.setTimestamp(base + 100000);
+        frame.setPublishTime(base + 100050);
+        telemetry.scanPublished(frame);
+    }
+
+    telemetry.scanConsumed(frame, 400050);
+    telemetry.scanConsumed(frame, 400060);
+    telemetry.scanPresented(410050);
+    telemetry.scanPresented(420050);
+
+    ASSERT_EQ(telemetry.getPublished(), 2u);
+    ASSERT_EQ(telemetry.getConsumed(), 1u);
+    ASSERT_EQ(telemetry.getPresented(), 1u);
+    ASSERT_EQ(telemetry.getLate(), 1u);
+
+    ASSERT_EQ(telemetry.getHistogram(ScanTelemetry::ACQUISITION).getMax(), 100000u);
+    ASSERT_EQ(telemetry.getHistogram(ScanTelemetry::PUBLISH).getMax(), 50u);
+    ASSERT_EQ(telemetry.getHistogram(ScanTelemetry::QUEUE).getMax(), 100000u);
+    ASSERT_EQ(telemetry.getHistogram(ScanTelemetry::RENDER).getMax(), 10000u);
+    ASSERT_EQ(telemetry.getHistogram(ScanTelemetry::SCAN_TO_PHOTON).getMax(), 210050u);
+
+    // Scans 3 and 4 are overwritten before the consumer gets to them
+    frame.setSequence(5);
+    telemetry.scanConsumed(frame, 500000);
+    ASSERT_EQ(telemetry.getDropped(), 2u);
+}
+
+TEST(LIDAR, TelemetryLuaLibrary)
+{
+    LIDARDeviceManager devices;
+    devices.addDevice("sim://rate=8000,rpm=600,realtime=0");
+    ASSERT_TRUE(waitForFrames(devices, 3));
+
+    for(int i = 0; i < 3; i++)
+    {
+        devices.fuse();
+        devices.framePresented();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    devices.lua_openLidarLib(L);
+
+    const char* script =
+        "assert(lidar.getDeviceCount() == 1)\n"
+        "assert(lidar.getPort(1):sub(1, 6) == 'sim://')\n"
+        "local latency = lidar.getLatency(1)\n"
+        "assert(latency.count >= 3 and latency.p99 >= latency.p50 and latency.max >= latency.p99)\n"
+        "assert(lidar.getLatency(1, 'acquisition').count >= 3)\n"
+        "local counters = lidar.getCounters(1)\n"
+        "assert(counters.published >= counters.consumed and counters.presented >= 3)\n"
+        "assert(not pcall(lidar.getLatency, 2))\n"
+        "assert(not pcall(lidar.getLatency, 1, 'nonsense'))\n"
+        "assert(lidar.dumpTelemetry('telemetry-test.json'))\n";
+
+    int result = luaL_dostring(L, script);
+    ASSERT_EQ(result, 0) << lua_tostring(L, -1);
+    lua_close(L);
+
+    FILE* file = fopen("telemetry-test.json", "r");
+    ASSERT_NE(file, nullptr);
+
+    char buffer[4096] = {0};
+    fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    remove("telemetry-test.json");
+
+    ASSERT_NE(strstr(buffer, "\"scanToPhoton\": {\"count\": "), nullptr);
+    ASSERT_NE(strstr(buffer, "\"name\": \"sim://rate=8000,rpm=600,realtime=0\""), nullptr);
+}
+
+static ScanNode sectorNode(float degrees, bool sync = false)
+{
+    ScanNode node = {};
+    node.angle_z_q14 = (uint16_t) (degrees * (1 << 14) / 90.0f);
+    node.dist_mm_q2 = 4000;
+    node.flag = sync ? SL_LIDAR_RESP_HQ_FLAG_SYNCBIT : 0;
+    return node;
+}
+
+TEST(LIDAR, SectorStreamAssembly)
+{
+    SectorStream stream(4, 8);
+
+    // Starts mid revolution, jitters back over the 90 degree edge, then wraps
+    std::vector<ScanNode> nodes;
+    for(float angle : {50.0f, 80.0f, 91.0f, 89.5f, 120.0f, 181.0f, 270.0f, 359.0f})
+        nodes.push_back(sectorNode(angle));
+    nodes.push_back(sectorNode(0.5f, true));
+    nodes.push_back(sectorNode(45.0f));
+
+    stream.feed(nodes.data(), nodes.size(), 1000);
+
+    const uint16_t expectedIndex[] = {0, 1, 2, 3};
+    const size_t expectedSize[] = {2, 3, 1, 2};
+
+    for(int i = 0; i < 4; i++)
+    {
+        const ScanSector* sector = stream.next();
+        ASSERT_NE(sector, nullptr);
+        ASSERT_EQ(sector->index, expectedIndex[i]);
+        ASSERT_EQ(sector->count, 4u);
+        ASSERT_EQ(sector->frame.size(), expectedSize[i]);
+        ASSERT_EQ(sector->frame.getSequence(), i + 1u);
+        ASSERT_EQ(sector->revolution, 0u);
+        stream.release();
+    }
+
+    // The new revolution's first sector is still open
+    ASSERT_EQ(stream.next(), nullptr);
+
+    stream.feed(&nodes[5], 1, 2000);
+    const ScanSector* sector = stream.next();
+    ASSERT_NE(sector, nullptr);
+    ASSERT_EQ(sector->revolution, 1u);
+    ASSERT_EQ(sector->frame.size(), 2u);
+    ASSERT_FLOAT_EQ(sector->getStartAngle(), 0.0f);
+    ASSERT_FLOAT_EQ(sector->getEndAngle(), 90.0f);
+    stream.release();
+}
+
+TEST(LIDAR, SectorStreamOverflow)
+{
+    SectorStream stream(16, 4);
+
+    std::vector<ScanNode> nodes;
+    for(int i = 0; i < 720; i++)
+        nodes.push_back(sectorNode(i * 0.5f, i == 0));
+
+    stream.feedRevolution(nodes.data(), nodes.size(), 10, 20);
+
+    // Only the first four fit, the rest are dropped rather than overwriting
+    ASSERT_EQ(stream.getPublished(), 4u);
+    ASSERT_EQ(stream.getDropped(), 12u);
+
+    for(uint64_t i = 0; i < 4; i++)
+    {
+        ASSERT_EQ(stream.next()->frame.getSequence(), i + 1);
+        ASSERT_EQ(stream.next()->frame.size(), 45u);
+        ASSERT_EQ(stream.next()->frame.getFirstByteTime(), 10u);
+        stream.release();
+    }
+
+    ASSERT_EQ(stream.next(), nullptr);
+
+    // Sequence numbers show the gap left by the dropped sectors
+    stream.feedRevolution(nodes.data(), 45, 30, 40);
+    ASSERT_EQ(stream.next()->frame.getSequence(), 17u);
+    ASSERT_EQ(stream.next()->revolution, 2u);
+}
+
+TEST(LIDAR, SectorStreamingLatency)
+{
+    LIDARFrameGrabber grabber("sim://rate=8000,rpm=600,realtime=1");
+    grabber.start();
+    ASSERT_TRUE(grabber.hasLiveSectors());
+
+    SectorStream& stream = grabber.getSectorStream();
+    uint64_t sectors = 0;
+    uint64_t lastSequence = 0;
+    uint64_t worst = 0;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+    while(sectors < 40 && std::chrono::steady_clock::now() < deadline)
+    {
+        const ScanSector* sector = stream.next();
+
+        if(!sector)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        ASSERT_EQ(sector->frame.getSequence(), lastSequence + 1);
+        lastSequence = sector->frame.getSequence();
+
+        // A 22.5 degree sector at 10 Hz takes about 6 ms, far short of the
+        // 100 ms a whole revolution takes to publish
+        worst = std::max(worst, sector->frame.getPublishTime() - sector->frame.getFirstByteTime());
+        sectors++;
+        stream.release();
+    }
+
+    grabber.stop();
+
+    ASSERT_GE(sectors, 40u);
+    ASSERT_LT(worst, 30000u);
+    ASSERT_EQ(stream.getDropped(), 0u);
+}
+
+static void publishBusFrame(ScanBus& bus, uint64_t sequence)
+{
+    ScanFrame& frame = bus.claim();
+    ScanNode node = sectorNode((float) (sequence % 360));
+    frame.assign(&node, 1);
+    frame.setSequence(sequence);
+    bus.publish();
+}
+
+TEST(LIDAR, ScanBusFanOut)
+{
+    ScanBus bus(16, 2);
+    std::shared_ptr<ScanBus::Subscriber> fast = bus.subscribe("fast", 4);
+    std::shared_ptr<ScanBus::Subscriber> slow = bus.subscribe("slow", 2);
+
+    ASSERT_FALSE(bus.latest());
+    ASSERT_FALSE(fast->next());
+
+    for(uint64_t i = 1; i <= 2; i++)
+        publishBusFrame(bus, i);
+
+    // Both subscribers and latest() share one frame rather than copies
+    ScanBus::FrameRef first = fast->next();
+    ScanBus::FrameRef second = fast->next();
+    ScanBus::FrameRef slowFirst = slow->next();
+    ASSERT_EQ(first->getSequence(), 1u);
+    ASSERT_EQ(second->getSequence(), 2u);
+    ASSERT_EQ(slowFirst.get(), first.get());
+    ASSERT_EQ(bus.latest().get(), second.get());
+    ASSERT_EQ(first.useCount(), 2);
+    ASSERT_EQ(second.useCount(), 3);
+    ASSERT_NEAR(second->degrees()[0], 2.0f, 0.01f);
+
+    // Once the last reference goes the frame is back in the pool
+    size_t free = bus.getFreeFrames();
+    first.reset();
+    ASSERT_EQ(bus.getFreeFrames(), free);
+    slowFirst.reset();
+    ASSERT_EQ(bus.getFreeFrames(), free + 1);
+    second.reset();
+
+    // The slow subscriber only keeps its newest two
+    for(uint64_t i = 3; i <= 6; i++)
+        publishBusFrame(bus, i);
+
+    for(uint64_t i = 3; i <= 6; i++)
+        ASSERT_EQ(fast->next()->getSequence(), i);
+
+    ASSERT_EQ(slow->next()->getSequence(), 5u);
+    ASSERT_EQ(slow->next()->getSequence(), 6u);
+    ASSERT_FALSE(slow->next());
+
+    ScanBus::SubscriberStats stats = slow->getStats();
+    ASSERT_EQ(stats.name, "slow");
+    ASSERT_EQ(stats.received, 3u);
+    ASSERT_EQ(stats.dropped, 3u);
+    ASSERT_EQ(stats.maxQueued, 2u);
+    ASSERT_EQ(stats.lag, 0u);
+    ASSERT_EQ(fast->getStats().dropped, 0u);
+
+    // After warming up, the pool covers every queue and stops growing
+    size_t poolSize = bus.getPoolSize();
+
+    for(uint64_t i = 7; i <= 200; i++)
+    {
+        publishBusFrame(bus, i);
+
+        if(i % 4 == 0)
+        {
+            while(fast->next()) {}
+        }
+    }
+
+    ASSERT_EQ(bus.getPoolSize(), poolSize);
+
+    // Dropping the handle ends the subscription and returns its frames
+    ASSERT_EQ(bus.getSubscribers().size(), 2u);
+    slow.reset();
+    publishBusFrame(bus, 201);
+    ASSERT_EQ(bus.getSubscribers().size(), 1u);
+    ASSERT_EQ(bus.getSubscribers()[0].name, "fast");
+
+    fast.reset();
+    ASSERT_EQ(bus.getFreeFrames(), bus.getPoolSize() - 1);
+}
+
+TEST(LIDAR, ScanBusBlockingSubscriber)
+{
+    const uint64_t numFrames = 2000;
+
+    ScanBus bus(16);
+    std::shared_ptr<ScanBus::Subscriber> every = bus.subscribe("every", 2, ScanBus::BLOCK, 1000);
+    std::shared_ptr<ScanBus::Subscriber> latest = bus.subscribe("latest", 1);
+
+    std::atomic<bool> failed(false);
+
+    // A blocking subscriber gets every frame in order, however slow it is
+    std::thread consumer([&]()
+    {
+        for(uint64_t i = 1; i <= numFrames; i++)
+        {
+            ScanBus::FrameRef frame = every->next(5000);
+
+            if(!frame || frame->getSequence() != i)
+            {
+                failed = true;
+                return;
+            }
+
+            if(i % 100 == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    // And next() returns once the subscription is closed
+    std::thread waiter([&]()
+    {
+        uint64_t last = 0;
+
+        while(ScanBus::FrameRef frame = latest->next(5000))
+        {
+            if(frame->getSequence() <= last)
+                failed = true;
+
+            last = frame->getSequence();
+        }
+    });
+
+    for(uint64_t i = 1; i <= numFrames; i++)
+        publishBusFrame(bus, i);
+
+    consumer.join();
+    latest->close();
+    waiter.join();
+
+    ASSERT_FALSE(failed);
+
+    ScanBus::SubscriberStats stats = every->getStats();
+    ASSERT_EQ(stats.received, numFrames);
+    ASSERT_EQ(stats.dropped, 0u);
+    ASSERT_GT(stats.blocked, 0u);
+    ASSERT_LE(stats.maxQueued, 2u);
+
+    ASSERT_TRUE(latest->isClosed());
+    ASSERT_FALSE(latest->next());
+
+    // One that never reads only holds publishing up for its timeout
+    every.reset();
+    std::shared_ptr<ScanBus::Subscriber> stalled = bus.subscribe("stalled", 1, ScanBus::BLOCK, 1);
+
+    for(uint64_t i = 1; i <= 20; i++)
+        publishBusFrame(bus, numFrames + i);
+
+    stats = stalled->getStats();
+    ASSERT_EQ(stats.received, 0u);
+    ASSERT_EQ(stats.dropped, 19u);
+    ASSERT_EQ(stats.blocked, 19u);
+    ASSERT_GE(stats.blockedMicros, 19000u);
+    ASSERT_EQ(stats.queued, 1u);
+    ASSERT_EQ(stats.policy, ScanBus::BLOCK);
+}
+
+TEST(LIDAR, ScanBusBlockedPublishLeavesBusUsable)
+{
+    ScanBus bus(16);
+    std::shared_ptr<ScanBus::Subscriber> stalled = bus.subscribe("stalled", 1, ScanBus::BLOCK, 1000);
+
+    publishBusFrame(bus, 1);
+
+    // The second frame waits up to a second for the stalled subscriber
+    std::thread producer([&]() { publishBusFrame(bus, 2); });
+
+    while(!stalled->getStats().blocked)
+        std::this_thread::yield();
+
+    // Meanwhile the bus can still be looked at and subscribed to
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ScanBus::SubscriberStats> subscribers = bus.getSubscribers();
+    std::shared_ptr<ScanBus::Subscriber> late = bus.subscribe("late");
+    auto waited = std::chrono::steady_clock::now() - start;
+
+    producer.join();
+
+    ASSERT_EQ(subscribers.size(), 1u);
+    ASSERT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(waited).count(), 500);
+    ASSERT_EQ(stalled->getStats().dropped, 1u);
+}
+
+TEST(LIDAR, ScanBusSkipsCopiesWithoutSubscribers)
+{
+    ScanBus bus(16, 2);
+    ScanNode node = sectorNode(10.0f);
+    ScanFrame frame;
+    frame.assign(&node, 1);
+
+    // Nothing is claimed while nobody listens
+    bus.publish(frame);
+    ASSERT_EQ(bus.getPublished(), 1u);
+    ASSERT_EQ(bus.getFreeFrames(), 2u);
+    ASSERT_FALSE(bus.latest());
+
+    std::shared_ptr<ScanBus::Subscriber> subscriber = bus.subscribe("test");
+    bus.publish(frame);
+    ASSERT_TRUE(subscriber->next());
+    ASSERT_TRUE(bus.latest());
+
+    // A closed subscriber no longer counts
+    subscriber->close();
+    size_t free = bus.getFreeFrames();
+    bus.publish(frame);
+    ASSERT_EQ(bus.getFreeFrames(), free);
+    ASSERT_EQ(bus.getPublished(), 3u);
+}
+
+TEST(LIDAR, ScanBusFromGrabber)
+{
+    LIDARFrameGrabber grabber("sim://rate=8000,rpm=600,realtime=0");
+    std::shared_ptr<ScanBus::Subscriber> subscriber = grabber.getBus().subscribe("test", 8);
+    grabber.start();
+
+    uint64_t lastSequence = 0;
+
+    for(int i = 0; i < 20; i++)
+    {
+        ScanBus::FrameRef frame = subscriber->next(2000);
+        ASSERT_TRUE(frame);
+        ASSERT_GT(frame->getSequence(), lastSequence);
+        ASSERT_GT(frame->size(), 0u);
+        lastSequence = frame->getSequence();
+    }
+
+    grabber.stop();
+
+    ASSERT_GE(grabber.getBus().getPublished(), 20u);
+    ASSERT_EQ(subscriber->getStats().received, 20u);
+}
+
+TEST(LIDAR, ScanPipelineSteadyState)
+{
+    LIDARFrameGrabber grabber("sim://rate=8000,rpm=600,realtime=0");
+    std::shared_ptr<ScanBus::Subscriber> subscriber = grabber.getBus().subscribe("test", 4);
+    grabber.start();
+
+    // Warm up until every queue has been through a few rounds
+    for(int i = 0; i < 20; i++)
+        ASSERT_TRUE(subscriber->next(2000));
+
+    uint64_t heapAllocations = ScanFrame::getHeapAllocations();
+    uint64_t poolAllocations = grabber.getFramePool().getAllocations();
+    uint64_t busAllocations = grabber.getBus().getStorage().getAllocations();
+    size_t busFrames = grabber.getBus().getPoolSize();
+    uint64_t published = grabber.getBus().getPublished();
+
+    for(int i = 0; i < 200; i++)
+    {
+        ScanBus::FrameRef frame = subscriber->next(2000);
+        ASSERT_TRUE(frame);
+        ASSERT_TRUE(frame->isPooled());
+        grabber.latestFrame();
+    }
+
+    grabber.stop();
+
+    ASSERT_GE(grabber.getBus().getPublished(), published + 200);
+    ASSERT_TRUE(grabber.latestFrame().isPooled());
+
+    // Not a single frame was allocated for all those scans
+    ASSERT_EQ(ScanFrame::getHeapAllocations(), heapAllocations);
+    ASSERT_EQ(grabber.getFramePool().getAllocations(), poolAllocations);
+    ASSERT_EQ(grabber.getBus().getStorage().getAllocations(), busAllocations);
+    ASSERT_EQ(grabber.getBus().getPoolSize(), busFrames);
+}
+
+TEST(LIDAR, ScanGridReductions)
+{
+    // Three returns in the 10-11 degree bin, one dropout and one in the last bin
+    std::vector<ScanNode> nodes;
+    nodes.push_back(sectorNode(10.1f));
+    nodes.push_back(sectorNode(10.45f));
+    nodes.push_back(sectorNode(10.9f));
+    nodes.push_back(sectorNode(200.5f));
+    nodes.push_back(sectorNode(359.9f));
+    nodes[0].dist_mm_q2 = 4000;
+    nodes[1].dist_mm_q2 = 8000;
+    nodes[2].dist_mm_q2 = 2000;
+    nodes[3].dist_mm_q2 = 0;
+    nodes[4].dist_mm_q2 = 400;
+
+    ScanFrame frame(16);
+    frame.assign(nodes.data(), nodes.size());
+    frame.setSequence(7);
+
+    ScanGrid grid(1.0f, ScanGrid::MIN);
+    ASSERT_EQ(grid.size(), 360u);
+    grid.build(frame);
+
+    ASSERT_EQ(grid.getSequence(), 7u);
+    ASSERT_FLOAT_EQ(grid.range(10.5f), 500.0f);
+    ASSERT_FLOAT_EQ(grid.range(200.0f), 0.0f);
+    ASSERT_FLOAT_EQ(grid.range(359.5f), 100.0f);
+    ASSERT_FLOAT_EQ(grid.range(-0.5f), 100.0f);
+    ASSERT_FLOAT_EQ(grid.range(720.0f + 10.2f), 500.0f);
+    ASSERT_FLOAT_EQ(grid.range(42.0f), 0.0f);
+
+    grid.configure(1.0f, ScanGrid::NEAREST);
+    grid.build(frame);
+    ASSERT_FLOAT_EQ(grid.range(10.0f), 2000.0f);
+
+    grid.configure(1.0f, ScanGrid::MEAN);
+    grid.build(frame);
+    ASSERT_FLOAT_EQ(grid.range(10.0f), 3500.0f / 3.0f);
+
+    // Resolutions that don't divide a turn are rounded so the bins do
+    grid.configure(0.7f, ScanGrid::MIN);
+    ASSERT_EQ(grid.size(), 514u);
+    ASSERT_NEAR(grid.getResolution() * grid.size(), 360.0f, 0.001f);
+}
+
+TEST(LIDAR, ScanGridMatchesLinearSearch)
+{
+    SimulatedScanDevice device(SimulatorParams::parse("sim://rate=8000,rpm=600,realtime=0,noise=5"));
+    ASSERT_TRUE(SL_IS_OK(device.connect()));
+    ASSERT_TRUE(SL_IS_OK(device.startScan()));
+
+    std::vector<ScanNode> nodes(8192);
+    size_t count = nodes.size();
+    ASSERT_TRUE(SL_IS_OK(device.grabScanDataHq(nodes.data(), count)));
+    device.ascendScanData(nodes.data(), count);
+
+    ScanFrame frame(8192);
+    frame.assign(nodes.data(), count);
+
+    ScanGrid grid(0.25f, ScanGrid::MIN);
+    grid.build(frame);
+
+    for(size_t bin = 0; bin < grid.size(); bin++)
+    {
+        float expected = 0.0f;
+
+        for(size_t i = 0; i < frame.size(); i++)
+        {
+            if(grid.binOf(frame.angle(i)) == bin && frame.distance(i) > 0.0f && (expected == 0.0f || frame.distance(i) < expected))
+                expected = frame.distance(i);
+        }
+
+        ASSERT_FLOAT_EQ(grid.rangeAt(bin), expected) << "bin " << bin;
+    }
+}
+
+TEST(LIDAR, ScanGridFromGrabber)
+{
+    LIDARDeviceManager devices;
+    devices.addDevice("sim://rate=8000,rpm=600,realtime=0");
+    ASSERT_TRUE(waitForFrames(devices, 2));
+
+    LIDARFrameGrabber* grabber = devices.getGrabber(0);
+    grabber->setScanGrid(0.5f, ScanGrid::MIN);
+
+    const ScanGrid& grid = grabber->getScanGrid();
+    ASSERT_EQ(grid.size(), 720u);
+    ASSERT_EQ(grid.getSequence(), grabber->latestFrame().getSequence());
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    devices.lua_openLidarLib(L);
+
+    const char* script =
+        "lidar.setGrid(1, 1.0, 'mean')\n"
+        "local ranges = lidar.getRanges(1)\n"
+        "assert(#ranges == 360 and ranges.resolution == 1.0)\n"
+        "assert(lidar.getRange(1, 90.5) == ranges[91])\n"
+        "assert(not pcall(lidar.setGrid, 1, 1.0, 'median'))\n";
+
+    int result = luaL_dostring(L, script);
+    ASSERT_EQ(result, 0) << lua_tostring(L, -1);
+    lua_close(L);
+
+    ASSERT_EQ(grabber->getScanGrid().getReduction(), ScanGrid::MEAN);
+}
+
+TEST(LIDAR, MotionModelPoses)
+{
+    // Driving a quarter turn a second for four seconds comes back around
+    Pose2D pose = ConstantVelocityModel::integrate(1000.0f, 0.0f, 90.0f, 4.0f);
+    ASSERT_NEAR(pose.x, 0.0f, 0.5f);
+    ASSERT_NEAR(pose.y, 0.0f, 0.5f);
+    ASSERT_NEAR(pose.yaw, 360.0f, 0.01f);
+
+    // After one second it is a quarter circle of radius 1000 / (pi / 2) along
+    pose = ConstantVelocityModel::integrate(1000.0f, 0.0f, 90.0f, 1.0f);
+    ASSERT_NEAR(pose.x, 2000.0f / (float) PI, 0.5f);
+    ASSERT_NEAR(pose.y, 2000.0f / (float) PI, 0.5f);
+
+    Pose2D identity = pose.compose(pose.inverse());
+    ASSERT_NEAR(identity.x, 0.0f, 1e-3f);
+    ASSERT_NEAR(identity.y, 0.0f, 1e-3f);
+    ASSERT_NEAR(identity.yaw, 0.0f, 1e-3f);
+
+    ConstantVelocityModel constant(500.0f, 0.0f, 0.0f);
+    constant.setReferenceTime(1000000);
+    ASSERT_TRUE(constant.getPose(1000000 - 200000, pose));
+    ASSERT_NEAR(pose.x, -100.0f, 1e-3f);
+
+    PoseStream stream(4, 50000);
+    ASSERT_FALSE(stream.getPose(1000000, pose));
+
+    stream.push(1000000, { 0.0f, 0.0f, 350.0f });
+    stream.push(1100000, { 100.0f, 200.0f, 10.0f });
+    stream.push(1050000, { 999.0f, 999.0f, 0.0f });
+    ASSERT_EQ(stream.size(), 2u);
+
+    // Headings take the short way round
+    ASSERT_TRUE(stream.getPose(1025000, pose));
+    ASSERT_NEAR(pose.x, 25.0f, 1e-3f);
+    ASSERT_NEAR(pose.y, 50.0f, 1e-3f);
+    ASSERT_NEAR(pose.yaw, 355.0f, 1e-3f);
+
+    ASSERT_TRUE(stream.getPose(1140000, pose));
+    ASSERT_NEAR(pose.x, 100.0f, 1e-3f);
+    ASSERT_FALSE(stream.getPose(1160000, pose));
+    ASSERT_FALSE(stream.getPose(900000, pose));
+
+    // The oldest pose goes once the stream is full
+    for(uint64_t i = 2; i <= 4; i++)
+        stream.push(1000000 + i * 100000, { i * 100.0f, 0.0f, 0.0f });
+
+    ASSERT_EQ(stream.size(), 4u);
+    ASSERT_FALSE(stream.getPose(1000000, pose));
+
+    Timeline timeline;
+    timeline.setDuration(2.0f);
+    timeline.addTrack("x", 0.0f, 2000.0f);
+    timeline.addTrack("yaw", 0.0f, 90.0f);
+
+    TimelineMotionModel motion(&timeline);
+    ASSERT_FALSE(motion.getPose(1000000, pose));
+
+    // One second in, the pose a quarter second either side of the sync
+    timeline.play();
+    timeline.update(1.0f);
+    motion.sync(1000000);
+
+    ASSERT_TRUE(motion.getPose(750000, pose));
+    ASSERT_NEAR(pose.x, 750.0f, 0.5f);
+    ASSERT_NEAR(pose.y, 0.0f, 1e-3f);
+    ASSERT_NEAR(pose.yaw, 33.75f, 0.01f);
+
+    ASSERT_TRUE(motion.getPose(1250000, pose));
+    ASSERT_NEAR(pose.x, 1250.0f, 0.5f);
+
+    // A paused timeline holds still
+    timeline.pause();
+    motion.sync(1000000);
+    ASSERT_TRUE(motion.getPose(1250000, pose));
+    ASSERT_NEAR(pose.x, 1000.0f, 0.5f);
+}
+
+// How far a point in the room's frame is from the nearest wall line
+static float wallError(const SimulatedWorld& world, float x, float y)
+{
+    return std::min(std::min(std::fabs(x - world.minX), std::fabs(x - world.maxX)),
+        std::min(std::fabs(y - world.minY), std::fabs(y - world.maxY)));
+}
+
+TEST(LIDAR, DeskewMovingPlatform)
+{
+    SimulatedWorld world;
+    world.addBox(world.minX, world.minY, world.maxX, world.maxY);
+
+    // A revolution driving forward at 1.5 m/s while turning 30 degrees/s
+    SimulatedScanDevice device(SimulatorParams::parse("sim://rate=8000,rpm=600,realtime=0,vx=1500,spin=30"), world);
+    ASSERT_TRUE(SL_IS_OK(device.connect()));
+    ASSERT_TRUE(SL_IS_OK(device.startScan()));
+
+    std::vector<ScanNode> nodes(8192);
+    size_t count = nodes.size();
+    ASSERT_TRUE(SL_IS_OK(device.grabScanDataHq(nodes.data(), count)));
+    device.ascendScanData(nodes.data(), count);
+
+    // The revolution's first node was captured at start and the last 1/8000 s
+    // before the end
+    const uint64_t start = 5000000;
+    ScanFrame frame(8192);
+    frame.assign(nodes.data(), count);
+    frame.setFirstByteTime(start);
+    frame.setTimestamp(start + 100000);
+
+    std::vector<uint64_t> times(count);
+    ASSERT_TRUE(ScanDeskew::nodeTimes(frame, times.data()));
+
+    uint16_t first = ScanDeskew::sweepStart(frame);
+
+    for(size_t i = 0; i < count; i++)
+    {
+        uint64_t expected = start + (uint16_t) (frame.angles()[i] - first) * 100000ull / 65536;
+        ASSERT_EQ(times[i], expected);
+        ASSERT_LT(times[i], start + 100000);
+    }
+
+    std::vector<float> x(count), y(count);
+    std::vector<float> rawX(count), rawY(count);
+    PolarToCartesian::convert(frame, x.data(), y.data());
+    rawX = x;
+    rawY = y;
+
+    ConstantVelocityModel model(1500.0f, 0.0f, 30.0f);
+    model.setReferenceTime(start);
+
+    ScanDeskew deskew;
+    ASSERT_TRUE(deskew.apply(frame, model, x.data(), y.data()));
+
+    // Seen from where the sensor ended up, every point should lie on a wall
+    Pose2D end;
+    model.getPose(frame.getTimestamp(), end);
+
+    float rawError = 0.0f;
+    float maxError = 0.0f;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        Pose2D point = end.compose({ x[i], y[i], 0.0f });
+        Pose2D raw = end.compose({ rawX[i], rawY[i], 0.0f });
+
+        maxError = std::max(maxError, wallError(world, point.x, point.y));
+        rawError += wallError(world, raw.x, raw.y) / count;
+    }
+
+    ASSERT_LT(maxError, 3.0f);
+    ASSERT_GT(rawError, 50.0f);
+
+    // Without a first byte time nothing is known about when nodes were seen
+    frame.setFirstByteTime(0);
+    std::vector<float> untouched = rawX;
+    ASSERT_FALSE(deskew.apply(frame, model, untouched.data(), rawY.data()));
+    ASSERT_EQ(untouched, rawX);
+}
+
+TEST(LIDAR, DeviceManagerDeskew)
+{
+    LIDARDeviceManager devices;
+    devices.addDevice("sim://rate=8000,rpm=600,realtime=0,vx=1000,spin=36000");
+    ASSERT_TRUE(waitForFrames(devices, 2));
+
+    devices.getGrabber(0)->stop();
+    const LIDARFrameGrabber::Frame& frame = devices.getGrabber(0)->latestFrame();
+
+    std::vector<float> x(frame.size()), y(frame.size());
+    PolarToCartesian::convert(frame, x.data(), y.data());
+
+    // A model with no poses leaves the scan as it is
+    devices.setMotionModel(std::make_shared<PoseStream>());
+    const LIDARDeviceManager::FusedFrame& fused = devices.fuse();
+    ASSERT_EQ(fused.size, frame.size());
+
+    for(size_t i = 0; i < frame.size(); i++)
+    {
+        ASSERT_FLOAT_EQ(fused.x[i], x[i]);
+        ASSERT_FLOAT_EQ(fused.y[i], y[i]);
+    }
+
+    std::shared_ptr<ConstantVelocityModel> model = std::make_shared<ConstantVelocityModel>(1000.0f, 0.0f, 36000.0f);
+    devices.setMotionModel(model);
+    devices.fuse();
+
+    ScanDeskew deskew;
+    deskew.apply(frame, *model, x.data(), y.data());
+
+    for(size_t i = 0; i < frame.size(); i++)
+    {
+        ASSERT_NEAR(fused.x[i], x[i], 1e-3f);
+        ASSERT_NEAR(fused.y[i], y[i], 1e-3f);
+    }
+}
+
+// Lays out what sysfs shows for a tty: its device, the device's driver and
+// the vendor of the USB device a level or two up
+static void addFakeTty(const std::string& root, const std::string& name, const std::string& device, const char* driver, const char* vendor, int levels)
+{
+    std::string sysDevice = root + "/sys/devices/" + device;
+    ASSERT_EQ(system(("mkdir -p " + sysDevice + " " + root + "/sys/class/tty/" + name + " " + root + "/sys/bus/drivers/" + driver).c_str()), 0);
+
+    ASSERT_EQ(symlink((root + "/sys/bus/drivers/" + driver).c_str(), (sysDevice + "/driver").c_str()), 0);
+    ASSERT_EQ(symlink(sysDevice.c_str(), (root + "/sys/class/tty/" + name + "/device").c_str()), 0);
+
+    if(vendor)
+    {
+        std::string usb = sysDevice;
+
+        for(int i = 0; i < levels; i++)
+            usb = usb.substr(0, usb.rfind('/'));
+
+        std::ofstream(usb + "/idVendor") << vendor << "\n";
+    }
+
+    std::ofstream(root + "/dev/" + name) << "";
+}
+
+static bool waitForDevices(DeviceDiscovery& discovery, size_t count)
+{
+    for(int i = 0; i < 200; i++)
+    {
+        if(discovery.getRevision() && discovery.getDevices().size() == count)
+            return true;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return false;
+}
+
+TEST(LIDAR, DeviceDiscovery)
+{
+    char path[] = "/tmp/discoveryXXXXXX";
+    ASSERT_NE(mkdtemp(path), nullptr);
+
+    std::string root = path;
+    ASSERT_EQ(mkdir((root + "/dev").c_str(), 0755), 0);
+
+    // A CP2102 bridge and a CDC device from a USB serial vendor are kept, the
+    // on-board UART, a virtual console and an unknown USB device are not
+    addFakeTty(root, "ttyUSB0", "usb1/1-1/1-1:1.0/ttyUSB0", "cp210x", "10c4", 2);
+    addFakeTty(root, "ttyACM0", "usb1/1-2/1-2:1.0", "vendor_acm", "1a86", 1);
+    addFakeTty(root, "ttyACM1", "usb1/1-3/1-3:1.0", "vendor_acm", "abcd", 1);
+    addFakeTty(root, "ttyS0", "platform/serial8250/tty/ttyS0", "serial8250", nullptr, 0);
+    std::ofstream(root + "/dev/tty1") << "";
+    std::ofstream(root + "/dev/null") << "";
+
+    DeviceDiscovery discovery(root);
+    ASSERT_TRUE(discovery.isCandidate("ttyUSB0"));
+    ASSERT_TRUE(discovery.isCandidate("ttyACM0"));
+    ASSERT_FALSE(discovery.isCandidate("ttyACM1"));
+    ASSERT_FALSE(discovery.isCandidate("ttyS0"));
+    ASSERT_FALSE(discovery.isCandidate("tty1"));
+
+    std::vector<std::string> expected = { root + "/dev/ttyACM0", root + "/dev/ttyUSB0" };
+    ASSERT_EQ(discovery.scan(), expected);
+    ASSERT_EQ(discovery.getRevision(), 0u);
+
+    discovery.start();
+    ASSERT_TRUE(waitForDevices(discovery, 2));
+    ASSERT_EQ(discovery.getDevices(), expected);
+
+    // Ports are picked up and dropped as /dev changes
+    addFakeTty(root, "ttyUSB1", "usb1/1-4/1-4:1.0/ttyUSB1", "ftdi_sio", nullptr, 0);
+    ASSERT_TRUE(waitForDevices(discovery, 3));
+    ASSERT_EQ(discovery.getDevices()[2], root + "/dev/ttyUSB1");
+
+    ASSERT_EQ(unlink((root + "/dev/ttyUSB0").c_str()), 0);
+    ASSERT_TRUE(waitForDevices(discovery, 2));
+    ASSERT_EQ(discovery.getDevices()[1], root + "/dev/ttyUSB1");
+
+    // A port that can't be opened isn't listed
+    ASSERT_EQ(unlink((root + "/dev/ttyACM0").c_str()), 0);
+    ASSERT_EQ(mkdir((root + "/dev/ttyACM0").c_str(), 0755), 0);
+    ASSERT_TRUE(waitForDevices(discovery, 1));
+
+    // Nothing in /dev changes when only sysfs does, that takes a refresh
+    std::ofstream(root + "/sys/devices/usb1/1-3/idVendor") << "10c4\n";
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_EQ(discovery.getDevices().size(), 1u);
+
+    discovery.refresh();
+    ASSERT_TRUE(waitForDevices(discovery, 2));
+    ASSERT_EQ(discovery.getDevices()[0], root + "/dev/ttyACM1");
+
+    discovery.stop();
+    ASSERT_FALSE(discovery.isRunning());
+
+    ASSERT_EQ(system(("rm -rf " + root).c_str()), 0);
+}
+
+// A wall at 2 m, one node per degree, with a few things for the filters to
+// find
+static void makeFilterScene(ScanFrame& frame)
+{
+    std::vector<ScanNode> nodes(360);
+
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        nodes[i].angle_z_q14 = (uint16_t) (i * 65536 / 360);
+        nodes[i].dist_mm_q2 = 2000 * 4;
+        nodes[i].quality = 100;
+        nodes[i].flag = i == 0;
+    }
+
+    // Dropouts right after the first node, so its neighbors are across the wrap
+    nodes[1].dist_mm_q2 = 0;
+    nodes[2].dist_mm_q2 = 0;
+
+    nodes[10].dist_mm_q2 = 50 * 4;
+    nodes[20].quality = 5;
+    nodes[50].dist_mm_q2 = 0;
+    nodes[100].dist_mm_q2 = 5000 * 4;
+
+    // An edge with a foreground on one side, a background on the other and a
+    // mixed return in between
+    for(size_t i = 195; i < 200; i++)
+        nodes[i].dist_mm_q2 = 1000 * 4;
+
+    for(size_t i = 201; i < 206; i++)
+        nodes[i].dist_mm_q2 = 3000 * 4;
+
+    frame.assign(nodes.data(), nodes.size());
+}
+
+static std::vector<size_t> filterOne(ScanFilter::Stage stage, ScanFilter::Config config, ScanFrame& frame)
+{
+    makeFilterScene(frame);
+    std::vector<uint32_t> before(frame.distances(), frame.distances() + frame.size());
+
+    config.enabled[stage] = true;
+    ScanFilter filter(config);
+    filter.apply(frame);
+
+    std::vector<size_t> rejected;
+
+    for(size_t i = 0; i < frame.size(); i++)
+    {
+        if(before[i] && !frame.distances()[i])
+            rejected.push_back(i);
+    }
+
+    EXPECT_EQ(filter.getLastRejected(stage), rejected.size()) << ScanFilter::getStageName(stage);
+    return rejected;
+}
+
+TEST(LIDAR, ScanFilterStages)
+{
+    ScanFrame frame(360);
+    ScanFilter::Config config;
+    config.neighbors = 2;
+
+    const ScanFilter::Implementation detected = ScanFilter::getImplementation();
+
+    for(int impl = ScanFilter::SCALAR; impl <= ScanFilter::SSE2; impl++)
+    {
+        if(!ScanFilter::setImplementation((ScanFilter::Implementation) impl))
+            continue;
+
+        SCOPED_TRACE(ScanFilter::getImplementationName((ScanFilter::Implementation) impl));
+
+        ASSERT_EQ(filterOne(ScanFilter::RANGE, config, frame), std::vector<size_t>({ 10 }));
+        ASSERT_EQ(filterOne(ScanFilter::QUALITY, config, frame), std::vector<size_t>({ 20 }));
+        ASSERT_EQ(filterOne(ScanFilter::MIXED_PIXEL, config, frame), std::vector<size_t>({ 200 }));
+
+        // The first node only has support across the wrap
+        ASSERT_EQ(filterOne(ScanFilter::ISOLATED, config, frame), std::vector<size_t>({ 10, 100, 200 }));
+
+        // Everything next to a jump is seen at a grazing angle, the plain
+        // wall and the nodes next to a dropout are not
+        std::vector<size_t> shadowed = filterOne(ScanFilter::SHADOW, config, frame);
+        for(size_t i : { 100, 194, 195, 199, 200, 201, 205, 206 })
+            ASSERT_TRUE(std::count(shadowed.begin(), shadowed.end(), i)) << i;
+        for(size_t i : { 0, 3, 20, 49, 51, 150, 197, 203, 300, 359 })
+            ASSERT_FALSE(std::count(shadowed.begin(), shadowed.end(), i)) << i;
+
+        // The median smooths spikes away and leaves dropouts alone
+        ASSERT_TRUE(filterOne(ScanFilter::MEDIAN, config, frame).empty());
+        ASSERT_EQ(frame.distance(100), 2000.0f);
+        ASSERT_EQ(frame.distance(10), 2000.0f);
+        ASSERT_EQ(frame.distance(50), 0.0f);
+        ASSERT_EQ(frame.distance(49), 2000.0f);
+        ASSERT_EQ(frame.distance(0), 2000.0f);
+
+        config.medianWindow = 5;
+        filterOne(ScanFilter::MEDIAN, config, frame);
+        ASSERT_EQ(frame.distance(197), 1000.0f);
+        ASSERT_EQ(frame.distance(200), 2000.0f);
+        config.medianWindow = 3;
+
+        // The whole chain, the farthest node is looked up again afterwards
+        makeFilterScene(frame);
+        ASSERT_EQ(frame.distance(frame.longestIndex()), 5000.0f);
+
+        ScanFilter::Config all = config;
+        std::fill(all.enabled, all.enabled + ScanFilter::STAGE_COUNT, true);
+        all.neighbors = 1;
+        ScanFilter filter(all);
+        filter.apply(frame);
+
+        ASSERT_EQ(filter.getRuns(), 1u);
+        ASSERT_EQ(frame.distance(frame.longestIndex()), 3000.0f);
+        ASSERT_EQ(frame.distance(100), 0.0f);
+        ASSERT_EQ(frame.distance(300), 2000.0f);
+    }
+
+    ScanFilter::setImplementation(detected);
+}
+
+TEST(LIDAR, ScanFilterImplementationsAgree)
+{
+    SimulatedScanDevice device(SimulatorParams::parse("sim://rate=8000,rpm=600,realtime=0,noise=30,dropout=0.05"));
+    ASSERT_TRUE(SL_IS_OK(device.connect()));
+    ASSERT_TRUE(SL_IS_OK(device.startScan()));
+
+    std::vector<ScanNode> nodes(8192);
+    size_t count = nodes.size();
+    ASSERT_TRUE(SL_IS_OK(device.grabScanDataHq(nodes.data(), count)));
+    device.ascendScanData(nodes.data(), count);
+
+    // An odd count leaves the SIMD kernels a tail
+    count -= 3;
+
+    for(size_t i = 0; i < count; i++)
+        nodes[i].quality = (uint8_t) (i * 37);
+
+    ScanFrame frame(8192);
+    const ScanFilter::Implementation detected = ScanFilter::getImplementation();
+
+    for(int s = 0; s < ScanFilter::STAGE_COUNT; s++)
+    {
+        ScanFilter::Stage stage = (ScanFilter::Stage) s;
+
+        for(int window : { 3, 5 })
+        {
+            ScanFilter::Config config;
+            config.enabled[stage] = true;
+            config.medianWindow = window;
+            config.minRange = 1000.0f;
+            config.maxRange = 3000.0f;
+            config.minQuality = 128;
+            config.isolatedDistance = 40.0f;
+            config.mixedPixelJump = 50.0f;
+
+            std::vector<uint32_t> results[2];
+
+            for(int impl = ScanFilter::SCALAR; impl <= ScanFilter::SSE2; impl++)
+            {
+                if(!ScanFilter::setImplementation((ScanFilter::Implementation) impl))
+                    continue;
+
+                frame.assign(nodes.data(), count);
+                ScanFilter filter(config);
+
+                auto start = std::chrono::steady_clock::now();
+                filter.apply(frame);
+                double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+                if(window == 3)
+                    printf("%-11s %-6s %7.1f us, %u removed\n", ScanFilter::getStageName(stage),
+                        ScanFilter::getImplementationName((ScanFilter::Implementation) impl), micros, filter.getLastRejected(stage));
+
+                results[impl].assign(frame.distances(), frame.distances() + frame.size());
+            }
+
+            if(!results[ScanFilter::SSE2].empty())
+            {
+                ASSERT_EQ(results[ScanFilter::SCALAR], results[ScanFilter::SSE2]) << ScanFilter::getStageName(stage);
+            }
+
+            // The median against sorting every window
+            if(stage == ScanFilter::MEDIAN)
+            {
+                for(size_t i = 0; i < count; i++)
+                {
+                    std::vector<uint32_t> around;
+
+                    for(int k = -window / 2; k <= window / 2; k++)
+                    {
+                        uint32_t d = nodes[(i + count + k) % count].dist_mm_q2;
+                        around.push_back(d ? d : nodes[i].dist_mm_q2);
+                    }
+
+                    std::nth_element(around.begin(), around.begin() + window / 2, around.end());
+                    ASSERT_EQ(results[ScanFilter::SCALAR][i], nodes[i].dist_mm_q2 ? around[window / 2] : 0) << i;
+                }
+            }
+        }
+    }
+
+    ScanFilter::setImplementation(detected);
+}
+
+TEST(LIDAR, ScanFilterFromGrabber)
+{
+    LIDARDeviceManager devices;
+    devices.addDevice("sim://rate=8000,rpm=600,realtime=0,noise=30");
+    LIDARFrameGrabber* grabber = devices.getGrabber(0);
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    devices.lua_openLidarLib(L);
+
+    const char* script =
+        "lidar.setFilter(1, 'range', true, 3000, 5500)\n"
+        "lidar.setFilter(1, 'median', true, 5)\n"
+        "assert(not pcall(lidar.setFilter, 1, 'median', true, 4))\n"
+        "assert(not pcall(lidar.setFilter, 1, 'blur'))\n";
+
+    int result = luaL_dostring(L, script);
+    ASSERT_EQ(result, 0) << lua_tostring(L, -1);
+
+    ScanFilter::Config config = grabber->getFilterConfig();
+    ASSERT_TRUE(config.enabled[ScanFilter::RANGE]);
+    ASSERT_TRUE(config.enabled[ScanFilter::MEDIAN]);
+    ASSERT_FALSE(config.enabled[ScanFilter::SHADOW]);
+    ASSERT_EQ(config.medianWindow, 5);
+
+    // Frames already captured may predate the config. A few revolutions,
+    // since one of the moving circles passes over the sensor now and then.
+    uint64_t sequence = grabber->latestFrame().getSequence() + 2;
+    size_t returns = 0;
+
+    for(int r = 0; r < 10; r++)
+    {
+        ASSERT_TRUE(waitForFrames(devices, sequence));
+        const LIDARFrameGrabber::Frame& frame = grabber->latestFrame();
+        sequence = frame.getSequence() + 1;
+
+        for(size_t i = 0; i < frame.size(); i++)
+        {
+            if(frame.distance(i) == 0.0f)
+                continue;
+
+            ASSERT_GE(frame.distance(i), 3000.0f);
+            ASSERT_LE(frame.distance(i), 5500.0f);
+            returns++;
+        }
+    }
+
+    ASSERT_GT(returns, 0u);
+    ASSERT_GT(grabber->getFilter().getRejected(ScanFilter::RANGE), 0u);
+
+    script =
+        "local stats = lidar.getFilterStats(1)\n"
+        "assert(stats.runs > 0)\n"
+        "assert(stats.range.enabled and stats.range.rejected > 0 and stats.range.micros > 0)\n"
+        "assert(not stats.shadow.enabled and stats.shadow.rejected == 0)\n";
+
+    result = luaL_dostring(L, script);
+    ASSERT_EQ(result, 0) << lua_tostring(L, -1);
+    lua_close(L);
+}
+
+// A wall at 2 m with noise, two nodes per degree. Nodes from first to last
+// are at range instead, or dropped when range is 0.
+static void makeNoisyWall(ScanFrame& frame, std::mt19937& random, uint64_t sequence,
+    size_t first = 0, size_t last = 0, uint32_t range = 0)
+{
+    std::normal_distribution<float> noise(0.0f, 20.0f);
+    std::vector<ScanNode> nodes(720);
+
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        nodes[i].angle_z_q14 = (uint16_t) ((2 * i + 1) * 65536 / 1440);
+        nodes[i].dist_mm_q2 = (uint32_t) ((2000.0f + noise(random)) * 4);
+        nodes[i].quality = 100;
+        nodes[i].flag = i == 0;
+
+        if(i >= first && i < last)
+            nodes[i].dist_mm_q2 = range ? (uint32_t) ((range + noise(random)) * 4) : 0;
+    }
+
+    frame.assign(nodes.data(), nodes.size());
+    frame.setSequence(sequence);
+    frame.setTimestamp(sequence * 100000);
+}
+
+static float rmsError(const ScanFrame& frame, size_t first, size_t last, float expected)
+{
+    double sum = 0.0;
+
+    for(size_t i = first; i < last; i++)
+        sum += (frame.distance(i) - expected) * (frame.distance(i) - expected);
+
+    return (float) std::sqrt(sum / (last - first));
+}
+
+TEST(LIDAR, TemporalFilterModes)
+{
+    const ScanFilter::Implementation detected = ScanFilter::getImplementation();
+
+    for(int impl = ScanFilter::SCALAR; impl <= ScanFilter::SSE2; impl++)
+    {
+        if(!ScanFilter::setImplementation((ScanFilter::Implementation) impl))
+            continue;
+
+        SCOPED_TRACE(ScanFilter::getImplementationName((ScanFilter::Implementation) impl));
+
+        for(TemporalFilter::Mode mode : { TemporalFilter::EMA, TemporalFilter::MEDIAN })
+        {
+            SCOPED_TRACE(TemporalFilter::getModeName(mode));
+
+            TemporalFilter::Config config;
+            config.mode = mode;
+            config.alpha = 0.2f;
+            config.maxMisses = 3;
+
+            TemporalFilter filter(config);
+            ASSERT_EQ(filter.size(), 720u);
+
+            std::mt19937 random(7);
+            ScanFrame frame(720);
+            uint64_t sequence = 0;
+
+            makeNoisyWall(frame, random, ++sequence);
+            float raw = rmsError(frame, 0, 720, 2000.0f);
+
+            for(int r = 0; r < 30; r++)
+            {
+                makeNoisyWall(frame, random, ++sequence);
+                filter.update(frame);
+            }
+
+            // One node per bin, at the bin centers, with the times of the last revolution
+            const ScanFrame& smoothed = filter.getFrame();
+            ASSERT_EQ(smoothed.size(), 720u);
+            ASSERT_EQ(smoothed.getSequence(), sequence);
+            ASSERT_EQ(smoothed.getTimestamp(), frame.getTimestamp());
+            ASSERT_NEAR(smoothed.angle(100), 50.25f, 0.01f);
+            ASSERT_LT(rmsError(smoothed, 0, 720, 2000.0f), raw * 0.75f);
+            ASSERT_EQ(filter.getLastResets(), 0u);
+
+            // Something moves in front of the wall and shows up right away
+            makeNoisyWall(frame, random, ++sequence, 100, 140, 1000);
+            filter.update(frame);
+            ASSERT_EQ(filter.getLastResets(), 40u);
+            ASSERT_LT(rmsError(smoothed, 100, 140, 1000.0f), 25.0f);
+
+            // Returns that go missing hold for a few revolutions, then clear
+            for(int r = 0; r < 3; r++)
+            {
+                makeNoisyWall(frame, random, ++sequence, 300, 310, 0);
+                filter.update(frame);
+                ASSERT_GT(smoothed.distance(305), 1900.0f);
+            }
+
+            makeNoisyWall(frame, random, ++sequence, 300, 310, 0);
+            filter.update(frame);
+            ASSERT_EQ(smoothed.distance(305), 0.0f);
+            ASSERT_GT(smoothed.distance(310), 1900.0f);
+
+            filter.reset();
+            ASSERT_EQ(filter.getSequence(), 0u);
+            ASSERT_EQ(filter.getFrame().distance(0), 0.0f);
+        }
+    }
+
+    ScanFilter::setImplementation(detected);
+
+    // A one revolution blip within the reset distance doesn't get through a median
+    TemporalFilter::Config config;
+    config.mode = TemporalFilter::MEDIAN;
+    config.window = 3;
+
+    TemporalFilter filter(config);
+    std::mt19937 random(11);
+    ScanFrame frame(720);
+
+    for(uint64_t sequence = 1; sequence <= 4; sequence++)
+    {
+        makeNoisyWall(frame, random, sequence, 0, 720, sequence == 3 ? 2100 : 2000);
+        filter.update(frame);
+    }
+
+    ASSERT_LT(rmsError(filter.getFrame(), 0, 720, 2000.0f), 30.0f);
+}
+
+TEST(LIDAR, DeviceManagerSmoothing)
+{
+    LIDARDeviceManager devices;
+    devices.addDevice("sim://rate=8000,rpm=600,realtime=0,noise=20");
+    ASSERT_TRUE(waitForFrames(devices, 2));
+    ASSERT_EQ(devices.getSmoothing(0), nullptr);
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    devices.lua_openLidarLib(L);
+
+    const char* script =
+        "lidar.setSmoothing(1, 'median', 3, 1.0)\n"
+        "assert(not pcall(lidar.setSmoothing, 1, 'median', 4))\n"
+        "assert(not pcall(lidar.setSmoothing, 1, 'kalman'))\n"
+        "assert(not pcall(lidar.setSmoothing, 2, 'ema'))\n";
+
+    int result = luaL_dostring(L, script);
+    ASSERT_EQ(result, 0) << lua_tostring(L, -1);
+
+    const TemporalFilter* smoothing = devices.getSmoothing(0);
+    ASSERT_NE(smoothing, nullptr);
+    ASSERT_EQ(smoothing->getConfig().mode, TemporalFilter::MEDIAN);
+    ASSERT_EQ(smoothing->getConfig().window, 3);
+    ASSERT_EQ(smoothing->size(), 360u);
+
+    // The fused cloud has one point per bin while smoothing is on
+    const LIDARDeviceManager::FusedFrame& fused = devices.fuse();
+    ASSERT_EQ(fused.sources.size(), 1u);
+    ASSERT_EQ(fused.sources[0].count, 360u);
+    ASSERT_EQ(fused.sources[0].sequence, smoothing->getSequence());
+    ASSERT_EQ(smoothing->getRevolutions(), 1u);
+
+    ASSERT_EQ(luaL_dostring(L, "lidar.setSmoothing(1, false)"), 0);
+    ASSERT_EQ(devices.getSmoothing(0), nullptr);
+    ASSERT_NE(devices.fuse().sources[0].count, 360u);
+
+    lua_close(L);
+}
+
+// A wall at 4 m, 8000 nodes a turn, with a thin post, a gap in the wall and
+// a stretch of dropouts
+static void makeDecimatorScene(ScanFrame& frame)
+{
+    std::vector<ScanNode> nodes(8000);
+
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        nodes[i].angle_z_q14 = (uint16_t) (i * 65536 / nodes.size());
+        nodes[i].dist_mm_q2 = (uint32_t) ((4000.0f + 50.0f * std::sin(i * 0.01f)) * 4);
+        nodes[i].quality = 100;
+        nodes[i].flag = i == 0;
+    }
+
+    for(size_t i = 2000; i < 2003; i++)
+        nodes[i].dist_mm_q2 = 1000 * 4;
+
+    nodes[5000].dist_mm_q2 = 7000 * 4;
+
+    for(size_t i = 6000; i < 6100; i++)
+        nodes[i].dist_mm_q2 = 0;
+
+    frame.assign(nodes.data(), nodes.size());
+}
+
+static void checkDecimated(const ScanDecimator& decimator, const ScanFrame& frame, size_t budget)
+{
+    const std::vector<uint32_t>& kept = decimator.getKept();
+    ASSERT_LE(kept.size(), budget);
+    ASSERT_GE(kept.size(), budget / 2);
+
+    for(size_t k = 0; k < kept.size(); k++)
+    {
+        ASSERT_NE(frame.distances()[kept[k]], 0u) << kept[k];
+
+        if(k > 0)
+        {
+            ASSERT_LT(kept[k - 1], kept[k]);
+        }
+    }
+
+    // The post, the gap and both ends of the dropouts survive
+    ASSERT_TRUE(std::any_of(kept.begin(), kept.end(), [](uint32_t i) { return i >= 2000 && i < 2003; }));
+    ASSERT_TRUE(std::find(kept.begin(), kept.end(), 5000u) != kept.end());
+    ASSERT_TRUE(std::any_of(kept.begin(), kept.end(), [](uint32_t i) { return i >= 5900 && i < 6000; }));
+    ASSERT_TRUE(std::any_of(kept.begin(), kept.end(), [](uint32_t i) { return i >= 6100 && i < 6200; }));
+}
+
+TEST(LIDAR, ScanDecimator)
+{
+    ScanFrame frame(8000);
+    makeDecimatorScene(frame);
+
+    ScanDecimator decimator;
+    decimator.decimate(frame, 400);
+    checkDecimated(decimator, frame, 400);
+
+    // The same scan as points around an origin away from the rig's
+    std::vector<float> x(frame.size());
+    std::vector<float> y(frame.size());
+
+    for(size_t i = 0; i < frame.size(); i++)
+    {
+        float radians = frame.angle(i) * 3.14159265f / 180.0f;
+        x[i] = 100.0f + frame.distance(i) * std::cos(radians);
+        y[i] = -200.0f + frame.distance(i) * std::sin(radians);
+    }
+
+    decimator.decimate(x.data(), y.data(), x.size(), 100.0f, -200.0f, 400);
+    checkDecimated(decimator, frame, 400);
+
+    // Nothing to thin out, only the dropouts go
+    ASSERT_EQ(decimator.decimate(frame, 8000), 7900u);
+    ASSERT_EQ(decimator.decimate(x.data(), y.data(), x.size(), 100.0f, -200.0f, 10000), 7900u);
+    ASSERT_EQ(decimator.decimate(x.data(), y.data(), 0, 0.0f, 0.0f, 10), 0u);
+
+    ASSERT_EQ(ScanDecimator::getBudget(100.0f, 3.0f), 420u);
+    ASSERT_EQ(ScanDecimator::getBudget(0.0f, 3.0f), 2u);
+}
+
+TEST(LIDAR, ScanDecimatorVertexBudget)
+{
+    ScanFrame frame(8000);
+    makeDecimatorScene(frame);
+
+    std::vector<float> x(frame.size());
+    std::vector<float> y(frame.size());
+
+    for(size_t i = 0; i < frame.size(); i++)
+    {
+        float radians = frame.angle(i) * 3.14159265f / 180.0f;
+        x[i] = frame.distance(i) * std::cos(radians);
+        y[i] = frame.distance(i) * std::sin(radians);
+    }
+
+    // The preview's work per draw, a position, UV and color per point
+    ScanDecimator decimator;
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    vertices.reserve(x.size() * 9);
+    indices.reserve(x.size());
+
+    auto build = [&](size_t budget)
+    {
+        vertices.clear();
+        indices.clear();
+        decimator.decimate(x.data(), y.data(), x.size(), 0.0f, 0.0f, budget);
+
+        for(uint32_t i : decimator.getKept())
+        {
+            indices.push_back((uint32_t) indices.size());
+            vertices.insert(vertices.end(), { x[i], y[i], 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f });
+        }
+
+        return indices.size();
+    };
+
+    const int RUNS = 200;
+    size_t full = 0;
+    double fullMicros = 0.0;
+
+    // Radius of the unit circle on screen: a small window, a full HD one
+    // zoomed out and one zoomed in past the point where every node shows
+    for(float radius : { 0.0f, 150.0f, 400.0f, 1500.0f })
+    {
+        size_t budget = radius > 0.0f ? ScanDecimator::getBudget(radius, 3.0f) : x.size();
+        size_t drawn = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for(int r = 0; r < RUNS; r++)
+            drawn = build(budget);
+
+        double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / RUNS;
+
+        if(radius == 0.0f)
+        {
+            full = drawn;
+            fullMicros = micros;
+            printf("full        %5zu vertices %7.1f us\n", drawn, micros);
+            continue;
+        }
+
+        printf("%4.0f px     %5zu vertices %7.1f us (%.0f%% of the vertices, %.0f%% of the time)\n",
+            radius, drawn, micros, 100.0 * drawn / full, 100.0 * micros / fullMicros);
+
+        ASSERT_LE(drawn, std::min(budget, full));
+
+        if(budget < x.size() / 2)
+        {
+            ASSERT_LT(drawn, full / 2);
+        }
+    }
+}
@@ -0,0 +1,856 @@
+#include <gtest/gtest.h>
+
+#include <lidar/ProtocolDecoder.hpp>
+#include <lidar/NativeScanDevice.hpp>
+#include <lidar/Crc32.hpp>
+#include <LIDARFrameGrabber.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+using namespace em;
+
+typedef std::vector<uint8_t> Bytes;
+
+static void put16(Bytes& out, uint16_t value)
+{
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+static void put32(Bytes& out, uint32_t value)
+{
+    put16(out, value & 0xFFFF);
+    put16(out, value >> 16);
+}
+
+static void putStandard(Bytes& out, int angleQ6, int distQ2, int quality, bool sync)
+{
+    out.push_back((quality << 2) | (sync ? 1 : 2));
+    put16(out, (angleQ6 << 1) | 1);
+    put16(out, distQ2);
+}
+
+// Prepends the header of a capsule to its cabins and fills in the checksum
+static void putCapsule(Bytes& out, int startQ6, bool startFlag, const Bytes& cabins)
+{
+    Bytes body;
+    put16(body, startQ6 | (startFlag ? 0x8000 : 0));
+    body.insert(body.end(), cabins.begin(), cabins.end());
+
+    uint8_t checksum = 0;
+    for(uint8_t byte : body)
+        checksum ^= byte;
+
+    out.push_back(0xA0 | (checksum & 0xF));
+    out.push_back(0x50 | (checksum >> 4));
+    out.insert(out.end(), body.begin(), body.end());
+}
+
+static void putExpressCapsule(Bytes& out, int startQ6, const uint16_t* distances)
+{
+    Bytes cabins;
+
+    for(int i = 0; i < 16; i++)
+    {
+        put16(cabins, distances[i * 2] << 2);
+        put16(cabins, distances[i * 2 + 1] << 2);
+        cabins.push_back(0);
+    }
+
+    putCapsule(out, startQ6, false, cabins);
+}
+
+static void putDenseCapsule(Bytes& out, int startQ6, const uint16_t* distances)
+{
+    Bytes cabins;
+
+    for(int i = 0; i < 40; i++)
+        put16(cabins, distances[i]);
+
+    putCapsule(out, startQ6, false, cabins);
+}
+
+static void putUltraCapsule(Bytes& out, int startQ6, const uint32_t* combined)
+{
+    Bytes cabins;
+
+    for(int i = 0; i < 32; i++)
+        put32(cabins, combined[i]);
+
+    putCapsule(out, startQ6, false, cabins);
+}
+
+static void putHQ(Bytes& out, const ScanNode* nodes)
+{
+    size_t start = out.size();
+
+    out.push_back(0xA5);
+    for(int i = 0; i < 8; i++)
+        out.push_back(0);
+
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(nodes);
+    out.insert(out.end(), bytes, bytes + 96 * sizeof(ScanNode));
+
+    // CRC input is zero padded to a multiple of four bytes
+    uint8_t padding[4] = { 0 };
+    size_t size = out.size() - start;
+    uint32_t crc = crc32(out.data() + start, size);
+    crc = crc32(padding, (4 - size % 4) % 4, crc);
+    put32(out, crc);
+}
+
+static uint32_t ultraCabin(int major, int predict1, int predict2)
+{
+    return (major & 0xFFF) | ((predict1 & 0x3FF) << 12) | ((uint32_t) (predict2 & 0x3FF) << 22);
+}
+
+// Synthesizes numPackets packets of the given format around a spinning sensor
+static Bytes makeStream(ProtocolDecoder::Format format, int numPackets, std::mt19937& rng)
+{
+    std::uniform_int_distribution<int> distance(100, 8000);
+    Bytes out;
+
+    for(int p = 0; p < numPackets; p++)
+    {
+        int startQ6 = (p * 9 * 64) % (360 << 6);
+
+        switch(format)
+        {
+        case ProtocolDecoder::STANDARD:
+            putStandard(out, startQ6, distance(rng) << 2, 47, startQ6 == 0);
+            break;
+        case ProtocolDecoder::CAPSULE:
+        {
+            uint16_t distances[32];
+            for(uint16_t& d : distances)
+                d = distance(rng);
+            putExpressCapsule(out, startQ6, distances);
+            break;
+        }
+        case ProtocolDecoder::DENSE_CAPSULE:
+        {
+            uint16_t distances[40];
+            for(uint16_t& d : distances)
+                d = distance(rng);
+            putDenseCapsule(out, startQ6, distances);
+            break;
+        }
+        case ProtocolDecoder::ULTRA_CAPSULE:
+        {
+            uint32_t combined[32];
+            for(uint32_t& c : combined)
+                c = ultraCabin(distance(rng) % 512, 5, -5);
+            putUltraCapsule(out, startQ6, combined);
+            break;
+        }
+        case ProtocolDecoder::HQ:
+        {
+            ScanNode nodes[96];
+            for(int i = 0; i < 96; i++)
+            {
+                nodes[i].angle_z_q14 = (startQ6 << 8) / 90 + i;
+                nodes[i].dist_mm_q2 = distance(rng) << 2;
+                nodes[i].quality = 190;
+                nodes[i].flag = p == 0 && i == 0;
+            }
+            putHQ(out, nodes);
+            break;
+        }
+        }
+    }
+
+    return out;
+}
+
+struct Collected
+{
+    std::vector<ScanNode> nodes;
+    std::vector<size_t> batches;
+};
+
+static void collect(const ScanNode* nodes, size_t count, void* user)
+{
+    Collected* collected = static_cast<Collected*>(user);
+    collected->nodes.insert(collected->nodes.end(), nodes, nodes + count);
+    collected->batches.push_back(count);
+}
+
+static bool sameNodes(const std::vector<ScanNode>& a, const std::vector<ScanNode>& b)
+{
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(ScanNode)) == 0;
+}
+
+TEST(Protocol, StandardFixture)
+{
+    // Captured standard scan nodes: 90 degrees at 1 m with the sync bit, then
+    // 180.5 degrees at 250.25 mm
+    const uint8_t fixture[] = {
+        0x3D, 0x01, 0x2D, 0xA0, 0x0F,
+        0x2A, 0x41, 0x5A, 0xE9, 0x03
+    };
+
+    ProtocolDecoder decoder(ProtocolDecoder::STANDARD);
+    Collected collected;
+    decoder.feed(fixture, sizeof(fixture), collect, &collected);
+
+    ASSERT_EQ(collected.nodes.size(), 2);
+
+    EXPECT_EQ(collected.nodes[0].angle_z_q14, 1 << 14);
+    EXPECT_EQ(collected.nodes[0].dist_mm_q2, 4000);
+    EXPECT_EQ(collected.nodes[0].quality, 60);
+    EXPECT_EQ(collected.nodes[0].flag, 1);
+
+    EXPECT_NEAR(collected.nodes[1].angle_z_q14 * 90.0f / (1 << 14), 180.5f, 0.01f);
+    EXPECT_EQ(collected.nodes[1].dist_mm_q2, 1001);
+    EXPECT_EQ(collected.nodes[1].quality, 40);
+    EXPECT_EQ(collected.nodes[1].flag, 0);
+
+    EXPECT_EQ(decoder.getStats().packets, 2);
+    EXPECT_EQ(decoder.getStats().skippedBytes, 0);
+}
+
+TEST(Protocol, CapsuleAngles)
+{
+    // Two capsules 16 degrees apart, the first one's nodes are spread evenly
+    // between their start angles
+    uint16_t distances[32];
+    for(int i = 0; i < 32; i++)
+        distances[i] = 1000 + i;
+
+    Bytes stream;
+    putExpressCapsule(stream, 100 << 6, distances);
+    putExpressCapsule(stream, 116 << 6, distances);
+
+    ProtocolDecoder decoder(ProtocolDecoder::CAPSULE);
+    Collected collected;
+
+    // Nothing comes out until the following capsule arrives
+    decoder.feed(stream.data(), 84, collect, &collected);
+    ASSERT_TRUE(collected.nodes.empty());
+
+    decoder.feed(stream.data() + 84, 84, collect, &collected);
+    ASSERT_EQ(collected.nodes.size(), 32);
+    ASSERT_EQ(collected.batches.size(), 1);
+
+    for(int i = 0; i < 32; i++)
+    {
+        EXPECT_NEAR(collected.nodes[i].angle_z_q14 * 90.0f / (1 << 14), 100.0f + i * 0.5f, 0.02f);
+        EXPECT_EQ(collected.nodes[i].dist_mm_q2, (1000 + i) << 2);
+        EXPECT_EQ(collected.nodes[i].flag, 0);
+    }
+}
+
+TEST(Protocol, DenseCapsuleWrap)
+{
+    uint16_t distances[40];
+    for(int i = 0; i < 40; i++)
+        distances[i] = 500 + i;
+
+    // The first capsule crosses zero degrees
+    Bytes stream;
+    putDenseCapsule(stream, 350 << 6, distances);
+    putDenseCapsule(stream, 10 << 6, distances);
+
+    ProtocolDecoder decoder(ProtocolDecoder::DENSE_CAPSULE);
+    Collected collected;
+    decoder.feed(stream.data(), stream.size(), collect, &collected);
+
+    ASSERT_EQ(collected.nodes.size(), 40);
+
+    int syncs = 0;
+    for(int i = 0; i < 40; i++)
+    {
+        float angle = collected.nodes[i].angle_z_q14 * 90.0f / (1 << 14);
+        EXPECT_NEAR(fmodf(350.0f + i * 0.5f, 360.0f), angle, 0.02f);
+        EXPECT_EQ(collected.nodes[i].dist_mm_q2, (500 + i) << 2);
+        syncs += collected.nodes[i].flag;
+    }
+
+    EXPECT_EQ(syncs, 1);
+}
+
+TEST(Protocol, UltraCapsuleDistances)
+{
+    uint32_t combined[32];
+    for(int i = 0; i < 32; i++)
+        combined[i] = ultraCabin(300, 4, -4);
+
+    // A scaled major distance and an invalid prediction
+    combined[0] = ultraCabin(600, 3, 0x1FF);
+
+    Bytes stream;
+    putUltraCapsule(stream, 0, combined);
+    putUltraCapsule(stream, 12 << 6, combined);
+
+    ProtocolDecoder decoder(ProtocolDecoder::ULTRA_CAPSULE);
+    Collected collected;
+    decoder.feed(stream.data(), stream.size(), collect, &collected);
+
+    ASSERT_EQ(collected.nodes.size(), 96);
+
+    // 600 decodes as 512 + 88 * 2, its prediction is scaled the same way
+    EXPECT_EQ(collected.nodes[0].dist_mm_q2, 688 << 2);
+    EXPECT_EQ(collected.nodes[1].dist_mm_q2, (688 + (3 << 1)) << 2);
+    EXPECT_EQ(collected.nodes[2].dist_mm_q2, 0);
+
+    // The second prediction is relative to the next cabin
+    EXPECT_EQ(collected.nodes[3].dist_mm_q2, 300 << 2);
+    EXPECT_EQ(collected.nodes[4].dist_mm_q2, 304 << 2);
+    EXPECT_EQ(collected.nodes[5].dist_mm_q2, 296 << 2);
+
+    for(const ScanNode& node : collected.nodes)
+        EXPECT_LT(node.angle_z_q14, 4 << 14);
+}
+
+TEST(Protocol, HQChecksum)
+{
+    std::mt19937 rng(7);
+    Bytes stream = makeStream(ProtocolDecoder::HQ, 3, rng);
+
+    // Flip a bit in the middle packet's nodes
+    stream[781 + 100] ^= 0x10;
+
+    ProtocolDecoder decoder(ProtocolDecoder::HQ);
+    Collected collected;
+    decoder.feed(stream.data(), stream.size(), collect, &collected);
+
+    // Resyncing may also reject sync bytes inside the corrupt packet
+    EXPECT_EQ(decoder.getStats().packets, 2);
+    EXPECT_GE(decoder.getStats().checksumErrors, 1);
+    ASSERT_EQ(collected.nodes.size(), 192);
+
+    // Good packets come through untouched
+    EXPECT_EQ(memcmp(collected.nodes.data(), stream.data() + 9, 96 * sizeof(ScanNode)), 0);
+    EXPECT_EQ(memcmp(collected.nodes.data() + 96, stream.data() + 781 * 2 + 9, 96 * sizeof(ScanNode)), 0);
+}
+
+TEST(Protocol, CapsuleChecksum)
+{
+    std::mt19937 rng(11);
+    Bytes stream = makeStream(ProtocolDecoder::DENSE_CAPSULE, 4, rng);
+    stream[84 * 2 + 30] ^= 0x01;
+
+    ProtocolDecoder decoder(ProtocolDecoder::DENSE_CAPSULE);
+    Collected collected;
+    decoder.feed(stream.data(), stream.size(), collect, &collected);
+
+    // The corrupt capsule is dropped and the rest stay in sync
+    EXPECT_EQ(decoder.getStats().packets, 3);
+    EXPECT_EQ(decoder.getStats().checksumErrors, 1);
+    EXPECT_EQ(decoder.getStats().skippedBytes, 84);
+    EXPECT_EQ(collected.nodes.size(), 80);
+}
+
+TEST(Protocol, FragmentFuzz)
+{
+    const ProtocolDecoder::Format formats[] = {
+        ProtocolDecoder::STANDARD,
+        ProtocolDecoder::CAPSULE,
+        ProtocolDecoder::DENSE_CAPSULE,
+        ProtocolDecoder::ULTRA_CAPSULE,
+        ProtocolDecoder::HQ
+    };
+
+    std::mt19937 rng(1234);
+
+    for(ProtocolDecoder::Format format : formats)
+    {
+        const size_t packet = ProtocolDecoder::packetSize(format);
+        Bytes clean = makeStream(format, 200, rng);
+
+        // Splice in line noise that can't be mistaken for a packet start
+        Bytes stream;
+        size_t noise = 0;
+
+        for(size_t offset = 0; offset < clean.size(); offset += packet)
+        {
+            if(rng() % 4 == 0)
+            {
+                size_t length = 1 + rng() % 16;
+                for(size_t i = 0; i < length; i++)
+                    stream.push_back((rng() & 0x3C));
+                noise += length;
+            }
+
+            stream.insert(stream.end(), clean.begin() + offset, clean.begin() + offset + packet);
+        }
+
+        ProtocolDecoder whole(format);
+        Collected expected;
+        whole.feed(stream.data(), stream.size(), collect, &expected);
+
+        ASSERT_EQ(whole.getStats().packets, 200);
+        ASSERT_EQ(whole.getStats().skippedBytes, noise);
+        ASSERT_EQ(whole.getStats().checksumErrors, 0);
+
+        for(int round = 0; round < 20; round++)
+        {
+            ProtocolDecoder decoder(format);
+            Collected collected;
+            size_t maxChunk = 1 + rng() % (2 * packet);
+
+            for(size_t offset = 0; offset < stream.size();)
+            {
+                size_t chunk = std::min<size_t>(1 + rng() % maxChunk, stream.size() - offset);
+                decoder.feed(stream.data() + offset, chunk, collect, &collected);
+                offset += chunk;
+            }
+
+            ASSERT_TRUE(sameNodes(collected.nodes, expected.nodes)) << "format " << format << " round " << round;
+            ASSERT_EQ(decoder.getStats().packets, 200);
+            ASSERT_EQ(decoder.getStats().skippedBytes, noise);
+        }
+    }
+}
+
+TEST(Protocol, DecoderThroughput)
+{
+    const ProtocolDecoder::Format formats[] = {
+        ProtocolDecoder::STANDARD,
+        ProtocolDecoder::CAPSULE,
+        ProtocolDecoder::DENSE_CAPSULE,
+        ProtocolDecoder::ULTRA_CAPSULE,
+        ProtocolDecoder::HQ
+    };
+    const char* names[] = { "standard", "capsule", "dense", "ultra", "hq" };
+
+    std::mt19937 rng(99);
+
+    for(int f = 0; f < 5; f++)
+    {
+        Bytes stream = makeStream(formats[f], 8 * 1024 * 1024 / ProtocolDecoder::packetSize(formats[f]), rng);
+
+        ProtocolDecoder decoder(formats[f]);
+        Collected collected;
+        collected.nodes.reserve(4 * 1024 * 1024);
+
+        auto start = std::chrono::steady_clock::now();
+
+        // Serial reads come in at most a few kilobytes at a time
+        for(size_t offset = 0; offset < stream.size(); offset += 4096)
+            decoder.feed(stream.data() + offset, std::min<size_t>(4096, stream.size() - offset), collect, &collected);
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("%-8s %6.1f MB/s %7.1f Mnodes/s\n", names[f],
+            stream.size() / seconds / 1e6, decoder.getStats().nodes / seconds / 1e6);
+
+        ASSERT_EQ(decoder.getStats().checksumErrors, 0);
+        ASSERT_GT(decoder.getStats().nodes, 0);
+    }
+}
+
+// Plays the device side of the serial protocol from memory
+class FakeChannel : public sl::IChannel
+{
+public:
+    Bytes written;
+    Bytes scanStream;
+    uint8_t scanAnswerType = ProtocolDecoder::ANS_TYPE_DENSE_CAPSULE;
+
+    bool open() override { return true; }
+    void close() override {}
+    void flush() override {}
+
+    bool waitForData(size_t size, sl_u32 timeoutInMs, size_t* actualReady) override
+    {
+        if(actualReady)
+            *actualReady = m_rx.size();
+        return m_rx.size() >= size;
+    }
+
+    int write(const void* data, size_t size) override
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        written.insert(written.end(), bytes, bytes + size);
+
+        switch(bytes[1])
+        {
+        case 0x50:
+        {
+            uint8_t info[20] = { 0x18, 0x1D, 0x01, 0x05 };
+            respond(0x04, info, sizeof(info));
+            break;
+        }
+        case 0x52:
+        {
+            uint8_t health[3] = { 0, 0, 0 };
+            respond(0x06, health, sizeof(health));
+            break;
+        }
+        case 0x84:
+        {
+            uint8_t typical[6] = { 0x7C, 0, 0, 0, 2, 0 };
+            respond(0x20, typical, sizeof(typical));
+            break;
+        }
+        case 0x82:
+            respond(scanAnswerType, nullptr, 0);
+            m_rx.insert(m_rx.end(), scanStream.begin(), scanStream.end());
+            break;
+        }
+
+        return (int) size;
+    }
+
+    // Hands data out in small uneven pieces like a real UART
+    int read(void* buffer, size_t size) override
+    {
+        size = std::min(size, std::min(m_rx.size(), (size_t) 37));
+        std::copy(m_rx.begin(), m_rx.begin() + size, static_cast<uint8_t*>(buffer));
+        m_rx.erase(m_rx.begin(), m_rx.begin() + size);
+        return (int) size;
+    }
+
+    void clearReadCache() override { m_rx.clear(); }
+    void setDTR() override {}
+    void clearDTR() override {}
+private:
+    std::deque<uint8_t> m_rx;
+
+    void respond(uint8_t type, const uint8_t* payload, size_t size)
+    {
+        const uint8_t descriptor[7] = { 0xA5, 0x5A, (uint8_t) size, 0, 0, 0x40, type };
+        m_rx.insert(m_rx.end(), descriptor, descriptor + 7);
+        m_rx.insert(m_rx.end(), payload, payload + size);
+    }
+};
+
+TEST(Protocol, NativeScanDevice)
+{
+    FakeChannel* channel = new FakeChannel();
+
+    // Three revolutions of dense capsules, 20 per revolution. The last one
+    // never completes.
+    uint16_t distances[40];
+    for(int i = 0; i < 40; i++)
+        distances[i] = 2000 + i;
+
+    for(int p = 0; p < 60; p++)
+        putDenseCapsule(channel->scanStream, (p % 20) * 18 * 64, distances);
+
+    NativeScanDevice device(channel);
+    ASSERT_TRUE(NativeScanDevice::isNativePort("native:///dev/ttyUSB0"));
+    ASSERT_EQ(NativeScanDevice::getSerialPath("native:///dev/ttyUSB0"), "/dev/ttyUSB0");
+
+    ASSERT_TRUE(SL_IS_OK(device.connect()));
+
+    sl_lidar_response_device_info_t info;
+    ASSERT_TRUE(SL_IS_OK(device.getDeviceInfo(info, 100)));
+    EXPECT_EQ(info.model, 0x18);
+    EXPECT_EQ(info.firmware_version, 0x011D);
+    EXPECT_EQ(info.hardware_version, 5);
+
+    sl_lidar_response_device_health_t health;
+    ASSERT_TRUE(SL_IS_OK(device.getHealth(health, 100)));
+    EXPECT_EQ(health.status, 0);
+
+    ASSERT_TRUE(SL_IS_OK(device.startScan()));
+    EXPECT_EQ(device.startScan(), SL_RESULT_ALREADY_DONE);
+    EXPECT_EQ(device.getDecoder().getFormat(), ProtocolDecoder::DENSE_CAPSULE);
+
+    // The typical mode went out as an express scan with a valid checksum
+    const uint8_t express[] = { 0xA5, 0x82, 0x05, 0x02, 0, 0, 0, 0, 0xA5 ^ 0x82 ^ 0x05 ^ 0x02 };
+    ASSERT_TRUE(std::search(channel->written.begin(), channel->written.end(), express, express + sizeof(express)) != channel->written.end());
+
+    ScanNode nodes[8192];
+
+    for(int revolution = 0; revolution < 2; revolution++)
+    {
+        size_t count = 8192;
+        ASSERT_TRUE(SL_IS_OK(device.grabScanDataHq(nodes, count, 100)));
+        EXPECT_NEAR(count, 800, 2);
+
+        device.ascendScanData(nodes, count);
+
+        for(size_t i = 0; i < count; i++)
+        {
+            EXPECT_GE(nodes[i].dist_mm_q2, 2000 << 2);
+
+            if(i)
+            {
+                EXPECT_LE(nodes[i - 1].angle_z_q14, nodes[i].angle_z_q14);
+            }
+        }
+    }
+
+    // Only a partial revolution is left
+    size_t count = 8192;
+    EXPECT_EQ(device.grabScanDataHq(nodes, count, 20), SL_RESULT_OPERATION_TIMEOUT);
+    EXPECT_EQ(count, 0);
+
+    ASSERT_TRUE(SL_IS_OK(device.stop()));
+    device.disconnect();
+}
+
+// Plays an RPLidar doing standard scans on the master side of a pseudo
+// terminal. The slave is reached through a symlink, so the device can be
+// unplugged and plugged back in at the same path on a fresh pty.
+class PtyDevice
+{
+public:
+    PtyDevice(const std::string& link) : m_link(link), m_master(-1), m_slave(-1), m_running(false) {}
+    ~PtyDevice() { unplug(); }
+
+    bool plug()
+    {
+        m_master = posix_openpt(O_RDWR | O_NOCTTY);
+
+        if(m_master == -1 || grantpt(m_master) != 0 || unlockpt(m_master) != 0)
+            return false;
+
+        std::string slave = ptsname(m_master);
+
+        // Holding the slave open keeps the master from reading hangups until
+        // the grabber opens it, and makes it raw before any byte goes through
+        m_slave = open(slave.c_str(), O_RDWR | O_NOCTTY);
+        termios tio;
+        tcgetattr(m_slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(m_slave, TCSANOW, &tio);
+
+        unlink(m_link.c_str());
+
+        if(symlink(slave.c_str(), m_link.c_str()) != 0)
+            return false;
+
+        m_running = true;
+        m_thread = std::thread(&PtyDevice::run, this);
+
+        return true;
+    }
+
+    void unplug()
+    {
+        m_running = false;
+
+        if(m_thread.joinable())
+            m_thread.join();
+
+        unlink(m_link.c_str());
+
+        for(int* fd : { &m_master, &m_slave })
+        {
+            if(*fd != -1)
+                close(*fd);
+
+            *fd = -1;
+        }
+    }
+private:
+    std::string m_link;
+    int m_master;
+    int m_slave;
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+
+    // Scan descriptors announce the size of each node and carry no payload
+    void respond(uint8_t type, const uint8_t* payload, size_t size, bool streaming = false)
+    {
+        Bytes out = { 0xA5, 0x5A, (uint8_t) size, 0, 0, (uint8_t) (streaming ? 0x40 : 0), type };
+
+        if(payload)
+            out.insert(out.end(), payload, payload + size);
+
+        if(write(m_master, out.data(), out.size()) < 0)
+            return;
+    }
+
+    void run()
+    {
+        Bytes commands;
+        bool scanning = false;
+        auto nextRevolution = std::chrono::steady_clock::now();
+
+        while(m_running)
+        {
+            pollfd fd = { m_master, POLLIN, 0 };
+            uint8_t buffer[256];
+
+            if(poll(&fd, 1, 2) > 0 && (fd.revents & POLLIN))
+            {
+                ssize_t length = read(m_master, buffer, sizeof(buffer));
+
+                if(length > 0)
+                    commands.insert(commands.end(), buffer, buffer + length);
+            }
+
+            // A5, the command, and for commands with bit 7 set a size, the
+            // payload and a checksum
+            while(commands.size() >= 2)
+            {
+                if(commands[0] != 0xA5)
+                {
+                    commands.erase(commands.begin());
+                    continue;
+                }
+
+                uint8_t command = commands[1];
+                size_t length = 2;
+
+                if(command & 0x80)
+                {
+                    if(commands.size() < 3)
+                        break;
+
+                    length = 3 + commands[2] + 1;
+                }
+
+                if(commands.size() < length)
+                    break;
+
+                commands.erase(commands.begin(), commands.begin() + length);
+
+                if(command == 0x50)
+                {
+                    uint8_t info[20] = { 0x18, 0x1D, 0x01, 0x05 };
+                    respond(0x04, info, sizeof(info));
+                }
+                else if(command == 0x52)
+                {
+                    uint8_t health[3] = { 0, 0, 0 };
+                    respond(0x06, health, sizeof(health));
+                }
+                else if(command == 0x84)
+                {
+                    // Typical mode 0, a standard scan
+                    uint8_t typical[6] = { 0x7C, 0, 0, 0, 0, 0 };
+                    respond(0x20, typical, sizeof(typical));
+                }
+                else if(command == 0x20)
+                {
+                    respond(0x81, nullptr, 5, true);
+                    scanning = true;
+                }
+                else if(command == 0x25)
+                    scanning = false;
+            }
+
+            // A revolution of 180 nodes every 20 ms
+            if(scanning && std::chrono::steady_clock::now() >= nextRevolution)
+            {
+                Bytes revolution;
+
+                for(int i = 0; i < 180; i++)
+                    putStandard(revolution, i * 2 * 64, 4000 + i * 4, 40, i == 0);
+
+                nextRevolution += std::chrono::milliseconds(20);
+
+                if(write(m_master, revolution.data(), revolution.size()) < 0)
+                    continue;
+            }
+            else if(!scanning)
+                nextRevolution = std::chrono::steady_clock::now();
+        }
+    }
+};
+
+// A unique file for a test to write, removed however the test ends
+class TempFile
+{
+public:
+    TempFile(const char* pattern) : m_path(pattern)
+    {
+        int fd = mkstemp(&m_path[0]);
+
+        if(fd != -1)
+            close(fd);
+        else
+            m_path.clear();
+    }
+
+    ~TempFile()
+    {
+        if(!m_path.empty())
+            unlink(m_path.c_str());
+    }
+
+    TempFile(const TempFile&) = delete;
+    TempFile& operator=(const TempFile&) = delete;
+
+    const std::string& getPath() const { return m_path; }
+private:
+    std::string m_path;
+};
+
+static bool waitFor(const std::function<bool()>& condition, int millis)
+{
+    for(int i = 0; i < millis / 10; i++)
+    {
+        if(condition())
+            return true;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return condition();
+}
+
+TEST(Protocol, GrabberReconnects)
+{
+    std::string link = "/tmp/fakelidar-" + std::to_string(getpid());
+    PtyDevice device(link);
+    ASSERT_TRUE(device.plug());
+
+    // Outlives the grabber, so the recording is closed before it goes
+    TempFile recording("/tmp/reconnectXXXXXX");
+    ASSERT_FALSE(recording.getPath().empty());
+
+    LIDARFrameGrabber grabber("native://" + link);
+
+    LIDARFrameGrabber::ReconnectPolicy policy;
+    policy.commandTimeout = 200;
+    policy.scanTimeout = 200;
+    policy.maxStalls = 2;
+    policy.maxRestarts = 1;
+    policy.initialBackoff = 50;
+    policy.maxBackoff = 200;
+    grabber.setReconnectPolicy(policy);
+    grabber.start();
+
+    ASSERT_TRUE(waitFor([&]() { return grabber.getRevolutionCount() >= 5; }, 3000));
+    ASSERT_EQ(grabber.getConnectionState(), LIDARFrameGrabber::SCANNING);
+    ASSERT_TRUE(grabber.isConnected());
+    ASSERT_TRUE(grabber.startRecording(recording.getPath()));
+
+    const LIDARFrameGrabber::Frame& frame = grabber.latestFrame();
+    ASSERT_EQ(frame.size(), 180u);
+
+    // Pulling the device leaves the last scan in place and keeps recording
+    device.unplug();
+    ASSERT_TRUE(waitFor([&]() { return grabber.getConnectionState() == LIDARFrameGrabber::BACKING_OFF; }, 3000));
+    ASSERT_EQ(grabber.getStatus(), LIDARFrameGrabber::ERROR);
+
+    uint64_t revolutions = grabber.getRevolutionCount();
+    uint64_t sequence = grabber.latestFrame().getSequence();
+    uint64_t written = grabber.getRecorder().getScansWritten();
+    ASSERT_EQ(grabber.latestFrame().size(), 180u);
+
+    // With nothing at the path every attempt fails, further and further apart
+    ASSERT_TRUE(waitFor([&]() { return grabber.getFailedAttempts() >= 3; }, 3000));
+    ASSERT_EQ(grabber.getRevolutionCount(), revolutions);
+    ASSERT_TRUE(grabber.getRecorder().isOpen());
+
+    // Plugged back in, it picks up where it left off
+    ASSERT_TRUE(device.plug());
+    ASSERT_TRUE(waitFor([&]() { return grabber.getRevolutionCount() >= revolutions + 5; }, 3000));
+    ASSERT_EQ(grabber.getConnectionState(), LIDARFrameGrabber::SCANNING);
+    ASSERT_EQ(grabber.getReconnects(), 1u);
+    ASSERT_GT(grabber.latestFrame().getSequence(), sequence);
+    ASSERT_GT(grabber.getRecorder().getScansWritten(), written);
+
+    grabber.stop();
+    ASSERT_EQ(grabber.getConnectionState(), LIDARFrameGrabber::DISCONNECTED);
+    ASSERT_EQ(grabber.getStatus(), LIDARFrameGrabber::IDLE);
+}
@@ -0,0 +1,499 @@
+#include <gtest/gtest.h>
+
+#include <lidar/ScanRecorder.hpp>
+#include <lidar/MappedRecording.hpp>
+#include <lidar/ReplayScanDevice.hpp>
+#include <LIDARFrameGrabber.hpp>
+#include <lidar/SimulatedScanDevice.hpp>
+#include <lidar/Clock.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+using namespace em;
+
+static std::string tempPath(const char* name)
+{
+    return testing::TempDir() + name;
+}
+
+static sl_lidar_response_device_info_t simulatedInfo(SimulatedScanDevice& device)
+{
+    sl_lidar_response_device_info_t info;
+    device.getDeviceInfo(info);
+    return info;
+}
+
+// Records numScans simulated revolutions, waiting for each one to hit the disk
+static void recordScans(const std::string& path, int numScans, std::vector<std::vector<ScanNode>>* scans = nullptr, ScanEncoding encoding = SCAN_ENCODING_RAW)
+{
+    SimulatedScanDevice device(SimulatorParams::parse("sim://rate=8000,rpm=600,noise=10,realtime=0"));
+    device.connect();
+    device.startScan();
+
+    ScanRecorder recorder;
+    ASSERT_TRUE(recorder.open(path, simulatedInfo(device), encoding, 4));
+
+    ScanNode nodes[8192];
+
+    for(int i = 0; i < numScans; i++)
+    {
+        size_t count = 8192;
+        device.grabScanDataHq(nodes, count);
+
+        ASSERT_TRUE(recorder.write(nodes, count, monotonicMicros()));
+
+        while(recorder.getScansWritten() < (uint64_t) i + 1)
+            std::this_thread::yield();
+
+        if(scans)
+            scans->emplace_back(nodes, nodes + count);
+    }
+
+    recorder.close();
+    ASSERT_EQ(recorder.getScansDropped(), 0u);
+}
+
+TEST(Recording, RoundTrip)
+{
+    std::string path = tempPath("roundtrip.rplr");
+    std::vector<std::vector<ScanNode>> scans;
+    recordScans(path, 50, &scans);
+
+    RecordingHeader header;
+    std::vector<RecordingIndexEntry> index;
+    bool hadFooter = false;
+
+    ASSERT_TRUE(ScanRecording::readIndex(path, header, index, &hadFooter));
+    ASSERT_TRUE(hadFooter);
+    ASSERT_EQ(index.size(), 50u);
+    ASSERT_EQ(memcmp(header.serialNumber, "SIMULATEDLIDAR00", 16), 0);
+    ASSERT_EQ(header.firmwareVersion, (1 << 8) | 29);
+    ASSERT_EQ(header.hardwareVersion, 7);
+
+    // Seek straight to scan 10 through the index and compare it
+    FILE* file = fopen(path.c_str(), "rb");
+    ASSERT_NE(file, nullptr);
+
+    RecordedScanHeader scan;
+    fseeko(file, index[10].offset, SEEK_SET);
+    ASSERT_EQ(fread(&scan, sizeof(scan), 1, file), 1u);
+    ASSERT_TRUE(ScanRecording::isValidScan(scan));
+    ASSERT_EQ(scan.sequence, 10u);
+    ASSERT_EQ(scan.nodeCount, scans[10].size());
+    ASSERT_EQ(scan.timestamp, index[10].timestamp);
+
+    std::vector<RecordedNode> nodes(scan.nodeCount);
+    ASSERT_EQ(fread(nodes.data(), sizeof(RecordedNode), nodes.size(), file), nodes.size());
+    fclose(file);
+
+    ASSERT_TRUE(ScanRecording::isValidScan(scan, nodes.data()));
+    ASSERT_EQ(memcmp(nodes.data(), scans[10].data(), scan.payloadSize), 0);
+
+    for(size_t i = 1; i < index.size(); i++)
+        ASSERT_GE(index[i].timestamp, index[i - 1].timestamp);
+}
+
+TEST(Recording, CrashRecovery)
+{
+    std::string path = tempPath("crash.rplr");
+    recordScans(path, 20);
+
+    RecordingHeader header;
+    std::vector<RecordingIndexEntry> index;
+    ASSERT_TRUE(ScanRecording::readIndex(path, header, index));
+    ASSERT_EQ(index.size(), 20u);
+
+    // Simulate a crash halfway through writing scan 15: no index, no footer
+    ASSERT_EQ(truncate(path.c_str(), index[15].offset + 100), 0);
+
+    bool hadFooter = true;
+    ASSERT_TRUE(ScanRecording::readIndex(path, header, index, &hadFooter));
+    ASSERT_FALSE(hadFooter);
+    ASSERT_EQ(index.size(), 15u);
+
+    ASSERT_EQ(ScanRecording::recover(path), 15);
+
+    ASSERT_TRUE(ScanRecording::readIndex(path, header, index, &hadFooter));
+    ASSERT_TRUE(hadFooter);
+    ASSERT_EQ(index.size(), 15u);
+
+    // Garbage is not a recording
+    std::string garbage = tempPath("garbage.rplr");
+    FILE* file = fopen(garbage.c_str(), "wb");
+    fputs("definitely not a recording, just some text that is long enough", file);
+    fclose(file);
+
+    ASSERT_FALSE(ScanRecording::readIndex(garbage, header, index));
+    ASSERT_EQ(ScanRecording::recover(garbage), -1);
+}
+
+TEST(Recording, BoundedQueue)
+{
+    std::string path = tempPath("bounded.rplr");
+
+    sl_lidar_response_device_info_t info;
+    memset(&info, 0, sizeof(info));
+
+    ScanRecorder recorder(2);
+    ASSERT_TRUE(recorder.open(path, info));
+
+    std::vector<ScanNode> nodes(8192);
+    for(size_t i = 0; i < nodes.size(); i++)
+        nodes[i] = { (uint16_t) i, (uint32_t) i * 4, 47, 0 };
+
+    // Hammer the recorder much faster than it can write
+    const int numScans = 500;
+    for(int i = 0; i < numScans; i++)
+        recorder.write(nodes.data(), nodes.size(), monotonicMicros());
+
+    recorder.close();
+    ASSERT_FALSE(recorder.isOpen());
+    ASSERT_FALSE(recorder.write(nodes.data(), nodes.size(), monotonicMicros()));
+
+    ASSERT_EQ(recorder.getScansWritten() + recorder.getScansDropped(), (uint64_t) numScans);
+    ASSERT_GT(recorder.getScansWritten(), 0u);
+
+    RecordingHeader header;
+    std::vector<RecordingIndexEntry> index;
+    ASSERT_TRUE(ScanRecording::readIndex(path, header, index));
+    ASSERT_EQ(index.size(), recorder.getScansWritten());
+}
+
+TEST(Recording, MappedRecording)
+{
+    std::string path = tempPath("mapped.rplr");
+    std::vector<std::vector<ScanNode>> scans;
+    recordScans(path, 30, &scans);
+
+    MappedRecording recording;
+    ASSERT_TRUE(recording.open(path));
+    ASSERT_TRUE(recording.hasFooter());
+    ASSERT_EQ(recording.getScanCount(), 30u);
+
+    for(size_t i = 0; i < scans.size(); i++)
+    {
+        RecordedScanView view = recording.getScan(i);
+        ASSERT_NE(view.header, nullptr);
+        ASSERT_EQ(view.header->nodeCount, scans[i].size());
+        ASSERT_EQ(memcmp(view.nodes, scans[i].data(), view.header->payloadSize), 0);
+    }
+
+    ASSERT_EQ(recording.getScan(30).header, nullptr);
+
+    // Seeking by time lands on the scan recorded at or before it
+    ASSERT_EQ(recording.findScan(recording.getTimestamp(7)), 7u);
+    ASSERT_EQ(recording.findScan(recording.getTimestamp(7) + 1), 7u);
+    ASSERT_EQ(recording.findScan(0), 0u);
+    ASSERT_EQ(recording.findScan(UINT64_MAX), 29u);
+
+    // A crashed recording still opens, its index is rebuilt in memory
+    recording.close();
+    ASSERT_EQ(truncate(path.c_str(), sizeof(RecordingHeader) + 3 * (32 + scans[0].size() * 8) + 10), 0);
+    ASSERT_TRUE(recording.open(path));
+    ASSERT_FALSE(recording.hasFooter());
+    ASSERT_EQ(recording.getScanCount(), 3u);
+}
+
+TEST(Recording, ReplayThroughFrameGrabber)
+{
+    std::string path = tempPath("replay.rplr");
+    std::vector<std::vector<ScanNode>> scans;
+    recordScans(path, 30, &scans);
+
+    LIDARFrameGrabber grabber("replay://" + path);
+    ASSERT_EQ(grabber.getDevice()->getType(), ScanDevice::REPLAY);
+
+    ReplayScanDevice* replay = static_cast<ReplayScanDevice*>(grabber.getDevice());
+    replay->setSpeed(0.0f);
+    replay->setLooping(false);
+
+    grabber.start();
+
+    for(int i = 0; i < 500 && !replay->isPaused(); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // Playback stops on the last scan when not looping
+    ASSERT_TRUE(grabber.isConnected());
+    ASSERT_TRUE(replay->isPaused());
+    ASSERT_EQ(replay->getPosition(), 29u);
+    ASSERT_EQ(grabber.getSerialNumber().substr(0, 4), "5349");
+
+    replay->seek(3);
+    for(int i = 0; i < 500 && replay->getPosition() != 3; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    ASSERT_EQ(replay->getPosition(), 3u);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const LIDARFrameGrabber::Frame& frame = grabber.latestFrame();
+    ASSERT_EQ(frame.size(), scans[3].size());
+    ASSERT_FLOAT_EQ(frame.distance(10), scans[3][10].dist_mm_q2 / 4.0f);
+
+    grabber.stop();
+}
+
+// Consecutive revolutions of a simulated room
+static std::vector<std::vector<ScanNode>> simulateScans(const std::string& params, int numScans)
+{
+    SimulatedScanDevice device(SimulatorParams::parse(params));
+    device.connect();
+    device.startScan();
+
+    std::vector<std::vector<ScanNode>> scans;
+    std::vector<ScanNode> nodes(8192);
+
+    for(int i = 0; i < numScans; i++)
+    {
+        size_t count = nodes.size();
+        device.grabScanDataHq(nodes.data(), count);
+        scans.emplace_back(nodes.begin(), nodes.begin() + count);
+    }
+
+    return scans;
+}
+
+static bool sameNodes(const ScanNode* a, const std::vector<ScanNode>& b)
+{
+    return memcmp(a, b.data(), b.size() * sizeof(ScanNode)) == 0;
+}
+
+TEST(Recording, CodecRoundTrip)
+{
+    std::vector<std::vector<ScanNode>> scans = simulateScans("sim://rate=8000,rpm=600,noise=10,dropout=0.05,realtime=0", 20);
+
+    ScanEncoder encoder(4);
+    ScanDecoder decoder;
+    std::vector<uint8_t> packed;
+    std::vector<ScanNode> nodes(8192);
+
+    for(size_t i = 0; i < scans.size(); i++)
+    {
+        size_t size = encoder.encode(scans[i].data(), scans[i].size(), packed);
+        ASSERT_EQ(size, packed.size());
+        ASSERT_LT(size, scans[i].size() * sizeof(ScanNode) / 2);
+        ASSERT_EQ(ScanDecoder::getChain(packed.data(), packed.size()), (int) (i % 4));
+
+        size_t count = nodes.size();
+        ASSERT_TRUE(decoder.decode(packed.data(), packed.size(), nodes.data(), count)) << "scan " << i;
+        ASSERT_EQ(count, scans[i].size());
+        ASSERT_TRUE(sameNodes(nodes.data(), scans[i])) << "scan " << i;
+    }
+
+    // Edge cases, each as a key scan
+    std::mt19937 random(7);
+    std::vector<std::vector<ScanNode>> cases(5);
+
+    cases[1].push_back({ 12345, 4000, 47, SL_LIDAR_RESP_HQ_FLAG_SYNCBIT });
+
+    for(size_t i = 0; i < 8192; i++)
+    {
+        // Anything goes, which doesn't compress and is stored raw
+        cases[2].push_back({ (uint16_t) random(), (uint32_t) random(), (uint8_t) random(), (uint8_t) random() });
+
+        // Everything dropped
+        cases[3].push_back({ (uint16_t) (i * 8), 0, 0, (uint8_t) (i == 0) });
+    }
+
+    // Odd flags and a wrapping angle
+    for(size_t i = 0; i < 100; i++)
+        cases[4].push_back({ (uint16_t) (65000 + i * 20), (uint32_t) (8000 + i), 60, (uint8_t) (i % 7 == 0 ? 2 : 0) });
+
+    encoder.setKeyInterval(1);
+
+    for(size_t i = 0; i < cases.size(); i++)
+    {
+        size_t size = encoder.encode(cases[i].data(), cases[i].size(), packed);
+        ASSERT_LE(size, ScanEncoder::getMaxEncodedSize(cases[i].size()));
+
+        size_t count = nodes.size();
+        ASSERT_TRUE(decoder.decode(packed.data(), packed.size(), nodes.data(), count)) << "case " << i;
+        ASSERT_EQ(count, cases[i].size());
+        ASSERT_TRUE(sameNodes(nodes.data(), cases[i])) << "case " << i;
+    }
+
+    ASSERT_EQ(encoder.encode(cases[2].data(), cases[2].size(), packed), ScanEncoder::getMaxEncodedSize(8192));
+}
+
+TEST(Recording, CodecRejects)
+{
+    std::vector<std::vector<ScanNode>> scans = simulateScans("sim://rate=8000,rpm=600,noise=10,realtime=0", 3);
+
+    ScanEncoder encoder(10);
+    std::vector<std::vector<uint8_t>> packed(scans.size());
+
+    for(size_t i = 0; i < scans.size(); i++)
+        encoder.encode(scans[i].data(), scans[i].size(), packed[i]);
+
+    std::vector<ScanNode> nodes(8192);
+    size_t count = nodes.size();
+
+    // A scan whose predecessor this decoder never saw
+    ScanDecoder decoder;
+    ASSERT_FALSE(decoder.decode(packed[1].data(), packed[1].size(), nodes.data(), count));
+
+    // Too little room
+    count = scans[0].size() - 1;
+    ASSERT_FALSE(decoder.decode(packed[0].data(), packed[0].size(), nodes.data(), count));
+
+    // Cut short, which also breaks the chain until the next key scan
+    count = nodes.size();
+    ASSERT_FALSE(decoder.decode(packed[0].data(), packed[0].size() - 3, nodes.data(), count));
+    ASSERT_FALSE(decoder.decode(packed[1].data(), packed[1].size(), nodes.data(), count));
+
+    // Trailing garbage
+    std::vector<uint8_t> longer = packed[0];
+    longer.push_back(0);
+    ASSERT_FALSE(decoder.decode(longer.data(), longer.size(), nodes.data(), count));
+
+    ASSERT_FALSE(decoder.decode(packed[0].data(), 10, nodes.data(), count));
+    ASSERT_EQ(ScanDecoder::getChain(packed[0].data(), 10), -1);
+
+    // Skipping a scan breaks the chain too
+    ASSERT_TRUE(decoder.decode(packed[0].data(), packed[0].size(), nodes.data(), count));
+    count = nodes.size();
+    ASSERT_FALSE(decoder.decode(packed[2].data(), packed[2].size(), nodes.data(), count));
+
+    count = nodes.size();
+    decoder.reset();
+    ASSERT_TRUE(decoder.decode(packed[0].data(), packed[0].size(), nodes.data(), count));
+    count = nodes.size();
+    ASSERT_TRUE(decoder.decode(packed[1].data(), packed[1].size(), nodes.data(), count));
+    ASSERT_TRUE(sameNodes(nodes.data(), scans[1]));
+}
+
+TEST(Recording, PackedRecording)
+{
+    std::string path = tempPath("packed.rplr");
+    std::vector<std::vector<ScanNode>> scans;
+    recordScans(path, 30, &scans, SCAN_ENCODING_PACKED);
+
+    MappedRecording recording;
+    ASSERT_TRUE(recording.open(path));
+    ASSERT_EQ(recording.getHeader().version, 2);
+    ASSERT_EQ(recording.getScanCount(), 30u);
+
+    RecordedScanView view = recording.getScan(5);
+    ASSERT_NE(view.header, nullptr);
+    ASSERT_EQ(view.header->encoding, SCAN_ENCODING_PACKED);
+    ASSERT_EQ(view.nodes, nullptr);
+    ASSERT_LT(view.header->payloadSize, view.header->nodeCount * sizeof(RecordedNode) / 2);
+
+    std::vector<ScanNode> nodes(8192);
+
+    // In order, backwards and all over the place
+    std::vector<size_t> order;
+    for(size_t i = 0; i < scans.size(); i++)
+        order.push_back(i);
+    for(size_t i = scans.size(); i-- > 0;)
+        order.push_back(i);
+
+    std::mt19937 random(3);
+    for(int i = 0; i < 30; i++)
+        order.push_back(random() % scans.size());
+
+    for(size_t i : order)
+    {
+        ASSERT_EQ(recording.readScan(i, nodes.data(), nodes.size()), scans[i].size());
+        ASSERT_TRUE(sameNodes(nodes.data(), scans[i])) << "scan " << i;
+    }
+
+    ASSERT_EQ(recording.readScan(6, nodes.data(), 10), 10u);
+    ASSERT_EQ(memcmp(nodes.data(), scans[6].data(), 10 * sizeof(ScanNode)), 0);
+    ASSERT_EQ(recording.readScan(30, nodes.data(), nodes.size()), 0u);
+
+    // Replays like a raw recording
+    {
+        ReplayScanDevice replay(path);
+        ASSERT_EQ(replay.connect(), SL_RESULT_OK);
+        ASSERT_EQ(replay.startScan(), SL_RESULT_OK);
+        replay.setSpeed(0.0f);
+        replay.setLooping(false);
+
+        for(size_t i = 0; i < scans.size(); i++)
+        {
+            size_t count = nodes.size();
+            ASSERT_EQ(replay.grabScanDataHq(nodes.data(), count), SL_RESULT_OK);
+            ASSERT_EQ(count, scans[i].size());
+            ASSERT_TRUE(sameNodes(nodes.data(), scans[i])) << "scan " << i;
+        }
+
+        replay.seek(11);
+        size_t count = nodes.size();
+        ASSERT_EQ(replay.grabScanDataHq(nodes.data(), count), SL_RESULT_OK);
+        ASSERT_TRUE(sameNodes(nodes.data(), scans[11]));
+    }
+
+    // A crash leaves every whole scan readable
+    std::vector<RecordingIndexEntry> index;
+    RecordingHeader header;
+    ASSERT_TRUE(ScanRecording::readIndex(path, header, index));
+
+    recording.close();
+    ASSERT_EQ(truncate(path.c_str(), index[23].offset + 40), 0);
+    ASSERT_EQ(ScanRecording::recover(path), 23);
+
+    ASSERT_TRUE(recording.open(path));
+    ASSERT_EQ(recording.getScanCount(), 23u);
+    ASSERT_EQ(recording.readScan(22, nodes.data(), nodes.size()), scans[22].size());
+    ASSERT_TRUE(sameNodes(nodes.data(), scans[22]));
+
+    // Raw recordings keep the old version so older builds still read them
+    std::string raw = tempPath("raw.rplr");
+    recordScans(raw, 2);
+    ASSERT_TRUE(ScanRecording::readIndex(raw, header, index));
+    ASSERT_EQ(header.version, 1);
+}
+
+TEST(Recording, CodecThroughput)
+{
+    // No real recordings ship with the repo, so the simulated room stands in
+    // for one at a few noise and dropout levels
+    const char* worlds[] = {
+        "sim://rate=8000,rpm=600,noise=0,realtime=0",
+        "sim://rate=8000,rpm=600,noise=10,dropout=0.02,realtime=0",
+        "sim://rate=16000,rpm=600,noise=30,dropout=0.1,realtime=0"
+    };
+
+    for(const char* world : worlds)
+    {
+        std::vector<std::vector<ScanNode>> scans = simulateScans(world, 100);
+
+        ScanEncoder encoder;
+        ScanDecoder decoder;
+        std::vector<std::vector<uint8_t>> packed(scans.size());
+        std::vector<ScanNode> nodes(8192);
+        size_t raw = 0;
+        size_t size = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for(size_t i = 0; i < scans.size(); i++)
+            size += encoder.encode(scans[i].data(), scans[i].size(), packed[i]);
+
+        auto encoded = std::chrono::steady_clock::now();
+
+        for(size_t i = 0; i < scans.size(); i++)
+        {
+            size_t count = nodes.size();
+            ASSERT_TRUE(decoder.decode(packed[i].data(), packed[i].size(), nodes.data(), count));
+            raw += count * sizeof(ScanNode);
+        }
+
+        auto decoded = std::chrono::steady_clock::now();
+
+        double encodeSeconds = std::chrono::duration<double>(encoded - start).count();
+        double decodeSeconds = std::chrono::duration<double>(decoded - encoded).count();
+        size_t numNodes = raw / sizeof(ScanNode);
+
+        printf("%s: %.2fx, %.2f bits per node, encode %.1f Mnodes/s, decode %.1f Mnodes/s\n",
+            world, (double) raw / size, size * 8.0 / numNodes,
+            numNodes / encodeSeconds / 1e6, numNodes / decodeSeconds / 1e6);
+
+        ASSERT_LT(size, raw);
+    }
+}
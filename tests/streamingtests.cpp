@@ -0,0 +1,586 @@
+#include <gtest/gtest.h>
+
+#include <lidar/ScanServer.hpp>
+#include <lidar/ScanStreamClient.hpp>
+#include <lidar/SharedScanRing.hpp>
+#include <lidar/SimulatedScanDevice.hpp>
+#include <lidar/Crc32.hpp>
+#include <lidar/Clock.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+using namespace em;
+
+// Ports of their own so test runs side by side don't collide
+static uint16_t testPort(int offset)
+{
+    return (uint16_t) (20000 + (getpid() % 10000) * 4 + offset);
+}
+
+static std::vector<std::vector<ScanNode>> simulateScans(int numScans)
+{
+    SimulatedScanDevice device(SimulatorParams::parse("sim://rate=8000,rpm=600,noise=10,dropout=0.02,realtime=0"));
+    device.connect();
+    device.startScan();
+
+    std::vector<std::vector<ScanNode>> scans;
+    std::vector<ScanNode> nodes(8192);
+
+    for(int i = 0; i < numScans; i++)
+    {
+        size_t count = nodes.size();
+        device.grabScanDataHq(nodes.data(), count);
+        scans.emplace_back(nodes.begin(), nodes.begin() + count);
+    }
+
+    return scans;
+}
+
+static void fillFrame(ScanFrame& frame, const std::vector<ScanNode>& nodes, uint64_t sequence)
+{
+    frame.assign(nodes.data(), nodes.size());
+    frame.setSequence(sequence);
+    frame.setTimestamp(sequence * 100000);
+}
+
+static bool sameNodes(const std::vector<ScanNode>& a, const std::vector<ScanNode>& b)
+{
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(ScanNode)) == 0;
+}
+
+// Waits for the server to list count subscribers, UDP included
+static bool waitForSubscribers(const ScanServer& server, size_t count)
+{
+    for(int i = 0; i < 500 && server.getSubscribers().size() != count; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+    return server.getSubscribers().size() == count;
+}
+
+TEST(Streaming, Loopback)
+{
+    std::vector<std::vector<ScanNode>> scans = simulateScans(30);
+    ScanFrame frame(8192);
+
+    for(ScanEncoding encoding : { SCAN_ENCODING_PACKED, SCAN_ENCODING_RAW })
+    {
+        ScanServer::Config config;
+        config.udpPort = testPort(0);
+        config.tcpPort = 0;
+        config.encoding = encoding;
+        config.keyInterval = 4;
+
+        ScanStreamClient udp;
+        ASSERT_TRUE(udp.listenUdp("127.0.0.1", config.udpPort));
+
+        ScanServer server;
+        ASSERT_TRUE(server.start(config));
+        ASSERT_NE(server.getTcpPort(), 0);
+
+        ScanStreamClient tcp;
+        ASSERT_TRUE(tcp.connectTcp("127.0.0.1", server.getTcpPort()));
+        ASSERT_TRUE(waitForSubscribers(server, 2));
+
+        std::vector<ScanNode> nodes;
+        uint32_t sequence = 0;
+        uint64_t timestamp = 0;
+
+        for(size_t i = 0; i < scans.size(); i++)
+        {
+            fillFrame(frame, scans[i], i + 1);
+            ASSERT_TRUE(server.publish(frame));
+
+            for(ScanStreamClient* client : { &tcp, &udp })
+            {
+                ASSERT_TRUE(client->receive(nodes, sequence, timestamp, 1000)) << "frame " << i;
+                ASSERT_EQ(sequence, i + 1);
+                ASSERT_EQ(timestamp, (i + 1) * 100000);
+                ASSERT_TRUE(sameNodes(nodes, scans[i])) << "frame " << i;
+            }
+        }
+
+        for(ScanStreamClient* client : { &tcp, &udp })
+        {
+            const ScanStreamClient::Stats& stats = client->getStats();
+            ASSERT_EQ(stats.framesReceived, scans.size());
+            ASSERT_EQ(stats.framesMissed, 0u);
+            ASSERT_EQ(stats.framesCorrupt, 0u);
+            ASSERT_EQ(stats.framesLate, 0u);
+            ASSERT_EQ(stats.framesSkipped, 0u);
+        }
+
+        std::vector<ScanServer::SubscriberStats> subscribers = server.getSubscribers();
+        ASSERT_EQ(subscribers[0].address, "udp://127.0.0.1:" + std::to_string(config.udpPort));
+
+        for(const ScanServer::SubscriberStats& subscriber : subscribers)
+        {
+            ASSERT_EQ(subscriber.framesSent, scans.size());
+            ASSERT_EQ(subscriber.framesDropped, 0u);
+        }
+
+        ASSERT_EQ(server.getFramesPublished(), scans.size());
+        ASSERT_EQ(server.getFramesDropped(), 0u);
+
+        // Hanging up is noticed and the subscriber goes away
+        tcp.close();
+        ASSERT_TRUE(waitForSubscribers(server, 1));
+
+        server.stop();
+        ASSERT_FALSE(server.publish(frame));
+    }
+}
+
+TEST(Streaming, SlowSubscriber)
+{
+    std::vector<std::vector<ScanNode>> scans = simulateScans(20);
+    ScanFrame frame(8192);
+
+    ScanServer::Config config;
+    config.udpAddress = "";
+    config.tcpPort = 0;
+    config.keyInterval = 5;
+    config.maxQueuedBytes = 256 * 1024;
+
+    ScanServer server;
+    ASSERT_TRUE(server.start(config));
+
+    // One subscriber keeps up, the other doesn't read until the end
+    ScanStreamClient fast;
+    ScanStreamClient slow;
+    ASSERT_TRUE(fast.connectTcp("127.0.0.1", server.getTcpPort()));
+    ASSERT_TRUE(waitForSubscribers(server, 1));
+    ASSERT_TRUE(slow.connectTcp("127.0.0.1", server.getTcpPort()));
+    ASSERT_TRUE(waitForSubscribers(server, 2));
+
+    const int numFrames = 1500;
+    std::vector<ScanNode> nodes;
+    uint32_t sequence = 0;
+    uint64_t timestamp = 0;
+
+    for(int i = 0; i < numFrames; i++)
+    {
+        fillFrame(frame, scans[i % scans.size()], i + 1);
+
+        // Acquisition never waits on either of them
+        ASSERT_TRUE(server.publish(frame));
+        ASSERT_TRUE(fast.receive(nodes, sequence, timestamp, 1000));
+        ASSERT_EQ(sequence, (uint32_t) i + 1);
+    }
+
+    std::vector<ScanServer::SubscriberStats> subscribers = server.getSubscribers();
+    ASSERT_EQ(subscribers.size(), 2u);
+    ASSERT_EQ(subscribers[0].framesSent, (uint64_t) numFrames);
+    ASSERT_EQ(subscribers[0].framesDropped, 0u);
+    ASSERT_GT(subscribers[1].framesDropped, 0u);
+    ASSERT_EQ(subscribers[1].framesSent + subscribers[1].framesDropped, (uint64_t) numFrames);
+
+    // Whatever the slow one gets is whole, in order and decodes, since it
+    // only resumes at key frames
+    uint32_t last = 0;
+    while(slow.getStats().framesReceived < subscribers[1].framesSent)
+    {
+        ASSERT_TRUE(slow.receive(nodes, sequence, timestamp, 1000));
+        ASSERT_GT(sequence, last);
+        ASSERT_TRUE(sameNodes(nodes, scans[(sequence - 1) % scans.size()])) << "frame " << sequence;
+        last = sequence;
+    }
+
+    const ScanStreamClient::Stats& stats = slow.getStats();
+    ASSERT_EQ(stats.framesCorrupt, 0u);
+    ASSERT_EQ(stats.framesLate, 0u);
+    ASSERT_EQ(stats.framesSkipped, 0u);
+    ASSERT_EQ(stats.framesMissed, subscribers[1].framesDropped - (numFrames - last));
+    ASSERT_EQ(server.getFramesDropped(), 0u);
+}
+
+TEST(Streaming, Reassembly)
+{
+    std::vector<std::vector<ScanNode>> scans = simulateScans(1);
+    const uint16_t port = testPort(1);
+
+    ScanStreamClient client;
+    ASSERT_TRUE(client.listenUdp("127.0.0.1", port));
+
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_NE(sender, -1);
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    auto makeFrame = [&](uint32_t sequence)
+    {
+        RecordedScanHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = ScanRecording::SCAN_MAGIC;
+        header.sequence = sequence;
+        header.nodeCount = (uint32_t) scans[0].size();
+        header.payloadSize = header.nodeCount * sizeof(ScanNode);
+        header.encoding = SCAN_ENCODING_RAW;
+        header.checksum = crc32(scans[0].data(), header.payloadSize);
+
+        std::vector<uint8_t> frame(sizeof(header) + header.payloadSize);
+        memcpy(frame.data(), &header, sizeof(header));
+        memcpy(frame.data() + sizeof(header), scans[0].data(), header.payloadSize);
+        return frame;
+    };
+
+    // Sends the given fragments of a frame cut into count pieces
+    auto sendFragments = [&](const std::vector<uint8_t>& frame, uint32_t sequence, std::vector<int> order, int count)
+    {
+        size_t body = (frame.size() + count - 1) / count;
+
+        for(int f : order)
+        {
+            StreamDatagramHeader header;
+            header.magic = ScanServer::DATAGRAM_MAGIC;
+            header.sequence = sequence;
+            header.frameSize = (uint32_t) frame.size();
+            header.offset = (uint32_t) (f * body);
+            header.fragment = (uint16_t) f;
+            header.fragmentCount = (uint16_t) count;
+
+            size_t size = std::min(body, frame.size() - header.offset);
+            std::vector<uint8_t> datagram(sizeof(header) + size);
+            memcpy(datagram.data(), &header, sizeof(header));
+            memcpy(datagram.data() + sizeof(header), frame.data() + header.offset, size);
+
+            sendto(sender, datagram.data(), datagram.size(), 0, (sockaddr*) &address, sizeof(address));
+        }
+    };
+
+    std::vector<ScanNode> nodes;
+    uint32_t sequence = 0;
+    uint64_t timestamp = 0;
+
+    // Out of order with a duplicate
+    std::vector<uint8_t> frame = makeFrame(5);
+    sendFragments(frame, 5, { 2, 0, 0, 1 }, 3);
+    ASSERT_TRUE(client.receive(nodes, sequence, timestamp, 1000));
+    ASSERT_EQ(sequence, 5u);
+    ASSERT_TRUE(sameNodes(nodes, scans[0]));
+
+    // A damaged payload fails its checksum
+    frame = makeFrame(6);
+    frame[100] ^= 0xFF;
+    sendFragments(frame, 6, { 0, 1, 2 }, 3);
+    ASSERT_FALSE(client.receive(nodes, sequence, timestamp, 100));
+    ASSERT_EQ(client.getStats().framesCorrupt, 1u);
+
+    // Garbage and an old frame are turned away
+    sendto(sender, "nonsense that is not a datagram header", 38, 0, (sockaddr*) &address, sizeof(address));
+    frame = makeFrame(4);
+    sendFragments(frame, 4, { 0, 1 }, 2);
+
+    // A frame left incomplete is a gap once the next one arrives
+    frame = makeFrame(7);
+    sendFragments(frame, 7, { 0 }, 2);
+    frame = makeFrame(8);
+    sendFragments(frame, 8, { 1, 0 }, 2);
+
+    ASSERT_TRUE(client.receive(nodes, sequence, timestamp, 1000));
+    ASSERT_EQ(sequence, 8u);
+    ASSERT_TRUE(sameNodes(nodes, scans[0]));
+
+    const ScanStreamClient::Stats& stats = client.getStats();
+    ASSERT_EQ(stats.framesReceived, 2u);
+    ASSERT_EQ(stats.framesCorrupt, 2u);
+    ASSERT_EQ(stats.framesLate, 1u);
+    ASSERT_EQ(stats.framesMissed, 2u);
+
+    close(sender);
+}
+
+// Every node of frame sequence is derived from the sequence, so a torn read
+// shows up as nodes that disagree
+static void fillSharedFrame(ScanFrame& frame, uint64_t sequence)
+{
+    size_t count = 200 + sequence % 800;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        frame.angles()[i] = (uint16_t) (sequence + i);
+        frame.distances()[i] = (uint32_t) (sequence * 3 + i);
+        frame.qualities()[i] = (uint8_t) sequence;
+        frame.flags()[i] = (uint8_t) (sequence >> 8);
+    }
+
+    frame.resize(count);
+    frame.setSequence(sequence);
+    frame.setTimestamp(sequence * 10);
+}
+
+static bool isSharedFrame(const uint16_t* angles, const uint32_t* distances, const uint8_t* qualities, const uint8_t* flags,
+    size_t count, uint64_t sequence)
+{
+    if(count != 200 + sequence % 800)
+        return false;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        if(angles[i] != (uint16_t) (sequence + i) || distances[i] != (uint32_t) (sequence * 3 + i) ||
+           qualities[i] != (uint8_t) sequence || flags[i] != (uint8_t) (sequence >> 8))
+            return false;
+    }
+
+    return true;
+}
+
+TEST(SharedRing, ReadLatestAndEvery)
+{
+    const std::string name = "/rplidar-test-" + std::to_string(getpid());
+
+    SharedScanReader reader;
+    ASSERT_FALSE(reader.open(name));
+
+    SharedScanRing ring;
+    ASSERT_TRUE(ring.create(name, 4, 1024));
+    ASSERT_TRUE(reader.open(name));
+    ASSERT_EQ(reader.getSlotCount(), 4u);
+    ASSERT_EQ(reader.getCapacity(), 1024u);
+
+    ScanFrame frame(1024);
+    ScanFrame read;
+    ASSERT_FALSE(reader.readLatest(read));
+    ASSERT_FALSE(reader.readNext(read));
+
+    for(uint64_t sequence = 1; sequence <= 3; sequence++)
+    {
+        fillSharedFrame(frame, sequence);
+        ASSERT_TRUE(ring.publish(frame));
+    }
+
+    ASSERT_TRUE(reader.readLatest(read));
+    ASSERT_EQ(read.getSequence(), 3u);
+    ASSERT_TRUE(isSharedFrame(read.angles(), read.distances(), read.qualities(), read.flags(), read.size(), 3));
+
+    for(uint64_t sequence = 1; sequence <= 3; sequence++)
+    {
+        ASSERT_TRUE(reader.readNext(read));
+        ASSERT_EQ(read.getSequence(), sequence);
+        ASSERT_EQ(read.getTimestamp(), sequence * 10);
+    }
+
+    ASSERT_FALSE(reader.readNext(read));
+
+    // Falling more than a ring behind skips to the oldest frame still there
+    for(uint64_t sequence = 4; sequence <= 13; sequence++)
+    {
+        fillSharedFrame(frame, sequence);
+        ring.publish(frame);
+    }
+
+    ASSERT_TRUE(reader.readNext(read));
+    ASSERT_EQ(read.getSequence(), 11u);
+    ASSERT_EQ(reader.getMissed(), 7u);
+
+    // Zero copy, straight out of the ring
+    SharedScanReader::View view;
+    ASSERT_FALSE(reader.acquire(13, view));
+    ASSERT_FALSE(reader.acquire(8, view));
+    ASSERT_TRUE(reader.acquire(12, view));
+    ASSERT_TRUE(isSharedFrame(view.angles, view.distances, view.qualities, view.flags, view.count, view.sequence));
+    ASSERT_TRUE(reader.validate(view));
+
+    for(uint64_t sequence = 14; sequence <= 17; sequence++)
+    {
+        fillSharedFrame(frame, sequence);
+        ring.publish(frame);
+    }
+
+    ASSERT_FALSE(reader.validate(view));
+
+    // Readers keep their mapping after the writer goes away
+    ring.close();
+    ASSERT_FALSE(ring.publish(frame));
+    ASSERT_TRUE(reader.readLatest(read));
+    ASSERT_EQ(read.getSequence(), 17u);
+
+    SharedScanReader late;
+    ASSERT_FALSE(late.open(name));
+}
+
+TEST(SharedRing, ConcurrentReaders)
+{
+    const std::string name = "/rplidar-stress-" + std::to_string(getpid());
+    const uint64_t numFrames = 100000;
+
+    SharedScanRing ring;
+    ASSERT_TRUE(ring.create(name, 8, 1024));
+
+    // A reader in another process that wants every frame
+    pid_t child = fork();
+    ASSERT_NE(child, -1);
+
+    if(child == 0)
+    {
+        SharedScanReader reader;
+        ScanFrame read;
+        uint64_t last = 0;
+
+        if(!reader.open(name))
+            _exit(2);
+
+        while(last < numFrames)
+        {
+            if(!reader.readNext(read))
+                continue;
+
+            if(read.getSequence() <= last ||
+               !isSharedFrame(read.angles(), read.distances(), read.qualities(), read.flags(), read.size(), read.getSequence()))
+                _exit(1);
+
+            last = read.getSequence();
+        }
+
+        _exit(0);
+    }
+
+    std::atomic<int> opened(0);
+    std::atomic<int> failures(0);
+    std::vector<std::thread> readers;
+    std::vector<uint64_t> received(4, 0);
+    std::vector<uint64_t> torn(4, 0);
+
+    // Two threads read every frame with copies, two read the latest in place
+    for(int r = 0; r < 4; r++)
+    {
+        readers.emplace_back([&, r]()
+        {
+            SharedScanReader reader;
+
+            // Every frame counts from the first one published
+            if(!reader.open(name))
+                failures++;
+
+            opened++;
+
+            if(!reader.isOpen())
+                return;
+
+            ScanFrame read;
+            uint64_t last = 0;
+
+            while(last < numFrames)
+            {
+                if(r < 2)
+                {
+                    if(!reader.readNext(read))
+                        continue;
+
+                    if(read.getSequence() <= last ||
+                       !isSharedFrame(read.angles(), read.distances(), read.qualities(), read.flags(), read.size(), read.getSequence()))
+                        failures++;
+
+                    last = read.getSequence();
+                    received[r]++;
+                }
+                else
+                {
+                    SharedScanReader::View view;
+                    uint64_t published = reader.getPublished();
+
+                    if(!published || !reader.acquire(published - 1, view))
+                        continue;
+
+                    bool consistent = isSharedFrame(view.angles, view.distances, view.qualities, view.flags, view.count, view.sequence);
+
+                    if(!reader.validate(view))
+                    {
+                        torn[r]++;
+                        continue;
+                    }
+
+                    if(!consistent || view.sequence < last)
+                        failures++;
+
+                    last = view.sequence;
+                    received[r]++;
+                }
+            }
+
+            if(r < 2 && received[r] + reader.getMissed() != numFrames)
+                failures++;
+        });
+    }
+
+    ScanFrame frame(1024);
+
+    while(opened < 4)
+        std::this_thread::yield();
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(uint64_t sequence = 1; sequence <= numFrames; sequence++)
+    {
+        fillSharedFrame(frame, sequence);
+        ring.publish(frame);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for(std::thread& reader : readers)
+        reader.join();
+
+    int status = 0;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    printf("%.0f frames/s written, every-frame readers got %llu and %llu, latest readers %llu and %llu (%llu torn reads caught)\n",
+        numFrames / seconds, (unsigned long long) received[0], (unsigned long long) received[1],
+        (unsigned long long) received[2], (unsigned long long) received[3], (unsigned long long) (torn[2] + torn[3]));
+
+    ASSERT_EQ(failures, 0);
+    ASSERT_EQ(ring.getPublished(), numFrames);
+}
+
+TEST(SharedRing, LiveRingIsNotTakenOver)
+{
+    const std::string name = "/rplidar-test-owned-" + std::to_string(getpid());
+
+    ScanFrame frame(1024);
+    fillSharedFrame(frame, 1);
+
+    SharedScanRing ring;
+    ASSERT_TRUE(ring.create(name, 4, 1024));
+    ASSERT_TRUE(ring.publish(frame));
+
+    // A second writer is turned away and the first one's readers keep going
+    SharedScanRing other;
+    ASSERT_FALSE(other.create(name, 4, 1024));
+    ASSERT_FALSE(other.isOpen());
+
+    SharedScanReader reader;
+    ASSERT_TRUE(reader.open(name));
+    ASSERT_TRUE(ring.publish(frame));
+    ASSERT_EQ(reader.getPublished(), 2u);
+
+    ring.close();
+
+    // A ring whose writer died without closing it is replaced
+    pid_t child = fork();
+
+    if(!child)
+    {
+        SharedScanRing abandoned;
+        _exit(abandoned.create(name, 4, 1024) ? 0 : 1);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    ASSERT_TRUE(other.create(name, 4, 1024));
+    other.close();
+}